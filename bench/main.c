@@ -0,0 +1,1103 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmarks of the fast paths of the functional blocks.
+ *
+ * The benchmarks run the GK, GT, and GGU blocks on synthetic bursts
+ * of packets built in memory, so they need no NIC. The GK and GGU
+ * blocks go through the iterations of their main loops at the lcore of
+ * the benchmarks, without the LLS block; the GT benchmark runs the
+ * parsing and the policies of a GT block. Only the processing of
+ * the bursts is measured; building the bursts, i.e. the traffic
+ * generator, is not.
+ *
+ * Build with `make bench`, and run from the `gatekeeper` directory,
+ * so the GT benchmark finds the Lua policy, e.g.:
+ *
+ *    $ sudo build/gatekeeper-bench -l 0 -- -t gk,gt -w zipf -6 50
+ *
+ * The flows of a capture file of Gatekeeper can also be replayed
+ * with `-r FILE`.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_eal.h>
+#include <rte_log.h>
+#include <rte_mbuf.h>
+#include <rte_lcore.h>
+#include <rte_thash.h>
+#include <rte_cycles.h>
+#include <rte_random.h>
+#include <rte_malloc.h>
+
+#include "gatekeeper_capture.h"
+#include "gatekeeper_fib.h"
+#include "gatekeeper_ggu.h"
+#include "gatekeeper_gk.h"
+#include "gatekeeper_gt.h"
+#include "gatekeeper_ipip.h"
+#include "gatekeeper_log.h"
+#include "gatekeeper_main.h"
+#include "gatekeeper_net.h"
+#include "../gk/sched.h"
+
+/* Defined by main/main.c in Gatekeeper. */
+volatile int exiting = false;
+uint64_t cycles_per_sec;
+uint64_t cycles_per_ms;
+uint64_t picosec_per_cycle;
+
+/* The destinations that the synthetic traffic goes to. */
+#define BENCH_NUM_DSTS (16)
+
+/* The UDP payload of the synthetic packets. */
+#define BENCH_PAYLOAD_LEN (18)
+
+/* The destination port that the compiled policy of lua/policy.lua covers. */
+#define BENCH_POLICY_PORT (80)
+
+enum bench_workload {
+	/* Each packet comes from a new random source. */
+	BENCH_SPOOFED,
+	/* The packets come from a fixed set of flows with Zipf popularity. */
+	BENCH_ZIPF,
+	/* The packets replay the flows of the packets of a pcap file. */
+	BENCH_REPLAY,
+};
+
+static struct {
+	const char          *tests;
+	enum bench_workload workload;
+	/* The pcap file of BENCH_REPLAY. */
+	const char          *replay_path;
+	/* The number of flows of BENCH_ZIPF. */
+	unsigned int        num_flows;
+	double              zipf_s;
+	/* The percentage of IPv6 flows. */
+	unsigned int        ip6_pct;
+	uint64_t            num_pkts;
+	unsigned int        burst;
+	/* The entries of each flow table. */
+	unsigned int        flow_ht_size;
+	/* The format of the notifications of the GGU benchmark. */
+	unsigned int        ggu_version;
+} opts = {
+	.tests = "hash,gk,gt,ggu",
+	.workload = BENCH_SPOOFED,
+	.num_flows = 100000,
+	.zipf_s = 1.0,
+	.ip6_pct = 0,
+	.num_pkts = 10000000,
+	.burst = 32,
+	.flow_ht_size = 1 << 20,
+	.ggu_version = GGU_PD_VER2,
+};
+
+/*
+ * Traffic generator.
+ */
+
+/* The flows of BENCH_ZIPF, and the cumulative distribution of them. */
+static struct ip_flow *zipf_flows;
+static double         *zipf_cdf;
+
+static void
+gen_random_flow(struct ip_flow *flow)
+{
+	uint64_t r = rte_rand();
+	unsigned int dst = r % BENCH_NUM_DSTS;
+
+	memset(flow, 0, sizeof(*flow));
+	if ((r >> 32) % 100 < opts.ip6_pct) {
+		uint64_t src[2] = { rte_rand(), rte_rand() };
+		uint8_t prefix[] = { 0x20, 0x01, 0x0d, 0xb8 };
+
+		flow->proto = ETHER_TYPE_IPv6;
+		rte_memcpy(flow->f.v6.src, src, sizeof(flow->f.v6.src));
+		rte_memcpy(flow->f.v6.dst, prefix, sizeof(prefix));
+		flow->f.v6.dst[15] = dst + 1;
+	} else {
+		flow->proto = ETHER_TYPE_IPv4;
+		flow->f.v4.src = (uint32_t)rte_rand();
+		flow->f.v4.dst = rte_cpu_to_be_32(IPv4(10, 1, 0, dst + 1));
+	}
+}
+
+static int
+init_zipf(void)
+{
+	unsigned int i;
+	double sum = 0;
+
+	zipf_flows = malloc(opts.num_flows * sizeof(*zipf_flows));
+	zipf_cdf = malloc(opts.num_flows * sizeof(*zipf_cdf));
+	if (zipf_flows == NULL || zipf_cdf == NULL) {
+		free(zipf_flows);
+		free(zipf_cdf);
+		return -1;
+	}
+
+	for (i = 0; i < opts.num_flows; i++) {
+		gen_random_flow(&zipf_flows[i]);
+		sum += 1 / pow(i + 1, opts.zipf_s);
+		zipf_cdf[i] = sum;
+	}
+	for (i = 0; i < opts.num_flows; i++)
+		zipf_cdf[i] /= sum;
+
+	return 0;
+}
+
+/* The flows of BENCH_REPLAY, in the order of the pcap file. */
+static struct ip_flow *replay_flows;
+static unsigned int   num_replay_flows;
+static unsigned int   next_replay_flow;
+
+/*
+ * Get the flow of the packet in @data. The flow of an IP-in-IP packet,
+ * e.g. a packet captured by a GT block, is the flow of its inner packet.
+ */
+static int
+parse_replay_flow(const uint8_t *data, uint32_t len, struct ip_flow *flow)
+{
+	int depth;
+	uint16_t proto;
+	const struct ether_hdr *eth_hdr = (const struct ether_hdr *)data;
+
+	if (len < sizeof(*eth_hdr))
+		return -1;
+	proto = rte_be_to_cpu_16(eth_hdr->ether_type);
+	data += sizeof(*eth_hdr);
+	len -= sizeof(*eth_hdr);
+
+	memset(flow, 0, sizeof(*flow));
+	for (depth = 0; depth < 2; depth++) {
+		uint8_t next_proto;
+		uint32_t hdr_len;
+
+		if (proto == ETHER_TYPE_IPv4) {
+			const struct ipv4_hdr *ip4_hdr =
+				(const struct ipv4_hdr *)data;
+
+			if (len < sizeof(*ip4_hdr))
+				return -1;
+			hdr_len = (ip4_hdr->version_ihl & 0xF) * 4;
+			next_proto = ip4_hdr->next_proto_id;
+			flow->proto = ETHER_TYPE_IPv4;
+			flow->f.v4.src = ip4_hdr->src_addr;
+			flow->f.v4.dst = ip4_hdr->dst_addr;
+		} else if (proto == ETHER_TYPE_IPv6) {
+			const struct ipv6_hdr *ip6_hdr =
+				(const struct ipv6_hdr *)data;
+
+			if (len < sizeof(*ip6_hdr))
+				return -1;
+			hdr_len = sizeof(*ip6_hdr);
+			next_proto = ip6_hdr->proto;
+			flow->proto = ETHER_TYPE_IPv6;
+			rte_memcpy(flow->f.v6.src, ip6_hdr->src_addr,
+				sizeof(flow->f.v6.src));
+			rte_memcpy(flow->f.v6.dst, ip6_hdr->dst_addr,
+				sizeof(flow->f.v6.dst));
+		} else
+			return -1;
+
+		if (next_proto == IPPROTO_IPIP)
+			proto = ETHER_TYPE_IPv4;
+		else if (next_proto == IPPROTO_IPV6)
+			proto = ETHER_TYPE_IPv6;
+		else
+			break;
+
+		if (len < hdr_len)
+			return -1;
+		data += hdr_len;
+		len -= hdr_len;
+	}
+
+	return 0;
+}
+
+static int
+init_replay(void)
+{
+	bool swapped;
+	unsigned int max_flows = 0;
+	struct pcap_file_hdr file_hdr;
+	struct pcap_rec_hdr rec_hdr;
+	static uint8_t data[PCAP_SNAPLEN];
+	FILE *file = fopen(opts.replay_path, "r");
+
+	if (file == NULL) {
+		RTE_LOG(ERR, GATEKEEPER, "bench: cannot open %s\n",
+			opts.replay_path);
+		return -1;
+	}
+
+	if (fread(&file_hdr, sizeof(file_hdr), 1, file) != 1)
+		goto format;
+	swapped = file_hdr.magic == rte_bswap32(PCAP_MAGIC);
+	if ((file_hdr.magic != PCAP_MAGIC && !swapped) ||
+			(swapped ? rte_bswap32(file_hdr.linktype)
+			: file_hdr.linktype) != PCAP_LINKTYPE_ETH)
+		goto format;
+
+	while (fread(&rec_hdr, sizeof(rec_hdr), 1, file) == 1) {
+		uint32_t len = swapped ? rte_bswap32(rec_hdr.incl_len)
+			: rec_hdr.incl_len;
+
+		if (len > sizeof(data) || fread(data, len, 1, file) != 1)
+			goto format;
+
+		if (num_replay_flows == max_flows) {
+			struct ip_flow *flows;
+
+			max_flows = max_flows == 0 ? 1024 : 2 * max_flows;
+			flows = realloc(replay_flows,
+				max_flows * sizeof(*flows));
+			if (flows == NULL) {
+				RTE_LOG(ERR, MALLOC,
+					"bench: cannot allocate the flows of %s\n",
+					opts.replay_path);
+				goto error;
+			}
+			replay_flows = flows;
+		}
+
+		if (parse_replay_flow(data, len,
+				&replay_flows[num_replay_flows]) == 0)
+			num_replay_flows++;
+	}
+
+	fclose(file);
+	if (num_replay_flows == 0) {
+		RTE_LOG(ERR, GATEKEEPER, "bench: %s has no IP packets\n",
+			opts.replay_path);
+		return -1;
+	}
+	return 0;
+
+format:
+	RTE_LOG(ERR, GATEKEEPER,
+		"bench: %s is not a pcap file of Ethernet packets\n",
+		opts.replay_path);
+error:
+	fclose(file);
+	free(replay_flows);
+	replay_flows = NULL;
+	return -1;
+}
+
+static void
+next_flow(struct ip_flow *flow)
+{
+	double u;
+	unsigned int lo, hi;
+
+	if (opts.workload == BENCH_SPOOFED) {
+		gen_random_flow(flow);
+		return;
+	}
+
+	if (opts.workload == BENCH_REPLAY) {
+		*flow = replay_flows[next_replay_flow++];
+		if (next_replay_flow == num_replay_flows)
+			next_replay_flow = 0;
+		return;
+	}
+
+	/* Find the first flow whose cumulative probability covers @u. */
+	u = (double)(rte_rand() >> 11) / (1ULL << 53);
+	lo = 0;
+	hi = opts.num_flows - 1;
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (zipf_cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*flow = zipf_flows[lo];
+}
+
+/*
+ * Build a UDP packet of @flow in @m; if @tunnel is not NULL,
+ * encapsulate it as a Gatekeeper server does with @priority.
+ */
+static void
+build_pkt(struct rte_mbuf *m, const struct ip_flow *flow,
+	struct ipip_tunnel_info *tunnel, uint8_t priority)
+{
+	struct ether_hdr *eth_hdr;
+	struct udp_hdr *udp_hdr;
+	size_t l3_len = flow->proto == ETHER_TYPE_IPv4
+		? sizeof(struct ipv4_hdr) : sizeof(struct ipv6_hdr);
+	uint16_t l4_len = sizeof(*udp_hdr) + BENCH_PAYLOAD_LEN;
+
+	rte_pktmbuf_reset(m);
+	eth_hdr = (struct ether_hdr *)rte_pktmbuf_append(m,
+		sizeof(*eth_hdr) + l3_len + l4_len);
+	RTE_VERIFY(eth_hdr != NULL);
+	memset(eth_hdr, 0, sizeof(*eth_hdr) + l3_len + l4_len);
+	eth_hdr->ether_type = rte_cpu_to_be_16(flow->proto);
+
+	if (flow->proto == ETHER_TYPE_IPv4) {
+		struct ipv4_hdr *ip4_hdr = (struct ipv4_hdr *)&eth_hdr[1];
+
+		ip4_hdr->version_ihl = IP_VHL_DEF;
+		ip4_hdr->total_length = rte_cpu_to_be_16(l3_len + l4_len);
+		ip4_hdr->time_to_live = IP_DEFTTL;
+		ip4_hdr->next_proto_id = IPPROTO_UDP;
+		ip4_hdr->src_addr = flow->f.v4.src;
+		ip4_hdr->dst_addr = flow->f.v4.dst;
+		udp_hdr = (struct udp_hdr *)&ip4_hdr[1];
+	} else {
+		struct ipv6_hdr *ip6_hdr = (struct ipv6_hdr *)&eth_hdr[1];
+
+		ip6_hdr->vtc_flow = rte_cpu_to_be_32(6 << 28);
+		ip6_hdr->payload_len = rte_cpu_to_be_16(l4_len);
+		ip6_hdr->proto = IPPROTO_UDP;
+		ip6_hdr->hop_limits = IP_DEFTTL;
+		rte_memcpy(ip6_hdr->src_addr, flow->f.v6.src,
+			sizeof(ip6_hdr->src_addr));
+		rte_memcpy(ip6_hdr->dst_addr, flow->f.v6.dst,
+			sizeof(ip6_hdr->dst_addr));
+		udp_hdr = (struct udp_hdr *)&ip6_hdr[1];
+	}
+
+	/* Half of the flows go to the port of the compiled policy. */
+	udp_hdr->src_port = rte_cpu_to_be_16(1024 + (rte_rand() & 0x7FFF));
+	udp_hdr->dst_port = rte_cpu_to_be_16(
+		((const uint8_t *)&flow->f)[3] & 1 ? BENCH_POLICY_PORT : 443);
+	udp_hdr->dgram_len = rte_cpu_to_be_16(l4_len);
+
+	if (tunnel != NULL)
+		RTE_VERIFY(encapsulate(m, priority, tunnel) == m);
+}
+
+static void
+init_tunnel(struct ipip_tunnel_info *tunnel)
+{
+	memset(tunnel, 0, sizeof(*tunnel));
+	tunnel->flow.proto = ETHER_TYPE_IPv4;
+	tunnel->flow.f.v4.src = rte_cpu_to_be_32(IPv4(192, 0, 2, 1));
+	tunnel->flow.f.v4.dst = rte_cpu_to_be_32(IPv4(192, 0, 2, 2));
+	ipip_tunnel_refresh(tunnel);
+}
+
+/*
+ * Measurements.
+ */
+
+struct bench_meter {
+	uint64_t start;
+	uint64_t cycles;
+	/* The counter of cache misses, or -1 if it is not available. */
+	int      perf_fd;
+};
+
+static void
+meter_init(struct bench_meter *meter)
+{
+	struct perf_event_attr attr;
+
+	memset(meter, 0, sizeof(*meter));
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	meter->perf_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (meter->perf_fd < 0)
+		RTE_LOG(WARNING, GATEKEEPER,
+			"bench: cannot count cache misses; check /proc/sys/kernel/perf_event_paranoid\n");
+}
+
+static inline void
+meter_start(struct bench_meter *meter)
+{
+	if (meter->perf_fd >= 0)
+		ioctl(meter->perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+	meter->start = rte_rdtsc();
+}
+
+static inline void
+meter_stop(struct bench_meter *meter)
+{
+	meter->cycles += rte_rdtsc() - meter->start;
+	if (meter->perf_fd >= 0)
+		ioctl(meter->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+}
+
+static void
+meter_report(struct bench_meter *meter, const char *name, uint64_t num_pkts)
+{
+	uint64_t misses;
+
+	printf("%-5s %10" PRIu64 " pkts %8.2f Mpps %8.1f cycles/pkt",
+		name, num_pkts,
+		meter->cycles == 0 ? 0.0 : (double)num_pkts *
+			cycles_per_sec / meter->cycles / 1e6,
+		(double)meter->cycles / num_pkts);
+
+	if (meter->perf_fd >= 0 &&
+			read(meter->perf_fd, &misses, sizeof(misses)) ==
+			sizeof(misses))
+		printf(" %8.2f cache misses/pkt\n",
+			(double)misses / num_pkts);
+	else
+		printf("      n/a cache misses/pkt\n");
+
+	if (meter->perf_fd >= 0)
+		close(meter->perf_fd);
+}
+
+/*
+ * The network configuration of the GK and GGU blocks
+ * of the benchmarks, which have no network interfaces.
+ */
+static struct net_config bench_net;
+
+static void
+init_bench_net(void)
+{
+	struct gatekeeper_if *front = &bench_net.front;
+	struct gatekeeper_if *back = &bench_net.back;
+	const struct ether_addr back_mac = {
+		.addr_bytes = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+	};
+
+	memset(&bench_net, 0, sizeof(bench_net));
+	bench_net.back_iface_enabled = true;
+
+	front->configured_proto = GK_CONFIGURED_IPV4 | GK_CONFIGURED_IPV6;
+	front->hw_nd_filter = true;
+	front->mtu = ETHER_MTU;
+
+	back->configured_proto = GK_CONFIGURED_IPV4 | GK_CONFIGURED_IPV6;
+	back->mtu = ETHER_MTU;
+	back->ip4_addr.s_addr = rte_cpu_to_be_32(IPv4(192, 0, 2, 1));
+	RTE_VERIFY(inet_pton(AF_INET6, "2001:db8:ffff::1",
+		&back->ip6_addr) == 1);
+	ether_addr_copy(&back_mac, &back->eth_addr);
+}
+
+/*
+ * Set up a GK block at the lcore of the benchmarks with the parameters
+ * of lua/gk.lua, whose FIB sends all synthetic flows to a Grantor server.
+ * There is no limit on the bandwidth of the requests, so no request
+ * is left in the egress scheduler after a burst.
+ */
+static struct gk_config *
+bench_gk_create(void)
+{
+	struct gk_config *gk_conf = alloc_gk_conf();
+
+	if (gk_conf == NULL)
+		return NULL;
+
+	gk_conf->flow_ht_size = opts.flow_ht_size;
+	gk_conf->request_timeout_sec = 60;
+	gk_conf->flow_table_scan_iter = 16;
+	gk_conf->mailbox_max_entries = 512;
+	gk_conf->mailbox_mem_cache_size = 64;
+	gk_conf->mailbox_watermark = 384;
+	gk_conf->cmd_budget_us = 20;
+	gk_conf->cmd_drain_budget_us = 200;
+	gk_conf->request_queue_len = 1024;
+	gk_conf->max_num_ipv4_rules = 1024;
+	gk_conf->num_ipv4_tbl8s = 256;
+	gk_conf->max_num_ipv6_rules = 1024;
+	gk_conf->num_ipv6_tbl8s = 256;
+
+	if (gk_bench_instance_setup(&bench_net, gk_conf) < 0) {
+		rte_free(gk_conf);
+		return NULL;
+	}
+
+	if (add_fib_entry("10.1.0.0/16", "192.0.2.2", GK_FWD_GRANTOR,
+			gk_conf) < 0 ||
+			add_fib_entry("2001:db8::/32", "192.0.2.2",
+			GK_FWD_GRANTOR, gk_conf) < 0) {
+		gk_conf_put(gk_conf);
+		return NULL;
+	}
+
+	return gk_conf;
+}
+
+/*
+ * The benchmarks.
+ *
+ * Each benchmark builds a burst, and then processes it
+ * between meter_start() and meter_stop().
+ */
+
+/* The GK blocks keep request packets in their egress schedulers. */
+#define BENCH_NUM_MBUFS (2047)
+
+static struct rte_mempool *bench_pool;
+static struct rte_mbuf *bench_pkts[GATEKEEPER_MAX_PKT_BURST];
+static struct ip_flow bench_flows[GATEKEEPER_MAX_PKT_BURST];
+static volatile uint32_t bench_sink;
+
+/* The RSS hash of the flows, which the GK and GT blocks depend on. */
+static void
+hash_bench_run(unsigned int num_pkts, struct bench_meter *meter)
+{
+	unsigned int i;
+	uint32_t acc = 0;
+
+	for (i = 0; i < num_pkts; i++)
+		next_flow(&bench_flows[i]);
+
+	meter_start(meter);
+	for (i = 0; i < num_pkts; i++)
+		acc ^= rss_ip_flow_hf(&bench_flows[i], 0, 0);
+	meter_stop(meter);
+
+	bench_sink = acc;
+}
+
+/*
+ * The bursts of a GK block, from the front interface
+ * to the egress scheduler of the back interface.
+ */
+static struct gk_config *gk_bench_conf;
+static uint64_t gk_num_tx;
+
+static int
+gk_bench_setup(void)
+{
+	gk_bench_conf = bench_gk_create();
+	gk_num_tx = 0;
+	return gk_bench_conf == NULL ? -1 : 0;
+}
+
+static void
+gk_bench_run(unsigned int num_pkts, struct bench_meter *meter)
+{
+	unsigned int i;
+	uint16_t num_tx;
+	struct rte_mbuf *pkts[GATEKEEPER_MAX_PKT_BURST];
+	struct rte_mbuf *tx_bufs[GATEKEEPER_MAX_PKT_BURST];
+
+	/* The GK block frees or sends the packets of each burst. */
+	RTE_VERIFY(rte_pktmbuf_alloc_bulk(bench_pool, pkts, num_pkts) == 0);
+	for (i = 0; i < num_pkts; i++) {
+		next_flow(&bench_flows[i]);
+		build_pkt(pkts[i], &bench_flows[i], NULL, 0);
+		/* As the RSS of the front interface does. */
+		pkts[i]->hash.rss = rss_ip_flow_hf(&bench_flows[i], 0, 0);
+	}
+
+	meter_start(meter);
+	num_tx = gk_bench_instance_process(gk_bench_conf, pkts, num_pkts,
+		tx_bufs);
+	meter_stop(meter);
+
+	gk_num_tx += num_tx;
+	for (i = 0; i < num_tx; i++)
+		rte_pktmbuf_free(tx_bufs[i]);
+}
+
+static void
+gk_bench_teardown(void)
+{
+	printf("gk: %" PRIu64 " packets sent to the back interface\n",
+		gk_num_tx);
+	gk_conf_put(gk_bench_conf);
+}
+
+/*
+ * The path of a request through a GT block: the parsing of
+ * the encapsulated packet, the compiled policy, and
+ * the Lua policy for the requests that the compiled policy misses.
+ */
+static struct gt_lua_policy gt_policy;
+static struct ipip_tunnel_info gt_tunnel;
+static uint64_t gt_num_compiled;
+static uint64_t gt_num_lua;
+
+static int
+gt_bench_setup(void)
+{
+	if (load_lua_policy(rte_lcore_id(), 0, &gt_policy) < 0)
+		return -1;
+
+	init_tunnel(&gt_tunnel);
+	gt_num_compiled = 0;
+	gt_num_lua = 0;
+	return 0;
+}
+
+static void
+gt_bench_run(unsigned int num_pkts, struct bench_meter *meter)
+{
+	unsigned int i;
+	unsigned int num_lua = 0;
+	struct gt_packet_headers pkt_infos[GATEKEEPER_MAX_PKT_BURST];
+	struct ggu_policy policies[GATEKEEPER_MAX_PKT_BURST];
+
+	for (i = 0; i < num_pkts; i++) {
+		next_flow(&bench_flows[i]);
+		build_pkt(bench_pkts[i], &bench_flows[i], &gt_tunnel,
+			PRIORITY_REQ_MIN);
+	}
+
+	meter_start(meter);
+	for (i = 0; i < num_pkts; i++) {
+		RTE_VERIFY(gt_parse_incoming_pkt(bench_pkts[i],
+			&pkt_infos[num_lua]) == 0);
+		if (lookup_simple_policy(gt_policy.simple_policy,
+				&pkt_infos[num_lua], &policies[num_lua]) < 0)
+			num_lua++;
+	}
+
+	if (num_lua > 0)
+		RTE_VERIFY(lookup_lua_policy(&gt_policy, pkt_infos,
+			policies, num_lua) == 0);
+	meter_stop(meter);
+
+	gt_num_compiled += num_pkts - num_lua;
+	gt_num_lua += num_lua;
+}
+
+static void
+gt_bench_teardown(void)
+{
+	printf("gt: %" PRIu64 " decisions of the compiled policy, %" PRIu64 " of the Lua policy\n",
+		gt_num_compiled, gt_num_lua);
+	destroy_lua_policy(&gt_policy);
+}
+
+/*
+ * A flood of granted decisions received by a GGU block, and installed
+ * in the flow table of a GK block at the same lcore. Each decision
+ * counts as a packet; the notifications carry up to
+ * BENCH_GGU_DECISIONS decisions each.
+ */
+#define BENCH_GGU_DECISIONS (8)
+
+/* The ports of lua/ggu.lua. */
+#define BENCH_GGU_SRC_PORT (0xA0A0)
+#define BENCH_GGU_DST_PORT (0xB0B0)
+
+static struct gk_config *ggu_bench_gk_conf;
+static struct ggu_config *ggu_bench_conf;
+
+static int
+ggu_bench_setup(void)
+{
+	ggu_bench_gk_conf = bench_gk_create();
+	if (ggu_bench_gk_conf == NULL)
+		return -1;
+
+	ggu_bench_conf = alloc_ggu_conf();
+	if (ggu_bench_conf == NULL)
+		goto gk;
+
+	ggu_bench_conf->ggu_src_port = BENCH_GGU_SRC_PORT;
+	ggu_bench_conf->ggu_dst_port = BENCH_GGU_DST_PORT;
+	ggu_bench_conf->num_ggu_src_ports = 1;
+	if (ggu_bench_instance_setup(&bench_net, ggu_bench_gk_conf,
+			ggu_bench_conf) < 0) {
+		rte_free(ggu_bench_conf);
+		goto gk;
+	}
+
+	return 0;
+
+gk:
+	gk_conf_put(ggu_bench_gk_conf);
+	return -1;
+}
+
+/* Write the source and destination addresses of @flow at @ptr. */
+static uint8_t *
+put_flow_addrs(uint8_t *ptr, const struct ip_flow *flow)
+{
+	size_t len = flow->proto == ETHER_TYPE_IPv4
+		? sizeof(flow->f.v4) : sizeof(flow->f.v6);
+
+	rte_memcpy(ptr, &flow->f, len);
+	return ptr + len;
+}
+
+/* Write the parameters of the granted decisions at @ptr. */
+static uint8_t *
+put_granted_params(uint8_t *ptr)
+{
+	const uint32_t params[4] = {
+		/* tx_rate_kb_sec, cap_expire_sec. */
+		rte_cpu_to_be_32(10), rte_cpu_to_be_32(10),
+		/* next_renewal_ms, renewal_step_ms. */
+		rte_cpu_to_be_32(5000), rte_cpu_to_be_32(1000),
+	};
+
+	rte_memcpy(ptr, params, sizeof(params));
+	return ptr + sizeof(params);
+}
+
+/*
+ * Build in @m a notification of a Grantor server that grants
+ * the @num flows of @flows, in the format of opts.ggu_version.
+ */
+static void
+build_ggu_pkt(struct rte_mbuf *m, const struct ip_flow *flows,
+	unsigned int num)
+{
+	struct ether_hdr *eth_hdr;
+	struct ipv4_hdr *ip4_hdr;
+	struct udp_hdr *udp_hdr;
+	uint8_t *payload, *ptr;
+	uint16_t l4_len;
+	unsigned int i;
+	/* Room for IPv6 decisions in either format. */
+	size_t max_len = sizeof(struct ggu_common_hdr) + 1 + 16 +
+		num * (1 + sizeof(flows->f.v6) + 16);
+
+	rte_pktmbuf_reset(m);
+	eth_hdr = (struct ether_hdr *)rte_pktmbuf_append(m,
+		sizeof(*eth_hdr) + sizeof(*ip4_hdr) + sizeof(*udp_hdr) +
+		max_len);
+	RTE_VERIFY(eth_hdr != NULL);
+	memset(eth_hdr, 0, rte_pktmbuf_data_len(m));
+	eth_hdr->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
+
+	ip4_hdr = (struct ipv4_hdr *)&eth_hdr[1];
+	ip4_hdr->version_ihl = IP_VHL_DEF;
+	ip4_hdr->time_to_live = IP_DEFTTL;
+	ip4_hdr->next_proto_id = IPPROTO_UDP;
+	ip4_hdr->src_addr = rte_cpu_to_be_32(IPv4(192, 0, 2, 2));
+	ip4_hdr->dst_addr = bench_net.back.ip4_addr.s_addr;
+
+	udp_hdr = (struct udp_hdr *)&ip4_hdr[1];
+	udp_hdr->src_port = rte_cpu_to_be_16(BENCH_GGU_SRC_PORT);
+	udp_hdr->dst_port = rte_cpu_to_be_16(BENCH_GGU_DST_PORT);
+	payload = (uint8_t *)&udp_hdr[1];
+
+	if (opts.ggu_version == GGU_PD_VER1) {
+		struct ggu_common_hdr *hdr = (struct ggu_common_hdr *)payload;
+
+		hdr->v1 = GGU_PD_VER1;
+		ptr = (uint8_t *)&hdr[1];
+
+		/* The IPv4 decisions come before the IPv6 ones. */
+		for (i = 0; i < num; i++) {
+			if (flows[i].proto != ETHER_TYPE_IPv4)
+				continue;
+			ptr = put_granted_params(put_flow_addrs(ptr,
+				&flows[i]));
+			hdr->n3++;
+		}
+		for (i = 0; i < num; i++) {
+			if (flows[i].proto != ETHER_TYPE_IPv6)
+				continue;
+			ptr = put_granted_params(put_flow_addrs(ptr,
+				&flows[i]));
+			hdr->n4++;
+		}
+	} else {
+		struct ggu_v2_hdr *hdr = (struct ggu_v2_hdr *)payload;
+
+		hdr->v1 = GGU_PD_VER2;
+		hdr->num_param_sets = 1;
+		hdr->num_decisions = rte_cpu_to_be_16(num);
+		ptr = (uint8_t *)&hdr[1];
+
+		*ptr++ = GK_GRANTED;
+		ptr = put_granted_params(ptr);
+		for (i = 0; i < num; i++) {
+			*ptr++ = flows[i].proto == ETHER_TYPE_IPv6
+				? GGU_V2_IPV6 : 0;
+			ptr = put_flow_addrs(ptr, &flows[i]);
+		}
+	}
+
+	l4_len = sizeof(*udp_hdr) + (ptr - payload);
+	udp_hdr->dgram_len = rte_cpu_to_be_16(l4_len);
+	ip4_hdr->total_length = rte_cpu_to_be_16(sizeof(*ip4_hdr) + l4_len);
+	RTE_VERIFY(rte_pktmbuf_trim(m, max_len - (ptr - payload)) == 0);
+}
+
+static void
+ggu_bench_run(unsigned int num_pkts, struct bench_meter *meter)
+{
+	unsigned int i;
+	unsigned int num_ggu = 0;
+	uint16_t num_tx;
+	struct rte_mbuf *pkts[GATEKEEPER_MAX_PKT_BURST];
+	struct rte_mbuf *tx_bufs[GATEKEEPER_MAX_PKT_BURST];
+
+	for (i = 0; i < num_pkts; i++)
+		next_flow(&bench_flows[i]);
+
+	/* The GGU block frees the packets of each burst. */
+	for (i = 0; i < num_pkts; i += BENCH_GGU_DECISIONS) {
+		pkts[num_ggu] = rte_pktmbuf_alloc(bench_pool);
+		RTE_VERIFY(pkts[num_ggu] != NULL);
+		build_ggu_pkt(pkts[num_ggu++], &bench_flows[i],
+			RTE_MIN(BENCH_GGU_DECISIONS, num_pkts - i));
+	}
+
+	meter_start(meter);
+	ggu_bench_instance_process(ggu_bench_conf, pkts, num_ggu);
+	/* The idle GK block drains its mailbox. */
+	num_tx = gk_bench_instance_process(ggu_bench_gk_conf, NULL, 0,
+		tx_bufs);
+	meter_stop(meter);
+
+	RTE_VERIFY(num_tx == 0);
+}
+
+static void
+ggu_bench_teardown(void)
+{
+	const struct ggu_stats *stats = ggu_bench_conf->instances[0].stats;
+
+	printf("ggu: %" PRIu64 " decisions received, %" PRIu64 " dropped, %" PRIu64 " invalid packets\n",
+		stats->decisions_received, stats->decisions_dropped,
+		stats->pkts_invalid);
+	ggu_conf_put(ggu_bench_conf);
+	gk_conf_put(ggu_bench_gk_conf);
+}
+
+static struct bench_test {
+	const char *name;
+	int  (*setup)(void);
+	void (*run)(unsigned int num_pkts, struct bench_meter *meter);
+	void (*teardown)(void);
+} bench_tests[] = {
+	{ "hash", NULL, hash_bench_run, NULL },
+	{ "gk", gk_bench_setup, gk_bench_run, gk_bench_teardown },
+	{ "gt", gt_bench_setup, gt_bench_run, gt_bench_teardown },
+	{ "ggu", ggu_bench_setup, ggu_bench_run, ggu_bench_teardown },
+};
+
+static int
+run_bench_test(struct bench_test *test)
+{
+	uint64_t num_pkts = 0;
+	struct bench_meter meter;
+
+	if (test->setup != NULL && test->setup() < 0) {
+		RTE_LOG(ERR, GATEKEEPER, "bench: cannot set up %s\n",
+			test->name);
+		return -1;
+	}
+
+	meter_init(&meter);
+	while (num_pkts < opts.num_pkts && likely(!exiting)) {
+		unsigned int burst = RTE_MIN((uint64_t)opts.burst,
+			opts.num_pkts - num_pkts);
+
+		test->run(burst, &meter);
+		num_pkts += burst;
+	}
+	meter_report(&meter, test->name, num_pkts);
+
+	if (test->teardown != NULL)
+		test->teardown();
+	return 0;
+}
+
+static void
+usage(const char *prgname)
+{
+	printf("Usage: %s [EAL options] -- [options]\n"
+		"  -t TESTS      comma-separated tests among hash, gk, gt, and ggu (default %s)\n"
+		"  -w WORKLOAD   spoofed, i.e. a new source per packet, or zipf (default spoofed)\n"
+		"  -r FILE       replay the flows of the packets of a pcap file instead\n"
+		"  -f FLOWS      number of flows of the zipf workload (default %u)\n"
+		"  -s EXPONENT   exponent of the zipf workload (default %.1f)\n"
+		"  -6 PERCENT    percentage of IPv6 flows (default %u)\n"
+		"  -n PACKETS    packets of each test (default %" PRIu64 ")\n"
+		"  -b BURST      packets of each burst, at most %d (default %u)\n"
+		"  -e ENTRIES    entries of each flow table (default %u)\n"
+		"  -g VERSION    format of the GGU notifications, 1 or 2 (default %u)\n",
+		prgname, opts.tests, opts.num_flows, opts.zipf_s,
+		opts.ip6_pct, opts.num_pkts, GATEKEEPER_MAX_PKT_BURST,
+		opts.burst, opts.flow_ht_size, opts.ggu_version);
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+	int opt;
+	const char *prgname = argv[0];
+
+	while ((opt = getopt(argc, argv, "t:w:r:f:s:6:n:b:e:g:")) != -1) {
+		switch (opt) {
+		case 't':
+			opts.tests = optarg;
+			break;
+		case 'w':
+			if (strcmp(optarg, "spoofed") == 0)
+				opts.workload = BENCH_SPOOFED;
+			else if (strcmp(optarg, "zipf") == 0)
+				opts.workload = BENCH_ZIPF;
+			else
+				goto usage;
+			break;
+		case 'r':
+			opts.workload = BENCH_REPLAY;
+			opts.replay_path = optarg;
+			break;
+		case 'f':
+			opts.num_flows = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			opts.zipf_s = strtod(optarg, NULL);
+			break;
+		case '6':
+			opts.ip6_pct = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			opts.num_pkts = strtoull(optarg, NULL, 0);
+			break;
+		case 'b':
+			opts.burst = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			opts.flow_ht_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			opts.ggu_version = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (opts.num_flows == 0 || opts.ip6_pct > 100 ||
+			opts.num_pkts == 0 || opts.burst == 0 ||
+			opts.burst > GATEKEEPER_MAX_PKT_BURST ||
+			opts.flow_ht_size == 0 ||
+			(opts.ggu_version != GGU_PD_VER1 &&
+			opts.ggu_version != GGU_PD_VER2))
+		goto usage;
+
+	return 0;
+
+usage:
+	usage(prgname);
+	return -1;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int i;
+	int ret = rte_eal_init(argc, argv);
+	if (ret < 0)
+		rte_exit(EXIT_FAILURE, "Error with EAL initialization!\n");
+	argc -= ret;
+	argv += ret;
+
+	ret = parse_args(argc, argv);
+	if (ret < 0)
+		goto out;
+
+	cycles_per_sec = rte_get_tsc_hz();
+	cycles_per_ms = cycles_per_sec / 1000;
+	picosec_per_cycle = 1000000000000ULL / cycles_per_sec;
+
+	ret = init_log();
+	if (ret < 0)
+		goto out;
+
+	/* As gatekeeper_init_network() does. */
+	rte_convert_rss_key((uint32_t *)&default_rss_key,
+		(uint32_t *)rss_key_be, RTE_DIM(default_rss_key));
+	init_ip_flow_hash();
+	init_bench_net();
+
+	if (opts.workload == BENCH_ZIPF) {
+		ret = init_zipf();
+		if (ret < 0) {
+			RTE_LOG(ERR, MALLOC,
+				"bench: cannot allocate the flows of the zipf workload\n");
+			goto out;
+		}
+	} else if (opts.workload == BENCH_REPLAY) {
+		ret = init_replay();
+		if (ret < 0)
+			goto out;
+	}
+
+	bench_pool = rte_pktmbuf_pool_create("bench_pool",
+		BENCH_NUM_MBUFS, 0, 0,
+		RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+	if (bench_pool == NULL) {
+		RTE_LOG(ERR, MALLOC, "bench: cannot create the mbuf pool\n");
+		ret = -1;
+		goto zipf;
+	}
+	ret = rte_pktmbuf_alloc_bulk(bench_pool, bench_pkts, opts.burst);
+	if (ret < 0) {
+		RTE_LOG(ERR, MALLOC, "bench: cannot allocate the mbufs\n");
+		goto pool;
+	}
+
+	for (i = 0; i < RTE_DIM(bench_tests); i++) {
+		char list[64];
+		char *tok, *saveptr;
+
+		snprintf(list, sizeof(list), "%s", opts.tests);
+		for (tok = strtok_r(list, ",", &saveptr); tok != NULL;
+				tok = strtok_r(NULL, ",", &saveptr))
+			if (strcmp(tok, bench_tests[i].name) == 0)
+				break;
+		if (tok == NULL)
+			continue;
+
+		ret = run_bench_test(&bench_tests[i]);
+		if (ret < 0)
+			break;
+	}
+
+	for (i = 0; i < opts.burst; i++)
+		rte_pktmbuf_free(bench_pkts[i]);
+pool:
+	rte_mempool_free(bench_pool);
+zipf:
+	free(replay_flows);
+	free(zipf_cdf);
+	free(zipf_flows);
+out:
+	return ret;
+}
@@ -16,11 +16,366 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <rte_log.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+
 #include "gatekeeper_config.h"
+#include "gatekeeper_fib.h"
+#include "gatekeeper_gk.h"
+#include "gatekeeper_gt.h"
+#include "gatekeeper_launch.h"
+#include "gatekeeper_main.h"
 
-int
-run_dynamic_config(__attribute__((unused)) const struct dynamic_config *dy_conf)
+/* XXX Sample parameter, need to be tested for better performance. */
+#define DY_CMD_BURST_SIZE (32)
+
+static int
+stage_fib_cmd(struct dy_cmd_entry *entry, struct gk_config *gk_conf)
+{
+	switch (entry->op) {
+	case DY_FIB_ADD:
+		return gk_fib_stage_add(entry->u.fib.prefix,
+			entry->u.fib.gateway[0] != '\0'
+				? entry->u.fib.gateway : NULL,
+			entry->u.fib.action, gk_conf);
+
+	case DY_FIB_DEL:
+		return gk_fib_stage_del(entry->u.fib.prefix, gk_conf);
+
+	default:
+		RTE_LOG(ERR, GATEKEEPER,
+			"dyn_cfg: unknown command operation %u\n", entry->op);
+		return -1;
+	}
+}
+
+static inline bool
+is_fib_cmd(const struct dy_cmd_entry *entry)
+{
+	return entry->op == DY_FIB_ADD || entry->op == DY_FIB_DEL;
+}
+
+static void
+process_other_cmd(struct dy_cmd_entry *entry, struct dynamic_config *dy_conf)
+{
+	switch (entry->op) {
+	case DY_FLOWS_EXPORT:
+		gk_export_flows(dy_conf->gk, entry->u.flows.path);
+		break;
+
+	case DY_FLOWS_IMPORT:
+		gk_import_flows(dy_conf->gk, entry->u.flows.path);
+		break;
+
+	case DY_GT_POLICY_RELOAD:
+		gt_reload_policy(dy_conf->gt);
+		break;
+
+	case DY_TALKERS_REPORT:
+		gk_report_talkers(dy_conf->gk, entry->u.flows.path);
+		break;
+
+	default:
+		RTE_LOG(ERR, GATEKEEPER,
+			"dyn_cfg: unknown command operation %u\n", entry->op);
+		break;
+	}
+}
+
+static int
+cleanup_dy(struct dynamic_config *dy_conf)
 {
-	/* TODO Initialize and run Dynamic Config functional block. */
+	destroy_mailbox(&dy_conf->mb);
+	if (dy_conf->gk != NULL) {
+		gk_conf_put(dy_conf->gk);
+		dy_conf->gk = NULL;
+	}
+	if (dy_conf->gt != NULL) {
+		gt_conf_put(dy_conf->gt);
+		dy_conf->gt = NULL;
+	}
+	rte_free(dy_conf);
 	return 0;
 }
+
+static int
+dyn_cfg_proc(void *arg)
+{
+	uint32_t lcore = rte_lcore_id();
+	struct dynamic_config *dy_conf = arg;
+	struct gk_config *gk_conf = dy_conf->gk;
+
+	RTE_LOG(NOTICE, GATEKEEPER,
+		"dyn_cfg: the Dynamic Config block is running at lcore = %u\n",
+		lcore);
+
+	while (likely(!exiting)) {
+		int i;
+		int num_cmd;
+		int num_staged = 0;
+		int num_other_cmds = 0;
+		struct dy_cmd_entry *dy_cmds[DY_CMD_BURST_SIZE];
+		struct dy_cmd_entry *other_cmds[DY_CMD_BURST_SIZE];
+
+		num_cmd = mb_dequeue_burst(&dy_conf->mb,
+			(void **)dy_cmds, DY_CMD_BURST_SIZE);
+		if (num_cmd == 0)
+			continue;
+
+		/*
+		 * All the FIB commands of a burst go into a single new
+		 * version of the FIBs, so a burst of route changes
+		 * only rebuilds the FIBs once. Only Gatekeeper servers
+		 * send FIB commands; see send_fib_cmd().
+		 */
+		if (gk_conf != NULL)
+			gk_fib_update_begin(gk_conf);
+		for (i = 0; i < num_cmd; i++) {
+			if (!is_fib_cmd(dy_cmds[i])) {
+				other_cmds[num_other_cmds++] = dy_cmds[i];
+				continue;
+			}
+			if (stage_fib_cmd(dy_cmds[i], gk_conf) == 0)
+				num_staged++;
+			mb_free_entry(&dy_conf->mb, dy_cmds[i]);
+		}
+
+		if (num_staged > 0) {
+			if (gk_fib_update_commit(gk_conf) < 0)
+				RTE_LOG(ERR, GATEKEEPER,
+					"dyn_cfg: failed to update the FIBs, %d changes were dropped\n",
+					num_staged);
+		} else if (gk_conf != NULL)
+			gk_fib_update_abort(gk_conf);
+
+		/*
+		 * The other commands run after the FIB commands, so
+		 * flow snapshots see the FIBs that they depend on.
+		 */
+		for (i = 0; i < num_other_cmds; i++) {
+			process_other_cmd(other_cmds[i], dy_conf);
+			mb_free_entry(&dy_conf->mb, other_cmds[i]);
+		}
+	}
+
+	RTE_LOG(NOTICE, GATEKEEPER,
+		"dyn_cfg: the Dynamic Config block at lcore = %u is exiting\n",
+		lcore);
+	return cleanup_dy(dy_conf);
+}
+
+/*
+ * There should be only one dynamic_config instance.
+ * Return an error if trying to allocate the second instance.
+ */
+struct dynamic_config *
+alloc_dy_conf(void)
+{
+	static rte_atomic16_t num_dy_conf_alloc = RTE_ATOMIC16_INIT(0);
+
+	if (rte_atomic16_test_and_set(&num_dy_conf_alloc) == 1)
+		return rte_calloc("dynamic_config", 1,
+			sizeof(struct dynamic_config), 0);
+	else {
+		RTE_LOG(ERR, GATEKEEPER,
+			"dyn_cfg: trying to allocate the second instance of struct dynamic_config\n");
+		return NULL;
+	}
+}
+
+/*
+ * Run the Dynamic Config block for the GK blocks of @gk_conf on
+ * a Gatekeeper server, or for the GT blocks of @gt_conf on a Grantor
+ * server; the other configuration must be NULL.
+ */
+int
+run_dynamic_config(struct gk_config *gk_conf, struct gt_config *gt_conf,
+	struct dynamic_config *dy_conf)
+{
+	int ret;
+	struct mailbox_params mb_params;
+
+	if ((gk_conf == NULL) == (gt_conf == NULL) || dy_conf == NULL) {
+		ret = -1;
+		goto out;
+	}
+
+	mb_params.max_entries = dy_conf->mailbox_max_entries;
+	mb_params.mem_cache_size = dy_conf->mailbox_mem_cache_size;
+	mb_params.watermark = dy_conf->mailbox_watermark;
+	ret = init_mailbox("dy", &mb_params, sizeof(struct dy_cmd_entry),
+		dy_conf->lcore_id, &dy_conf->mb);
+	if (ret < 0)
+		goto out;
+
+	ret = launch_at_stage3("dyn_cfg", dyn_cfg_proc, dy_conf,
+		dy_conf->lcore_id);
+	if (ret < 0)
+		goto mailbox;
+
+	if (gk_conf != NULL) {
+		gk_conf_hold(gk_conf);
+		dy_conf->gk = gk_conf;
+	} else {
+		gt_conf_hold(gt_conf);
+		dy_conf->gt = gt_conf;
+	}
+
+	ret = 0;
+	goto out;
+
+mailbox:
+	destroy_mailbox(&dy_conf->mb);
+out:
+	return ret;
+}
+
+static int
+send_fib_cmd(enum dy_cmd_op op, const char *prefix, const char *gateway,
+	int action, struct dynamic_config *dy_conf)
+{
+	int ret;
+	struct dy_cmd_entry *entry;
+
+	if (dy_conf->gk == NULL) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"dyn_cfg: there is no FIB to update on a Grantor server\n");
+		return -1;
+	}
+
+	entry = mb_alloc_entry(&dy_conf->mb);
+	if (entry == NULL)
+		return -1;
+
+	entry->op = op;
+	ret = snprintf(entry->u.fib.prefix, sizeof(entry->u.fib.prefix),
+		"%s", prefix);
+	if (ret < 0 || ret >= (int)sizeof(entry->u.fib.prefix))
+		goto invalid;
+	ret = snprintf(entry->u.fib.gateway, sizeof(entry->u.fib.gateway),
+		"%s", gateway != NULL ? gateway : "");
+	if (ret < 0 || ret >= (int)sizeof(entry->u.fib.gateway))
+		goto invalid;
+	entry->u.fib.action = action;
+
+	return mb_send_entry(&dy_conf->mb, entry);
+
+invalid:
+	RTE_LOG(ERR, GATEKEEPER,
+		"dyn_cfg: invalid FIB prefix \"%s\" or gateway\n", prefix);
+	mb_free_entry(&dy_conf->mb, entry);
+	return -1;
+}
+
+/*
+ * Request the Dynamic Config block to add the prefix @prefix to the
+ * FIBs of the GK blocks; see gk_fib_stage_add() for the parameters.
+ *
+ * The GK blocks keep forwarding packets while the FIBs are updated.
+ */
+int
+dy_add_fib_entry(const char *prefix, const char *gateway,
+	int action, struct dynamic_config *dy_conf)
+{
+	return send_fib_cmd(DY_FIB_ADD, prefix, gateway, action, dy_conf);
+}
+
+/*
+ * Request the Dynamic Config block to remove the prefix @prefix
+ * from the FIBs of the GK blocks.
+ */
+int
+dy_del_fib_entry(const char *prefix, struct dynamic_config *dy_conf)
+{
+	return send_fib_cmd(DY_FIB_DEL, prefix, NULL, 0, dy_conf);
+}
+
+static int
+send_flows_cmd(enum dy_cmd_op op, const char *path,
+	struct dynamic_config *dy_conf)
+{
+	int ret;
+	struct dy_cmd_entry *entry;
+
+	if (dy_conf->gk == NULL) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"dyn_cfg: there are no GK flows on a Grantor server\n");
+		return -1;
+	}
+
+	entry = mb_alloc_entry(&dy_conf->mb);
+	if (entry == NULL)
+		return -1;
+
+	entry->op = op;
+	ret = snprintf(entry->u.flows.path, sizeof(entry->u.flows.path),
+		"%s", path);
+	if (ret < 0 || ret >= (int)sizeof(entry->u.flows.path)) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"dyn_cfg: invalid path \"%s\"\n", path);
+		mb_free_entry(&dy_conf->mb, entry);
+		return -1;
+	}
+
+	return mb_send_entry(&dy_conf->mb, entry);
+}
+
+/*
+ * Request the Dynamic Config block to write the granted and declined
+ * flows of the GK blocks to the flow snapshot @path.
+ */
+int
+dy_export_flows(const char *path, struct dynamic_config *dy_conf)
+{
+	return send_flows_cmd(DY_FLOWS_EXPORT, path, dy_conf);
+}
+
+/*
+ * Request the Dynamic Config block to load the flow snapshot @path,
+ * e.g. exported by another Gatekeeper server, into the GK blocks.
+ */
+int
+dy_import_flows(const char *path, struct dynamic_config *dy_conf)
+{
+	return send_flows_cmd(DY_FLOWS_IMPORT, path, dy_conf);
+}
+
+/*
+ * Request the Dynamic Config block to write the top talkers
+ * of the GK blocks to @path; see gk_report_talkers().
+ */
+int
+dy_report_talkers(const char *path, struct dynamic_config *dy_conf)
+{
+	return send_flows_cmd(DY_TALKERS_REPORT, path, dy_conf);
+}
+
+/*
+ * Request the Dynamic Config block to load the Lua policy again,
+ * and to swap it into the GT blocks; see gt_reload_policy().
+ *
+ * The GT blocks keep deciding requests with the current policy
+ * until the new policy is ready.
+ */
+int
+dy_reload_gt_policy(struct dynamic_config *dy_conf)
+{
+	struct dy_cmd_entry *entry;
+
+	if (dy_conf->gt == NULL) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"dyn_cfg: there is no policy to reload on a Gatekeeper server\n");
+		return -1;
+	}
+
+	entry = mb_alloc_entry(&dy_conf->mb);
+	if (entry == NULL)
+		return -1;
+
+	entry->op = DY_GT_POLICY_RELOAD;
+	return mb_send_entry(&dy_conf->mb, entry);
+}
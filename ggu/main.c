@@ -17,6 +17,7 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include <rte_ip.h>
 #include <rte_udp.h>
@@ -32,58 +33,127 @@
 #include "gatekeeper_main.h"
 #include "gatekeeper_config.h"
 #include "gatekeeper_launch.h"
+#include "gatekeeper_log.h"
+
+/* Find the decision for @flow held back in @st, if any. */
+static struct gk_cmd_entry *
+find_staged_policy(struct mb_stage *st, const struct ip_flow *flow)
+{
+	unsigned int i;
+
+	for (i = 0; i < st->num_staged; i++) {
+		struct gk_cmd_entry *entry = st->staged_entries[i];
+		if (entry->op == GGU_POLICY_ADD &&
+				ip_flow_cmp_eq(&entry->u.ggu.flow, flow, 0) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* XXX Sample parameter: the decisions decoded before they are sent. */
+#define GGU_DECISION_BURST (512)
+
+/*
+ * The decisions decoded from a burst of packets, in CPU order,
+ * which are sent to the GK blocks grouped by GK block.
+ */
+struct ggu_decisions {
+	unsigned int      num;
+	struct ggu_policy policies[GGU_DECISION_BURST];
+	/* The index of the GK block of each decision. */
+	uint16_t          gk_idx[GGU_DECISION_BURST];
+	/* The decisions ordered by GK block. */
+	uint16_t          order[GGU_DECISION_BURST];
+};
 
 static void
-process_single_policy(const struct ggu_policy *policy, const struct ggu_config *ggu_conf)
+send_policy(struct mb_stage *st, const struct ggu_policy *policy,
+	struct ggu_instance *instance, const struct ggu_config *ggu_conf)
 {
 	struct gk_cmd_entry *entry;
-	/*
-	 * Obtain mailbox of that GK block,
-	 * and send the policy decision to the GK block.
-	 */
-	struct mailbox *mb =
-		get_responsible_gk_mailbox(&policy->flow, ggu_conf->gk);
+	bool coalesced = false;
 
-	if (mb == NULL)
-		return;
+	instance->stats->decisions_received++;
 
-	entry = mb_alloc_entry(mb);
-	if (entry == NULL)
-		return;
+	if (ggu_conf->coalesce_decisions && st->num_staged > 0 &&
+			mb_congested(st->mb))
+		entry = find_staged_policy(st, &policy->flow);
+	else
+		entry = NULL;
+
+	if (entry != NULL)
+		coalesced = true;
+	else {
+		entry = mb_stage_alloc_entry(st);
+		if (entry == NULL) {
+			instance->stats->decisions_dropped++;
+			return;
+		}
+	}
 
 	entry->op = GGU_POLICY_ADD;
-	entry->u.ggu.state = policy->state;
-	rte_memcpy(&entry->u.ggu.flow, &policy->flow, sizeof(entry->u.ggu.flow));
-
-	switch(policy->state) {
-	case GK_GRANTED:
-		entry->u.ggu.params.u.granted.tx_rate_kb_sec =
-			rte_be_to_cpu_32(
-			policy->params.u.granted.tx_rate_kb_sec);
-		entry->u.ggu.params.u.granted.cap_expire_sec =
-			rte_be_to_cpu_32(
-			policy->params.u.granted.cap_expire_sec);
-		entry->u.ggu.params.u.granted.next_renewal_ms =
-			rte_be_to_cpu_32(
-			policy->params.u.granted.next_renewal_ms);
-		entry->u.ggu.params.u.granted.renewal_step_ms =
-			rte_be_to_cpu_32(
-			policy->params.u.granted.renewal_step_ms);
-		break;
+	rte_memcpy(&entry->u.ggu, policy, sizeof(entry->u.ggu));
 
-	case GK_DECLINED:
-		entry->u.ggu.params.u.declined.expire_sec =
-			rte_be_to_cpu_32(policy->params.u.declined.expire_sec);
-		break;
+	if (!coalesced)
+		mb_stage_send_entry(st, entry);
+}
 
-	default:
-		RTE_LOG(ERR, GATEKEEPER, "ggu: impossible policy state %hhu\n",
-			policy->state);
-		mb_free_entry(mb, entry);
+/*
+ * Send the decoded decisions to the GK blocks: first, find the GK
+ * block of each decision, then send the decisions of each GK block
+ * together, so each staging buffer is only touched once.
+ */
+static void
+flush_decisions(struct ggu_decisions *dec, struct ggu_instance *instance,
+	const struct ggu_config *ggu_conf)
+{
+	unsigned int i;
+	int g;
+	int num_gk = ggu_conf->gk->num_lcores;
+	const struct gk_rss_dispatch *dispatch =
+		ggu_conf->gk->rss_dispatch_cur;
+	uint16_t starts[RTE_MAX_LCORE + 1];
+
+	if (dec->num == 0)
 		return;
+
+	for (i = 0; i < dec->num; i++) {
+		uint32_t rss_hash_val =
+			rss_ip_flow_hf(&dec->policies[i].flow, 0, 0);
+		dec->gk_idx[i] = dispatch->instance_idx[
+			rss_hash_val & dispatch->reta_mask];
+	}
+
+	/* Counting sort of the decisions by GK block. */
+	memset(starts, 0, (num_gk + 1) * sizeof(starts[0]));
+	for (i = 0; i < dec->num; i++)
+		starts[dec->gk_idx[i] + 1]++;
+	for (g = 0; g < num_gk; g++)
+		starts[g + 1] += starts[g];
+	for (i = 0; i < dec->num; i++)
+		dec->order[starts[dec->gk_idx[i]]++] = i;
+
+	/* Now, @starts[g] is where the decisions of block g + 1 begin. */
+	i = 0;
+	for (g = 0; g < num_gk; g++) {
+		struct mb_stage *st = &instance->gk_stages[g];
+
+		for (; i < starts[g]; i++)
+			send_policy(st, &dec->policies[dec->order[i]],
+				instance, ggu_conf);
 	}
 
-	mb_send_entry(mb, entry);
+	dec->num = 0;
+}
+
+static inline struct ggu_policy *
+next_policy(struct ggu_decisions *dec, struct ggu_instance *instance,
+	const struct ggu_config *ggu_conf)
+{
+	if (unlikely(dec->num == GGU_DECISION_BURST))
+		flush_decisions(dec, instance, ggu_conf);
+	return &dec->policies[dec->num++];
 }
 
 static int
@@ -96,38 +166,35 @@ validate_packet_len(struct rte_mbuf *pkt, uint16_t proto)
 	else if (proto == ETHER_TYPE_IPv6)
 		minimum_size += sizeof(struct ipv6_hdr);
 	else {
-		RTE_LOG(NOTICE, GATEKEEPER,
-			"ggu: unknown packet type %hu\n",
-			proto);
+		fast_log(LOG_GGU_UNKNOWN_PROTO, proto, 0, 0, 0);
 		return -1;
 	}
 
 	minimum_size += sizeof(struct udp_hdr) + sizeof(struct ggu_common_hdr);
 
 	if (pkt->data_len < minimum_size) {
-		RTE_LOG(NOTICE, GATEKEEPER,
-			"ggu: the packet's actual size is %hu, which doesn't have the minimum expected size %hu\n",
-			pkt->data_len, minimum_size);
+		fast_log(LOG_GGU_TOO_SHORT, pkt->data_len, minimum_size, 0, 0);
 		return -1;
 	}
 
 	return 0;
 }
 
-static void
-process_single_packet(struct rte_mbuf *pkt, const struct ggu_config *ggu_conf)
+/*
+ * Validate the headers of @pkt, and return its GGU header, and in
+ * @payload_len the length of the payload starting at that header;
+ * return NULL if @pkt is not a valid GGU packet.
+ */
+static struct ggu_common_hdr *
+validate_ggu_packet(struct rte_mbuf *pkt, const struct ggu_config *ggu_conf,
+	uint16_t *payload_len)
 {
-	uint8_t j;
-	uint8_t *policy_ptr;
 	uint16_t ether_type;
 	struct ether_hdr *eth_hdr;
 	struct ipv4_hdr *ip4hdr;
 	struct ipv6_hdr *ip6hdr;
 	struct udp_hdr *udphdr;
-	struct ggu_common_hdr *gguhdr;
-	uint16_t real_payload_len;
-	uint16_t expected_payload_len;
-	struct ggu_policy policy;
+	uint16_t dgram_len;
 
 	eth_hdr = rte_pktmbuf_mtod(pkt, struct ether_hdr *);
 	ether_type = rte_be_to_cpu_16(eth_hdr->ether_type);
@@ -135,20 +202,18 @@ process_single_packet(struct rte_mbuf *pkt, const struct ggu_config *ggu_conf)
 	switch (ether_type) {
 	case ETHER_TYPE_IPv4:
 		if (validate_packet_len(pkt, ETHER_TYPE_IPv4) < 0)
-			goto free_packet;
+			return NULL;
 
 		ip4hdr = rte_pktmbuf_mtod_offset(pkt, 
 			struct ipv4_hdr *, sizeof(struct ether_hdr));
 		if (ip4hdr->next_proto_id != IPPROTO_UDP) {
-			RTE_LOG(ERR, GATEKEEPER,
-				"ggu: received non-UDP packets, IPv4 ntuple filter bug!\n");
-			goto free_packet;
+			fast_log(LOG_GGU_NON_UDP_IP4, 0, 0, 0, 0);
+			return NULL;
 		}
 
 		if (ip4hdr->dst_addr != ggu_conf->net->back.ip4_addr.s_addr) {
-			RTE_LOG(ERR, GATEKEEPER,
-				"ggu: received packets not destined to the Gatekeeper server, IPv4 ntuple filter bug!\n");
-			goto free_packet;
+			fast_log(LOG_GGU_NOT_DESTINED, 0, 0, 0, 0);
+			return NULL;
 		}
 
 		udphdr = (struct udp_hdr *)&ip4hdr[1];
@@ -156,128 +221,344 @@ process_single_packet(struct rte_mbuf *pkt, const struct ggu_config *ggu_conf)
 
 	case ETHER_TYPE_IPv6:
 		if (validate_packet_len(pkt, ETHER_TYPE_IPv6) < 0)
-			goto free_packet;
+			return NULL;
 
 		ip6hdr = rte_pktmbuf_mtod_offset(pkt, 
 			struct ipv6_hdr *, sizeof(struct ether_hdr));
 		if (ip6hdr->proto != IPPROTO_UDP) {
-			RTE_LOG(ERR, GATEKEEPER,
-				"ggu: received non-UDP packets, IPv6 ntuple filter bug!\n");
-			goto free_packet;
+			fast_log(LOG_GGU_NON_UDP_IP6, 0, 0, 0, 0);
+			return NULL;
 		}
 
 		/*
-		 * TODO Given that IPv6 ntuple filter doesn't check
+		 * Given that IPv6 ntuple filter doesn't check
 		 * the destination address, it must be done here.
-		 * If the IPv6 packet is not destined to
-		 * the Gatekeeper server, redirect the packet properly.
 		 */
 		if (memcmp(ip6hdr->dst_addr,
 				ggu_conf->net->back.ip6_addr.s6_addr,
 				sizeof(ip6hdr->dst_addr)) != 0) {
-			return;
+			fast_log(LOG_GGU_NOT_DESTINED, 0, 0, 0, 0);
+			return NULL;
 		}
 
 		udphdr = (struct udp_hdr *)&ip6hdr[1];
 		break;
 
 	default:
-		RTE_LOG(NOTICE, GATEKEEPER,
-			"ggu: unknown network layer protocol %hu\n",
-			ether_type);
-		goto free_packet;
-		break;
+		fast_log(LOG_GGU_UNKNOWN_PROTO, ether_type, 0, 0, 0);
+		return NULL;
 	}
 
-	if (udphdr->src_port != ggu_conf->ggu_src_port ||
+	/* Any port of the range of source ports may reach any instance. */
+	if ((uint16_t)(rte_be_to_cpu_16(udphdr->src_port) -
+			rte_be_to_cpu_16(ggu_conf->ggu_src_port)) >=
+			ggu_conf->num_ggu_src_ports ||
 			udphdr->dst_port != ggu_conf->ggu_dst_port) {
-		RTE_LOG(ERR, GATEKEEPER,
-			"ggu: unknown udp src port %hu, dst port %hu, ntuple filter bug!\n",
+		fast_log(LOG_GGU_UNKNOWN_PORTS,
 			rte_be_to_cpu_16(udphdr->src_port),
-			rte_be_to_cpu_16(udphdr->dst_port));
-		goto free_packet;
+			rte_be_to_cpu_16(udphdr->dst_port), 0, 0);
+		return NULL;
 	}
 
 	/* XXX Check the UDP checksum. */
 
-	gguhdr = (struct ggu_common_hdr *)&udphdr[1];
-	if (gguhdr->v1 != GGU_PD_VER1) {
-		RTE_LOG(NOTICE, GATEKEEPER,
-			"ggu: unknown policy decision format %hhu\n",
-			gguhdr->v1);
-		goto free_packet;
+	dgram_len = rte_be_to_cpu_16(udphdr->dgram_len);
+	if (dgram_len < sizeof(*udphdr) + sizeof(struct ggu_common_hdr) ||
+			(uint8_t *)udphdr + dgram_len >
+			rte_pktmbuf_mtod(pkt, uint8_t *) + pkt->data_len) {
+		fast_log(LOG_GGU_BAD_PAYLOAD_LEN, dgram_len,
+			sizeof(*udphdr) + sizeof(struct ggu_common_hdr), 0, 0);
+		return NULL;
 	}
 
-	policy_ptr = (uint8_t *)&gguhdr[1];
+	*payload_len = dgram_len - sizeof(*udphdr);
+	return (struct ggu_common_hdr *)&udphdr[1];
+}
 
-	real_payload_len = rte_be_to_cpu_16(udphdr->dgram_len);
-	expected_payload_len = sizeof(*udphdr) + sizeof(*gguhdr) +
+/*
+ * Decode @n decisions of state @state for flows of protocol @proto
+ * starting at @ptr, and return where the next decisions start.
+ */
+static uint8_t *
+decode_v1_policies(uint8_t *ptr, uint8_t n, uint8_t state, uint16_t proto,
+	struct ggu_decisions *dec, struct ggu_instance *instance,
+	const struct ggu_config *ggu_conf)
+{
+	uint8_t j;
+	size_t addr_len = proto == ETHER_TYPE_IPv4
+		? sizeof(((struct ip_flow *)0)->f.v4)
+		: sizeof(((struct ip_flow *)0)->f.v6);
+
+	for (j = 0; j < n; j++) {
+		struct ggu_policy *policy =
+			next_policy(dec, instance, ggu_conf);
+		uint32_t *params;
+
+		policy->state = state;
+		policy->flow.proto = proto;
+		rte_memcpy(&policy->flow.f, ptr, addr_len);
+		ptr += addr_len;
+
+		params = (uint32_t *)ptr;
+		if (state == GK_DECLINED) {
+			policy->params.u.declined.expire_sec =
+				rte_be_to_cpu_32(params[0]);
+			ptr += sizeof(policy->params.u.declined);
+		} else {
+			policy->params.u.granted.tx_rate_kb_sec =
+				rte_be_to_cpu_32(params[0]);
+			policy->params.u.granted.cap_expire_sec =
+				rte_be_to_cpu_32(params[1]);
+			policy->params.u.granted.next_renewal_ms =
+				rte_be_to_cpu_32(params[2]);
+			policy->params.u.granted.renewal_step_ms =
+				rte_be_to_cpu_32(params[3]);
+			ptr += sizeof(policy->params.u.granted);
+		}
+	}
+
+	return ptr;
+}
+
+static int
+decode_v1(struct ggu_common_hdr *gguhdr, uint16_t payload_len,
+	struct ggu_decisions *dec, struct ggu_instance *instance,
+	const struct ggu_config *ggu_conf)
+{
+	uint8_t *policy_ptr = (uint8_t *)&gguhdr[1];
+	struct ggu_policy policy;
+	uint16_t expected_payload_len = sizeof(*gguhdr) +
 		(gguhdr->n1 + gguhdr->n3) * sizeof(policy.flow.f.v4) +
 		(gguhdr->n2 + gguhdr->n4) * sizeof(policy.flow.f.v6) +
 		(gguhdr->n1 + gguhdr->n2) * sizeof(policy.params.u.declined) + 
 		(gguhdr->n3 + gguhdr->n4) * sizeof(policy.params.u.granted);
-	if (real_payload_len < expected_payload_len) {
-		RTE_LOG(NOTICE, GATEKEEPER,
-			"ggu: the size (%hu) of the payload available in the UDP header doesn't match the expected size (%hu)!\n",
-			real_payload_len, expected_payload_len);
-		goto free_packet;
+
+	if (payload_len < expected_payload_len) {
+		fast_log(LOG_GGU_BAD_PAYLOAD_LEN, payload_len,
+			expected_payload_len, 0, 0);
+		return -1;
 	}
 
-	/* Loop over each policy decision on the packet. */
-
-	/* Process the IPv4 decline decisions. */
-	memset(&policy, 0, sizeof(policy));
-	policy.state = GK_DECLINED;
-	policy.flow.proto = ETHER_TYPE_IPv4;
-	for (j = 0; j < gguhdr->n1; j++) {
-		rte_memcpy(&policy.flow.f.v4, policy_ptr,
-			sizeof(policy.flow.f.v4));
-		policy_ptr += sizeof(policy.flow.f.v4);
-		rte_memcpy(&policy.params.u.declined, policy_ptr,
-			sizeof(policy.params.u.declined));
-		policy_ptr += sizeof(policy.params.u.declined);
-		process_single_policy(&policy, ggu_conf);
+	policy_ptr = decode_v1_policies(policy_ptr, gguhdr->n1,
+		GK_DECLINED, ETHER_TYPE_IPv4, dec, instance, ggu_conf);
+	policy_ptr = decode_v1_policies(policy_ptr, gguhdr->n2,
+		GK_DECLINED, ETHER_TYPE_IPv6, dec, instance, ggu_conf);
+	policy_ptr = decode_v1_policies(policy_ptr, gguhdr->n3,
+		GK_GRANTED, ETHER_TYPE_IPv4, dec, instance, ggu_conf);
+	decode_v1_policies(policy_ptr, gguhdr->n4,
+		GK_GRANTED, ETHER_TYPE_IPv6, dec, instance, ggu_conf);
+	return 0;
+}
+
+/*
+ * Walk the @num decisions of a version 2 payload that start at @ptr
+ * and end before @end, whose parameter sets are @sets, and add them
+ * to @dec, or only validate them if @dec is NULL. This way a malformed
+ * packet is dropped entirely, instead of having its first decisions
+ * applied.
+ */
+static int
+walk_v2_decisions(uint8_t *ptr, uint8_t *end, uint16_t num,
+	const struct ggu_policy *sets, uint8_t num_sets,
+	struct ggu_decisions *dec, struct ggu_instance *instance,
+	const struct ggu_config *ggu_conf, uint8_t *payload)
+{
+	struct ip_flow flow;
+	bool has_prev = false;
+	uint16_t n;
+
+	for (n = 0; n < num; n++) {
+		uint8_t desc;
+		uint8_t set;
+		uint16_t proto;
+		size_t addr_len;
+		size_t len;
+
+		if (ptr >= end)
+			goto too_short;
+
+		desc = *ptr;
+		set = desc & GGU_V2_PARAM_SET_MASK;
+		if (set >= num_sets) {
+			fast_log(LOG_GGU_BAD_V2_FIELD, desc, ptr - payload,
+				0, 0);
+			return -1;
+		}
+
+		proto = (desc & GGU_V2_IPV6)
+			? ETHER_TYPE_IPv6 : ETHER_TYPE_IPv4;
+		if ((desc & GGU_V2_SAME_DST) &&
+				(!has_prev || flow.proto != proto)) {
+			fast_log(LOG_GGU_BAD_V2_FIELD, desc, ptr - payload,
+				0, 0);
+			return -1;
+		}
+		flow.proto = proto;
+		addr_len = proto == ETHER_TYPE_IPv4
+			? sizeof(flow.f.v4.src) : sizeof(flow.f.v6.src);
+
+		len = 1 + ((desc & GGU_V2_SAME_DST) ? addr_len : 2 * addr_len);
+		if ((size_t)(end - ptr) < len)
+			goto too_short;
+		ptr++;
+
+		if (flow.proto == ETHER_TYPE_IPv4) {
+			rte_memcpy(&flow.f.v4.src, ptr, addr_len);
+			if (!(desc & GGU_V2_SAME_DST))
+				rte_memcpy(&flow.f.v4.dst, ptr + addr_len,
+					addr_len);
+		} else {
+			rte_memcpy(flow.f.v6.src, ptr, addr_len);
+			if (!(desc & GGU_V2_SAME_DST))
+				rte_memcpy(flow.f.v6.dst, ptr + addr_len,
+					addr_len);
+		}
+		ptr += len - 1;
+		has_prev = true;
+
+		if (dec != NULL) {
+			struct ggu_policy *policy =
+				next_policy(dec, instance, ggu_conf);
+
+			policy->state = sets[set].state;
+			rte_memcpy(&policy->params, &sets[set].params,
+				sizeof(policy->params));
+			rte_memcpy(&policy->flow, &flow, sizeof(flow));
+		}
 	}
 
-	/* Process the IPv6 decline decisions. */
-	policy.flow.proto = ETHER_TYPE_IPv6;
-	for (j = 0; j < gguhdr->n2; j++) {
-		rte_memcpy(&policy.flow.f.v6, policy_ptr,
-			sizeof(policy.flow.f.v6));
-		policy_ptr += sizeof(policy.flow.f.v6);
-		rte_memcpy(&policy.params.u.declined, policy_ptr,
-			sizeof(policy.params.u.declined));
-		policy_ptr += sizeof(policy.params.u.declined);
-		process_single_policy(&policy, ggu_conf);
+	return 0;
+
+too_short:
+	fast_log(LOG_GGU_BAD_PAYLOAD_LEN, end - payload,
+		ptr - payload + 1, 0, 0);
+	return -1;
+}
+
+static int
+decode_v2(struct ggu_common_hdr *gguhdr, uint16_t payload_len,
+	struct ggu_decisions *dec, struct ggu_instance *instance,
+	const struct ggu_config *ggu_conf)
+{
+	struct ggu_v2_hdr *hdr = (struct ggu_v2_hdr *)gguhdr;
+	uint8_t *payload = (uint8_t *)hdr;
+	uint8_t *ptr = (uint8_t *)&hdr[1];
+	uint8_t *end = payload + payload_len;
+	struct ggu_policy sets[GGU_V2_MAX_PARAM_SETS];
+	uint16_t num_decisions = rte_be_to_cpu_16(hdr->num_decisions);
+	uint8_t i;
+
+	RTE_BUILD_BUG_ON(sizeof(*hdr) != sizeof(*gguhdr));
+
+	if (hdr->num_param_sets > GGU_V2_MAX_PARAM_SETS) {
+		fast_log(LOG_GGU_BAD_V2_FIELD, hdr->num_param_sets,
+			offsetof(struct ggu_v2_hdr, num_param_sets), 0, 0);
+		return -1;
 	}
 
-	/* Process the IPv4 granted decisions. */
-	policy.state = GK_GRANTED;
-	policy.flow.proto = ETHER_TYPE_IPv4;
-	for (j = 0; j < gguhdr->n3; j++) {
-		rte_memcpy(&policy.flow.f.v4, policy_ptr,
-			sizeof(policy.flow.f.v4));
-		policy_ptr += sizeof(policy.flow.f.v4);
-		rte_memcpy(&policy.params.u.granted, policy_ptr,
-			sizeof(policy.params.u.granted));
-		policy_ptr += sizeof(policy.params.u.granted);
-		process_single_policy(&policy, ggu_conf);
+	for (i = 0; i < hdr->num_param_sets; i++) {
+		uint32_t params[4];
+		size_t params_len;
+
+		if (ptr >= end)
+			goto too_short;
+
+		sets[i].state = *ptr;
+		if (sets[i].state == GK_DECLINED)
+			params_len = sizeof(sets[i].params.u.declined);
+		else if (sets[i].state == GK_GRANTED)
+			params_len = sizeof(sets[i].params.u.granted);
+		else {
+			fast_log(LOG_GGU_BAD_V2_FIELD, *ptr, ptr - payload,
+				0, 0);
+			return -1;
+		}
+
+		if ((size_t)(end - ptr) < 1 + params_len)
+			goto too_short;
+		rte_memcpy(params, ptr + 1, params_len);
+		ptr += 1 + params_len;
+
+		if (sets[i].state == GK_DECLINED) {
+			sets[i].params.u.declined.expire_sec =
+				rte_be_to_cpu_32(params[0]);
+		} else {
+			sets[i].params.u.granted.tx_rate_kb_sec =
+				rte_be_to_cpu_32(params[0]);
+			sets[i].params.u.granted.cap_expire_sec =
+				rte_be_to_cpu_32(params[1]);
+			sets[i].params.u.granted.next_renewal_ms =
+				rte_be_to_cpu_32(params[2]);
+			sets[i].params.u.granted.renewal_step_ms =
+				rte_be_to_cpu_32(params[3]);
+		}
 	}
 
-	/* Process the IPv6 granted decisions. */
-	policy.flow.proto = ETHER_TYPE_IPv6;
-	for (j = 0; j < gguhdr->n4; j++) {
-		rte_memcpy(&policy.flow.f.v6, policy_ptr,
-			sizeof(policy.flow.f.v6));
-		policy_ptr += sizeof(policy.flow.f.v6);
-		rte_memcpy(&policy.params.u.granted, policy_ptr,
-			sizeof(policy.params.u.granted));
-		policy_ptr += sizeof(policy.params.u.granted);
-		process_single_policy(&policy, ggu_conf);
+	if (walk_v2_decisions(ptr, end, num_decisions, sets,
+			hdr->num_param_sets, NULL, instance, ggu_conf,
+			payload) < 0)
+		return -1;
+	walk_v2_decisions(ptr, end, num_decisions, sets,
+		hdr->num_param_sets, dec, instance, ggu_conf, payload);
+	return 0;
+
+too_short:
+	fast_log(LOG_GGU_BAD_PAYLOAD_LEN, payload_len,
+		ptr - payload + 1, 0, 0);
+	return -1;
+}
+
+/*
+ * Validate a burst of GGU packets, and decode their decisions into
+ * @dec, which are sent to the GK blocks by flush_decisions().
+ */
+static void
+process_pkts(struct rte_mbuf **pkts, uint16_t num_pkts,
+	struct ggu_decisions *dec, struct ggu_instance *instance,
+	const struct ggu_config *ggu_conf)
+{
+	uint16_t i;
+
+	for (i = 0; i < num_pkts; i++)
+		rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void *));
+
+	for (i = 0; i < num_pkts; i++) {
+		uint16_t payload_len;
+		int ret;
+		struct ggu_common_hdr *gguhdr =
+			validate_ggu_packet(pkts[i], ggu_conf, &payload_len);
+
+		if (gguhdr == NULL)
+			ret = -1;
+		else if (gguhdr->v1 == GGU_PD_VER1)
+			ret = decode_v1(gguhdr, payload_len, dec, instance,
+				ggu_conf);
+		else if (gguhdr->v1 == GGU_PD_VER2)
+			ret = decode_v2(gguhdr, payload_len, dec, instance,
+				ggu_conf);
+		else {
+			fast_log(LOG_GGU_UNKNOWN_FORMAT, gguhdr->v1, 0, 0, 0);
+			ret = -1;
+		}
+
+		if (ret < 0)
+			instance->stats->pkts_invalid++;
+		rte_pktmbuf_free(pkts[i]);
 	}
 
-free_packet:
-	rte_pktmbuf_free(pkt);
+	flush_decisions(dec, instance, ggu_conf);
+}
+
+static int
+get_block_idx(struct ggu_config *ggu_conf, unsigned int lcore_id)
+{
+	int i;
+	for (i = 0; i < ggu_conf->num_lcores; i++)
+		if (ggu_conf->lcores[i] == lcore_id)
+			return i;
+	rte_panic("Unexpected condition: lcore %u is not running a ggu instance\n",
+		lcore_id);
+	return 0;
 }
 
 static int
@@ -285,68 +566,184 @@ ggu_proc(void *arg)
 {
 	uint32_t lcore = rte_lcore_id();
 	struct ggu_config *ggu_conf = (struct ggu_config *)arg;
+	struct ggu_instance *instance =
+		&ggu_conf->instances[get_block_idx(ggu_conf, lcore)];
 	uint8_t port_in = ggu_conf->net->back.id;
-	uint16_t rx_queue = ggu_conf->rx_queue_back;
+	uint16_t rx_queue = instance->rx_queue_back;
+	int num_gk = ggu_conf->gk->num_lcores;
+	int i;
+	struct poll_state poll;
 
 	RTE_LOG(NOTICE, GATEKEEPER,
 		"ggu: the GK-GT unit is running at lcore = %u\n", lcore);
 
+	ggu_conf_hold(ggu_conf);
+
+	for (i = 0; i < num_gk; i++)
+		mb_stage_init(&instance->gk_stages[i],
+			&ggu_conf->gk->instances[i].mb);
+	poll_init(&poll, &ggu_conf->poll, port_in, rx_queue);
+	poll_enable_rx_intr(&poll, &ggu_conf->poll, NULL, "ggu");
+
 	while (likely(!exiting)) {
-		uint16_t i;
 		uint16_t num_rx;
 		struct rte_mbuf *bufs[GATEKEEPER_MAX_PKT_BURST];
 
 		/* Load a set of GK-GT packets from the back NIC. */
-		num_rx = rte_eth_rx_burst(port_in, rx_queue, bufs,
-			GATEKEEPER_MAX_PKT_BURST);
-		if (unlikely(num_rx == 0))
-			continue;
+		num_rx = poll_rx(&poll, &ggu_conf->poll, bufs);
+
+		if (num_rx > 0) {
+			STATS_CYCLES_BEGIN(start);
+			process_pkts(bufs, num_rx, instance->dec, instance,
+				ggu_conf);
+			STATS_CYCLES_END(
+				&instance->stats->process_single_packet,
+				start, num_rx);
+		}
+
+		/*
+		 * Send the decisions to the GK blocks.
+		 *
+		 * While packets keep arriving, the decisions for
+		 * a congested GK block are held back to coalesce;
+		 * they are sent once the staging buffer is full,
+		 * or as soon as there are no packets to process.
+		 */
+		for (i = 0; i < num_gk; i++) {
+			struct mb_stage *st = &instance->gk_stages[i];
+			if (ggu_conf->coalesce_decisions && num_rx > 0 &&
+					mb_congested(st->mb))
+				continue;
+			mb_stage_flush(st);
+		}
 
-		for (i = 0; i < num_rx; i++)
-			process_single_packet(bufs[i], ggu_conf);
+		/* Without packets, all decisions have just been sent. */
+		poll_idle(&poll, &ggu_conf->poll, num_rx > 0);
 	}
 
+	poll_release(&poll);
+	for (i = 0; i < num_gk; i++)
+		mb_stage_release(&instance->gk_stages[i]);
+
 	RTE_LOG(NOTICE, GATEKEEPER,
 		"ggu: the GK-GT unit at lcore = %u is exiting\n", lcore);
-	return cleanup_ggu(ggu_conf);
+	return ggu_conf_put(ggu_conf);
 }
 
 static int
-ggu_state1(void *arg)
+ggu_stage1(void *arg)
 {
 	struct ggu_config *ggu_conf = arg;
-	int ret = get_queue_id(&ggu_conf->net->back, QUEUE_TYPE_RX,
-		ggu_conf->lcore_id);
-	if (ret < 0) {
-		RTE_LOG(ERR, GATEKEEPER, "ggu: cannot assign an RX queue for the back interface for lcore %u\n",
-			ggu_conf->lcore_id);
-		return ret;
+	int i;
+
+	for (i = 0; i < ggu_conf->num_lcores; i++) {
+		unsigned int lcore = ggu_conf->lcores[i];
+		int ret = get_queue_id(&ggu_conf->net->back, QUEUE_TYPE_RX,
+			lcore, ggu_conf->poll.num_rx_desc);
+		if (ret < 0) {
+			RTE_LOG(ERR, GATEKEEPER, "ggu: cannot assign an RX queue for the back interface for lcore %u\n",
+				lcore);
+			return ret;
+		}
+		ggu_conf->instances[i].rx_queue_back = ret;
 	}
-	ggu_conf->rx_queue_back = ret;
+
 	return 0;
 }
 
 static int
-ggu_state2(void *arg)
+ggu_stage2(void *arg)
 {
 	struct ggu_config *ggu_conf = arg;
+	uint16_t src_port = rte_be_to_cpu_16(ggu_conf->ggu_src_port);
+	uint16_t i;
 
 	/*
 	 * Setup the ntuple filters that assign the GK-GT packets
-	 * to its queue for both IPv4 and IPv6 addresses.
+	 * to the queues of the instances for both IPv4 and IPv6
+	 * addresses. The source ports are dealt out to the instances,
+	 * so the notifications coming from a given source port,
+	 * and thus their order, stay with a single instance.
 	 */
-	return ntuple_filter_add(ggu_conf->net->back.id,
-		ggu_conf->net->back.ip4_addr.s_addr,
-		ggu_conf->ggu_src_port,
-		ggu_conf->ggu_dst_port,
-		ggu_conf->rx_queue_back);
+	for (i = 0; i < ggu_conf->num_ggu_src_ports; i++) {
+		struct ggu_instance *instance =
+			&ggu_conf->instances[i % ggu_conf->num_lcores];
+		int ret = steer_ggu(&ggu_conf->net->back,
+			rte_cpu_to_be_16(src_port + i),
+			ggu_conf->ggu_dst_port, instance->rx_queue_back);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void
+free_instances(struct ggu_config *ggu_conf)
+{
+	int i;
+
+	if (ggu_conf->instances == NULL)
+		return;
+
+	for (i = 0; i < ggu_conf->num_lcores; i++) {
+		rte_free(ggu_conf->instances[i].gk_stages);
+		rte_free(ggu_conf->instances[i].dec);
+		if (ggu_conf->instances[i].stats != NULL)
+			stats_free("ggu", ggu_conf->lcores[i]);
+	}
+	rte_free(ggu_conf->instances);
+	ggu_conf->instances = NULL;
+}
+
+static int
+alloc_instances(struct ggu_config *ggu_conf, struct gk_config *gk_conf)
+{
+	int i;
+
+	ggu_conf->instances = rte_calloc_socket("ggu_instances",
+		ggu_conf->num_lcores, sizeof(*ggu_conf->instances), 0,
+		get_lcores_socket_id(ggu_conf->lcores, ggu_conf->num_lcores));
+	if (ggu_conf->instances == NULL)
+		goto error;
+
+	for (i = 0; i < ggu_conf->num_lcores; i++) {
+		unsigned int lcore = ggu_conf->lcores[i];
+		struct ggu_instance *instance = &ggu_conf->instances[i];
+
+		instance->gk_stages = rte_calloc_socket("ggu_gk_stages",
+			gk_conf->num_lcores, sizeof(*instance->gk_stages), 0,
+			rte_lcore_to_socket_id(lcore));
+		if (instance->gk_stages == NULL)
+			goto error;
+
+		instance->dec = rte_zmalloc_socket("ggu_decisions",
+			sizeof(*instance->dec), 0,
+			rte_lcore_to_socket_id(lcore));
+		if (instance->dec == NULL)
+			goto error;
+
+		instance->stats = stats_alloc("ggu", lcore,
+			sizeof(*instance->stats));
+		if (instance->stats == NULL)
+			goto instances;
+	}
+
+	return 0;
+
+error:
+	RTE_LOG(ERR, MALLOC, "ggu: out of memory for the GGU instances\n");
+instances:
+	free_instances(ggu_conf);
+	return -1;
 }
 
 int
 run_ggu(struct net_config *net_conf,
 	struct gk_config *gk_conf, struct ggu_config *ggu_conf)
 {
-	int ret;
+	int ret, i;
+	size_t before = heap_allocated();
 
 	if (ggu_conf == NULL || net_conf == NULL || gk_conf == NULL) {
 		ret = -1;
@@ -359,19 +756,55 @@ run_ggu(struct net_config *net_conf,
 		goto out;
 	}
 
-	ret = net_launch_at_stage1(net_conf, 0, 0, 1, 0, ggu_state1, ggu_conf);
-	if (ret < 0)
+	if (ggu_conf->num_lcores <= 0) {
+		RTE_LOG(ERR, GATEKEEPER, "ggu: no lcore is assigned\n");
+		ret = -1;
 		goto out;
+	}
+
+	/* A single source port is the behavior of older configurations. */
+	if (ggu_conf->num_ggu_src_ports == 0)
+		ggu_conf->num_ggu_src_ports = 1;
 
-	ret = launch_at_stage2(ggu_state2, ggu_conf);
+	if (ggu_conf->num_ggu_src_ports < ggu_conf->num_lcores ||
+			(uint32_t)ggu_conf->ggu_src_port +
+			ggu_conf->num_ggu_src_ports - 1 > UINT16_MAX) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"ggu: the %hu source ports starting at %hu must fit in the port space and be at least as many as the %d instances\n",
+			ggu_conf->num_ggu_src_ports, ggu_conf->ggu_src_port,
+			ggu_conf->num_lcores);
+		ret = -1;
+		goto out;
+	}
+
+	ret = check_poll_config(&ggu_conf->poll, &net_conf->back, "ggu");
 	if (ret < 0)
-		goto stage1;
+		goto out;
 
-	ret = launch_at_stage3("ggu", ggu_proc, ggu_conf, ggu_conf->lcore_id);
+	ret = alloc_instances(ggu_conf, gk_conf);
 	if (ret < 0)
-		goto stage2;
+		goto out;
 
 	ggu_conf->net = net_conf;
+
+	ret = net_launch_at_stage1(net_conf, 0, 0, ggu_conf->num_lcores, 0,
+		"ggu", ggu_stage1, ggu_conf);
+	if (ret < 0)
+		goto instances;
+
+	ret = launch_at_stage2(ggu_stage2, ggu_conf);
+	if (ret < 0)
+		goto stage1;
+
+	for (i = 0; i < ggu_conf->num_lcores; i++) {
+		unsigned int lcore = ggu_conf->lcores[i];
+		ret = launch_at_stage3("ggu", ggu_proc, ggu_conf, lcore);
+		if (ret < 0) {
+			pop_n_at_stage3(i);
+			goto stage2;
+		}
+	}
+
 	gk_conf_hold(gk_conf);
 	ggu_conf->gk = gk_conf;
 
@@ -382,6 +815,8 @@ run_ggu(struct net_config *net_conf,
 	ggu_conf->ggu_src_port = rte_cpu_to_be_16(ggu_conf->ggu_src_port);
 	ggu_conf->ggu_dst_port = rte_cpu_to_be_16(ggu_conf->ggu_dst_port);
 
+	rte_atomic32_init(&ggu_conf->ref_cnt);
+	log_heap_reserved("ggu", "at configuration", before);
 	ret = 0;
 	goto out;
 
@@ -389,6 +824,9 @@ stage2:
 	pop_n_at_stage2(1);
 stage1:
 	pop_n_at_stage1(1);
+instances:
+	free_instances(ggu_conf);
+	ggu_conf->net = NULL;
 out:
 	return ret;
 }
@@ -411,13 +849,88 @@ alloc_ggu_conf(void)
 	}
 }
 
-int
+static int
 cleanup_ggu(struct ggu_config *ggu_conf)
 {
 	ggu_conf->net = NULL;
 	gk_conf_put(ggu_conf->gk);
 	ggu_conf->gk = NULL;
+	free_instances(ggu_conf);
+	rte_free(ggu_conf->lcores);
 	rte_free(ggu_conf);
 
 	return 0;
 }
+
+int
+ggu_conf_put(struct ggu_config *ggu_conf)
+{
+	if (rte_atomic32_dec_and_test(&ggu_conf->ref_cnt))
+		return cleanup_ggu(ggu_conf);
+
+	return 0;
+}
+
+/*
+ * The benchmarks of bench/main.c run a GGU instance at the calling
+ * lcore, without queues on the back interface. The instance sends
+ * its decisions to the GK blocks of @gk_conf, e.g. the one that
+ * gk_bench_instance_setup() sets up at the same lcore.
+ * ggu_conf_put() releases the instance.
+ */
+int
+ggu_bench_instance_setup(struct net_config *net_conf,
+	struct gk_config *gk_conf, struct ggu_config *ggu_conf)
+{
+	int i;
+
+	ggu_conf->lcores = rte_malloc("ggu_bench_lcores",
+		sizeof(*ggu_conf->lcores), 0);
+	if (ggu_conf->lcores == NULL) {
+		RTE_LOG(ERR, MALLOC, "ggu: cannot allocate the lcores\n");
+		return -1;
+	}
+	ggu_conf->lcores[0] = rte_lcore_id();
+	ggu_conf->num_lcores = 1;
+	if (ggu_conf->num_ggu_src_ports == 0)
+		ggu_conf->num_ggu_src_ports = 1;
+
+	if (alloc_instances(ggu_conf, gk_conf) < 0) {
+		rte_free(ggu_conf->lcores);
+		ggu_conf->lcores = NULL;
+		ggu_conf->num_lcores = 0;
+		return -1;
+	}
+
+	for (i = 0; i < gk_conf->num_lcores; i++)
+		mb_stage_init(&ggu_conf->instances[0].gk_stages[i],
+			&gk_conf->instances[i].mb);
+
+	ggu_conf->net = net_conf;
+	gk_conf_hold(gk_conf);
+	ggu_conf->gk = gk_conf;
+
+	/* As run_ggu() does. */
+	ggu_conf->ggu_src_port = rte_cpu_to_be_16(ggu_conf->ggu_src_port);
+	ggu_conf->ggu_dst_port = rte_cpu_to_be_16(ggu_conf->ggu_dst_port);
+
+	rte_atomic32_set(&ggu_conf->ref_cnt, 1);
+	return 0;
+}
+
+/*
+ * Go through an iteration of ggu_proc() with the burst @pkts,
+ * which is freed, and send all decisions to the GK blocks.
+ */
+void
+ggu_bench_instance_process(struct ggu_config *ggu_conf,
+	struct rte_mbuf **pkts, uint16_t num_pkts)
+{
+	struct ggu_instance *instance =
+		&ggu_conf->instances[get_block_idx(ggu_conf, rte_lcore_id())];
+	int i;
+
+	process_pkts(pkts, num_pkts, instance->dec, instance, ggu_conf);
+	for (i = 0; i < ggu_conf->gk->num_lcores; i++)
+		mb_stage_flush(&instance->gk_stages[i]);
+}
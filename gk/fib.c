@@ -0,0 +1,795 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <rte_log.h>
+#include <rte_atomic.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_memcpy.h>
+#include <rte_spinlock.h>
+
+#include "gatekeeper_fib.h"
+#include "gatekeeper_gk.h"
+#include "gatekeeper_main.h"
+
+/*
+ * At most two versions of the FIB of a NUMA node exist at any time:
+ * the published one and the one being built, whose versions differ by
+ * one. Thus, the parity of the version is enough to make the names of
+ * their LPM tables unique.
+ */
+static struct gk_fib *
+create_fib(struct gk_config *gk_conf, unsigned int socket_id,
+	uint64_t version)
+{
+	int ret;
+	char name[64];
+	struct gk_fib *fib;
+	struct rte_lpm_config ip4_params = {
+		.max_rules = gk_conf->max_num_ipv4_rules,
+		.number_tbl8s = gk_conf->num_ipv4_tbl8s,
+		.flags = 0,
+	};
+	struct rte_lpm6_config ip6_params = {
+		.max_rules = gk_conf->max_num_ipv6_rules,
+		.number_tbl8s = gk_conf->num_ipv6_tbl8s,
+		.flags = 0,
+	};
+
+	fib = rte_zmalloc_socket("gk_fib", sizeof(*fib), 0, socket_id);
+	if (fib == NULL) {
+		RTE_LOG(ERR, MALLOC,
+			"gk: failed to allocate the FIB at socket %u\n",
+			socket_id);
+		goto out;
+	}
+
+	ret = snprintf(name, sizeof(name), "gk_fib_ip4_%u_%u",
+		socket_id, (unsigned int)(version & 1));
+	RTE_VERIFY(ret > 0 && ret < (int)sizeof(name));
+	fib->ip4 = rte_lpm_create(name, socket_id, &ip4_params);
+	if (fib->ip4 == NULL) {
+		RTE_LOG(ERR, LPM,
+			"gk: cannot create the IPv4 FIB at socket %u\n",
+			socket_id);
+		goto fib;
+	}
+
+	ret = snprintf(name, sizeof(name), "gk_fib_ip6_%u_%u",
+		socket_id, (unsigned int)(version & 1));
+	RTE_VERIFY(ret > 0 && ret < (int)sizeof(name));
+	fib->ip6 = rte_lpm6_create(name, socket_id, &ip6_params);
+	if (fib->ip6 == NULL) {
+		RTE_LOG(ERR, LPM,
+			"gk: cannot create the IPv6 FIB at socket %u\n",
+			socket_id);
+		goto ip4;
+	}
+
+	return fib;
+
+ip4:
+	rte_lpm_free(fib->ip4);
+fib:
+	rte_free(fib);
+out:
+	return NULL;
+}
+
+static void
+destroy_fib(struct gk_fib *fib)
+{
+	rte_lpm6_free(fib->ip6);
+	rte_lpm_free(fib->ip4);
+	rte_free(fib);
+}
+
+static int
+add_rule_to_fib(struct gk_fib *fib, const struct gk_rib_rule *rule)
+{
+	uint8_t ip[16];
+
+	if (rule->prefix.proto == ETHER_TYPE_IPv4)
+		return rte_lpm_add(fib->ip4,
+			rte_be_to_cpu_32(rule->prefix.f.v4.dst),
+			rule->prefix_len, rule->nexthop_id);
+
+	/* rte_lpm6_add() takes a writable address. */
+	rte_memcpy(ip, rule->prefix.f.v6.dst, sizeof(ip));
+	return rte_lpm6_add(fib->ip6, ip, rule->prefix_len,
+		rule->nexthop_id);
+}
+
+/* Build version @version of the FIB at @socket_id from the staged RIB. */
+static struct gk_fib *
+build_fib(struct gk_config *gk_conf, unsigned int socket_id,
+	uint64_t version)
+{
+	unsigned int i;
+	struct gk_rib *rib = &gk_conf->rib;
+	struct gk_fib *fib = create_fib(gk_conf, socket_id, version);
+
+	if (fib == NULL)
+		return NULL;
+
+	fib->num_nexthops = rib->num_staged_nexthops;
+	rte_memcpy(fib->nexthops, rib->staged_nexthops,
+		fib->num_nexthops * sizeof(*fib->nexthops));
+
+	for (i = 0; i < rib->num_staged_rules; i++) {
+		int ret = add_rule_to_fib(fib, &rib->staged_rules[i]);
+		if (ret < 0) {
+			RTE_LOG(ERR, LPM,
+				"gk: cannot add rule %u to the FIB at socket %u (err = %d)\n",
+				i, socket_id, ret);
+			destroy_fib(fib);
+			return NULL;
+		}
+	}
+
+	return fib;
+}
+
+/*
+ * Create the RIB, and an empty copy of the FIB
+ * on each NUMA node that runs a GK block.
+ */
+int
+init_gk_fibs(struct gk_config *gk_conf)
+{
+	int i;
+	struct gk_rib *rib = &gk_conf->rib;
+
+	rte_spinlock_init(&rib->lock);
+	rib->num_nexthops = 0;
+	rib->num_staged_nexthops = 0;
+	rib->max_rules = gk_conf->max_num_ipv4_rules +
+		gk_conf->max_num_ipv6_rules;
+	rib->rules = rte_malloc("gk_rib_rules",
+		rib->max_rules * sizeof(*rib->rules), 0);
+	rib->staged_rules = rte_malloc("gk_rib_staged_rules",
+		rib->max_rules * sizeof(*rib->staged_rules), 0);
+	if (rib->rules == NULL || rib->staged_rules == NULL) {
+		RTE_LOG(ERR, MALLOC, "gk: failed to allocate the RIB\n");
+		goto error;
+	}
+
+	for (i = 0; i < gk_conf->num_lcores; i++) {
+		unsigned int socket_id =
+			rte_lcore_to_socket_id(gk_conf->lcores[i]);
+
+		RTE_VERIFY(socket_id < RTE_DIM(gk_conf->fibs));
+		if (gk_conf->fibs[socket_id] != NULL)
+			continue;
+
+		gk_conf->fibs[socket_id] = build_fib(gk_conf, socket_id,
+			gk_conf->fib_version);
+		if (gk_conf->fibs[socket_id] == NULL)
+			goto error;
+	}
+
+	return 0;
+
+error:
+	destroy_gk_fibs(gk_conf);
+	return -1;
+}
+
+void
+destroy_gk_fibs(struct gk_config *gk_conf)
+{
+	unsigned int i;
+
+	for (i = 0; i < RTE_DIM(gk_conf->fibs); i++) {
+		if (gk_conf->fibs[i] == NULL)
+			continue;
+		destroy_fib(gk_conf->fibs[i]);
+		gk_conf->fibs[i] = NULL;
+	}
+
+	rte_free(gk_conf->rib.staged_rules);
+	gk_conf->rib.staged_rules = NULL;
+	rte_free(gk_conf->rib.rules);
+	gk_conf->rib.rules = NULL;
+}
+
+/*
+ * The MAC address of the back interface is only known
+ * once the interface starts, so the next hops added before
+ * that are updated here.
+ *
+ * The GK blocks are not running yet, so the published FIBs
+ * are updated in place.
+ */
+void
+gk_fib_set_source_mac(struct gk_config *gk_conf)
+{
+	unsigned int i, j;
+	struct gk_rib *rib = &gk_conf->rib;
+
+	rte_spinlock_lock(&rib->lock);
+
+	for (j = 0; j < rib->num_nexthops; j++) {
+		ether_addr_copy(&gk_conf->net->back.eth_addr,
+			&rib->nexthops[j].tunnel.source_mac);
+		ipip_tunnel_refresh(&rib->nexthops[j].tunnel);
+	}
+	rte_memcpy(rib->staged_nexthops, rib->nexthops,
+		rib->num_nexthops * sizeof(*rib->nexthops));
+
+	for (i = 0; i < RTE_DIM(gk_conf->fibs); i++) {
+		struct gk_fib *fib = gk_conf->fibs[i];
+
+		if (fib == NULL)
+			continue;
+
+		for (j = 0; j < fib->num_nexthops; j++) {
+			ether_addr_copy(&gk_conf->net->back.eth_addr,
+				&fib->nexthops[j].tunnel.source_mac);
+			ipip_tunnel_refresh(&fib->nexthops[j].tunnel);
+		}
+	}
+
+	rte_spinlock_unlock(&rib->lock);
+}
+
+/*
+ * Parse @addr into @flow->f.*.dst, and set @flow->proto.
+ * Return the length of the address in bits, or -1 on failure.
+ */
+static int
+parse_addr(const char *addr, struct ip_flow *flow)
+{
+	if (inet_pton(AF_INET, addr, &flow->f.v4.dst) == 1) {
+		flow->proto = ETHER_TYPE_IPv4;
+		return 32;
+	}
+
+	if (inet_pton(AF_INET6, addr, flow->f.v6.dst) == 1) {
+		flow->proto = ETHER_TYPE_IPv6;
+		return 128;
+	}
+
+	return -1;
+}
+
+/* Parse the prefix "address/length" into @flow and @prefix_len. */
+static int
+parse_prefix(const char *prefix, struct ip_flow *flow, uint8_t *prefix_len)
+{
+	/* Need to make copy to tokenize. */
+	size_t prefix_str_len = strlen(prefix);
+	char prefix_copy[prefix_str_len + 1];
+	char *addr;
+	char *len_str;
+	char *saveptr;
+	char *end;
+	long len;
+	int max_len;
+
+	strncpy(prefix_copy, prefix, prefix_str_len + 1);
+
+	addr = strtok_r(prefix_copy, "/", &saveptr);
+	if (addr == NULL)
+		return -1;
+
+	max_len = parse_addr(addr, flow);
+	if (max_len < 0)
+		return -1;
+
+	len_str = strtok_r(NULL, "\0", &saveptr);
+	if (len_str == NULL)
+		return -1;
+
+	errno = 0;
+	len = strtol(len_str, &end, 10);
+	if (len_str == end || !*len_str || *end || errno == ERANGE ||
+			len < 0 || len > max_len)
+		return -1;
+
+	*prefix_len = len;
+	return 0;
+}
+
+/* Clear the bits of the address of @flow after the first @prefix_len. */
+static void
+mask_prefix(struct ip_flow *flow, uint8_t prefix_len)
+{
+	unsigned int i;
+
+	if (flow->proto == ETHER_TYPE_IPv4) {
+		flow->f.v4.dst &= rte_cpu_to_be_32(prefix_len == 0
+			? 0 : ~0U << (32 - prefix_len));
+		return;
+	}
+
+	for (i = 0; i < RTE_DIM(flow->f.v6.dst); i++) {
+		if (prefix_len >= 8) {
+			prefix_len -= 8;
+			continue;
+		}
+		flow->f.v6.dst[i] &= ~(0xFF >> prefix_len);
+		prefix_len = 0;
+	}
+}
+
+/*
+ * Whether the tunnel of @nexthop goes to the gateway of @gateway_flow.
+ * Only the destinations are compared, since the outer source address
+ * of the tunnel is filled in from the back interface.
+ */
+static bool
+is_nexthop_gateway(const struct gk_fib_nexthop *nexthop,
+	const struct ip_flow *gateway_flow)
+{
+	const struct ip_flow *flow = &nexthop->tunnel.flow;
+
+	if (flow->proto != gateway_flow->proto)
+		return false;
+
+	if (flow->proto == ETHER_TYPE_IPv4)
+		return flow->f.v4.dst == gateway_flow->f.v4.dst;
+
+	return memcmp(flow->f.v6.dst, gateway_flow->f.v6.dst,
+		sizeof(flow->f.v6.dst)) == 0;
+}
+
+/* Find the staged next hop for @action and @gateway_flow, or stage it. */
+static int
+get_nexthop(uint8_t action, const struct ip_flow *gateway_flow,
+	struct gk_config *gk_conf)
+{
+	unsigned int i;
+	struct gk_rib *rib = &gk_conf->rib;
+	struct gk_fib_nexthop *nexthop;
+	struct gatekeeper_if *back = &gk_conf->net->back;
+
+	int free_id = -1;
+	uint8_t gen;
+
+	for (i = 0; i < rib->num_staged_nexthops; i++) {
+		nexthop = &rib->staged_nexthops[i];
+		if (nexthop->action == GK_FIB_FREE) {
+			if (free_id < 0)
+				free_id = i;
+			continue;
+		}
+		if (nexthop->action == action && (action == GK_DROP ||
+				is_nexthop_gateway(nexthop, gateway_flow)))
+			return i;
+	}
+
+	if (free_id < 0) {
+		if (rib->num_staged_nexthops >= GK_FIB_MAX_NEXTHOPS) {
+			RTE_LOG(ERR, GATEKEEPER,
+				"gk: the FIB cannot have more than %d next hops\n",
+				GK_FIB_MAX_NEXTHOPS);
+			return -1;
+		}
+		free_id = rib->num_staged_nexthops;
+	}
+
+	/* The generation of an ID outlives the next hops that take it. */
+	nexthop = &rib->staged_nexthops[free_id];
+	gen = (unsigned int)free_id < rib->num_staged_nexthops
+		? nexthop->gen : 0;
+	memset(nexthop, 0, sizeof(*nexthop));
+	nexthop->action = action;
+	nexthop->gen = gen;
+
+	if (action != GK_DROP) {
+		/*
+		 * The outer source address is the address of the back
+		 * interface of the same IP version as the gateway.
+		 */
+		rte_memcpy(&nexthop->tunnel.flow, gateway_flow,
+			sizeof(nexthop->tunnel.flow));
+		if (gateway_flow->proto == ETHER_TYPE_IPv4) {
+			if (!(back->configured_proto & GK_CONFIGURED_IPV4))
+				goto no_addr;
+			nexthop->tunnel.flow.f.v4.src = back->ip4_addr.s_addr;
+		} else {
+			if (!(back->configured_proto & GK_CONFIGURED_IPV6))
+				goto no_addr;
+			rte_memcpy(nexthop->tunnel.flow.f.v6.src,
+				back->ip6_addr.s6_addr,
+				sizeof(nexthop->tunnel.flow.f.v6.src));
+		}
+		ether_addr_copy(&back->eth_addr,
+			&nexthop->tunnel.source_mac);
+		ipip_tunnel_refresh(&nexthop->tunnel);
+	}
+
+	if ((unsigned int)free_id == rib->num_staged_nexthops)
+		rib->num_staged_nexthops++;
+	return free_id;
+
+no_addr:
+	RTE_LOG(ERR, GATEKEEPER,
+		"gk: the back interface has no address of the IP version of the gateway\n");
+	return -1;
+}
+
+static int
+find_staged_rule(struct gk_rib *rib, const struct ip_flow *prefix_flow,
+	uint8_t prefix_len)
+{
+	unsigned int i;
+	size_t addr_len = prefix_flow->proto == ETHER_TYPE_IPv4
+		? sizeof(prefix_flow->f.v4.dst)
+		: sizeof(prefix_flow->f.v6.dst);
+	const void *addr = prefix_flow->proto == ETHER_TYPE_IPv4
+		? (const void *)&prefix_flow->f.v4.dst
+		: (const void *)prefix_flow->f.v6.dst;
+
+	for (i = 0; i < rib->num_staged_rules; i++) {
+		struct gk_rib_rule *rule = &rib->staged_rules[i];
+		const void *rule_addr = rule->prefix.proto == ETHER_TYPE_IPv4
+			? (const void *)&rule->prefix.f.v4.dst
+			: (const void *)rule->prefix.f.v6.dst;
+
+		if (rule->prefix.proto == prefix_flow->proto &&
+				rule->prefix_len == prefix_len &&
+				memcmp(rule_addr, addr, addr_len) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static int
+get_prefix(const char *prefix, struct ip_flow *prefix_flow,
+	uint8_t *prefix_len)
+{
+	memset(prefix_flow, 0, sizeof(*prefix_flow));
+	if (parse_prefix(prefix, prefix_flow, prefix_len) < 0) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: invalid FIB prefix \"%s\"\n", prefix);
+		return -1;
+	}
+	mask_prefix(prefix_flow, *prefix_len);
+	return 0;
+}
+
+/*
+ * Start an update of the FIBs. The changes staged with
+ * gk_fib_stage_add() and gk_fib_stage_del() are only seen by the GK
+ * blocks once gk_fib_update_commit() succeeds, all of them at once.
+ *
+ * Updates are serialized, so the caller must end the update with
+ * either gk_fib_update_commit() or gk_fib_update_abort().
+ */
+void
+gk_fib_update_begin(struct gk_config *gk_conf)
+{
+	unsigned int i;
+	struct gk_rib *rib = &gk_conf->rib;
+
+	rte_spinlock_lock(&rib->lock);
+
+	rte_memcpy(rib->staged_rules, rib->rules,
+		rib->num_rules * sizeof(*rib->rules));
+	rib->num_staged_rules = rib->num_rules;
+	rib->num_staged_ip4_rules = 0;
+	rib->num_staged_ip6_rules = 0;
+	for (i = 0; i < rib->num_rules; i++) {
+		if (rib->rules[i].prefix.proto == ETHER_TYPE_IPv4)
+			rib->num_staged_ip4_rules++;
+		else
+			rib->num_staged_ip6_rules++;
+	}
+
+	rte_memcpy(rib->staged_nexthops, rib->nexthops,
+		rib->num_nexthops * sizeof(*rib->nexthops));
+	rib->num_staged_nexthops = rib->num_nexthops;
+}
+
+/*
+ * Stage the prefix @prefix (e.g. "10.0.0.0/8") with the action
+ * @action (i.e. enum gk_fib_action). If the prefix is already
+ * in the FIB, its action is replaced.
+ *
+ * @gateway is the address of the Grantor server for GK_FWD_GRANTOR,
+ * or of the router on the back interface for GK_FWD_BACK,
+ * and it is ignored for GK_DROP.
+ */
+int
+gk_fib_stage_add(const char *prefix, const char *gateway,
+	int action, struct gk_config *gk_conf)
+{
+	int ret;
+	int nexthop_id;
+	uint8_t prefix_len;
+	struct ip_flow prefix_flow;
+	struct ip_flow gateway_flow;
+	struct gk_rib *rib = &gk_conf->rib;
+	struct gk_rib_rule *rule;
+
+	if (get_prefix(prefix, &prefix_flow, &prefix_len) < 0)
+		return -1;
+
+	memset(&gateway_flow, 0, sizeof(gateway_flow));
+	switch (action) {
+	case GK_FWD_GRANTOR:
+	case GK_FWD_BACK:
+		if (gateway == NULL || parse_addr(gateway,
+				&gateway_flow) < 0) {
+			RTE_LOG(ERR, GATEKEEPER,
+				"gk: invalid gateway address for FIB prefix \"%s\"\n",
+				prefix);
+			return -1;
+		}
+		break;
+	case GK_DROP:
+		break;
+	default:
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: invalid action %d for FIB prefix \"%s\"\n",
+			action, prefix);
+		return -1;
+	}
+
+	rule = NULL;
+	ret = find_staged_rule(rib, &prefix_flow, prefix_len);
+	if (ret >= 0)
+		rule = &rib->staged_rules[ret];
+	else if (prefix_flow.proto == ETHER_TYPE_IPv4 &&
+			rib->num_staged_ip4_rules >=
+			gk_conf->max_num_ipv4_rules)
+		goto full;
+	else if (prefix_flow.proto == ETHER_TYPE_IPv6 &&
+			rib->num_staged_ip6_rules >=
+			gk_conf->max_num_ipv6_rules)
+		goto full;
+
+	nexthop_id = get_nexthop(action, &gateway_flow, gk_conf);
+	if (nexthop_id < 0)
+		return -1;
+
+	if (rule == NULL) {
+		if (prefix_flow.proto == ETHER_TYPE_IPv4)
+			rib->num_staged_ip4_rules++;
+		else
+			rib->num_staged_ip6_rules++;
+		rule = &rib->staged_rules[rib->num_staged_rules++];
+		rte_memcpy(&rule->prefix, &prefix_flow, sizeof(rule->prefix));
+		rule->prefix_len = prefix_len;
+	}
+	rule->nexthop_id = nexthop_id;
+	return 0;
+
+full:
+	RTE_LOG(ERR, GATEKEEPER,
+		"gk: the FIB has no room for prefix \"%s\"\n", prefix);
+	return -1;
+}
+
+/* Stage the removal of the prefix @prefix (e.g. "10.0.0.0/8"). */
+int
+gk_fib_stage_del(const char *prefix, struct gk_config *gk_conf)
+{
+	int ret;
+	uint8_t prefix_len;
+	struct ip_flow prefix_flow;
+	struct gk_rib *rib = &gk_conf->rib;
+
+	if (get_prefix(prefix, &prefix_flow, &prefix_len) < 0)
+		return -1;
+
+	ret = find_staged_rule(rib, &prefix_flow, prefix_len);
+	if (ret < 0) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: FIB prefix \"%s\" does not exist\n", prefix);
+		return -1;
+	}
+
+	if (prefix_flow.proto == ETHER_TYPE_IPv4)
+		rib->num_staged_ip4_rules--;
+	else
+		rib->num_staged_ip6_rules--;
+
+	/* The order of the rules does not matter. */
+	rib->num_staged_rules--;
+	if ((unsigned int)ret != rib->num_staged_rules)
+		rte_memcpy(&rib->staged_rules[ret],
+			&rib->staged_rules[rib->num_staged_rules],
+			sizeof(rib->staged_rules[ret]));
+	return 0;
+}
+
+/*
+ * Wait until all GK blocks have loaded FIB version @version,
+ * or hold no FIB. The GK blocks pass a quiescent point at every
+ * iteration of their main loop, so the wait is short.
+ */
+static void
+wait_for_gk_quiescence(struct gk_config *gk_conf, uint64_t version)
+{
+	int i;
+
+	/* Before stage 1, there are no GK blocks. */
+	if (gk_conf->instances == NULL)
+		return;
+
+	for (i = 0; i < gk_conf->num_lcores; i++)
+		while (gk_conf->instances[i].fib_version < version)
+			rte_pause();
+}
+
+void
+gk_fib_update_abort(struct gk_config *gk_conf)
+{
+	rte_spinlock_unlock(&gk_conf->rib.lock);
+}
+
+/*
+ * Free the staged next hops that no staged rule refers to.
+ * Their IDs keep their generations, so the free next hops stay
+ * in the RIB until new next hops take them.
+ */
+static void
+free_unused_nexthops(struct gk_rib *rib)
+{
+	unsigned int i;
+	bool used[GK_FIB_MAX_NEXTHOPS];
+
+	memset(used, 0, sizeof(used));
+	for (i = 0; i < rib->num_staged_rules; i++)
+		used[rib->staged_rules[i].nexthop_id] = true;
+
+	for (i = 0; i < rib->num_staged_nexthops; i++) {
+		struct gk_fib_nexthop *nexthop = &rib->staged_nexthops[i];
+
+		if (used[i] || nexthop->action == GK_FIB_FREE)
+			continue;
+		nexthop->action = GK_FIB_FREE;
+		nexthop->gen++;
+	}
+}
+
+/*
+ * Build a new version of the FIB of each NUMA node from the staged RIB,
+ * publish them, and free the old versions once no GK block uses them.
+ *
+ * On failure, the staged changes are dropped,
+ * and the GK blocks keep using the current FIBs.
+ */
+int
+gk_fib_update_commit(struct gk_config *gk_conf)
+{
+	unsigned int i;
+	struct gk_rib *rib = &gk_conf->rib;
+	struct gk_rib_rule *rules;
+	struct gk_fib *new_fibs[RTE_DIM(gk_conf->fibs)];
+	struct gk_fib *old_fibs[RTE_DIM(gk_conf->fibs)];
+	uint64_t version = gk_conf->fib_version + 1;
+
+	free_unused_nexthops(rib);
+
+	memset(new_fibs, 0, sizeof(new_fibs));
+	for (i = 0; i < RTE_DIM(gk_conf->fibs); i++) {
+		if (gk_conf->fibs[i] == NULL)
+			continue;
+		new_fibs[i] = build_fib(gk_conf, i, version);
+		if (new_fibs[i] == NULL)
+			goto new_fibs;
+	}
+
+	/* Make sure the new FIBs are complete before they are visible. */
+	rte_wmb();
+	for (i = 0; i < RTE_DIM(gk_conf->fibs); i++) {
+		old_fibs[i] = gk_conf->fibs[i];
+		if (new_fibs[i] != NULL)
+			gk_conf->fibs[i] = new_fibs[i];
+	}
+
+	/*
+	 * A GK block that sees the new version also sees the new FIBs.
+	 * The full barrier pairs with the one of the GK blocks at their
+	 * quiescent points: either the loop below sees that a GK block
+	 * is still at an old version, or that GK block sees the new FIB.
+	 */
+	rte_wmb();
+	gk_conf->fib_version = version;
+	rte_smp_mb();
+
+	wait_for_gk_quiescence(gk_conf, version);
+
+	for (i = 0; i < RTE_DIM(gk_conf->fibs); i++)
+		if (new_fibs[i] != NULL)
+			destroy_fib(old_fibs[i]);
+
+	rules = rib->rules;
+	rib->rules = rib->staged_rules;
+	rib->staged_rules = rules;
+	rib->num_rules = rib->num_staged_rules;
+	rte_memcpy(rib->nexthops, rib->staged_nexthops,
+		rib->num_staged_nexthops * sizeof(*rib->nexthops));
+	rib->num_nexthops = rib->num_staged_nexthops;
+
+	rte_spinlock_unlock(&rib->lock);
+	return 0;
+
+new_fibs:
+	for (i = 0; i < RTE_DIM(gk_conf->fibs); i++)
+		if (new_fibs[i] != NULL)
+			destroy_fib(new_fibs[i]);
+	gk_fib_update_abort(gk_conf);
+	return -1;
+}
+
+/*
+ * Add the prefix @prefix to the FIBs of the GK blocks;
+ * see gk_fib_stage_add() for the parameters.
+ */
+int
+add_fib_entry(const char *prefix, const char *gateway,
+	int action, struct gk_config *gk_conf)
+{
+	gk_fib_update_begin(gk_conf);
+	if (gk_fib_stage_add(prefix, gateway, action, gk_conf) < 0) {
+		gk_fib_update_abort(gk_conf);
+		return -1;
+	}
+	return gk_fib_update_commit(gk_conf);
+}
+
+/* Remove the prefix @prefix from the FIBs of the GK blocks. */
+int
+del_fib_entry(const char *prefix, struct gk_config *gk_conf)
+{
+	gk_fib_update_begin(gk_conf);
+	if (gk_fib_stage_del(prefix, gk_conf) < 0) {
+		gk_fib_update_abort(gk_conf);
+		return -1;
+	}
+	return gk_fib_update_commit(gk_conf);
+}
+
+/*
+ * Look up the next hop of the destination of @flow.
+ * Return the ID of the next hop, or -ENOENT if there is no route.
+ */
+int
+gk_fib_lookup(struct gk_fib *fib, const struct ip_flow *flow)
+{
+	int ret;
+
+	if (flow->proto == ETHER_TYPE_IPv4) {
+		uint32_t nexthop_id;
+
+		ret = rte_lpm_lookup(fib->ip4,
+			rte_be_to_cpu_32(flow->f.v4.dst), &nexthop_id);
+		return ret == 0 ? (int)nexthop_id : -ENOENT;
+	} else {
+		/* rte_lpm6_lookup() takes a writable address. */
+		uint8_t ip[16];
+		uint8_t nexthop_id;
+
+		rte_memcpy(ip, flow->f.v6.dst, sizeof(ip));
+		ret = rte_lpm6_lookup(fib->ip6, ip, &nexthop_id);
+		return ret == 0 ? nexthop_id : -ENOENT;
+	}
+}
@@ -0,0 +1,118 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GATEKEEPER_GK_FLOW_H_
+#define _GATEKEEPER_GK_FLOW_H_
+
+#include <stdint.h>
+
+#include <rte_memory.h>
+
+#include "gatekeeper_gk.h"
+
+/*
+ * The flow entries are sized and aligned to a single cache line, so
+ * processing a packet touches only one line of the flow entry table.
+ *
+ * The key of an entry (i.e. its struct ip_flow) is not part of the entry;
+ * it is kept in the key store of the hash table of the flow table,
+ * which is only read to resolve lookups, and can be recovered with
+ * rte_hash_get_key_with_position() given the index of the entry.
+ *
+ * Within each state, the 64-bit fields come first to avoid padding.
+ */
+struct flow_entry {
+	/* The state of the entry (i.e. enum gk_flow_state). */
+	uint8_t state;
+
+	/*
+	 * The next hop in the FIB of the Grantor server to which
+	 * packets to the destination of the flow are sent, with its
+	 * generation (see gk_fib_nexthop_ref()).
+	 */
+	uint16_t grantor_id;
+
+	/*
+	 * The RSS hash value of the flow, so the entry can be
+	 * removed from the hash table without hashing the key again.
+	 */
+	uint32_t flow_hash_val;
+
+	/*
+	 * The links of the entry in the list of its slot of the timer
+	 * wheel of the flow table, and that slot; see gk/wheel.h.
+	 */
+	uint32_t timer_prev;
+	uint32_t timer_next;
+	uint16_t timer_slot;
+
+	union {
+		struct {
+			/* The time the last packet of the entry was seen. */
+			uint64_t last_packet_seen_at;
+			/* 
+			 * The priority associated to
+			 * the last packet of the entry.
+			 */
+			uint8_t last_priority;
+			/* 
+			 * The number of packets that the entry is allowed
+			 * to send with @last_priority without waiting
+			 * the amount of time necessary to be granted
+			 * @last_priority.
+			 */
+			uint8_t allowance;
+		} request;
+
+		struct {
+			/* When the granted capability expires. */
+			uint64_t cap_expire_at;
+			/* When @budget_byte is reset. */
+			uint64_t budget_renew_at;
+			/* When GK should send the next renewal to @grantor_id. */
+			uint64_t send_next_renewal_at;
+			/*
+			 * How many cycles (unit) GK must wait before
+			 * sending the next capability renewal request.
+			 */
+			uint64_t renewal_step_cycle;
+			/* 
+			 * When @budget_byte is reset, reset it to
+			 * @tx_rate_kb_cycle * 1024 bytes.
+			 */
+			int tx_rate_kb_cycle;
+			/* How many bytes @src can still send in current cycle. */
+			int budget_byte;
+		} granted;
+
+		struct {
+			/*
+			 * When the punishment (i.e. the declined capability)
+			 * expires.
+			 */
+			uint64_t expire_at;
+			/*
+			 * The packets of the entry dropped by the GK block;
+			 * see gk_offload_count_drop().
+			 */
+			uint32_t num_drops;
+		} declined;
+	} u;
+} __rte_cache_aligned;
+
+#endif /* _GATEKEEPER_GK_FLOW_H_ */
@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <limits.h>
 #include <string.h>
 #include <stdbool.h>
 
@@ -27,6 +28,7 @@
 #include <rte_memcpy.h>
 #include <rte_cycles.h>
 #include <rte_malloc.h>
+#include <rte_prefetch.h>
 
 #include "gatekeeper_gk.h"
 #include "gatekeeper_main.h"
@@ -36,88 +38,27 @@
 #include "gatekeeper_config.h"
 #include "gatekeeper_launch.h"
 #include "gatekeeper_lls.h"
+#include "gatekeeper_log.h"
+#include "flow.h"
+#include "offload.h"
+#include "persist.h"
+#include "sched.h"
+#include "talkers.h"
+#include "wheel.h"
 
 #define	START_PRIORITY		 (38)
 /* Set @START_ALLOWANCE as the double size of a large DNS reply. */
 #define	START_ALLOWANCE		 (8)
 
-/*
- * Priority used for DSCP field of encapsulated packets:
- *  0 for legacy packets; 1 for granted packets; 
- *  2 for capability renew; 3-63 for request packets.
- */
-#define PRIORITY_GRANTED	 (1)
-#define PRIORITY_RENEW_CAP	 (2)
-#define PRIORITY_MAX		 (63)
-
 /* XXX Sample parameters, need to be tested for better performance. */
 #define GK_CMD_BURST_SIZE        (32)
 
-struct flow_entry {
-	/* IP flow information. */
-	struct ip_flow flow;
-
-	/* The state of the entry. */
-	enum gk_flow_state state;
-
-	union {
-		struct {
-			/* The time the last packet of the entry was seen. */
-			uint64_t last_packet_seen_at;
-			/* 
-			 * The priority associated to
-			 * the last packet of the entry.
-			 */
-			uint8_t last_priority;
-			/* 
-			 * The number of packets that the entry is allowed
-			 * to send with @last_priority without waiting
-			 * the amount of time necessary to be granted
-			 * @last_priority.
-			 */
-			uint8_t allowance;
-			/* 
-			 * The ID of the Grantor server to which packets to
-			 * @dst must be sent.
-			 */
-			int grantor_id;
-		} request;
-
-		struct {
-			/* When the granted capability expires. */
-			uint64_t cap_expire_at;
-			/* When @budget_byte is reset. */
-			uint64_t budget_renew_at;
-			/* 
-			 * When @budget_byte is reset, reset it to
-			 * @tx_rate_kb_cycle * 1024 bytes.
-			 */
-			int tx_rate_kb_cycle;
-			/* How many bytes @src can still send in current cycle. */
-			int budget_byte;
-			/*
-			 * The ID of the Grantor server to which packets to
-			 * @dst must be sent.
-			 */
-			int grantor_id;
-			/* When GK should send the next renewal to @grantor_id. */
-			uint64_t send_next_renewal_at;
-			/*
-			 * How many cycles (unit) GK must wait before
-			 * sending the next capability renewal request.
-			 */
-			uint64_t renewal_step_cycle;
-		} granted;
-
-		struct {
-			/*
-			 * When the punishment (i.e. the declined capability)
-			 * expires.
-			 */
-			uint64_t expire_at;
-		} declined;
-	} u;
-};
+/*
+ * XXX Sample parameter, need to be tested for better performance.
+ * The number of flow entries sampled to find a victim
+ * when a flow table is full.
+ */
+#define GK_FLOW_EVICT_SAMPLE     (8)
 
 /* We should avoid calling integer_log_base_2() with zero. */
 static inline uint8_t
@@ -130,14 +71,45 @@ integer_log_base_2(uint64_t delta_time)
 #endif
 }
 
+/*
+ * The priority of a request is the integer log base 2 of the time
+ * in picoseconds between the current packet and the last seen packet,
+ * i.e. the largest p such that delta_cycles * picosec_per_cycle >= 2^p.
+ *
+ * Instead of multiplying at each packet, @instance->priority_cycles[p]
+ * holds the smallest delta in cycles of priority p. Since
+ * log2(delta_cycles) + log2(picosec_per_cycle) is either the priority
+ * or one less than it, a single comparison with the table is needed.
+ */
+static void
+init_priority_cycles(struct gk_instance *instance)
+{
+	unsigned int p;
+
+	if (unlikely(picosec_per_cycle == 0)) {
+		/* All requests have priority 0. */
+		instance->priority_offset = 0;
+		for (p = 0; p < GK_PRIORITY_LEVELS; p++)
+			instance->priority_cycles[p] = UINT64_MAX;
+		return;
+	}
+
+	instance->priority_offset = integer_log_base_2(picosec_per_cycle);
+	for (p = 0; p < GK_PRIORITY_LEVELS; p++)
+		instance->priority_cycles[p] = ((1ULL << p) +
+			picosec_per_cycle - 1) / picosec_per_cycle;
+}
+
 /* 
  * It converts the difference of time between the current packet and 
  * the last seen packet into a given priority. 
  */
-static uint8_t 
-priority_from_delta_time(uint64_t present, uint64_t past)
+static inline uint8_t
+priority_from_delta_time(const struct gk_instance *instance,
+	uint64_t present, uint64_t past)
 {
 	uint64_t delta_time;
+	unsigned int priority;
 
 	if (unlikely(present < past)) {
 		/*
@@ -150,24 +122,28 @@ priority_from_delta_time(uint64_t present, uint64_t past)
 		return 0;
 	}
 
-	delta_time = (present - past) * picosec_per_cycle;
-	if (unlikely(delta_time < 1))
+	delta_time = present - past;
+	if (unlikely(delta_time < instance->priority_cycles[0]))
 		return 0;
-	
-	return integer_log_base_2(delta_time);
+
+	priority = integer_log_base_2(delta_time) + instance->priority_offset;
+	if (unlikely(priority >= GK_PRIORITY_LEVELS - 1))
+		return GK_PRIORITY_LEVELS - 1;
+	if (delta_time >= instance->priority_cycles[priority + 1])
+		priority++;
+	return priority;
 }
 
 static inline void
-initialize_flow_entry(struct flow_entry *fe, struct ip_flow *flow)
+initialize_flow_entry(struct flow_entry *fe, uint32_t flow_hash_val,
+	uint16_t grantor_id, uint64_t now)
 {
-	rte_memcpy(&fe->flow, flow, sizeof(*flow));
-
+	fe->flow_hash_val = flow_hash_val;
+	fe->grantor_id = grantor_id;
 	fe->state = GK_REQUEST;
-	fe->u.request.last_packet_seen_at = rte_rdtsc();
+	fe->u.request.last_packet_seen_at = now;
 	fe->u.request.last_priority = START_PRIORITY;
 	fe->u.request.allowance = START_ALLOWANCE - 1;
-	/* TODO Grantor ID comes from LPM lookup. */
-	fe->u.request.grantor_id = 0;
 }
 
 static inline void
@@ -177,8 +153,6 @@ reinitialize_flow_entry(struct flow_entry *fe, uint64_t now)
 	fe->u.request.last_packet_seen_at = now;
 	fe->u.request.last_priority = START_PRIORITY;
 	fe->u.request.allowance = START_ALLOWANCE - 1;
-	/* TODO Grantor ID comes from LPM lookup. */
-	fe->u.request.grantor_id = 0;
 }
 
 static inline int
@@ -188,24 +162,51 @@ drop_packet(struct rte_mbuf *pkt)
 	return 0;
 }
 
+/*
+ * The packets of a burst that go through a tunnel. They are
+ * encapsulated together once the state machine of all flows
+ * of the burst has run; see gk_process_pkts().
+ */
+struct gk_encap_burst {
+	uint16_t                num_pkts;
+	struct rte_mbuf         *pkts[GATEKEEPER_MAX_PKT_BURST];
+	uint8_t                 priorities[GATEKEEPER_MAX_PKT_BURST];
+	struct ipip_tunnel_info *tunnels[GATEKEEPER_MAX_PKT_BURST];
+};
+
+static inline void
+add_to_encap_burst(struct gk_encap_burst *encap, struct rte_mbuf *pkt,
+	uint8_t priority, struct ipip_tunnel_info *tunnel)
+{
+	encap->pkts[encap->num_pkts] = pkt;
+	encap->priorities[encap->num_pkts] = priority;
+	encap->tunnels[encap->num_pkts++] = tunnel;
+}
+
+static inline bool
+tunnel_is_resolved(const struct gk_tunnel *tunnel)
+{
+	return tunnel->nh_state & LLS_NH_RESOLVED;
+}
+
 /* 
  * When a flow entry is at request state, all the GK block processing
  * that entry does is to:
  * (1) compute the priority of the packet.
  * (2) encapsulate the packet as a request.
  * (3) put this encapsulated packet in the request queue.
+ *
+ * Steps (2) and (3) are done for the whole burst through @encap.
  */
 static int
-gk_process_request(struct flow_entry *fe, struct ipacket *packet)
+gk_process_request(struct flow_entry *fe, struct ipacket *packet,
+	uint64_t now, struct gk_instance *instance,
+	struct gk_encap_burst *encap)
 {
-	int ret;
-	uint64_t now = rte_rdtsc();
-	uint8_t priority = priority_from_delta_time(now,
+	uint8_t priority = priority_from_delta_time(instance, now,
 			fe->u.request.last_packet_seen_at);
-
-	/* TODO The tunnel information should come from the LPM table. */
-	struct ipip_tunnel_info tunnel;
-	memset(&tunnel, 0, sizeof(tunnel));
+	struct gk_tunnel *tunnel =
+		&instance->tunnels[gk_fib_ref_to_nexthop_id(fe->grantor_id)];
 
 	fe->u.request.last_packet_seen_at = now;
 
@@ -228,19 +229,18 @@ gk_process_request(struct flow_entry *fe, struct ipacket *packet)
 	 * DSCP 0 for legacy packets; 1 for granted packets; 
 	 * 2 for capability renew; 3-63 for requests.
 	 */
-	priority += 3;
+	priority += PRIORITY_REQ_MIN;
 	if (unlikely(priority > PRIORITY_MAX))
 		priority = PRIORITY_MAX;
 
 	/* The assigned priority is @priority. */
 
-	/* Encapsulate the packet as a request. */
-	ret = encapsulate(packet->pkt, priority, &tunnel);
-	if (ret < 0)
-		return ret;
-
-	/* TODO Put this encapsulated packet in the request queue. */
+	/* No Ethernet address to send the packet to yet. */
+	if (unlikely(!tunnel_is_resolved(tunnel)))
+		return drop_packet(packet->pkt);
 
+	/* Encapsulate the packet as a request. */
+	add_to_encap_burst(encap, packet->pkt, priority, &tunnel->info);
 	return 0;
 }
 
@@ -251,21 +251,20 @@ cycle_from_second(uint64_t time)
 }
 
 static int
-gk_process_granted(struct flow_entry *fe, struct ipacket *packet)
+gk_process_granted(struct flow_entry *fe, struct ipacket *packet,
+	uint64_t now, struct gk_instance *instance,
+	struct gk_encap_burst *encap)
 {
-	int ret;
 	bool renew_cap;
 	uint8_t priority = PRIORITY_GRANTED;
-	uint64_t now = rte_rdtsc();
 	struct rte_mbuf *pkt = packet->pkt;
-
-	/* TODO The tunnel information should come from the LPM table. */
-	struct ipip_tunnel_info tunnel;
-	memset(&tunnel, 0, sizeof(tunnel));
+	uint32_t pkt_len;
+	struct gk_tunnel *tunnel =
+		&instance->tunnels[gk_fib_ref_to_nexthop_id(fe->grantor_id)];
 
 	if (now >= fe->u.granted.cap_expire_at) {
 		reinitialize_flow_entry(fe, now);
-		return gk_process_request(fe, packet);
+		return gk_process_request(fe, packet, now, instance, encap);
 	}
 
 	if (now >= fe->u.granted.budget_renew_at) {
@@ -273,10 +272,15 @@ gk_process_granted(struct flow_entry *fe, struct ipacket *packet)
 		fe->u.granted.budget_byte = fe->u.granted.tx_rate_kb_cycle * 1024;
 	}
 
-	if (pkt->data_len > fe->u.granted.budget_byte)
+	/*
+	 * Charge the whole packet, including the segments of jumbo frames.
+	 * A frame is bounded by the MTU, so its length fits in an int.
+	 */
+	pkt_len = rte_pktmbuf_pkt_len(pkt);
+	if ((int)pkt_len > fe->u.granted.budget_byte)
 		return drop_packet(pkt);
 
-	fe->u.granted.budget_byte -= pkt->data_len;
+	fe->u.granted.budget_byte -= pkt_len;
 	renew_cap = now >= fe->u.granted.send_next_renewal_at;
 	if (renew_cap) {
 		fe->u.granted.send_next_renewal_at = now +
@@ -289,25 +293,24 @@ gk_process_granted(struct flow_entry *fe, struct ipacket *packet)
 	 * mark it as a capability renewal request if @renew_cap is true,
 	 * enter destination according to @fe->u.granted.grantor_id.
 	 */
-	ret = encapsulate(packet->pkt, priority, &tunnel);
-	if (ret < 0)
-		return ret;
-
-	/* TODO Put the encapsulated packet in the granted queue. */
+	if (unlikely(!tunnel_is_resolved(tunnel)))
+		return drop_packet(pkt);
 
+	add_to_encap_burst(encap, pkt, priority, &tunnel->info);
 	return 0;
 }
 
 static int
-gk_process_declined(struct flow_entry *fe, struct ipacket *packet)
+gk_process_declined(struct flow_entry *fe, struct ipacket *packet,
+	uint64_t now, struct gk_instance *instance,
+	struct gk_encap_burst *encap)
 {
-	uint64_t now = rte_rdtsc();
-
 	if (unlikely(now >= fe->u.declined.expire_at)) {
 		reinitialize_flow_entry(fe, now);
-		return gk_process_request(fe, packet);
+		return gk_process_request(fe, packet, now, instance, encap);
 	}
 
+	gk_offload_count_drop(instance->offload, &packet->flow, fe);
 	return drop_packet(packet->pkt);
 }
 
@@ -322,95 +325,520 @@ static int get_block_idx(struct gk_config *gk_conf, unsigned int lcore_id)
 	return 0;
 }
 
+/*
+ * Return the flow table of @instance that holds the flows of
+ * protocol @proto, or NULL if the GK block doesn't handle such flows.
+ */
+static inline struct gk_flow_table *
+get_flow_table(struct gk_instance *instance, uint16_t proto)
+{
+	struct gk_flow_table *table;
+
+	if (likely(proto == ETHER_TYPE_IPv4))
+		table = &instance->ip4_flows;
+	else if (proto == ETHER_TYPE_IPv6)
+		table = &instance->ip6_flows;
+	else
+		return NULL;
+
+	return likely(table->hash_table != NULL) ? table : NULL;
+}
+
+/*
+ * The keys of the flow tables are only the addresses of the flows,
+ * i.e. the field @f of struct ip_flow, so the keys of the IPv4 flow table
+ * don't pay for the size of IPv6 addresses.
+ */
+static inline const void *
+flow_key(const struct ip_flow *flow)
+{
+	return &flow->f;
+}
+
 static int
-setup_gk_instance(unsigned int lcore_id, struct gk_config *gk_conf)
+setup_flow_table(struct gk_flow_table *table, const char *name,
+	unsigned int block_idx, unsigned int lcore_id,
+	unsigned int entries, uint32_t key_len, rte_hash_function hash_func,
+	const char *persist_dir)
 {
 	int  ret;
 	char ht_name[64];
-	unsigned int block_idx = get_block_idx(gk_conf, lcore_id);
-	unsigned int socket_id = rte_lcore_to_socket_id(lcore_id);
-
-	struct gk_instance *instance = &gk_conf->instances[block_idx];
 	struct rte_hash_parameters ip_flow_hash_params = {
-		.entries = gk_conf->flow_ht_size,
-		.key_len = sizeof(struct ip_flow),
-		.hash_func = rss_ip_flow_hf,
+		.entries = entries,
+		.key_len = key_len,
+		.hash_func = hash_func,
 		.hash_func_init_val = 0,
 	};
 
-	ret = snprintf(ht_name, sizeof(ht_name), "ip_flow_hash_%u", block_idx);
+	ret = snprintf(ht_name, sizeof(ht_name), "%s_flow_hash_%u",
+		name, block_idx);
 	RTE_VERIFY(ret > 0 && ret < (int)sizeof(ht_name));
 
 	/* Setup the flow hash table for GK block @block_idx. */
 	ip_flow_hash_params.name = ht_name;
-	ip_flow_hash_params.socket_id = socket_id;
-	instance->ip_flow_hash_table = rte_hash_create(&ip_flow_hash_params);
-	if (instance->ip_flow_hash_table == NULL) {
+	ip_flow_hash_params.socket_id = rte_lcore_to_socket_id(lcore_id);
+	table->hash_table = rte_hash_create(&ip_flow_hash_params);
+	if (table->hash_table == NULL) {
 		RTE_LOG(ERR, HASH,
-			"The GK block cannot create hash table at lcore %u!\n",
-			lcore_id);
+			"The GK block cannot create %s hash table at lcore %u!\n",
+			name, lcore_id);
 
-		ret = -1;
+		return -1;
+	}
+
+	table->wheel = gk_wheel_create(rte_rdtsc(),
+		ip_flow_hash_params.socket_id);
+	if (table->wheel == NULL) {
+		RTE_LOG(ERR, MALLOC,
+			"The GK block can't create %s timer wheel at lcore %u!\n",
+			name, lcore_id);
+
+		rte_hash_free(table->hash_table);
+		table->hash_table = NULL;
+		return -1;
+	}
+
+	/*
+	 * Setup the flow entry table for GK block @block_idx.
+	 * The table is zeroed, or restored when it persists, by
+	 * the GK block when it starts (see clear_flow_table()), so
+	 * the GK blocks first touch their tables in parallel, and
+	 * the pages are allocated on their NUMA nodes.
+	 */
+	if (persist_dir != NULL) {
+		ret = gk_flow_file_map(table, persist_dir, name, block_idx,
+			entries, key_len);
+		if (ret < 0)
+			goto wheel;
+		return 0;
+	}
+
+	table->entry_table = (struct flow_entry *)rte_malloc_socket(NULL,
+		(size_t)entries * sizeof(struct flow_entry),
+		RTE_CACHE_LINE_SIZE, ip_flow_hash_params.socket_id);
+	if (table->entry_table == NULL) {
+		RTE_LOG(ERR, MALLOC,
+			"The GK block can't create %s flow entry table at lcore %u!\n",
+			name, lcore_id);
+		goto wheel;
+	}
+	table->num_entries = entries;
+
+	return 0;
+
+wheel:
+	gk_wheel_destroy(table->wheel);
+	table->wheel = NULL;
+	rte_hash_free(table->hash_table);
+	table->hash_table = NULL;
+	return -1;
+}
+
+/*
+ * Zero the flow entries of @table, which is not persistent;
+ * called by the lcore of the GK block before it processes packets.
+ */
+static void
+clear_flow_table(struct gk_flow_table *table)
+{
+	if (table->entry_table == NULL || table->file != NULL)
+		return;
+
+	memset(table->entry_table, 0,
+		(size_t)table->num_entries * sizeof(struct flow_entry));
+}
+
+static void
+destroy_flow_table(struct gk_flow_table *table)
+{
+	if (table->hash_table != NULL) {
+		rte_hash_free(table->hash_table);
+		table->hash_table = NULL;
+	}
+
+	gk_wheel_destroy(table->wheel);
+	table->wheel = NULL;
+
+	if (table->file != NULL)
+		gk_flow_file_unmap(table);
+	else if (table->entry_table != NULL) {
+		rte_free(table->entry_table);
+		table->entry_table = NULL;
+	}
+}
+
+/* Whether the flow entry @fe can be removed from its flow table. */
+static inline bool
+flow_entry_expired(const struct flow_entry *fe, uint64_t now,
+	const struct gk_config *gk_conf)
+{
+	switch (fe->state) {
+	case GK_REQUEST:
+		return now >= fe->u.request.last_packet_seen_at +
+			gk_conf->request_timeout_cycles;
+
+	case GK_GRANTED:
+		return now >= fe->u.granted.cap_expire_at;
+
+	case GK_DECLINED:
+		return now >= fe->u.declined.expire_at;
+
+	default:
+		return true;
+	}
+}
+
+/* When the flow entry @fe expires, unless it is extended. */
+static inline uint64_t
+flow_entry_deadline(const struct flow_entry *fe,
+	const struct gk_config *gk_conf)
+{
+	switch (fe->state) {
+	case GK_REQUEST:
+		return fe->u.request.last_packet_seen_at +
+			gk_conf->request_timeout_cycles;
+
+	case GK_GRANTED:
+		return fe->u.granted.cap_expire_at;
+
+	case GK_DECLINED:
+		return fe->u.declined.expire_at;
+
+	default:
+		return 0;
+	}
+}
+
+static void
+del_flow_entry(struct gk_flow_table *table, const void *key,
+	struct flow_entry *fe)
+{
+	int ret;
+
+	gk_wheel_del(table->wheel, table->entry_table,
+		fe - table->entry_table);
+	ret = rte_hash_del_key_with_hash(table->hash_table,
+		key, fe->flow_hash_val);
+	if (ret < 0)
+		RTE_LOG(ERR, HASH,
+			"The GK block failed to delete a key from hash table!\n");
+}
+
+/*
+ * Handle at most @max_iter due expiration timers of @table:
+ * delete the entries that have expired, and schedule again
+ * those whose lifetimes were extended.
+ *
+ * The timers go on over the iterations of the main loop,
+ * so the work done at each iteration is bounded.
+ */
+static unsigned int
+expire_flow_entries(struct gk_flow_table *table, unsigned int max_iter,
+	uint64_t now, const struct gk_config *gk_conf)
+{
+	unsigned int i;
+	unsigned int num_expired = 0;
+
+	if (table->hash_table == NULL)
+		return 0;
+
+	for (i = 0; i < max_iter; i++) {
+		const void *key;
+		void *key_data;
+		struct flow_entry *fe;
+		int ret;
+		int32_t index = gk_wheel_pop_due(table->wheel,
+			table->entry_table, now);
+		if (index < 0)
+			break;
+
+		fe = &table->entry_table[index];
+		if (!flow_entry_expired(fe, now, gk_conf)) {
+			gk_wheel_add(table->wheel, table->entry_table, index,
+				flow_entry_deadline(fe, gk_conf));
+			continue;
+		}
+
+		ret = rte_hash_get_key_with_position(table->hash_table,
+			index, &key_data);
+		if (ret < 0) {
+			RTE_LOG(ERR, HASH,
+				"The GK block failed to find the key of an expired flow entry!\n");
+			continue;
+		}
+		key = key_data;
+
+		del_flow_entry(table, key, fe);
+		num_expired++;
+	}
+
+	return num_expired;
+}
+
+/*
+ * Make room in a full flow table.
+ *
+ * DPDK's hash table doesn't expose the entries of a bucket, so instead
+ * of looking into the bucket of the new flow, this function samples
+ * the next GK_FLOW_EVICT_SAMPLE entries of the scan of @table.
+ * All expired entries in the sample are deleted; if none is found,
+ * the oldest entry in request state of the sample is deleted.
+ *
+ * Returns the number of deleted entries.
+ */
+static unsigned int
+evict_flow_entries(struct gk_flow_table *table, uint64_t now,
+	const struct gk_config *gk_conf)
+{
+	unsigned int i;
+	unsigned int num_evicted;
+	const void *oldest_key = NULL;
+	struct flow_entry *oldest_fe = NULL;
+
+	/* First, the entries whose timers are due. */
+	num_evicted = expire_flow_entries(table, GK_FLOW_EVICT_SAMPLE,
+		now, gk_conf);
+	if (num_evicted > 0)
+		return num_evicted;
+
+	for (i = 0; i < GK_FLOW_EVICT_SAMPLE; i++) {
+		const void *key;
+		void *data;
+		struct flow_entry *fe;
+		int32_t index = rte_hash_iterate(table->hash_table,
+			&key, &data, &table->scan_next);
+		if (index < 0) {
+			table->scan_next = 0;
+			break;
+		}
+
+		fe = &table->entry_table[index];
+		if (flow_entry_expired(fe, now, gk_conf)) {
+			del_flow_entry(table, key, fe);
+			num_evicted++;
+		} else if (fe->state == GK_REQUEST && (oldest_fe == NULL ||
+				fe->u.request.last_packet_seen_at <
+				oldest_fe->u.request.last_packet_seen_at)) {
+			oldest_key = key;
+			oldest_fe = fe;
+		}
+	}
+
+	if (num_evicted == 0 && oldest_fe != NULL) {
+		del_flow_entry(table, oldest_key, oldest_fe);
+		num_evicted++;
+	}
+
+	return num_evicted;
+}
+
+/*
+ * Add a new flow entry for @flow into @table, evicting entries
+ * if @table is full. @evicted is set to true if entries were evicted,
+ * what invalidates positions previously obtained from @table.
+ *
+ * Returns the position of the new entry, or a negative value on failure.
+ */
+static int32_t
+add_flow_entry(struct gk_flow_table *table, const struct ip_flow *flow,
+	uint32_t flow_hash_val, uint16_t grantor_id, uint64_t now,
+	const struct gk_config *gk_conf, bool *evicted)
+{
+	int32_t ret = rte_hash_add_key_with_hash(table->hash_table,
+		flow_key(flow), flow_hash_val);
+	if (unlikely(ret == -ENOSPC) &&
+			evict_flow_entries(table, now, gk_conf) > 0) {
+		*evicted = true;
+		ret = rte_hash_add_key_with_hash(table->hash_table,
+			flow_key(flow), flow_hash_val);
+	}
+
+	if (ret < 0) {
+		fast_log(LOG_GK_ADD_FLOW_FAILED, -ret, 0, 0, 0);
+		return ret;
+	}
+
+	initialize_flow_entry(&table->entry_table[ret], flow_hash_val,
+		grantor_id, now);
+	gk_wheel_add(table->wheel, table->entry_table, ret,
+		now + gk_conf->request_timeout_cycles);
+	return ret;
+}
+
+static int
+setup_gk_instance(unsigned int lcore_id, struct gk_config *gk_conf)
+{
+	int  ret;
+	unsigned int block_idx = get_block_idx(gk_conf, lcore_id);
+	struct gk_instance *instance = &gk_conf->instances[block_idx];
+	uint8_t configured_proto = gk_conf->net->front.configured_proto;
+	struct mailbox_params mb_params = {
+		.max_entries = gk_conf->mailbox_max_entries,
+		.mem_cache_size = gk_conf->mailbox_mem_cache_size,
+		.watermark = gk_conf->mailbox_watermark,
+	};
+
+	RTE_BUILD_BUG_ON(sizeof(struct flow_entry) != RTE_CACHE_LINE_SIZE);
+
+	init_priority_cycles(instance);
+
+	ret = capture_tap_init(&instance->tap, &gk_conf->capture, "gk",
+		lcore_id);
+	if (ret < 0)
 		goto out;
+
+	/*
+	 * Only create the flow tables of the protocols
+	 * configured on the front interface.
+	 */
+	if (configured_proto & GK_CONFIGURED_IPV4) {
+		ret = setup_flow_table(&instance->ip4_flows, "ip4",
+			block_idx, lcore_id, gk_conf->flow_ht_size,
+			sizeof(((struct ip_flow *)0)->f.v4),
+			rss_ip4_flow_hf, gk_conf->flow_persist_dir);
+		if (ret < 0)
+			goto out;
+	}
+
+	if (configured_proto & GK_CONFIGURED_IPV6) {
+		ret = setup_flow_table(&instance->ip6_flows, "ip6",
+			block_idx, lcore_id, gk_conf->flow_ht_size,
+			sizeof(((struct ip_flow *)0)->f.v6),
+			rss_ip6_flow_hf, gk_conf->flow_persist_dir);
+		if (ret < 0)
+			goto ip4_flows;
+	}
+
+	ret = init_mailbox("gk", &mb_params,
+		sizeof(struct gk_cmd_entry), lcore_id, &instance->mb);
+    	if (ret < 0)
+        	goto ip6_flows;
+
+	instance->sched = gk_sched_create(gk_conf, lcore_id);
+	if (instance->sched == NULL) {
+		ret = -1;
+		goto mailbox;
+	}
+
+	if (gk_conf->offload_max_rules > 0) {
+		instance->offload = gk_offload_create(gk_conf, block_idx,
+			lcore_id);
+		if (instance->offload == NULL) {
+			ret = -1;
+			goto sched;
+		}
 	}
-	/* Set a new hash compare function other than the default one. */
-	rte_hash_set_cmp_func(instance->ip_flow_hash_table, ip_flow_cmp_eq);
 
-	/* Setup the flow entry table for GK block @block_idx. */
-	instance->ip_flow_entry_table = (struct flow_entry *)rte_calloc(NULL,
-		gk_conf->flow_ht_size, sizeof(struct flow_entry), 0);
-	if (instance->ip_flow_entry_table == NULL) {
+	instance->tunnels = rte_zmalloc_socket("gk_tunnels",
+		GK_FIB_MAX_NEXTHOPS * sizeof(*instance->tunnels), 0,
+		rte_lcore_to_socket_id(lcore_id));
+	if (instance->tunnels == NULL) {
 		RTE_LOG(ERR, MALLOC,
-			"The GK block can't create flow entry table at lcore %u!\n",
+			"gk: failed to allocate the tunnels at lcore %u\n",
 			lcore_id);
+		ret = -1;
+		goto offload;
+	}
 
+	instance->nh_cache = lls_nh_cache_create(GK_FIB_MAX_NEXTHOPS,
+		lcore_id);
+	if (instance->nh_cache == NULL) {
 		ret = -1;
-		goto flow_hash;
+		goto tunnels;
 	}
 
-	ret = init_mailbox("gk", MAILBOX_MAX_ENTRIES,
-		sizeof(struct gk_cmd_entry), lcore_id, &instance->mb);
-    	if (ret < 0)
-        	goto flow_entry;
+	instance->stats = stats_alloc("gk", lcore_id,
+		sizeof(*instance->stats));
+	if (instance->stats == NULL) {
+		ret = -1;
+		goto nh_cache;
+	}
+
+	if (gk_conf->track_talkers) {
+		instance->talkers = gk_talkers_alloc(lcore_id);
+		if (instance->talkers == NULL) {
+			ret = -1;
+			goto stats;
+		}
+	}
 
 	ret = 0;
 	goto out;
 
-flow_entry:
-    	rte_free(instance->ip_flow_entry_table);
-    	instance->ip_flow_entry_table = NULL;
-flow_hash:
-	rte_hash_free(instance->ip_flow_hash_table);
-	instance->ip_flow_hash_table = NULL;
+stats:
+	stats_free("gk", lcore_id);
+	instance->stats = NULL;
+nh_cache:
+	lls_nh_cache_release(instance->nh_cache);
+	instance->nh_cache = NULL;
+tunnels:
+	rte_free(instance->tunnels);
+	instance->tunnels = NULL;
+offload:
+	gk_offload_destroy(instance->offload);
+	instance->offload = NULL;
+sched:
+	gk_sched_destroy(instance->sched);
+	instance->sched = NULL;
+mailbox:
+	destroy_mailbox(&instance->mb);
+ip6_flows:
+	destroy_flow_table(&instance->ip6_flows);
+ip4_flows:
+	destroy_flow_table(&instance->ip4_flows);
 out:
 	return ret;
 }
 
 static void
-add_ggu_policy(struct ggu_policy *policy, struct gk_instance *instance)
+add_ggu_policy(struct ggu_policy *policy, struct gk_instance *instance,
+	const struct gk_config *gk_conf)
 {
 	int ret;
+	bool evicted = false;
+	bool was_declined;
 	uint64_t now = rte_rdtsc();
 	struct flow_entry *fe;
-	uint32_t rss_hash_val = rss_ip_flow_hf(&policy->flow, 0, 0);
+	uint32_t rss_hash_val;
+	struct gk_flow_table *table =
+		get_flow_table(instance, policy->flow.proto);
+
+	if (table == NULL) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: policy for unsupported flow protocol %hu!\n",
+			policy->flow.proto);
+		return;
+	}
 
-	ret = rte_hash_lookup_with_hash(instance->ip_flow_hash_table,
-		&policy->flow, rss_hash_val);
+	rss_hash_val = rss_ip_flow_hf(&policy->flow, 0, 0);
+	ret = rte_hash_lookup_with_hash(table->hash_table,
+		flow_key(&policy->flow), rss_hash_val);
+	if (ret >= 0 && unlikely(!gk_fib_ref_is_current(instance->fib,
+			table->entry_table[ret].grantor_id))) {
+		/* The next hop of the flow is no longer in the FIB. */
+		del_flow_entry(table, flow_key(&policy->flow),
+			&table->entry_table[ret]);
+		ret = -ENOENT;
+	}
 	if (ret < 0) {
-		/* Create a new flow entry. */
-		ret = rte_hash_add_key_with_hash(
-			instance->ip_flow_hash_table,
- 			(void *)&policy->flow, rss_hash_val);
-		if (ret < 0) {
-			RTE_LOG(ERR, HASH,
-				"The GK block failed to add new key to hash table!\n");
+		/* Only flows sent to a Grantor server have entries. */
+		int nexthop_id = gk_fib_lookup(instance->fib, &policy->flow);
+		if (nexthop_id < 0 || instance->fib->nexthops[
+				nexthop_id].action != GK_FWD_GRANTOR) {
+			RTE_LOG(WARNING, GATEKEEPER,
+				"gk: policy for a flow whose destination is not protected by a Grantor server!\n");
 			return;
 		}
 
-		fe = &instance->ip_flow_entry_table[ret];
-		initialize_flow_entry(fe, &policy->flow);
-	} else
-		fe = &instance->ip_flow_entry_table[ret];
+		/* Create a new flow entry. */
+		ret = add_flow_entry(table, &policy->flow, rss_hash_val,
+			gk_fib_nexthop_ref(instance->fib, nexthop_id), now,
+			gk_conf, &evicted);
+		if (ret < 0)
+			return;
+	}
+	fe = &table->entry_table[ret];
+	was_declined = fe->state == GK_DECLINED;
 
 	switch(policy->state) {
 	case GK_GRANTED:
@@ -430,30 +858,117 @@ add_ggu_policy(struct ggu_policy *policy, struct gk_instance *instance)
 			now + cycle_from_second(1);
 		fe->u.granted.budget_byte =
 			fe->u.granted.tx_rate_kb_cycle * 1024;
-
-		/* TODO Fill up the grantor id field. */
 		break;
 
 	case GK_DECLINED:
 		fe->state = GK_DECLINED;
 		fe->u.declined.expire_at = now +
 			policy->params.u.declined.expire_sec * cycles_per_sec;
+		if (!was_declined)
+			fe->u.declined.num_drops = 0;
 		break;
 
 	default:
-		RTE_LOG(ERR, GATEKEEPER,
-			"gk: unknown flow state %u!\n", policy->state);
-		break;
+		fast_log(LOG_GK_UNKNOWN_STATE, policy->state, 0, 0, 0);
+		return;
 	}
+
+	/* The NIC may be dropping the packets of the flow. */
+	if (was_declined && instance->offload != NULL)
+		gk_offload_update(instance->offload, &policy->flow, fe);
+
+	/* The new lifetime of the entry may be shorter. */
+	gk_wheel_add(table->wheel, table->entry_table, ret,
+		flow_entry_deadline(fe, gk_conf));
 }
 
-static void
-process_gk_cmd(struct gk_cmd_entry *entry, struct gk_instance *instance)
+/* Cycles to whole units of @unit_cycles, rounded up. */
+static inline uint32_t
+cycles_to_units(uint64_t cycles, uint64_t unit_cycles)
 {
-	switch(entry->op) {
-	case GGU_POLICY_ADD:
-		add_ggu_policy(&entry->u.ggu, instance);
-		break;
+	return (cycles + unit_cycles - 1) / unit_cycles;
+}
+
+/*
+ * Fill the next chunk of a flow snapshot; see struct gk_flow_dump.
+ * The remaining lifetimes are rounded up, so restored entries
+ * do not expire before the original ones.
+ */
+static void
+dump_flows(struct gk_flow_dump *dump, struct gk_instance *instance,
+	const struct gk_config *gk_conf)
+{
+	unsigned int i;
+	uint64_t now = rte_rdtsc();
+	struct gk_flow_table *table = get_flow_table(instance, dump->proto);
+	size_t key_len = dump->proto == ETHER_TYPE_IPv4
+		? sizeof(((struct ip_flow *)0)->f.v4)
+		: sizeof(((struct ip_flow *)0)->f.v6);
+
+	dump->num_policies = 0;
+	dump->end = table == NULL;
+
+	for (i = 0; table != NULL && i < GK_FLOW_DUMP_SCAN; i++) {
+		const void *key;
+		void *data;
+		struct flow_entry *fe;
+		struct ggu_policy *policy;
+		int32_t index = rte_hash_iterate(table->hash_table,
+			&key, &data, &dump->iter);
+		if (index < 0) {
+			dump->end = true;
+			break;
+		}
+
+		fe = &table->entry_table[index];
+		if ((fe->state != GK_GRANTED && fe->state != GK_DECLINED) ||
+				flow_entry_expired(fe, now, gk_conf))
+			continue;
+
+		policy = &dump->policies[dump->num_policies++];
+		policy->state = fe->state;
+		policy->flow.proto = dump->proto;
+		rte_memcpy(&policy->flow.f, key, key_len);
+
+		if (fe->state == GK_GRANTED) {
+			policy->params.u.granted.tx_rate_kb_sec =
+				fe->u.granted.tx_rate_kb_cycle;
+			policy->params.u.granted.cap_expire_sec =
+				cycles_to_units(fe->u.granted.cap_expire_at -
+					now, cycles_per_sec);
+			policy->params.u.granted.next_renewal_ms =
+				fe->u.granted.send_next_renewal_at > now
+				? cycles_to_units(
+					fe->u.granted.send_next_renewal_at -
+					now, cycles_per_ms)
+				: 0;
+			policy->params.u.granted.renewal_step_ms =
+				fe->u.granted.renewal_step_cycle /
+				cycles_per_ms;
+		} else {
+			policy->params.u.declined.expire_sec =
+				cycles_to_units(fe->u.declined.expire_at -
+					now, cycles_per_sec);
+		}
+	}
+
+	/* Pairs with the barrier in gk_export_flows(). */
+	rte_smp_wmb();
+	dump->done = 1;
+}
+
+static void
+process_gk_cmd(struct gk_cmd_entry *entry, struct gk_instance *instance,
+	const struct gk_config *gk_conf)
+{
+	switch(entry->op) {
+	case GGU_POLICY_ADD:
+		add_ggu_policy(&entry->u.ggu, instance, gk_conf);
+		break;
+
+	case GK_FLOW_DUMP:
+		dump_flows(entry->u.dump, instance, gk_conf);
+		break;
 
 	default:
 		RTE_LOG(ERR, GATEKEEPER,
@@ -466,19 +981,494 @@ static int
 gk_setup_rss(struct gk_config *gk_conf)
 {
 	int i, ret = 0;
-	uint8_t port_in = gk_conf->net->front.id;
 	uint16_t gk_queues[gk_conf->num_lcores];
 
 	for (i = 0; i < gk_conf->num_lcores; i++)
 		gk_queues[i] = gk_conf->instances[i].rx_queue_front;
 
-	ret = gatekeeper_setup_rss(port_in, gk_queues, gk_conf->num_lcores);
+	ret = gatekeeper_setup_rss(&gk_conf->net->front, gk_queues,
+		gk_conf->num_lcores);
 	if (ret < 0)
 		return ret;
 
-	ret = gatekeeper_get_rss_config(port_in, &gk_conf->rss_conf);
+	return gk_update_rss_dispatch(gk_conf);
+}
 
-	return ret;
+/* The FIB was not looked up for the packet, since it has a flow entry. */
+#define GK_FIB_NOT_LOOKED_UP (INT_MIN)
+
+/*
+ * Look up the FIB in bulk for the @num_pkts packets of @packets
+ * whose flows were not found (i.e. @positions[i] < 0), and store
+ * the IDs of their next hops, or -ENOENT, in @nexthop_ids.
+ */
+static void
+lookup_fib_bulk(struct gk_fib *fib, struct ipacket *packets,
+	const int32_t *positions, uint16_t num_pkts, int *nexthop_ids)
+{
+	int i;
+	unsigned int num_ip4 = 0;
+	unsigned int num_ip6 = 0;
+	uint16_t ip4_idx[GATEKEEPER_MAX_PKT_BURST];
+	uint16_t ip6_idx[GATEKEEPER_MAX_PKT_BURST];
+	uint32_t ip4_dsts[GATEKEEPER_MAX_PKT_BURST];
+	uint32_t ip4_nexthops[GATEKEEPER_MAX_PKT_BURST];
+	uint8_t ip6_dsts[GATEKEEPER_MAX_PKT_BURST][16];
+	int16_t ip6_nexthops[GATEKEEPER_MAX_PKT_BURST];
+
+	for (i = 0; i < num_pkts; i++) {
+		struct ip_flow *flow = &packets[i].flow;
+
+		nexthop_ids[i] = GK_FIB_NOT_LOOKED_UP;
+		if (positions[i] >= 0)
+			continue;
+
+		if (flow->proto == ETHER_TYPE_IPv4) {
+			ip4_idx[num_ip4] = i;
+			ip4_dsts[num_ip4++] = rte_be_to_cpu_32(flow->f.v4.dst);
+		} else {
+			ip6_idx[num_ip6] = i;
+			rte_memcpy(ip6_dsts[num_ip6++], flow->f.v6.dst,
+				sizeof(ip6_dsts[0]));
+		}
+	}
+
+	if (num_ip4 > 0) {
+		rte_lpm_lookup_bulk(fib->ip4, ip4_dsts, ip4_nexthops,
+			num_ip4);
+		for (i = 0; i < (int)num_ip4; i++) {
+			nexthop_ids[ip4_idx[i]] =
+				(ip4_nexthops[i] & RTE_LPM_LOOKUP_SUCCESS)
+				? (int)(ip4_nexthops[i] & 0x00FFFFFF)
+				: -ENOENT;
+		}
+	}
+
+	if (num_ip6 > 0) {
+		rte_lpm6_lookup_bulk_func(fib->ip6, ip6_dsts, ip6_nexthops,
+			num_ip6);
+		for (i = 0; i < (int)num_ip6; i++) {
+			nexthop_ids[ip6_idx[i]] = ip6_nexthops[i] >= 0
+				? ip6_nexthops[i] : -ENOENT;
+		}
+	}
+}
+
+/*
+ * Forward a packet whose destination is not protected to the gateway
+ * of the next hop @nexthop_id on the back interface.
+ */
+static void
+forward_to_back(struct rte_mbuf *pkt, int nexthop_id,
+	struct gk_instance *instance)
+{
+	struct gk_tunnel *tunnel = &instance->tunnels[nexthop_id];
+	struct ether_hdr *eth_hdr;
+
+	if (unlikely(!tunnel_is_resolved(tunnel))) {
+		drop_packet(pkt);
+		return;
+	}
+
+	/* The MAC addresses are the first bytes of the tunnel template. */
+	eth_hdr = rte_pktmbuf_mtod(pkt, struct ether_hdr *);
+	rte_memcpy(eth_hdr, tunnel->info.hdrs, 2 * ETHER_ADDR_LEN);
+	gk_sched_enqueue_granted(instance->sched, pkt);
+}
+
+/*
+ * Process a burst of packets received from the front interface.
+ *
+ * The burst goes through the following stages, so that the memory
+ * accesses of a packet overlap with the work done on the other packets
+ * of the same burst, instead of stalling the GK block on every packet:
+ *
+ * (1) prefetch the headers of all packets, and then parse them;
+ * (2) look up the flow table for all packets, and prefetch
+ *     the flow entries that were found; then look up the FIB in bulk
+ *     for the packets whose flows were not found;
+ * (3) run the flow state machine on each packet;
+ * (4) encapsulate the packets that go to the Grantor servers.
+ *
+ * The lookups use the RSS hash that the NIC has already computed, so
+ * they are done with rte_hash_lookup_with_hash() one key at a time;
+ * the bulk lookup of DPDK would recompute the hashes in software.
+ *
+ * The packets to be forwarded go to the egress scheduler of @instance.
+ */
+static void
+gk_process_pkts(struct gk_config *gk_conf, struct gk_instance *instance,
+	struct rte_mbuf **rx_bufs, uint16_t num_rx, uint64_t now)
+{
+	int i;
+	int ret;
+	uint16_t num_ip = 0;
+	unsigned int num_added = 0;
+	unsigned int num_nd = 0;
+	unsigned int num_submitted;
+	unsigned int num_encap;
+	bool evicted = false;
+	struct rte_mbuf *nd_bufs[GATEKEEPER_MAX_PKT_BURST];
+	struct ipacket packets[GATEKEEPER_MAX_PKT_BURST];
+	struct gk_flow_table *tables[GATEKEEPER_MAX_PKT_BURST];
+	int32_t positions[GATEKEEPER_MAX_PKT_BURST];
+	int nexthop_ids[GATEKEEPER_MAX_PKT_BURST];
+	const struct ip_flow *new_flows[GATEKEEPER_MAX_PKT_BURST];
+	struct gk_encap_burst encap;
+
+	encap.num_pkts = 0;
+
+	/* Stage 1: prefetch and parse the packets. */
+	for (i = 0; i < num_rx; i++)
+		rte_prefetch0(rte_pktmbuf_mtod(rx_bufs[i], void *));
+
+	for (i = 0; i < num_rx; i++) {
+		struct rte_mbuf *pkt = rx_bufs[i];
+		struct ipacket *packet = &packets[num_ip];
+
+		ret = extract_packet_info(pkt, packet);
+		if (ret < 0) {
+			/* Drop non-IP packets. */
+			drop_packet(pkt);
+			continue;
+		} else if (!gk_conf->net->front.hw_nd_filter &&
+				pkt_is_nd(packet, &gk_conf->net->front)) {
+			nd_bufs[num_nd++] = pkt;
+			continue;
+		}
+
+		tables[num_ip] = get_flow_table(instance, packet->flow.proto);
+		if (unlikely(tables[num_ip] == NULL)) {
+			drop_packet(pkt);
+			continue;
+		}
+
+		num_ip++;
+	}
+
+	if (instance->talkers != NULL)
+		gk_talkers_add_pkts(instance->talkers, packets, num_ip);
+
+	/* Hand the ND packets over to the LLS block. */
+	if (unlikely(num_nd > 0)) {
+		num_submitted = submit_nd(nd_bufs, num_nd,
+			&gk_conf->net->front);
+		for (i = num_submitted; i < (int)num_nd; i++)
+			drop_packet(nd_bufs[i]);
+	}
+
+	/* Stage 2: look up the flow entries of the packets. */
+	for (i = 0; i < num_ip; i++) {
+		positions[i] = rte_hash_lookup_with_hash(tables[i]->hash_table,
+			flow_key(&packets[i].flow), packets[i].pkt->hash.rss);
+		if (positions[i] >= 0)
+			rte_prefetch0(&tables[i]->entry_table[positions[i]]);
+	}
+
+	/* Still stage 2: look up the FIB for the flows without entries. */
+	lookup_fib_bulk(instance->fib, packets, positions,
+		num_ip, nexthop_ids);
+
+	/* Stage 3: run the state machine of the flows. */
+	for (i = 0; i < num_ip; i++) {
+		struct ipacket *packet = &packets[i];
+		struct gk_flow_table *table = tables[i];
+		struct rte_mbuf *pkt = packet->pkt;
+		/*
+		 * Pointer to the flow entry in request state
+		 * under evaluation.
+		 */
+		struct flow_entry *fe;
+
+		ret = positions[i];
+		if (unlikely(evicted) || (ret < 0 && num_added > 0)) {
+			/*
+			 * A previous packet of this burst may have
+			 * already created the flow entry, or evicted
+			 * the entry found by the lookup.
+			 */
+			ret = rte_hash_lookup_with_hash(table->hash_table,
+				flow_key(&packet->flow), pkt->hash.rss);
+		}
+
+		if (ret >= 0 && unlikely(!gk_fib_ref_is_current(
+				instance->fib,
+				table->entry_table[ret].grantor_id))) {
+			/*
+			 * The next hop of the flow was removed from
+			 * the FIB, so the FIB decides again as it does
+			 * for new flows. The positions found for the
+			 * next packets are looked up again.
+			 */
+			del_flow_entry(table, flow_key(&packet->flow),
+				&table->entry_table[ret]);
+			evicted = true;
+			ret = -ENOENT;
+		}
+
+		if (ret < 0) {
+			/*
+			 * 1.2 Otherwise, the FIB entry of the
+			 * destination address decides.
+			 */
+			struct gk_fib_nexthop *nexthop;
+			int nexthop_id = nexthop_ids[i];
+
+			if (unlikely(nexthop_id == GK_FIB_NOT_LOOKED_UP))
+				nexthop_id = gk_fib_lookup(instance->fib,
+					&packet->flow);
+			if (nexthop_id < 0) {
+				/* 1.2.3 There is no route, drop the packet. */
+				instance->stats->pkts_no_route++;
+				drop_packet(pkt);
+				continue;
+			}
+
+			nexthop = &instance->fib->nexthops[nexthop_id];
+			if (nexthop->action == GK_FWD_BACK) {
+				/*
+				 * 1.2.2 Forward the packet to
+				 * the back interface.
+				 */
+				instance->stats->pkts_fwd_back++;
+				forward_to_back(pkt, nexthop_id, instance);
+				continue;
+			} else if (nexthop->action != GK_FWD_GRANTOR) {
+				instance->stats->pkts_no_route++;
+				drop_packet(pkt);
+				continue;
+			}
+
+			/*
+			 * 1.2.1 The destination is protected, so enforce
+			 * the policies over its packets through
+			 * a new flow entry.
+			 */
+			ret = add_flow_entry(table, &packet->flow,
+				pkt->hash.rss,
+				gk_fib_nexthop_ref(instance->fib, nexthop_id),
+				now, gk_conf, &evicted);
+			if (ret < 0) {
+				instance->stats->flows_table_full++;
+				rte_pktmbuf_free(pkt);
+				continue;
+			}
+
+			instance->stats->flows_added++;
+			new_flows[num_added++] = &packet->flow;
+		}
+		fe = &table->entry_table[ret];
+		capture_pkt(&instance->tap, pkt, fe->state);
+
+		/*
+		 * 1.1 If the pair of source and destination addresses
+		 * is in the flow table, proceed as the entry instructs,
+		 * and go to the next packet.
+		 */
+		switch(fe->state) {
+		case GK_REQUEST: {
+			STATS_CYCLES_BEGIN(start);
+			ret = gk_process_request(fe, packet, now, instance,
+				&encap);
+			STATS_CYCLES_END(&instance->stats->process_request,
+				start, 1);
+			instance->stats->pkts_request++;
+			break;
+		}
+
+		case GK_GRANTED: {
+			STATS_CYCLES_BEGIN(start);
+			ret = gk_process_granted(fe, packet, now, instance,
+				&encap);
+			STATS_CYCLES_END(&instance->stats->process_granted,
+				start, 1);
+			instance->stats->pkts_granted++;
+			break;
+		}
+
+		case GK_DECLINED: {
+			STATS_CYCLES_BEGIN(start);
+			ret = gk_process_declined(fe, packet, now, instance,
+				&encap);
+			STATS_CYCLES_END(&instance->stats->process_declined,
+				start, 1);
+			instance->stats->pkts_declined++;
+			break;
+		}
+
+		default:
+			ret = -1;
+			fast_log(LOG_GK_UNKNOWN_STATE, fe->state, 0, 0, 0);
+			break;
+		}
+
+		if (ret < 0)
+			rte_pktmbuf_free(pkt);
+	}
+
+	if (instance->talkers != NULL)
+		gk_talkers_add_flows(instance->talkers, new_flows, num_added);
+
+	/* Stage 4: encapsulate the packets, and schedule them. */
+	num_encap = encapsulate_bulk(encap.pkts, encap.priorities,
+		encap.tunnels, encap.num_pkts);
+	instance->stats->encap_failed += encap.num_pkts - num_encap;
+	encap.num_pkts = num_encap;
+	for (i = 0; i < encap.num_pkts; i++) {
+		if (encap.priorities[i] >= PRIORITY_REQ_MIN)
+			gk_sched_enqueue_request(instance->sched,
+				encap.pkts[i], encap.priorities[i]);
+		else
+			gk_sched_enqueue_granted(instance->sched,
+				encap.pkts[i]);
+	}
+}
+
+/*
+ * Update the tunnel @nexthop_id of @instance with the Ethernet address
+ * of its next hop. Stale addresses are still used while the LLS block
+ * tries to resolve them again.
+ */
+static void
+refresh_tunnel(struct gk_instance *instance, unsigned int nexthop_id)
+{
+	struct gk_tunnel *tunnel = &instance->tunnels[nexthop_id];
+
+	tunnel->nh_state = lls_nh_cache_get(instance->nh_cache, nexthop_id,
+		&tunnel->info.nexthop_mac);
+	ipip_tunnel_refresh(&tunnel->info);
+}
+
+static inline bool
+nexthop_has_gateway(const struct gk_fib_nexthop *nexthop)
+{
+	return nexthop->action == GK_FWD_GRANTOR ||
+		nexthop->action == GK_FWD_BACK;
+}
+
+/*
+ * Take the tunnels of @instance from its new FIB.
+ *
+ * The IDs of the next hops that were freed, or taken by new next hops,
+ * have new generations. Their holds are all released before the new
+ * holds are placed, since the LLS block keeps a single hold for each
+ * address and lcore, and a gateway may have moved to another ID.
+ */
+static void
+load_fib_tunnels(struct gk_instance *instance, unsigned int lcore_id)
+{
+	unsigned int i;
+	struct gk_fib *fib = instance->fib;
+
+	for (i = 0; i < instance->num_tunnels; i++) {
+		if (fib->nexthops[i].gen != instance->tunnels[i].gen ||
+				!nexthop_has_gateway(&fib->nexthops[i]))
+			lls_nh_cache_put(instance->nh_cache, i);
+	}
+
+	for (i = 0; i < fib->num_nexthops; i++) {
+		const struct gk_fib_nexthop *nexthop = &fib->nexthops[i];
+		const struct ip_flow *gw = &nexthop->tunnel.flow;
+
+		/* Holds that failed before are placed again. */
+		if (nexthop_has_gateway(nexthop) &&
+				instance->nh_cache->entries[i].proto == 0 &&
+				lls_nh_cache_hold(instance->nh_cache, i,
+				gw->proto, gw->proto == ETHER_TYPE_IPv4
+				? (const void *)&gw->f.v4.dst
+				: (const void *)gw->f.v6.dst) < 0)
+			RTE_LOG(ERR, GATEKEEPER,
+				"gk: cannot resolve next hop %u at lcore %u\n",
+				i, lcore_id);
+
+		rte_memcpy(&instance->tunnels[i].info, &nexthop->tunnel,
+			sizeof(instance->tunnels[i].info));
+		instance->tunnels[i].gen = nexthop->gen;
+		refresh_tunnel(instance, i);
+	}
+	instance->num_tunnels = fib->num_nexthops;
+}
+
+/*
+ * Quiescent point of a GK block: the FIB of the previous iteration
+ * is no longer in use, so the latest published FIB can be loaded.
+ * The Ethernet addresses of the next hops that the LLS block
+ * has updated are also applied to the tunnels here.
+ *
+ * Only version checks are needed while nothing changes,
+ * so there is no locking on the fast path.
+ */
+static inline void
+gk_quiescent_point(struct gk_instance *instance,
+	const struct gk_config *gk_conf, unsigned int lcore_id,
+	unsigned int socket_id)
+{
+	unsigned int i;
+	uint32_t nh_version;
+	uint64_t version = gk_conf->fib_version;
+
+	if (unlikely(version != instance->fib_version)) {
+		instance->fib_version = version;
+		/* Pairs with the barrier in gk_fib_update_commit(). */
+		rte_smp_mb();
+		instance->fib = gk_conf->fibs[socket_id];
+		instance->nh_cache_version = instance->nh_cache->version;
+		rte_rmb();
+		load_fib_tunnels(instance, lcore_id);
+		return;
+	}
+
+	nh_version = instance->nh_cache->version;
+	if (likely(nh_version == instance->nh_cache_version))
+		return;
+
+	instance->nh_cache_version = nh_version;
+	/* Pairs with the barrier of the callback of the LLS block. */
+	rte_rmb();
+	for (i = 0; i < instance->num_tunnels; i++) {
+		if (instance->tunnels[i].nh_state !=
+				instance->nh_cache->entries[i].state)
+			refresh_tunnel(instance, i);
+	}
+}
+
+/*
+ * Process the commands of the mailbox of @instance on the budget
+ * described in struct gk_config, and return how many were processed.
+ */
+static unsigned int
+process_gk_cmds(struct gk_instance *instance, struct gk_config *gk_conf,
+	bool idle)
+{
+	uint64_t start = rte_rdtsc();
+	uint64_t budget = idle || mb_congested(&instance->mb)
+		? gk_conf->cmd_drain_budget_cycles
+		: gk_conf->cmd_budget_cycles;
+	unsigned int total = 0;
+
+	while (true) {
+		struct gk_cmd_entry *gk_cmds[GK_CMD_BURST_SIZE];
+		int num_cmd = mb_dequeue_burst(&instance->mb,
+			(void **)gk_cmds, GK_CMD_BURST_SIZE);
+		int i;
+
+		for (i = 0; i < num_cmd; i++) {
+			process_gk_cmd(gk_cmds[i], instance, gk_conf);
+			mb_free_entry(&instance->mb, gk_cmds[i]);
+		}
+		total += num_cmd;
+
+		if (num_cmd < GK_CMD_BURST_SIZE)
+			break;
+
+		if (rte_rdtsc() - start >= budget) {
+			instance->stats->cmds_out_of_budget++;
+			break;
+		}
+	}
+
+	instance->stats->cmds_processed += total;
+	return total;
 }
 
 static int
@@ -486,7 +1476,6 @@ gk_proc(void *arg)
 {
 	/* TODO Implement the basic algorithm of a GK block. */
 
-	int ret;
 	unsigned int lcore = rte_lcore_id();
 	struct gk_config *gk_conf = (struct gk_config *)arg;
 	unsigned int block_idx = get_block_idx(gk_conf, lcore);
@@ -496,145 +1485,99 @@ gk_proc(void *arg)
 	uint8_t port_out = get_net_conf()->back.id;
 	uint16_t rx_queue = instance->rx_queue_front;
 	uint16_t tx_queue = instance->tx_queue_back;
+	unsigned int socket_id = rte_lcore_to_socket_id(lcore);
+	struct poll_state poll;
 
 	RTE_LOG(NOTICE, GATEKEEPER,
 		"gk: the GK block is running at lcore = %u\n", lcore);
 
 	gk_conf_hold(gk_conf);
+	tx_buf_init(&instance->tx_buf, port_out, tx_queue);
+	poll_init(&poll, &gk_conf->poll, port_in, rx_queue);
+	poll_enable_rx_intr(&poll, &gk_conf->poll, &instance->mb, "gk");
+
+	clear_flow_table(&instance->ip4_flows);
+	clear_flow_table(&instance->ip6_flows);
+
+	/* The flows of a persistent table are checked against the FIB. */
+	gk_quiescent_point(instance, gk_conf, lcore, socket_id);
+	gk_flow_file_restore(&instance->ip4_flows, ETHER_TYPE_IPv4,
+		block_idx, instance, gk_conf);
+	gk_flow_file_restore(&instance->ip6_flows, ETHER_TYPE_IPv6,
+		block_idx, instance, gk_conf);
 
 	while (likely(!exiting)) {
 		/* Get burst of RX packets, from first port of pair. */
-		int i;
-		int num_cmd;
+		unsigned int num_cmd;
 		uint16_t num_rx;
-		uint16_t num_tx = 0;
-		uint16_t num_tx_succ;
+		uint16_t num_tx;
+		uint64_t now;
 		struct rte_mbuf *rx_bufs[GATEKEEPER_MAX_PKT_BURST];
 		struct rte_mbuf *tx_bufs[GATEKEEPER_MAX_PKT_BURST];
-		struct gk_cmd_entry *gk_cmds[GK_CMD_BURST_SIZE];
-
-		/* Load a set of packets from the front NIC. */
-		num_rx = rte_eth_rx_burst(port_in, rx_queue, rx_bufs,
-			GATEKEEPER_MAX_PKT_BURST);
-
-		if (unlikely(num_rx == 0))
-			continue;
-
-		for (i = 0; i < num_rx; i++) {
-			struct ipacket packet;
-			/*
-			 * Pointer to the flow entry in request state 
-			 * under evaluation.
-			 */
-			struct flow_entry *fe;
-			struct rte_mbuf *pkt = rx_bufs[i];
-
-			ret = extract_packet_info(pkt, &packet);
-			if (ret < 0) {
-				/* Drop non-IP packets. */
-				drop_packet(pkt);
-				continue;
-			} else if (pkt_is_nd(&packet, &gk_conf->net->front)) {
-				/*
-				 * TODO Use DPDK packet classification
-				 * and distribution here instead.
-				 */
-				if (submit_nd(pkt, &gk_conf->net->front) == -1)
-					drop_packet(pkt);
-				continue;
-			}
 
-			/* 
-			 * Find the flow entry for the IP pair.
-			 * Create a new flow entry if not found.
-			 */
-			ret = rte_hash_lookup_with_hash(
-				instance->ip_flow_hash_table,
-				&packet.flow, pkt->hash.rss);
-			if (ret < 0) {
-				/* Create a new flow entry. */
-				ret = rte_hash_add_key_with_hash(
-					instance->ip_flow_hash_table,
- 					(void *)&packet.flow, pkt->hash.rss);
-				if (ret < 0) {
-					RTE_LOG(ERR, HASH,
-						"The GK block failed to add new key to hash table!\n");
-					rte_pktmbuf_free(pkt);
-					continue;
-				}
-
-				fe = &instance->ip_flow_entry_table[ret];
-				initialize_flow_entry(fe, &packet.flow);
-			} else
-				fe = &instance->ip_flow_entry_table[ret];
-
-			/*
-			 * 1.1 If the pair of source and destination addresses 
-			 * is in the flow table, proceed as the entry instructs,
-			 * and go to the next packet.
-			 */
-			switch(fe->state) {
-			case GK_REQUEST:
-				ret = gk_process_request(fe, &packet);
-				break;
+		gk_quiescent_point(instance, gk_conf, lcore, socket_id);
 
-			case GK_GRANTED:
-				ret = gk_process_granted(fe, &packet);
-				break;
+		/* Load a set of packets from the front NIC. */
+		num_rx = poll_rx(&poll, &gk_conf->poll, rx_bufs);
 
-			case GK_DECLINED:
-				ret = gk_process_declined(fe, &packet);
-				break;
+		/* All the packets of a burst are processed at once. */
+		now = rte_rdtsc();
+		if (num_rx > 0)
+			gk_process_pkts(gk_conf, instance, rx_bufs, num_rx,
+				now);
 
-			default:
-				ret = -1;
-				/* XXX Incorrect state, log warning. */
-				RTE_LOG(ERR, GATEKEEPER,
-					"gk: unknown flow state!\n");
-				break;
-			}
+		/*
+		 * Requests may be waiting in the egress scheduler,
+		 * so it is served even when no packet arrives.
+		 */
+		num_tx = gk_sched_dequeue(instance->sched, tx_bufs,
+			GATEKEEPER_MAX_PKT_BURST, now);
 
-			if (ret < 0)
-				rte_pktmbuf_free(pkt);
-			else
-				tx_bufs[num_tx++] = pkt;
+		/* Send the TX packets to the second port of the pair. */
+		tx_buf_add_bulk(&instance->tx_buf, tx_bufs, num_tx, now);
+		tx_buf_drain(&instance->tx_buf, now);
+		instance->stats->req_dropped = instance->sched->req_dropped;
+		instance->stats->tx_dropped = instance->tx_buf.num_dropped;
 
-			/*
-			 * TODO 1.2 Otherwise, look up the destination address
-			 * in the global LPM table.
-			 *
-			 * 1.2.1 If there is an entry for the destination and 
-			 * the entry instructs to enforce policies over its packets,
- 			 * initialize an entry in the flow table, proceed as the 
-			 * brand-new entry instructs, and go to the next packet.
-			 *
-			 * 1.2.2 If there is an entry for the destination and
-			 * the entry instructs to forward its packets to the
-			 * back interface, forward accordingly.
-			 *
-			 * 1.2.3 Otherwise, drop the packet.
-			 */
+		/*
+		 * Commands are served even without traffic, so
+		 * flow snapshots and imports go on at idle blocks.
+		 */
+		num_cmd = process_gk_cmds(instance, gk_conf, num_rx == 0);
+
+		/* Reclaim the expired flow entries, even when idle. */
+		expire_flow_entries(&instance->ip4_flows,
+			gk_conf->flow_table_scan_iter, now, gk_conf);
+		expire_flow_entries(&instance->ip6_flows,
+			gk_conf->flow_table_scan_iter, now, gk_conf);
+		if (instance->offload != NULL) {
+			gk_offload_expire(instance->offload, now);
+			instance->stats->flows_offloaded =
+				instance->offload->num_installed;
+			instance->stats->flows_in_nic =
+				instance->offload->num_rules;
 		}
 
-		/* Send burst of TX packets, to second port of pair. */
-		num_tx_succ = rte_eth_tx_burst(port_out, tx_queue,
-			tx_bufs, num_tx);
+		/*
+		 * Back off once the mailbox has been serviced,
+		 * unless packets are waiting to be sent.
+		 */
+		poll_idle(&poll, &gk_conf->poll, num_rx > 0 || num_cmd > 0 ||
+			instance->sched->req_len > 0 ||
+			instance->tx_buf.num_pkts > 0);
+	}
 
-		/* XXX Do something better here! For now, free any unsent packets. */
-		if (unlikely(num_tx_succ < num_tx)) {
-			for (i = num_tx_succ; i < num_tx; i++)
-				rte_pktmbuf_free(tx_bufs[i]);
-		}
+	poll_release(&poll);
+	tx_buf_flush(&instance->tx_buf);
+	tx_buf_free(&instance->tx_buf);
 
-		/* Load a set of commands from its mailbox ring. */
-        	num_cmd = mb_dequeue_burst(&instance->mb,
-                	(void **)gk_cmds, GK_CMD_BURST_SIZE);
+	gk_flow_file_save(&instance->ip4_flows);
+	gk_flow_file_save(&instance->ip6_flows);
 
-        	for (i = 0; i < num_cmd; i++) {
-			process_gk_cmd(gk_cmds[i], instance);
-			mb_free_entry(&instance->mb, gk_cmds[i]);
-        	}
-	}
+	/* Do not hold back the updates of the FIB. */
+	instance->fib = NULL;
+	rte_smp_mb();
+	instance->fib_version = GK_FIB_QUIESCENT;
 
 	RTE_LOG(NOTICE, GATEKEEPER,
 		"gk: the GK block at lcore = %u is exiting\n", lcore);
@@ -648,23 +1591,50 @@ alloc_gk_conf(void)
 	return rte_calloc("gk_config", 1, sizeof(struct gk_config), 0);
 }
 
+/*
+ * Keep the flow entries of the GK blocks in files under @dir,
+ * preferably a hugetlbfs mount, so they survive restarts.
+ */
+int
+gk_set_flow_persist_dir(struct gk_config *gk_conf, const char *dir)
+{
+	size_t len = strlen(dir) + 1;
+	char *copy = rte_malloc("gk_flow_persist_dir", len, 0);
+
+	if (copy == NULL) {
+		RTE_LOG(ERR, MALLOC,
+			"gk: cannot allocate the flow persistence directory\n");
+		return -1;
+	}
+	memcpy(copy, dir, len);
+
+	rte_free(gk_conf->flow_persist_dir);
+	gk_conf->flow_persist_dir = copy;
+	return 0;
+}
+
 static int
 cleanup_gk(struct gk_config *gk_conf)
 {
 	int i;
 
 	for (i = 0; i < gk_conf->num_lcores; i++) {
-		if (gk_conf->instances[i].ip_flow_hash_table)
-			rte_hash_free(gk_conf->instances[i].
-				ip_flow_hash_table);
-
-		if (gk_conf->instances[i].ip_flow_entry_table)
-			rte_free(gk_conf->instances[i].
-				ip_flow_entry_table);
+		destroy_flow_table(&gk_conf->instances[i].ip4_flows);
+		destroy_flow_table(&gk_conf->instances[i].ip6_flows);
 
                 destroy_mailbox(&gk_conf->instances[i].mb);
+		gk_sched_destroy(gk_conf->instances[i].sched);
+		gk_offload_destroy(gk_conf->instances[i].offload);
+		lls_nh_cache_release(gk_conf->instances[i].nh_cache);
+		rte_free(gk_conf->instances[i].tunnels);
+		if (gk_conf->instances[i].stats != NULL)
+			stats_free("gk", gk_conf->lcores[i]);
+		if (gk_conf->instances[i].talkers != NULL)
+			gk_talkers_free(gk_conf->lcores[i]);
 	}
 
+	destroy_gk_fibs(gk_conf);
+	rte_free(gk_conf->flow_persist_dir);
 	rte_free(gk_conf->instances);
 	rte_free(gk_conf->lcores);
 	rte_free(gk_conf);
@@ -689,13 +1659,38 @@ static int
 gk_stage1(void *arg)
 {
 	struct gk_config *gk_conf = arg;
+	struct gk_instance *instances;
 	int i;
 
-	gk_conf->instances = rte_calloc(__func__, gk_conf->num_lcores,
-		sizeof(struct gk_instance), 0);
-	if (gk_conf->instances == NULL)
+	instances = rte_calloc_socket(__func__, gk_conf->num_lcores,
+		sizeof(struct gk_instance), 0,
+		get_lcores_socket_id(gk_conf->lcores, gk_conf->num_lcores));
+	if (instances == NULL)
 		return -1;
 
+	/* The GK blocks hold no FIB until they start. */
+	for (i = 0; i < gk_conf->num_lcores; i++)
+		instances[i].fib_version = GK_FIB_QUIESCENT;
+	rte_wmb();
+	gk_conf->instances = instances;
+
+	if (gk_conf->offload_max_rules > 0) {
+		/* The queue is allocated even without filters to use it. */
+		if (get_drop_queue_id(&gk_conf->net->front,
+				gk_conf->lcores[0]) < 0) {
+			RTE_LOG(ERR, GATEKEEPER,
+				"gk: cannot assign the drop queue of the front interface\n");
+			return -1;
+		}
+
+		if (rte_eth_dev_filter_supported(gk_conf->net->front.id,
+				RTE_ETH_FILTER_NTUPLE) < 0) {
+			RTE_LOG(WARNING, GATEKEEPER,
+				"gk: the front interface has no ntuple filters, so declined flows are only dropped in software\n");
+			gk_conf->offload_max_rules = 0;
+		}
+	}
+
 	for (i = 0; i < gk_conf->num_lcores; i++) {
 		unsigned int lcore = gk_conf->lcores[i];
 		struct gk_instance *inst_ptr = &gk_conf->instances[i];
@@ -703,7 +1698,8 @@ gk_stage1(void *arg)
 
 		/* Set up queue identifiers for RSS. */
 
-		ret = get_queue_id(&gk_conf->net->front, QUEUE_TYPE_RX, lcore);
+		ret = get_queue_id(&gk_conf->net->front, QUEUE_TYPE_RX, lcore,
+			gk_conf->poll.num_rx_desc);
 		if (ret < 0) {
 			RTE_LOG(ERR, GATEKEEPER, "gk: cannot assign an RX queue for the front interface for lcore %u\n",
 				lcore);
@@ -711,7 +1707,8 @@ gk_stage1(void *arg)
 		}
 		inst_ptr->rx_queue_front = ret;
 
-		ret = get_queue_id(&gk_conf->net->back, QUEUE_TYPE_TX, lcore);
+		ret = get_queue_id(&gk_conf->net->back, QUEUE_TYPE_TX, lcore,
+			gk_conf->poll.num_tx_desc);
 		if (ret < 0) {
 			RTE_LOG(ERR, GATEKEEPER, "gk: cannot assign a TX queue for the back interface for lcore %u\n",
 				lcore);
@@ -737,13 +1734,32 @@ static int
 gk_stage2(void *arg)
 {
 	struct gk_config *gk_conf = arg;
+
+	/* The back interface has started, so its MAC address is known. */
+	gk_fib_set_source_mac(gk_conf);
+
 	return gk_setup_rss(gk_conf);
 }
 
+/* Set @net_conf and the parameters in cycles of @gk_conf. */
+static void
+set_gk_net_conf(struct net_config *net_conf, struct gk_config *gk_conf)
+{
+	gk_conf->net = net_conf;
+	gk_conf->request_timeout_cycles =
+		cycle_from_second(gk_conf->request_timeout_sec);
+	gk_conf->cmd_budget_cycles =
+		(uint64_t)gk_conf->cmd_budget_us * cycles_per_sec / 1000000;
+	gk_conf->cmd_drain_budget_cycles =
+		(uint64_t)gk_conf->cmd_drain_budget_us * cycles_per_sec /
+		1000000;
+}
+
 int
 run_gk(struct net_config *net_conf, struct gk_config *gk_conf)
 {
 	int ret, i;
+	size_t before = heap_allocated();
 
 	if (net_conf == NULL || gk_conf == NULL) {
 		ret = -1;
@@ -756,16 +1772,39 @@ run_gk(struct net_config *net_conf, struct gk_config *gk_conf)
 		goto out;
 	}
 
-	gk_conf->net = net_conf;
+	ret = check_poll_config(&gk_conf->poll, &net_conf->front, "gk");
+	if (ret < 0)
+		goto out;
+
+	set_gk_net_conf(net_conf, gk_conf);
 
 	if (gk_conf->num_lcores <= 0)
 		goto success;
 
-	ret = net_launch_at_stage1(net_conf, gk_conf->num_lcores, 0, 0,
-		gk_conf->num_lcores, gk_stage1, gk_conf);
+	if (gk_conf->offload_max_rules > 0 &&
+			(gk_conf->offload_max_rules <
+				(unsigned int)gk_conf->num_lcores ||
+			gk_conf->offload_min_drops == 0)) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: the offload of declined flows needs a rule per GK block, and a positive number of drops\n");
+		ret = -1;
+		goto out;
+	}
+
+	/*
+	 * The FIBs are created now, so the configuration
+	 * can add prefixes to them once run_gk() returns.
+	 */
+	ret = init_gk_fibs(gk_conf);
 	if (ret < 0)
 		goto out;
 
+	ret = net_launch_at_stage1(net_conf,
+		gk_conf->num_lcores + (gk_conf->offload_max_rules > 0 ? 1 : 0),
+		0, 0, gk_conf->num_lcores, "gk", gk_stage1, gk_conf);
+	if (ret < 0)
+		goto fibs;
+
 	ret = launch_at_stage2(gk_stage2, gk_conf);
 	if (ret < 0)
 		goto stage1;
@@ -785,16 +1824,77 @@ stage2:
 	pop_n_at_stage2(1);
 stage1:
 	pop_n_at_stage1(1);
+fibs:
+	destroy_gk_fibs(gk_conf);
 out:
 	return ret;
 
 success:
 	rte_atomic32_init(&gk_conf->ref_cnt);
+	log_heap_reserved("gk", "at configuration", before);
 	return 0;
 }
 
-struct mailbox *
-get_responsible_gk_mailbox(const struct ip_flow *flow,
+/*
+ * Query the RETA of the front interface, and rebuild the map used by
+ * get_responsible_gk_mailbox() accordingly.
+ *
+ * It must be called again whenever the RETA of the front interface
+ * changes. Only the map not in use is written, so concurrent lookups
+ * are not disturbed, as long as no lookup lasts across two updates.
+ */
+int
+gk_update_rss_dispatch(struct gk_config *gk_conf)
+{
+	int ret;
+	uint32_t i;
+	struct gk_rss_dispatch *dispatch;
+
+	ret = gatekeeper_get_rss_config(&gk_conf->net->front,
+		&gk_conf->rss_conf);
+	if (ret < 0)
+		return ret;
+
+	if (!rte_is_power_of_2(gk_conf->rss_conf.reta_size)) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: RETA size %hu is not a power of 2!\n",
+			gk_conf->rss_conf.reta_size);
+		return -1;
+	}
+
+	dispatch = gk_conf->rss_dispatch_cur == &gk_conf->rss_dispatch[0]
+		? &gk_conf->rss_dispatch[1] : &gk_conf->rss_dispatch[0];
+
+	for (i = 0; i < gk_conf->rss_conf.reta_size; i++) {
+		uint32_t idx = i / RTE_RETA_GROUP_SIZE;
+		uint32_t shift = i % RTE_RETA_GROUP_SIZE;
+		uint16_t queue_id = gk_conf->rss_conf.reta_conf[idx].reta[shift];
+		int j;
+
+		for (j = 0; j < gk_conf->num_lcores; j++)
+			if (gk_conf->instances[j].rx_queue_front == queue_id)
+				break;
+
+		if (j == gk_conf->num_lcores) {
+			RTE_LOG(ERR, GATEKEEPER,
+				"gk: RETA entry %u points to queue %hu, which is not assigned to any GK block!\n",
+				i, queue_id);
+			return -1;
+		}
+
+		dispatch->instance_idx[i] = j;
+	}
+	dispatch->reta_mask = gk_conf->rss_conf.reta_size - 1;
+
+	/* Make sure the map is complete before it is visible. */
+	rte_wmb();
+	gk_conf->rss_dispatch_cur = dispatch;
+
+	return 0;
+}
+
+unsigned int
+get_responsible_gk_idx(const struct ip_flow *flow,
 	const struct gk_config *gk_conf)
 {
 	/*
@@ -802,36 +1902,143 @@ get_responsible_gk_mailbox(const struct ip_flow *flow,
 	 * pair <Src, Dst> in the decision.
 	 */
 	uint32_t rss_hash_val = rss_ip_flow_hf(flow, 0, 0);
-	uint32_t idx;
-	uint32_t shift;
-	uint16_t queue_id;
-	int i, block_idx = -1;
-
-	/*
-	 * XXX Change the mapping rss hash value to rss reta entry
-	 * if the reta size is not 128.
-	 */
-	RTE_VERIFY(gk_conf->rss_conf.reta_size == 128);
-	rss_hash_val = (rss_hash_val & 127);
+	const struct gk_rss_dispatch *dispatch = gk_conf->rss_dispatch_cur;
 
 	/*
 	 * Identify which GK block is responsible for the
 	 * pair <Src, Dst> in the decision.
 	 */
-	idx = rss_hash_val / RTE_RETA_GROUP_SIZE;
-	shift = rss_hash_val % RTE_RETA_GROUP_SIZE;
-	queue_id = gk_conf->rss_conf.reta_conf[idx].reta[shift];
+	return dispatch->instance_idx[rss_hash_val & dispatch->reta_mask];
+}
 
-	/* XXX Change mapping queue id to the gk instance id efficiently. */
-	for (i = 0; i < gk_conf->num_lcores; i++)
-		if (gk_conf->instances[i].rx_queue_front == queue_id) {
-			block_idx = i;
-			break;
-		}
+struct mailbox *
+get_responsible_gk_mailbox(const struct ip_flow *flow,
+	const struct gk_config *gk_conf)
+{
+	return &gk_conf->instances[get_responsible_gk_idx(flow, gk_conf)].mb;
+}
 
-	if (block_idx == -1)
-		RTE_LOG(ERR, GATEKEEPER,
-			"gk: wrong RSS configuration for GK blocks!\n");
+/*
+ * The benchmarks of bench/main.c run a GK block at the calling lcore,
+ * without queues on the network interfaces and without the LLS block.
+ *
+ * gk_bench_instance_setup() sets the instance up as gk_stage1() does.
+ * The FIB can then be filled with add_fib_entry() until the first
+ * burst; its next hops are taken as resolved, since there is no LLS
+ * block. gk_conf_put() releases the instance.
+ */
+int
+gk_bench_instance_setup(struct net_config *net_conf,
+	struct gk_config *gk_conf)
+{
+	int ret;
+	unsigned int lcore = rte_lcore_id();
+
+	gk_conf->lcores = rte_malloc("gk_bench_lcores",
+		sizeof(*gk_conf->lcores), 0);
+	if (gk_conf->lcores == NULL) {
+		RTE_LOG(ERR, MALLOC, "gk: cannot allocate the lcores\n");
+		return -1;
+	}
+	gk_conf->lcores[0] = lcore;
+	gk_conf->num_lcores = 1;
+	set_gk_net_conf(net_conf, gk_conf);
+
+	ret = init_gk_fibs(gk_conf);
+	if (ret < 0)
+		goto lcores;
+
+	gk_conf->instances = rte_calloc_socket(__func__, 1,
+		sizeof(struct gk_instance), 0, rte_lcore_to_socket_id(lcore));
+	if (gk_conf->instances == NULL) {
+		ret = -1;
+		goto fibs;
+	}
+	gk_conf->instances[0].fib_version = GK_FIB_QUIESCENT;
+
+	ret = setup_gk_instance(lcore, gk_conf);
+	if (ret < 0)
+		goto instances;
+
+	/* All flows belong to the only instance. */
+	gk_conf->rss_dispatch[0].reta_mask = 0;
+	gk_conf->rss_dispatch[0].instance_idx[0] = 0;
+	gk_conf->rss_dispatch_cur = &gk_conf->rss_dispatch[0];
 
-	return &gk_conf->instances[block_idx].mb;
+	clear_flow_table(&gk_conf->instances[0].ip4_flows);
+	clear_flow_table(&gk_conf->instances[0].ip6_flows);
+	rte_atomic32_set(&gk_conf->ref_cnt, 1);
+	return 0;
+
+instances:
+	rte_free(gk_conf->instances);
+	gk_conf->instances = NULL;
+fibs:
+	destroy_gk_fibs(gk_conf);
+lcores:
+	rte_free(gk_conf->lcores);
+	gk_conf->lcores = NULL;
+	gk_conf->num_lcores = 0;
+	return ret;
+}
+
+/*
+ * Load the latest FIB into @instance as gk_quiescent_point() does,
+ * but with all next hops resolved.
+ */
+static void
+load_bench_fib(struct gk_instance *instance, const struct gk_config *gk_conf,
+	unsigned int socket_id)
+{
+	unsigned int i;
+	struct gk_fib *fib;
+
+	instance->fib_version = gk_conf->fib_version;
+	rte_smp_mb();
+	fib = instance->fib = gk_conf->fibs[socket_id];
+
+	for (i = 0; i < fib->num_nexthops; i++) {
+		struct gk_tunnel *tunnel = &instance->tunnels[i];
+
+		rte_memcpy(&tunnel->info, &fib->nexthops[i].tunnel,
+			sizeof(tunnel->info));
+		tunnel->gen = fib->nexthops[i].gen;
+		tunnel->nh_state = LLS_NH_RESOLVED;
+		ipip_tunnel_refresh(&tunnel->info);
+	}
+	instance->num_tunnels = fib->num_nexthops;
+}
+
+/*
+ * Go through an iteration of gk_proc() with the burst @pkts,
+ * which may be empty, and return the number of packets that
+ * the instance sends in @tx_bufs, which the caller frees.
+ */
+uint16_t
+gk_bench_instance_process(struct gk_config *gk_conf, struct rte_mbuf **pkts,
+	uint16_t num_pkts, struct rte_mbuf **tx_bufs)
+{
+	unsigned int lcore = rte_lcore_id();
+	struct gk_instance *instance =
+		&gk_conf->instances[get_block_idx(gk_conf, lcore)];
+	uint16_t num_tx;
+	uint64_t now;
+
+	if (unlikely(instance->fib_version != gk_conf->fib_version))
+		load_bench_fib(instance, gk_conf,
+			rte_lcore_to_socket_id(lcore));
+
+	now = rte_rdtsc();
+	if (num_pkts > 0)
+		gk_process_pkts(gk_conf, instance, pkts, num_pkts, now);
+	num_tx = gk_sched_dequeue(instance->sched, tx_bufs,
+		GATEKEEPER_MAX_PKT_BURST, now);
+
+	process_gk_cmds(instance, gk_conf, num_pkts == 0);
+	expire_flow_entries(&instance->ip4_flows,
+		gk_conf->flow_table_scan_iter, now, gk_conf);
+	expire_flow_entries(&instance->ip6_flows,
+		gk_conf->flow_table_scan_iter, now, gk_conf);
+
+	return num_tx;
 }
@@ -0,0 +1,217 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <rte_log.h>
+#include <rte_hash.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_spinlock.h>
+
+#include "gatekeeper_gk.h"
+#include "gatekeeper_net.h"
+#include "offload.h"
+
+/* XXX Sample parameter, need to be tested for better performance. */
+#define GK_OFFLOAD_SCAN_ITER (16)
+
+/* The filters of the NIC are shared by all GK instances. */
+static rte_spinlock_t filter_lock = RTE_SPINLOCK_INITIALIZER;
+
+struct gk_offload *
+gk_offload_create(const struct gk_config *gk_conf, unsigned int block_idx,
+	unsigned int lcore_id)
+{
+	int ret;
+	char name[64];
+	int socket_id = rte_lcore_to_socket_id(lcore_id);
+	struct gk_offload *offload;
+	struct rte_hash_parameters params = {
+		.name = name,
+		.reserved = 0,
+		.key_len = sizeof(((struct ip_flow *)0)->f.v4),
+		.hash_func = rss_ip4_flow_hf,
+		.hash_func_init_val = 0,
+		.socket_id = socket_id,
+		.extra_flag = 0,
+	};
+
+	offload = rte_zmalloc_socket("gk_offload", sizeof(*offload), 0,
+		socket_id);
+	if (offload == NULL)
+		goto out;
+
+	offload->port_id = gk_conf->net->front.id;
+	offload->drop_queue = gk_conf->net->front.drop_queue;
+	offload->min_drops = gk_conf->offload_min_drops;
+	offload->max_rules =
+		gk_conf->offload_max_rules / gk_conf->num_lcores;
+
+	/* DPDK's hash tables have at least one bucket. */
+	offload->table_size = RTE_MAX(offload->max_rules,
+		(uint32_t)RTE_HASH_BUCKET_ENTRIES);
+	params.entries = offload->table_size;
+	ret = snprintf(name, sizeof(name), "gk_offload_%u", block_idx);
+	RTE_VERIFY(ret > 0 && ret < (int)sizeof(name));
+	offload->rules_by_flow = rte_hash_create(&params);
+	if (offload->rules_by_flow == NULL)
+		goto offload;
+
+	offload->rules = rte_calloc_socket("gk_offload_rules",
+		offload->table_size, sizeof(*offload->rules), 0, socket_id);
+	if (offload->rules == NULL)
+		goto hash;
+
+	return offload;
+
+hash:
+	rte_hash_free(offload->rules_by_flow);
+offload:
+	rte_free(offload);
+out:
+	RTE_LOG(ERR, MALLOC,
+		"gk: failed to allocate the offload of declined flows at lcore %u\n",
+		lcore_id);
+	return NULL;
+}
+
+static void
+del_rule(struct gk_offload *offload, uint32_t idx)
+{
+	int ret;
+	struct gk_offload_rule *rule = &offload->rules[idx];
+
+	rte_spinlock_lock(&filter_lock);
+	ip4_flow_filter_del(offload->port_id, rule->flow.f.v4.src,
+		rule->flow.f.v4.dst, offload->drop_queue);
+	rte_spinlock_unlock(&filter_lock);
+
+	ret = rte_hash_del_key(offload->rules_by_flow, &rule->flow.f);
+	if (ret < 0)
+		RTE_LOG(ERR, HASH,
+			"gk: failed to delete an offloaded flow from its table (err = %d)\n",
+			ret);
+	rule->in_use = false;
+	offload->num_rules--;
+}
+
+/* Remove the filters of @offload from the NIC, and free it. */
+void
+gk_offload_destroy(struct gk_offload *offload)
+{
+	uint32_t i;
+
+	if (offload == NULL)
+		return;
+
+	for (i = 0; i < offload->table_size; i++)
+		if (offload->rules[i].in_use)
+			del_rule(offload, i);
+
+	rte_free(offload->rules);
+	rte_hash_free(offload->rules_by_flow);
+	rte_free(offload);
+}
+
+/*
+ * Install a rule for the declined flow @flow of entry @fe,
+ * unless it has one, it is not an IPv4 flow, or there is no room.
+ */
+void
+gk_offload_add(struct gk_offload *offload, const struct ip_flow *flow,
+	const struct flow_entry *fe)
+{
+	int ret;
+	struct gk_offload_rule *rule;
+
+	if (flow->proto != ETHER_TYPE_IPv4 ||
+			offload->num_rules >= offload->max_rules)
+		return;
+
+	ret = rte_hash_add_key_with_hash(offload->rules_by_flow, &flow->f,
+		fe->flow_hash_val);
+	if (ret < 0)
+		return;
+	rule = &offload->rules[ret];
+	if (rule->in_use)
+		return;
+
+	rte_spinlock_lock(&filter_lock);
+	ret = ip4_flow_filter_add(offload->port_id, flow->f.v4.src,
+		flow->f.v4.dst, offload->drop_queue);
+	rte_spinlock_unlock(&filter_lock);
+	if (ret < 0) {
+		/* The NIC has no more room, or no rule can be installed. */
+		rte_hash_del_key_with_hash(offload->rules_by_flow, &flow->f,
+			fe->flow_hash_val);
+		offload->max_rules = offload->num_rules;
+		RTE_LOG(WARNING, GATEKEEPER,
+			"gk: the NIC drops the packets of at most %u declined flows of the GK block at lcore %u\n",
+			offload->max_rules, rte_lcore_id());
+		return;
+	}
+
+	rule->flow = *flow;
+	rule->expire_at = fe->u.declined.expire_at;
+	rule->in_use = true;
+	offload->num_rules++;
+	offload->num_installed++;
+}
+
+/*
+ * The policy of the entry @fe of @flow, which was declined,
+ * has been replaced; bring its rule, if any, up to date.
+ */
+void
+gk_offload_update(struct gk_offload *offload, const struct ip_flow *flow,
+	const struct flow_entry *fe)
+{
+	int ret;
+
+	if (flow->proto != ETHER_TYPE_IPv4 || offload->num_rules == 0)
+		return;
+
+	ret = rte_hash_lookup_with_hash(offload->rules_by_flow, &flow->f,
+		fe->flow_hash_val);
+	if (ret < 0)
+		return;
+
+	if (fe->state == GK_DECLINED)
+		offload->rules[ret].expire_at = fe->u.declined.expire_at;
+	else
+		del_rule(offload, ret);
+}
+
+/* Remove the expired rules of the next GK_OFFLOAD_SCAN_ITER slots. */
+void
+gk_offload_expire(struct gk_offload *offload, uint64_t now)
+{
+	unsigned int i;
+
+	if (offload->num_rules == 0)
+		return;
+
+	for (i = 0; i < GK_OFFLOAD_SCAN_ITER; i++) {
+		uint32_t idx = offload->scan_next;
+		struct gk_offload_rule *rule = &offload->rules[idx];
+
+		offload->scan_next = idx + 1 < offload->table_size
+			? idx + 1 : 0;
+		if (rule->in_use && now >= rule->expire_at)
+			del_rule(offload, idx);
+	}
+}
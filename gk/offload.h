@@ -0,0 +1,98 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GATEKEEPER_GK_OFFLOAD_H_
+#define _GATEKEEPER_GK_OFFLOAD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "gatekeeper_flow.h"
+#include "flow.h"
+
+/*
+ * The offload of the declined flows of a GK instance to the NIC.
+ *
+ * Once a GK instance has dropped @min_drops packets of a declined
+ * IPv4 flow, it installs a filter that steers the packets of that
+ * flow to the drop queue of the front interface (see
+ * get_drop_queue_id()), so the NIC drops them without costing CPU.
+ * While there is no room for a rule, the packets of the flow stay on
+ * the software path, and the flow is tried again every @min_drops
+ * drops, so the heaviest flows take the rules that become free.
+ *
+ * A rule lasts as long as the punishment of its flow. The NIC filters
+ * only match IPv4 addresses, so declined IPv6 flows are not offloaded.
+ */
+struct gk_offload_rule {
+	struct ip_flow flow;
+	/* When the punishment of @flow expires. */
+	uint64_t       expire_at;
+	bool           in_use;
+};
+
+struct gk_offload {
+	uint8_t                port_id;
+	uint16_t               drop_queue;
+	uint32_t               min_drops;
+
+	/*
+	 * The rules this instance may have, its share of the rules of
+	 * the NIC. It shrinks when the NIC runs out of room first.
+	 */
+	uint32_t               max_rules;
+	uint32_t               num_rules;
+
+	/*
+	 * The rules, indexed by the positions of their flows
+	 * in @rules_by_flow, and where the scan of expired rules resumes.
+	 */
+	struct rte_hash        *rules_by_flow;
+	uint32_t               table_size;
+	struct gk_offload_rule *rules;
+	uint32_t               scan_next;
+
+	/* Rules installed so far. */
+	uint64_t               num_installed;
+};
+
+struct gk_offload *gk_offload_create(const struct gk_config *gk_conf,
+	unsigned int block_idx, unsigned int lcore_id);
+void gk_offload_destroy(struct gk_offload *offload);
+void gk_offload_add(struct gk_offload *offload, const struct ip_flow *flow,
+	const struct flow_entry *fe);
+void gk_offload_update(struct gk_offload *offload, const struct ip_flow *flow,
+	const struct flow_entry *fe);
+void gk_offload_expire(struct gk_offload *offload, uint64_t now);
+
+/*
+ * Count a packet of the declined flow @flow, of entry @fe,
+ * that the GK instance of @offload has dropped.
+ */
+static inline void
+gk_offload_count_drop(struct gk_offload *offload, const struct ip_flow *flow,
+	struct flow_entry *fe)
+{
+	if (offload == NULL)
+		return;
+
+	if (++fe->u.declined.num_drops % offload->min_drops == 0)
+		gk_offload_add(offload, flow, fe);
+}
+
+#endif /* _GATEKEEPER_GK_OFFLOAD_H_ */
@@ -0,0 +1,438 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include <rte_log.h>
+#include <rte_hash.h>
+#include <rte_lcore.h>
+#include <rte_cycles.h>
+#include <rte_memcpy.h>
+
+#include "gatekeeper_main.h"
+#include "flow.h"
+#include "persist.h"
+#include "wheel.h"
+
+/* "GKFLOWS1" */
+#define GK_FLOW_FILE_MAGIC   (0x3153574f4c464b47ULL)
+#define GK_FLOW_FILE_VERSION (1)
+
+/*
+ * The layout of a flow file: this header, then the flow entries,
+ * a bitmap of the entries in use, and the keys of the entries.
+ *
+ * The timestamps of the flow entries are in cycles of the TSC, so
+ * the header also records the TSC and the monotonic clock at the time
+ * the entries were saved, which lets the next run translate them.
+ */
+struct gk_flow_file {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t num_entries;
+	uint32_t key_len;
+	uint32_t entry_size;
+	/* Whether the content below the header is a complete save. */
+	uint32_t saved;
+	uint64_t cycles_per_sec;
+	uint64_t saved_tsc;
+	uint64_t saved_clock_ns;
+} __rte_cache_aligned;
+
+static inline uint32_t
+bitmap_words(uint32_t num_entries)
+{
+	return (num_entries + 63) / 64;
+}
+
+static inline struct flow_entry *
+file_entries(struct gk_flow_file *file)
+{
+	return (struct flow_entry *)&file[1];
+}
+
+static inline uint64_t *
+file_bitmap(struct gk_flow_file *file, uint32_t num_entries)
+{
+	return (uint64_t *)&file_entries(file)[num_entries];
+}
+
+static inline uint8_t *
+file_keys(struct gk_flow_file *file, uint32_t num_entries)
+{
+	return (uint8_t *)&file_bitmap(file, num_entries)[
+		bitmap_words(num_entries)];
+}
+
+static uint64_t
+clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Map the file that holds the flow entries of @table, creating it
+ * if needed, and point @table->entry_table to the entries of the file.
+ *
+ * The pages of the file are not touched here, so that the lcore of
+ * the GK block is the first one to touch them.
+ */
+int
+gk_flow_file_map(struct gk_flow_table *table, const char *dir,
+	const char *name, unsigned int block_idx, unsigned int entries,
+	uint32_t key_len)
+{
+	int fd;
+	int ret;
+	char path[PATH_MAX];
+	struct stat st;
+	struct statfs stfs;
+	size_t len;
+	void *file;
+
+	ret = snprintf(path, sizeof(path), "%s/gk_flows_%s_%u",
+		dir, name, block_idx);
+	if (ret <= 0 || ret >= (int)sizeof(path)) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: the path of the %s flow file is too long\n", name);
+		return -1;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: cannot open the flow file %s (errno = %d)\n",
+			path, errno);
+		return -1;
+	}
+
+	if (fstatfs(fd, &stfs) < 0 || fstat(fd, &st) < 0) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: cannot stat the flow file %s (errno = %d)\n",
+			path, errno);
+		goto fd;
+	}
+
+	/* On hugetlbfs, the block size is the size of the huge pages. */
+	len = sizeof(struct gk_flow_file) +
+		entries * sizeof(struct flow_entry) +
+		bitmap_words(entries) * sizeof(uint64_t) +
+		(size_t)entries * key_len;
+	len = RTE_ALIGN_CEIL(len, (size_t)stfs.f_bsize);
+
+	/* A file of another size cannot be restored; discard it. */
+	if ((size_t)st.st_size != len && (ftruncate(fd, 0) < 0 ||
+			ftruncate(fd, len) < 0)) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: cannot resize the flow file %s to %zu bytes (errno = %d)\n",
+			path, len, errno);
+		goto fd;
+	}
+
+	file = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (file == MAP_FAILED) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: cannot map the flow file %s (errno = %d)\n",
+			path, errno);
+		goto fd;
+	}
+	close(fd);
+
+	table->file = file;
+	table->file_len = len;
+	table->num_entries = entries;
+	table->key_len = key_len;
+	table->entry_table = file_entries(table->file);
+	return 0;
+
+fd:
+	close(fd);
+	return -1;
+}
+
+void
+gk_flow_file_unmap(struct gk_flow_table *table)
+{
+	if (table->file == NULL)
+		return;
+
+	munmap(table->file, table->file_len);
+	table->file = NULL;
+	table->entry_table = NULL;
+}
+
+/*
+ * Save the keys of the entries of @table and the time base of
+ * the entries in the file of @table. Called by the lcore of the
+ * GK block when it exits, so nothing else changes the table.
+ */
+void
+gk_flow_file_save(struct gk_flow_table *table)
+{
+	uint32_t iter = 0;
+	int32_t pos;
+	const void *key;
+	void *data;
+	struct gk_flow_file *file = table->file;
+	uint64_t *bitmap;
+	uint8_t *keys;
+	unsigned int num_saved = 0;
+
+	if (file == NULL || table->hash_table == NULL)
+		return;
+
+	file->saved = 0;
+	rte_wmb();
+
+	bitmap = file_bitmap(file, table->num_entries);
+	keys = file_keys(file, table->num_entries);
+	memset(bitmap, 0, bitmap_words(table->num_entries) *
+		sizeof(*bitmap));
+
+	while ((pos = rte_hash_iterate(table->hash_table,
+			&key, &data, &iter)) >= 0) {
+		bitmap[pos / 64] |= 1ULL << (pos % 64);
+		rte_memcpy(&keys[(size_t)pos * table->key_len], key,
+			table->key_len);
+		num_saved++;
+	}
+
+	file->magic = GK_FLOW_FILE_MAGIC;
+	file->version = GK_FLOW_FILE_VERSION;
+	file->num_entries = table->num_entries;
+	file->key_len = table->key_len;
+	file->entry_size = sizeof(struct flow_entry);
+	file->cycles_per_sec = cycles_per_sec;
+	file->saved_tsc = rte_rdtsc();
+	file->saved_clock_ns = clock_ns();
+	rte_wmb();
+	file->saved = 1;
+
+	RTE_LOG(NOTICE, GATEKEEPER,
+		"gk: saved %u flow entries of the flow table at lcore %u\n",
+		num_saved, rte_lcore_id());
+}
+
+/*
+ * Translate the saved timestamp @ts to the TSC of this run.
+ * Return false if @ts had already passed.
+ */
+static bool
+translate_ts(uint64_t *ts, const struct gk_flow_file *file,
+	uint64_t now, double elapsed_ns)
+{
+	double left_ns;
+
+	if (*ts <= file->saved_tsc) {
+		*ts = now;
+		return false;
+	}
+
+	left_ns = (double)(*ts - file->saved_tsc) * 1e9 /
+		file->cycles_per_sec - elapsed_ns;
+	if (left_ns <= 0) {
+		*ts = now;
+		return false;
+	}
+
+	*ts = now + (uint64_t)(left_ns * cycles_per_sec / 1e9);
+	return true;
+}
+
+/* Translate the timestamps of @fe; return false if @fe has expired. */
+static bool
+translate_entry(struct flow_entry *fe, const struct gk_flow_file *file,
+	uint64_t now, double elapsed_ns)
+{
+	switch (fe->state) {
+	case GK_GRANTED:
+		if (!translate_ts(&fe->u.granted.cap_expire_at, file,
+				now, elapsed_ns))
+			return false;
+		/* Budgets and renewals that are due happen right away. */
+		translate_ts(&fe->u.granted.budget_renew_at, file,
+			now, elapsed_ns);
+		translate_ts(&fe->u.granted.send_next_renewal_at, file,
+			now, elapsed_ns);
+		fe->u.granted.renewal_step_cycle =
+			(double)fe->u.granted.renewal_step_cycle *
+			cycles_per_sec / file->cycles_per_sec;
+		return true;
+
+	case GK_DECLINED:
+		return translate_ts(&fe->u.declined.expire_at, file,
+			now, elapsed_ns);
+
+	default:
+		/* Request entries are cheap to rebuild. */
+		return false;
+	}
+}
+
+/*
+ * The entries of the file are not in the hash table, nor in
+ * the timer wheel of this run, so they are cleared before use.
+ */
+static void
+clear_entries(struct gk_flow_table *table)
+{
+	memset(table->entry_table, 0,
+		(size_t)table->num_entries * sizeof(struct flow_entry));
+}
+
+struct saved_flow {
+	struct flow_entry fe;
+	uint8_t           key[sizeof(((struct ip_flow *)0)->f)];
+};
+
+/*
+ * Re-add the granted and declined entries saved in the file of @table
+ * to @table, which must be empty. Entries whose flows are now sent to
+ * another GK block, or whose destinations are no longer protected by
+ * a Grantor server, are dropped.
+ *
+ * Called by the lcore of GK block @block_idx before it processes
+ * packets, and after it has loaded the FIB. Return the number of
+ * entries restored.
+ */
+unsigned int
+gk_flow_file_restore(struct gk_flow_table *table, uint16_t proto,
+	unsigned int block_idx, struct gk_instance *instance,
+	struct gk_config *gk_conf)
+{
+	uint32_t i;
+	uint64_t now;
+	uint64_t *bitmap;
+	uint8_t *keys;
+	double elapsed_ns;
+	unsigned int num_saved = 0;
+	unsigned int num_restored = 0;
+	struct saved_flow *flows = NULL;
+	struct gk_flow_file *file = table->file;
+	const struct gk_rss_dispatch *dispatch = gk_conf->rss_dispatch_cur;
+
+	if (file == NULL || table->hash_table == NULL)
+		return 0;
+
+	if (file->magic != GK_FLOW_FILE_MAGIC ||
+			file->version != GK_FLOW_FILE_VERSION ||
+			file->num_entries != table->num_entries ||
+			file->key_len != table->key_len ||
+			file->entry_size != sizeof(struct flow_entry) ||
+			file->saved == 0 || file->cycles_per_sec == 0 ||
+			instance->fib == NULL)
+		goto reset;
+
+	bitmap = file_bitmap(file, table->num_entries);
+	keys = file_keys(file, table->num_entries);
+	for (i = 0; i < bitmap_words(table->num_entries); i++)
+		num_saved += __builtin_popcountll(bitmap[i]);
+	if (num_saved == 0)
+		goto reset;
+
+	flows = malloc(num_saved * sizeof(*flows));
+	if (flows == NULL) {
+		RTE_LOG(ERR, MALLOC,
+			"gk: cannot allocate memory to restore %u flow entries at lcore %u\n",
+			num_saved, rte_lcore_id());
+		goto reset;
+	}
+
+	now = rte_rdtsc();
+	elapsed_ns = (double)clock_ns() - file->saved_clock_ns;
+	if (elapsed_ns < 0)
+		elapsed_ns = 0;
+
+	num_saved = 0;
+	for (i = 0; i < table->num_entries; i++) {
+		struct saved_flow *sf = &flows[num_saved];
+		struct ip_flow flow;
+		int nexthop_id;
+
+		if (!(bitmap[i / 64] & (1ULL << (i % 64))))
+			continue;
+
+		rte_memcpy(&sf->fe, &table->entry_table[i], sizeof(sf->fe));
+		if (!translate_entry(&sf->fe, file, now, elapsed_ns))
+			continue;
+
+		if (dispatch->instance_idx[sf->fe.flow_hash_val &
+				dispatch->reta_mask] != block_idx)
+			continue;
+
+		memset(&flow, 0, sizeof(flow));
+		flow.proto = proto;
+		rte_memcpy(&flow.f, &keys[(size_t)i * table->key_len],
+			table->key_len);
+		nexthop_id = gk_fib_lookup(instance->fib, &flow);
+		if (nexthop_id < 0 || instance->fib->nexthops[
+				nexthop_id].action != GK_FWD_GRANTOR)
+			continue;
+		sf->fe.grantor_id = gk_fib_nexthop_ref(instance->fib,
+			nexthop_id);
+
+		rte_memcpy(sf->key, &flow.f, table->key_len);
+		num_saved++;
+	}
+
+	/*
+	 * The entries are copied out before they are re-added, because
+	 * the hash table assigns them new positions in @entry_table.
+	 */
+	file->saved = 0;
+	clear_entries(table);
+	for (i = 0; i < num_saved; i++) {
+		struct flow_entry *fe = &flows[i].fe;
+		int ret = rte_hash_add_key_with_hash(table->hash_table,
+			flows[i].key, fe->flow_hash_val);
+		if (ret < 0)
+			continue;
+
+		fe->timer_slot = GK_WHEEL_NO_SLOT;
+		rte_memcpy(&table->entry_table[ret], fe, sizeof(*fe));
+		gk_wheel_add(table->wheel, table->entry_table, ret,
+			fe->state == GK_GRANTED
+				? fe->u.granted.cap_expire_at
+				: fe->u.declined.expire_at);
+		num_restored++;
+	}
+	free(flows);
+
+	RTE_LOG(NOTICE, GATEKEEPER,
+		"gk: restored %u flow entries of the flow table at lcore %u\n",
+		num_restored, rte_lcore_id());
+	return num_restored;
+
+reset:
+	file->saved = 0;
+	clear_entries(table);
+	return 0;
+}
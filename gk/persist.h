@@ -0,0 +1,47 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GATEKEEPER_GK_PERSIST_H_
+#define _GATEKEEPER_GK_PERSIST_H_
+
+#include <stdint.h>
+
+#include "gatekeeper_gk.h"
+
+/*
+ * Flow tables that survive restarts.
+ *
+ * The entries of a flow table may live in a file, preferably on
+ * a hugetlbfs mount, which is kept when Gatekeeper exits. When a GK
+ * block exits, it saves the keys of its entries and the time base of
+ * the timestamps of the entries in the file. When the GK block starts
+ * again, it re-adds the granted and declined entries of the file to
+ * its flow table, so these flows do not go through the request path
+ * again.
+ */
+
+int gk_flow_file_map(struct gk_flow_table *table, const char *dir,
+	const char *name, unsigned int block_idx, unsigned int entries,
+	uint32_t key_len);
+void gk_flow_file_unmap(struct gk_flow_table *table);
+void gk_flow_file_save(struct gk_flow_table *table);
+unsigned int gk_flow_file_restore(struct gk_flow_table *table,
+	uint16_t proto, unsigned int block_idx, struct gk_instance *instance,
+	struct gk_config *gk_conf);
+
+#endif /* _GATEKEEPER_GK_PERSIST_H_ */
@@ -0,0 +1,236 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <rte_ip.h>
+#include <rte_log.h>
+#include <rte_lcore.h>
+#include <rte_cycles.h>
+#include <rte_malloc.h>
+#include <rte_memcpy.h>
+
+#include "sched.h"
+
+/* Marks the end of a list of slots of the request queue. */
+#define GK_SCHED_NO_SLOT (UINT32_MAX)
+
+struct gk_sched *
+gk_sched_create(const struct gk_config *gk_conf, unsigned int lcore_id)
+{
+	uint32_t i;
+	int socket_id = rte_lcore_to_socket_id(lcore_id);
+	/* The largest request: a frame of the front interface in IPv6. */
+	uint32_t max_req_len = gk_conf->net->front.mtu + ETHER_HDR_LEN +
+		sizeof(struct ipv6_hdr);
+	struct gk_sched *sched;
+
+	RTE_BUILD_BUG_ON(GK_SCHED_REQ_LEVELS > 64);
+
+	if (gk_conf->request_queue_len == 0) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: the request queue must have room for packets\n");
+		return NULL;
+	}
+
+	if (gk_conf->request_rate_kb_sec != 0 &&
+			(uint64_t)gk_conf->request_burst_kb * 1024 <
+			max_req_len) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: the request bucket must hold at least one packet of %u bytes\n",
+			max_req_len);
+		return NULL;
+	}
+
+	sched = rte_zmalloc_socket("gk_sched", sizeof(*sched), 0, socket_id);
+	if (sched == NULL)
+		goto out;
+
+	sched->req_slots = rte_malloc_socket("gk_sched_slots",
+		gk_conf->request_queue_len * sizeof(*sched->req_slots),
+		0, socket_id);
+	if (sched->req_slots == NULL)
+		goto sched;
+
+	sched->req_next = rte_malloc_socket("gk_sched_next",
+		gk_conf->request_queue_len * sizeof(*sched->req_next),
+		0, socket_id);
+	if (sched->req_next == NULL)
+		goto slots;
+
+	for (i = 0; i < GK_SCHED_REQ_LEVELS; i++) {
+		sched->req_levels[i].head = GK_SCHED_NO_SLOT;
+		sched->req_levels[i].tail = GK_SCHED_NO_SLOT;
+	}
+	for (i = 0; i < gk_conf->request_queue_len - 1; i++)
+		sched->req_next[i] = i + 1;
+	sched->req_next[i] = GK_SCHED_NO_SLOT;
+	sched->req_free = 0;
+	sched->req_max_len = gk_conf->request_queue_len;
+
+	sched->req_rate_byte_sec =
+		(uint64_t)gk_conf->request_rate_kb_sec * 1024;
+	sched->req_max_tokens =
+		(uint64_t)gk_conf->request_burst_kb * 1024 * cycles_per_sec;
+	sched->req_tokens = sched->req_max_tokens;
+	sched->req_refilled_at = rte_rdtsc();
+
+	return sched;
+
+slots:
+	rte_free(sched->req_slots);
+sched:
+	rte_free(sched);
+out:
+	RTE_LOG(ERR, MALLOC,
+		"gk: failed to allocate the egress scheduler at lcore %u\n",
+		lcore_id);
+	return NULL;
+}
+
+/* Remove the oldest packet of @level of the request queue. */
+static struct rte_mbuf *
+pop_request(struct gk_sched *sched, unsigned int level)
+{
+	uint32_t slot = sched->req_levels[level].head;
+	struct rte_mbuf *pkt = sched->req_slots[slot];
+
+	sched->req_levels[level].head = sched->req_next[slot];
+	if (sched->req_levels[level].head == GK_SCHED_NO_SLOT) {
+		sched->req_levels[level].tail = GK_SCHED_NO_SLOT;
+		sched->req_levels_bitmap &= ~(1ULL << level);
+	}
+
+	sched->req_next[slot] = sched->req_free;
+	sched->req_free = slot;
+	sched->req_len--;
+
+	return pkt;
+}
+
+void
+gk_sched_destroy(struct gk_sched *sched)
+{
+	uint16_t i;
+
+	if (sched == NULL)
+		return;
+
+	for (i = 0; i < sched->num_granted; i++)
+		rte_pktmbuf_free(sched->granted[i]);
+
+	while (sched->req_levels_bitmap != 0)
+		rte_pktmbuf_free(pop_request(sched,
+			__builtin_ctzll(sched->req_levels_bitmap)));
+
+	rte_free(sched->req_next);
+	rte_free(sched->req_slots);
+	rte_free(sched);
+}
+
+void
+gk_sched_enqueue_request(struct gk_sched *sched, struct rte_mbuf *pkt,
+	uint8_t priority)
+{
+	uint32_t slot;
+	unsigned int level = priority - PRIORITY_REQ_MIN;
+
+	RTE_VERIFY(priority >= PRIORITY_REQ_MIN && priority <= PRIORITY_MAX);
+
+	if (unlikely(sched->req_len >= sched->req_max_len)) {
+		/* Drop from the lowest priority. */
+		unsigned int lowest =
+			__builtin_ctzll(sched->req_levels_bitmap);
+
+		sched->req_dropped++;
+		if (level <= lowest) {
+			rte_pktmbuf_free(pkt);
+			return;
+		}
+		rte_pktmbuf_free(pop_request(sched, lowest));
+	}
+
+	slot = sched->req_free;
+	sched->req_free = sched->req_next[slot];
+	sched->req_slots[slot] = pkt;
+	sched->req_next[slot] = GK_SCHED_NO_SLOT;
+
+	if (sched->req_levels[level].tail == GK_SCHED_NO_SLOT)
+		sched->req_levels[level].head = slot;
+	else
+		sched->req_next[sched->req_levels[level].tail] = slot;
+	sched->req_levels[level].tail = slot;
+	sched->req_levels_bitmap |= 1ULL << level;
+	sched->req_len++;
+}
+
+static void
+refill_request_tokens(struct gk_sched *sched, uint64_t now)
+{
+	uint64_t elapsed = now - sched->req_refilled_at;
+	uint64_t missing = sched->req_max_tokens - sched->req_tokens;
+
+	sched->req_refilled_at = now;
+
+	/* Avoid overflowing the multiplication below. */
+	if (elapsed >= missing / sched->req_rate_byte_sec + 1) {
+		sched->req_tokens = sched->req_max_tokens;
+		return;
+	}
+
+	sched->req_tokens += elapsed * sched->req_rate_byte_sec;
+}
+
+/*
+ * Fill @pkts with up to @max_pkts packets to be sent on the back
+ * interface: first, all granted packets of the current burst;
+ * then, the request packets that the token bucket allows,
+ * from the highest priority down.
+ */
+uint16_t
+gk_sched_dequeue(struct gk_sched *sched, struct rte_mbuf **pkts,
+	uint16_t max_pkts, uint64_t now)
+{
+	uint16_t num_pkts;
+
+	RTE_VERIFY(sched->num_granted <= max_pkts);
+	rte_memcpy(pkts, sched->granted,
+		sched->num_granted * sizeof(*pkts));
+	num_pkts = sched->num_granted;
+	sched->num_granted = 0;
+
+	if (sched->req_rate_byte_sec != 0)
+		refill_request_tokens(sched, now);
+
+	while (num_pkts < max_pkts && sched->req_levels_bitmap != 0) {
+		unsigned int level =
+			63 - __builtin_clzll(sched->req_levels_bitmap);
+		struct rte_mbuf *pkt = sched->req_slots[
+			sched->req_levels[level].head];
+
+		if (sched->req_rate_byte_sec != 0) {
+			uint64_t cost = (uint64_t)rte_pktmbuf_pkt_len(pkt) *
+				cycles_per_sec;
+			if (sched->req_tokens < cost)
+				break;
+			sched->req_tokens -= cost;
+		}
+
+		pkts[num_pkts++] = pop_request(sched, level);
+	}
+
+	return num_pkts;
+}
@@ -0,0 +1,103 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GATEKEEPER_GK_SCHED_H_
+#define _GATEKEEPER_GK_SCHED_H_
+
+#include <stdint.h>
+
+#include <rte_mbuf.h>
+
+#include "gatekeeper_gk.h"
+#include "gatekeeper_main.h"
+
+/*
+ * Priority used for DSCP field of encapsulated packets:
+ *  0 for legacy packets; 1 for granted packets;
+ *  2 for capability renew; 3-63 for request packets.
+ */
+#define PRIORITY_GRANTED	 (1)
+#define PRIORITY_RENEW_CAP	 (2)
+#define PRIORITY_REQ_MIN	 (3)
+#define PRIORITY_MAX		 (63)
+
+/* The number of priority levels of the request queue. */
+#define GK_SCHED_REQ_LEVELS (PRIORITY_MAX - PRIORITY_REQ_MIN + 1)
+
+/*
+ * The egress scheduler of a GK instance on the back interface.
+ *
+ * Granted packets, including capability renewals, are sent as soon as
+ * they are processed. Request packets wait in a priority queue, and
+ * are sent from the highest priority down as long as the token bucket
+ * that caps the bandwidth of requests allows. When the request queue is
+ * full, the oldest packet of the lowest priority is dropped, unless the
+ * new packet has no higher priority, in which case it is dropped.
+ */
+struct gk_sched {
+	/* The granted packets of the current burst. */
+	uint16_t         num_granted;
+	struct rte_mbuf  *granted[GATEKEEPER_MAX_PKT_BURST];
+
+	/* Bit i is set when the level i of the request queue has packets. */
+	uint64_t         req_levels_bitmap;
+
+	/*
+	 * The request queue is a set of FIFO lists, one per level,
+	 * that share @req_slots; @req_next links the slots of each list
+	 * and the list of free slots.
+	 */
+	struct {
+		uint32_t head;
+		uint32_t tail;
+	} req_levels[GK_SCHED_REQ_LEVELS];
+	uint32_t         req_free;
+	uint32_t         req_len;
+	uint32_t         req_max_len;
+	struct rte_mbuf  **req_slots;
+	uint32_t         *req_next;
+	/* Request packets dropped because the queue was full. */
+	uint64_t         req_dropped;
+
+	/*
+	 * Token bucket of the request bandwidth. The tokens are counted
+	 * in bytes times cycles per second, so refilling them needs no
+	 * division. A zero @req_rate_byte_sec disables the bucket.
+	 */
+	uint64_t         req_rate_byte_sec;
+	uint64_t         req_tokens;
+	uint64_t         req_max_tokens;
+	uint64_t         req_refilled_at;
+};
+
+struct gk_sched *gk_sched_create(const struct gk_config *gk_conf,
+	unsigned int lcore_id);
+void gk_sched_destroy(struct gk_sched *sched);
+void gk_sched_enqueue_request(struct gk_sched *sched,
+	struct rte_mbuf *pkt, uint8_t priority);
+uint16_t gk_sched_dequeue(struct gk_sched *sched, struct rte_mbuf **pkts,
+	uint16_t max_pkts, uint64_t now);
+
+static inline void
+gk_sched_enqueue_granted(struct gk_sched *sched, struct rte_mbuf *pkt)
+{
+	RTE_VERIFY(sched->num_granted < GATEKEEPER_MAX_PKT_BURST);
+	sched->granted[sched->num_granted++] = pkt;
+}
+
+#endif /* _GATEKEEPER_GK_SCHED_H_ */
@@ -0,0 +1,375 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Flow snapshots move the granted and declined flows of the GK blocks
+ * of a Gatekeeper server to the GK blocks of another server, so flows
+ * that change servers when the upstream ECMP changes (e.g. when
+ * servers are added or drained) are not sent to Grantor again.
+ *
+ * A snapshot is a stream of records after an 8-byte magic number.
+ * Each record is:
+ *  state (1 byte): GK_GRANTED or GK_DECLINED;
+ *  IP version (1 byte): 4 or 6;
+ *  source and destination addresses (8 or 32 bytes);
+ *  for GK_GRANTED, the fields tx_rate_kb_sec, cap_expire_sec,
+ *  next_renewal_ms, and renewal_step_ms of struct ggu_policy;
+ *  for GK_DECLINED, the field expire_sec of struct ggu_policy.
+ * The fields of the policies are 32-bit integers in network order,
+ * and the lifetimes are those left when the entries were exported.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_log.h>
+#include <rte_lcore.h>
+#include <rte_cycles.h>
+#include <rte_malloc.h>
+#include <rte_memcpy.h>
+#include <rte_byteorder.h>
+
+#include "gatekeeper_gk.h"
+#include "gatekeeper_main.h"
+
+#define GK_SNAPSHOT_MAGIC "GKSNAPS1"
+#define GK_SNAPSHOT_MAGIC_LEN (8)
+
+/* The policy fields of the largest record. */
+#define GK_SNAPSHOT_MAX_PARAMS (4)
+
+/*
+ * XXX Sample parameter: how long the exporter waits for
+ * a GK block to fill a chunk of the snapshot.
+ */
+#define GK_SNAPSHOT_DUMP_TIMEOUT_SEC (5)
+
+static unsigned int
+write_policy(FILE *f, const struct ggu_policy *policy)
+{
+	uint8_t hdr[2];
+	uint32_t params[GK_SNAPSHOT_MAX_PARAMS];
+	unsigned int num_params;
+	const void *addrs;
+	size_t addrs_len;
+
+	hdr[0] = policy->state;
+	if (policy->flow.proto == ETHER_TYPE_IPv4) {
+		hdr[1] = 4;
+		addrs = &policy->flow.f.v4;
+		addrs_len = sizeof(policy->flow.f.v4);
+	} else {
+		hdr[1] = 6;
+		addrs = &policy->flow.f.v6;
+		addrs_len = sizeof(policy->flow.f.v6);
+	}
+
+	if (policy->state == GK_GRANTED) {
+		params[0] = rte_cpu_to_be_32(
+			policy->params.u.granted.tx_rate_kb_sec);
+		params[1] = rte_cpu_to_be_32(
+			policy->params.u.granted.cap_expire_sec);
+		params[2] = rte_cpu_to_be_32(
+			policy->params.u.granted.next_renewal_ms);
+		params[3] = rte_cpu_to_be_32(
+			policy->params.u.granted.renewal_step_ms);
+		num_params = 4;
+	} else {
+		params[0] = rte_cpu_to_be_32(
+			policy->params.u.declined.expire_sec);
+		num_params = 1;
+	}
+
+	if (fwrite(hdr, sizeof(hdr), 1, f) != 1 ||
+			fwrite(addrs, addrs_len, 1, f) != 1 ||
+			fwrite(params, sizeof(params[0]) * num_params,
+				1, f) != 1)
+		return 0;
+	return 1;
+}
+
+/*
+ * Have GK block @instance fill @dump, and wait for it.
+ * Return 0 on success, -ENOSPC if the request could not be sent,
+ * or -ETIMEDOUT if the GK block did not answer, in which case
+ * @dump may still be written by the GK block later.
+ */
+static int
+request_dump(struct gk_instance *instance, struct gk_flow_dump *dump)
+{
+	uint64_t deadline;
+	struct gk_cmd_entry *entry = mb_alloc_entry(&instance->mb);
+
+	if (entry == NULL)
+		return -ENOSPC;
+
+	dump->done = 0;
+	entry->op = GK_FLOW_DUMP;
+	entry->u.dump = dump;
+	if (mb_send_entry(&instance->mb, entry) < 0)
+		return -ENOSPC;
+
+	deadline = rte_rdtsc() + GK_SNAPSHOT_DUMP_TIMEOUT_SEC * cycles_per_sec;
+	while (!dump->done) {
+		if (exiting || rte_rdtsc() >= deadline)
+			return -ETIMEDOUT;
+		rte_pause();
+	}
+
+	/* Pairs with the barrier in dump_flows(). */
+	rte_smp_rmb();
+	return 0;
+}
+
+/*
+ * Write the granted and declined flows of all GK blocks to the
+ * snapshot @path. The GK blocks fill the snapshot a chunk at a time
+ * between their bursts of packets, so they are never paused;
+ * entries that change while the snapshot is taken may be
+ * missed or written twice.
+ *
+ * This function must not run at the lcore of a GK block.
+ */
+int
+gk_export_flows(struct gk_config *gk_conf, const char *path)
+{
+	int i, j;
+	int ret = -1;
+	unsigned int num_written = 0;
+	const uint16_t protos[] = { ETHER_TYPE_IPv4, ETHER_TYPE_IPv6 };
+	struct gk_flow_dump *dump;
+	FILE *f = fopen(path, "wb");
+
+	if (f == NULL) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: cannot create the flow snapshot %s\n", path);
+		return -1;
+	}
+
+	dump = rte_malloc_socket("gk_flow_dump", sizeof(*dump), 0,
+		rte_socket_id());
+	if (dump == NULL) {
+		RTE_LOG(ERR, MALLOC,
+			"gk: cannot allocate memory to export flows\n");
+		goto file;
+	}
+
+	if (fwrite(GK_SNAPSHOT_MAGIC, GK_SNAPSHOT_MAGIC_LEN, 1, f) != 1)
+		goto write_error;
+
+	for (i = 0; i < gk_conf->num_lcores; i++) {
+		struct gk_instance *instance = &gk_conf->instances[i];
+
+		for (j = 0; j < (int)RTE_DIM(protos); j++) {
+			dump->proto = protos[j];
+			dump->iter = 0;
+			do {
+				unsigned int k;
+				int err = request_dump(instance, dump);
+
+				if (err == -ENOSPC) {
+					RTE_LOG(ERR, GATEKEEPER,
+						"gk: cannot send the flow snapshot request to the GK block at lcore %u\n",
+						gk_conf->lcores[i]);
+					goto dump;
+				} else if (err < 0) {
+					RTE_LOG(ERR, GATEKEEPER,
+						"gk: the GK block at lcore %u did not answer the flow snapshot request\n",
+						gk_conf->lcores[i]);
+					/*
+					 * The GK block may still write
+					 * to @dump, so it is not freed.
+					 */
+					goto file;
+				}
+
+				for (k = 0; k < dump->num_policies; k++) {
+					if (write_policy(f,
+							&dump->policies[k]) == 0)
+						goto write_error;
+				}
+				num_written += dump->num_policies;
+			} while (!dump->end);
+		}
+	}
+
+	if (fflush(f) != 0)
+		goto write_error;
+
+	RTE_LOG(NOTICE, GATEKEEPER,
+		"gk: exported %u flows to %s\n", num_written, path);
+	ret = 0;
+	goto dump;
+
+write_error:
+	RTE_LOG(ERR, GATEKEEPER,
+		"gk: cannot write the flow snapshot %s\n", path);
+dump:
+	rte_free(dump);
+file:
+	fclose(f);
+	return ret;
+}
+
+/*
+ * Read the next record of a snapshot into @policy.
+ * Return 1 on success, 0 at the end of the snapshot,
+ * and -1 if the record is invalid.
+ */
+static int
+read_policy(FILE *f, struct ggu_policy *policy)
+{
+	uint8_t hdr[2];
+	uint32_t params[GK_SNAPSHOT_MAX_PARAMS];
+	unsigned int num_params;
+	void *addrs;
+	size_t addrs_len;
+
+	if (fread(hdr, sizeof(hdr), 1, f) != 1)
+		return feof(f) ? 0 : -1;
+
+	memset(policy, 0, sizeof(*policy));
+	policy->state = hdr[0];
+	if (hdr[1] == 4) {
+		policy->flow.proto = ETHER_TYPE_IPv4;
+		addrs = &policy->flow.f.v4;
+		addrs_len = sizeof(policy->flow.f.v4);
+	} else if (hdr[1] == 6) {
+		policy->flow.proto = ETHER_TYPE_IPv6;
+		addrs = &policy->flow.f.v6;
+		addrs_len = sizeof(policy->flow.f.v6);
+	} else
+		return -1;
+
+	if (policy->state == GK_GRANTED)
+		num_params = 4;
+	else if (policy->state == GK_DECLINED)
+		num_params = 1;
+	else
+		return -1;
+
+	if (fread(addrs, addrs_len, 1, f) != 1 ||
+			fread(params, sizeof(params[0]) * num_params,
+				1, f) != 1)
+		return -1;
+
+	if (policy->state == GK_GRANTED) {
+		policy->params.u.granted.tx_rate_kb_sec =
+			rte_be_to_cpu_32(params[0]);
+		policy->params.u.granted.cap_expire_sec =
+			rte_be_to_cpu_32(params[1]);
+		policy->params.u.granted.next_renewal_ms =
+			rte_be_to_cpu_32(params[2]);
+		policy->params.u.granted.renewal_step_ms =
+			rte_be_to_cpu_32(params[3]);
+	} else {
+		policy->params.u.declined.expire_sec =
+			rte_be_to_cpu_32(params[0]);
+	}
+	return 1;
+}
+
+/*
+ * Load the snapshot @path into the flow tables of the GK blocks.
+ * Each flow goes to the GK block that receives its packets,
+ * as the decisions of the GK-GT unit do, and the lifetimes
+ * of the snapshot start counting again now.
+ *
+ * The import waits for congested mailboxes of GK blocks to drain,
+ * so it doesn't crowd out the decisions of the GK-GT unit.
+ * This function must not run at the lcore of a GK block.
+ */
+int
+gk_import_flows(struct gk_config *gk_conf, const char *path)
+{
+	int i;
+	int ret;
+	unsigned int num_read = 0;
+	unsigned int num_dropped = 0;
+	char magic[GK_SNAPSHOT_MAGIC_LEN];
+	struct ggu_policy policy;
+	struct mb_stage *stages;
+	FILE *f = fopen(path, "rb");
+
+	if (f == NULL) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: cannot open the flow snapshot %s\n", path);
+		return -1;
+	}
+
+	if (fread(magic, sizeof(magic), 1, f) != 1 ||
+			memcmp(magic, GK_SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: %s is not a flow snapshot\n", path);
+		fclose(f);
+		return -1;
+	}
+
+	stages = rte_calloc_socket("gk_import_stages", gk_conf->num_lcores,
+		sizeof(*stages), 0, rte_socket_id());
+	if (stages == NULL) {
+		RTE_LOG(ERR, MALLOC,
+			"gk: cannot allocate memory to import flows\n");
+		fclose(f);
+		return -1;
+	}
+	for (i = 0; i < gk_conf->num_lcores; i++)
+		mb_stage_init(&stages[i], &gk_conf->instances[i].mb);
+
+	while ((ret = read_policy(f, &policy)) > 0 && !exiting) {
+		struct mb_stage *st = &stages[
+			get_responsible_gk_idx(&policy.flow, gk_conf)];
+		struct gk_cmd_entry *entry;
+
+		num_read++;
+		if (st->mb->watermark != 0) {
+			while (mb_congested(st->mb) && !exiting)
+				rte_pause();
+		}
+
+		entry = mb_stage_alloc_entry(st);
+		if (entry == NULL) {
+			num_dropped++;
+			continue;
+		}
+
+		entry->op = GGU_POLICY_ADD;
+		rte_memcpy(&entry->u.ggu, &policy, sizeof(entry->u.ggu));
+		mb_stage_send_entry(st, entry);
+	}
+
+	for (i = 0; i < gk_conf->num_lcores; i++) {
+		mb_stage_flush(&stages[i]);
+		mb_stage_release(&stages[i]);
+	}
+	rte_free(stages);
+	fclose(f);
+
+	if (ret < 0) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: invalid record after %u flows of the flow snapshot %s\n",
+			num_read, path);
+		return -1;
+	}
+
+	RTE_LOG(NOTICE, GATEKEEPER,
+		"gk: imported %u flows from %s (%u dropped)\n",
+		num_read - num_dropped, path, num_dropped);
+	return 0;
+}
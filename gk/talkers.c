@@ -0,0 +1,510 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+
+#include <rte_log.h>
+#include <rte_jhash.h>
+#include <rte_malloc.h>
+#include <rte_memcpy.h>
+
+#include "gatekeeper_gk.h"
+#include "gatekeeper_stats.h"
+#include "talkers.h"
+
+/*
+ * XXX Sample parameter: how many times a report tries to read
+ * the list of a summary between two updates of its GK block.
+ */
+#define GK_TALKERS_READ_TRIES (1000)
+
+#define GK_TALKERS_INDEX_MASK (GK_TALKERS_INDEX_SLOTS - 1)
+
+struct gk_talkers *
+gk_talkers_alloc(unsigned int lcore_id)
+{
+	RTE_BUILD_BUG_ON(GK_TALKERS_WIDTH & (GK_TALKERS_WIDTH - 1));
+	RTE_BUILD_BUG_ON(GK_TALKERS_TOP > UINT8_MAX);
+	return stats_alloc("gk_talkers", lcore_id, sizeof(struct gk_talkers));
+}
+
+void
+gk_talkers_free(unsigned int lcore_id)
+{
+	stats_free("gk_talkers", lcore_id);
+}
+
+static inline void
+fill_key(struct gk_talker_key *key, const struct ip_flow *flow, bool dst)
+{
+	key->words[0] = flow->proto;
+	key->words[1] = 0;
+	key->words[2] = 0;
+	if (flow->proto == ETHER_TYPE_IPv4)
+		rte_memcpy(&key->words[1],
+			dst ? &flow->f.v4.dst : &flow->f.v4.src,
+			sizeof(flow->f.v4.src));
+	else
+		rte_memcpy(&key->words[1],
+			dst ? flow->f.v6.dst : flow->f.v6.src,
+			sizeof(flow->f.v6.src));
+}
+
+static inline bool
+keys_equal(const struct gk_talker_key *a, const struct gk_talker_key *b)
+{
+	return a->words[0] == b->words[0] && a->words[1] == b->words[1] &&
+		a->words[2] == b->words[2];
+}
+
+static inline uint64_t
+hash_key(const struct gk_talker_key *key)
+{
+	uint32_t h1 = 0;
+	uint32_t h2 = 0;
+
+	rte_jhash_32b_2hashes((const uint32_t *)key->words,
+		sizeof(*key) / sizeof(uint32_t), &h1, &h2);
+	return ((uint64_t)h2 << 32) | h1;
+}
+
+/* The counter of row @row of the sketch for @hash. */
+static inline uint32_t
+sketch_col(uint64_t hash, unsigned int row)
+{
+	uint32_t h1 = (uint32_t)hash;
+	uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+
+	return (h1 + row * h2) & (GK_TALKERS_WIDTH - 1);
+}
+
+/* Count @weight for @hash in the sketch, and return its new estimate. */
+static inline uint64_t
+sketch_add(struct gk_talkers_summary *s, uint64_t hash, uint64_t weight)
+{
+	unsigned int row;
+	uint64_t estimate = UINT64_MAX;
+
+	for (row = 0; row < GK_TALKERS_DEPTH; row++) {
+		uint64_t *counter = &s->sketch[row][sketch_col(hash, row)];
+
+		*counter += weight;
+		if (*counter < estimate)
+			estimate = *counter;
+	}
+	return estimate;
+}
+
+static uint64_t
+sketch_estimate(const struct gk_talkers_summary *s, uint64_t hash)
+{
+	unsigned int row;
+	uint64_t estimate = UINT64_MAX;
+
+	for (row = 0; row < GK_TALKERS_DEPTH; row++)
+		estimate = RTE_MIN(estimate,
+			s->sketch[row][sketch_col(hash, row)]);
+	return estimate;
+}
+
+static int
+find_top(const struct gk_talkers_summary *s, const struct gk_talker_key *key,
+	uint64_t hash)
+{
+	uint32_t slot;
+
+	for (slot = hash & GK_TALKERS_INDEX_MASK; s->index[slot] != 0;
+			slot = (slot + 1) & GK_TALKERS_INDEX_MASK) {
+		int pos = s->index[slot] - 1;
+
+		if (keys_equal(&s->top[pos].key, key))
+			return pos;
+	}
+	return -1;
+}
+
+static void
+index_insert(struct gk_talkers_summary *s, unsigned int pos)
+{
+	uint32_t slot = s->top[pos].hash & GK_TALKERS_INDEX_MASK;
+
+	while (s->index[slot] != 0)
+		slot = (slot + 1) & GK_TALKERS_INDEX_MASK;
+	s->index[slot] = pos + 1;
+}
+
+/*
+ * Remove the entry @pos of @s from the index, and move back
+ * the entries after it that would no longer be found.
+ */
+static void
+index_remove(struct gk_talkers_summary *s, unsigned int pos)
+{
+	uint32_t hole = s->top[pos].hash & GK_TALKERS_INDEX_MASK;
+	uint32_t slot;
+
+	while (s->index[hole] != pos + 1)
+		hole = (hole + 1) & GK_TALKERS_INDEX_MASK;
+
+	slot = hole;
+	while (true) {
+		uint32_t home;
+
+		slot = (slot + 1) & GK_TALKERS_INDEX_MASK;
+		if (s->index[slot] == 0)
+			break;
+
+		home = s->top[s->index[slot] - 1].hash & GK_TALKERS_INDEX_MASK;
+		if (((hole - home) & GK_TALKERS_INDEX_MASK) <
+				((slot - home) & GK_TALKERS_INDEX_MASK)) {
+			s->index[hole] = s->index[slot];
+			hole = slot;
+		}
+	}
+	s->index[hole] = 0;
+}
+
+static void
+find_min(struct gk_talkers_summary *s)
+{
+	uint64_t i;
+
+	s->min_idx = 0;
+	for (i = 1; i < s->num_top; i++)
+		if (s->top[i].count < s->top[s->min_idx].count)
+			s->min_idx = i;
+}
+
+static void
+summary_add(struct gk_talkers_summary *s, const struct gk_talker_key *key,
+	uint64_t weight)
+{
+	int pos;
+	uint64_t hash = hash_key(key);
+	uint64_t estimate = sketch_add(s, hash, weight);
+
+	s->total += weight;
+
+	/*
+	 * The estimate of an address of the list is always above
+	 * the smallest counter of the list, so the other addresses
+	 * do not need to be looked up.
+	 */
+	if (s->num_top == GK_TALKERS_TOP &&
+			estimate <= s->top[s->min_idx].count)
+		return;
+
+	pos = find_top(s, key, hash);
+	if (pos >= 0) {
+		s->top[pos].count += weight;
+		if ((uint64_t)pos == s->min_idx)
+			find_min(s);
+		return;
+	}
+
+	if (s->num_top < GK_TALKERS_TOP) {
+		/* Until the list is full, it has all addresses. */
+		pos = s->num_top++;
+		s->top[pos].key = *key;
+		s->top[pos].count = weight;
+		s->top[pos].error = 0;
+		s->top[pos].hash = hash;
+		index_insert(s, pos);
+		if (pos == 0 || weight < s->top[s->min_idx].count)
+			s->min_idx = pos;
+		return;
+	}
+
+	/* Replace the smallest counter, counting from the estimate. */
+	pos = s->min_idx;
+	index_remove(s, pos);
+	s->top[pos].key = *key;
+	s->top[pos].count = estimate;
+	s->top[pos].error = estimate - weight;
+	s->top[pos].hash = hash;
+	index_insert(s, pos);
+	find_min(s);
+}
+
+/*
+ * Count the sources, or the destinations if @dst is true, of @flows.
+ * Consecutive flows of a burst often share addresses, so each run of
+ * an address is counted at once.
+ */
+static void
+add_addrs(struct gk_talkers_summary *s, const struct ip_flow **flows,
+	unsigned int num_flows, bool dst)
+{
+	unsigned int i;
+	uint64_t weight = 1;
+	struct gk_talker_key key;
+
+	if (num_flows == 0)
+		return;
+
+	s->seq++;
+	rte_smp_wmb();
+
+	fill_key(&key, flows[0], dst);
+	for (i = 1; i < num_flows; i++) {
+		struct gk_talker_key next;
+
+		fill_key(&next, flows[i], dst);
+		if (keys_equal(&next, &key)) {
+			weight++;
+			continue;
+		}
+		summary_add(s, &key, weight);
+		key = next;
+		weight = 1;
+	}
+	summary_add(s, &key, weight);
+
+	rte_smp_wmb();
+	s->seq++;
+}
+
+/* Count the sources and the destinations of a burst of packets. */
+void
+gk_talkers_add_pkts(struct gk_talkers *talkers,
+	const struct ipacket *packets, unsigned int num_pkts)
+{
+	unsigned int i;
+	const struct ip_flow *flows[GATEKEEPER_MAX_PKT_BURST];
+
+	RTE_VERIFY(num_pkts <= GATEKEEPER_MAX_PKT_BURST);
+	for (i = 0; i < num_pkts; i++)
+		flows[i] = &packets[i].flow;
+
+	add_addrs(&talkers->srcs, flows, num_pkts, false);
+	add_addrs(&talkers->dsts, flows, num_pkts, true);
+}
+
+/* Count the destinations of the new flow entries of a burst. */
+void
+gk_talkers_add_flows(struct gk_talkers *talkers,
+	const struct ip_flow **flows, unsigned int num_flows)
+{
+	add_addrs(&talkers->dst_flows, flows, num_flows, true);
+}
+
+static int
+cmp_talkers(const void *a, const void *b)
+{
+	const struct gk_talker *ta = a;
+	const struct gk_talker *tb = b;
+
+	if (ta->count == tb->count)
+		return 0;
+	return ta->count > tb->count ? -1 : 1;
+}
+
+/*
+ * Add the summary @src into @dst; both must be summaries of
+ * the same kind. The list of @dst ends sorted by decreasing counts.
+ *
+ * An address missing from a full list may have been counted up to
+ * the smallest counter of that list, so its bounds are widened by it.
+ */
+void
+gk_talkers_merge(struct gk_talkers_summary *dst,
+	const struct gk_talkers_summary *src)
+{
+	unsigned int row, col;
+	uint64_t i;
+	unsigned int num_cands = 0;
+	struct gk_talker cands[2 * GK_TALKERS_TOP];
+	bool matched[GK_TALKERS_TOP] = { false };
+	uint64_t dst_min = dst->num_top == GK_TALKERS_TOP
+		? dst->top[dst->min_idx].count : 0;
+	uint64_t src_min = src->num_top == GK_TALKERS_TOP
+		? src->top[src->min_idx].count : 0;
+
+	for (row = 0; row < GK_TALKERS_DEPTH; row++)
+		for (col = 0; col < GK_TALKERS_WIDTH; col++)
+			dst->sketch[row][col] += src->sketch[row][col];
+	dst->total += src->total;
+
+	for (i = 0; i < dst->num_top; i++) {
+		struct gk_talker *cand = &cands[num_cands++];
+		int pos = find_top(src, &dst->top[i].key, dst->top[i].hash);
+
+		*cand = dst->top[i];
+		if (pos >= 0) {
+			cand->count += src->top[pos].count;
+			cand->error += src->top[pos].error;
+			matched[pos] = true;
+		} else {
+			cand->count += src_min;
+			cand->error += src_min;
+		}
+	}
+
+	for (i = 0; i < src->num_top; i++) {
+		struct gk_talker *cand;
+
+		if (matched[i])
+			continue;
+		cand = &cands[num_cands++];
+		*cand = src->top[i];
+		cand->count += dst_min;
+		cand->error += dst_min;
+	}
+
+	qsort(cands, num_cands, sizeof(cands[0]), cmp_talkers);
+	dst->num_top = RTE_MIN(num_cands, (unsigned int)GK_TALKERS_TOP);
+	memset(dst->index, 0, sizeof(dst->index));
+	for (i = 0; i < dst->num_top; i++) {
+		dst->top[i] = cands[i];
+		index_insert(dst, i);
+	}
+	dst->min_idx = dst->num_top > 0 ? dst->num_top - 1 : 0;
+}
+
+/* Copy the summary @src, which its GK block keeps writing, to @dst. */
+static int
+read_summary(struct gk_talkers_summary *dst,
+	const struct gk_talkers_summary *src)
+{
+	unsigned int i;
+	const volatile uint64_t *seq = &src->seq;
+
+	for (i = 0; i < GK_TALKERS_READ_TRIES; i++) {
+		uint64_t begin = *seq;
+
+		if (begin & 1) {
+			rte_pause();
+			continue;
+		}
+
+		rte_smp_rmb();
+		stats_read(dst, src, offsetof(struct gk_talkers_summary,
+			sketch));
+		rte_smp_rmb();
+		if (*seq == begin) {
+			stats_read(dst->sketch, src->sketch,
+				sizeof(dst->sketch));
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static void
+write_summary(FILE *f, const char *label, const struct gk_talkers_summary *s)
+{
+	uint64_t i;
+
+	fprintf(f, "%s total %" PRIu64 "\n", label, s->total);
+	for (i = 0; i < s->num_top; i++) {
+		const struct gk_talker *t = &s->top[i];
+		char addr[INET6_ADDRSTRLEN];
+		uint64_t upper = RTE_MIN(t->count,
+			sketch_estimate(s, t->hash));
+		uint64_t lower = RTE_MIN(t->count - t->error, upper);
+
+		if (inet_ntop(t->key.words[0] == ETHER_TYPE_IPv4
+				? AF_INET : AF_INET6, &t->key.words[1],
+				addr, sizeof(addr)) == NULL)
+			continue;
+		fprintf(f, "%s %s %" PRIu64 " %" PRIu64 "\n",
+			label, addr, upper, lower);
+	}
+}
+
+/*
+ * Merge the top talkers of the GK blocks, and write them to @path.
+ *
+ * Each line of the report is "<kind> <address> <at most> <at least>",
+ * where the kinds are "src" and "dst" for packets, and "dst_flows" for
+ * the new flows of the destinations, after a line
+ * "<kind> total <count>" for each kind.
+ */
+int
+gk_report_talkers(struct gk_config *gk_conf, const char *path)
+{
+	int i;
+	int ret = -1;
+	FILE *f;
+	struct gk_talkers *merged;
+	struct gk_talkers_summary *copy;
+
+	if (!gk_conf->track_talkers) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: the GK blocks do not track top talkers\n");
+		return -1;
+	}
+
+	merged = rte_zmalloc("gk_talkers_merged", sizeof(*merged), 0);
+	copy = rte_malloc("gk_talkers_copy", sizeof(*copy), 0);
+	if (merged == NULL || copy == NULL) {
+		RTE_LOG(ERR, MALLOC,
+			"gk: cannot allocate memory to report top talkers\n");
+		goto free;
+	}
+
+	for (i = 0; i < gk_conf->num_lcores; i++) {
+		struct gk_talkers *talkers = gk_conf->instances[i].talkers;
+		struct {
+			struct gk_talkers_summary *dst;
+			const struct gk_talkers_summary *src;
+		} summaries[] = {
+			{ &merged->srcs, &talkers->srcs },
+			{ &merged->dsts, &talkers->dsts },
+			{ &merged->dst_flows, &talkers->dst_flows },
+		};
+		unsigned int j;
+
+		for (j = 0; j < RTE_DIM(summaries); j++) {
+			if (read_summary(copy, summaries[j].src) < 0) {
+				RTE_LOG(WARNING, GATEKEEPER,
+					"gk: the top talkers of the GK block at lcore %u changed too fast to be read\n",
+					gk_conf->lcores[i]);
+				continue;
+			}
+			gk_talkers_merge(summaries[j].dst, copy);
+		}
+	}
+
+	f = fopen(path, "w");
+	if (f == NULL) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: cannot create the top talkers report %s\n", path);
+		goto free;
+	}
+	write_summary(f, "src", &merged->srcs);
+	write_summary(f, "dst", &merged->dsts);
+	write_summary(f, "dst_flows", &merged->dst_flows);
+	if (fclose(f) != 0) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gk: cannot write the top talkers report %s\n", path);
+		goto free;
+	}
+	ret = 0;
+
+free:
+	rte_free(copy);
+	rte_free(merged);
+	return ret;
+}
@@ -0,0 +1,104 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GATEKEEPER_GK_TALKERS_H_
+#define _GATEKEEPER_GK_TALKERS_H_
+
+#include <stdint.h>
+
+#include "gatekeeper_flow.h"
+#include "gatekeeper_net.h"
+
+/*
+ * The top talkers of a GK instance: the sources and the destinations
+ * with the most packets, and the destinations with the most new flows,
+ * i.e. about the most sources.
+ *
+ * Each of them is a summary made of a count-min sketch, which bounds
+ * the count of any address from above, and a space-saving list of the
+ * GK_TALKERS_TOP heaviest addresses. Only the addresses whose estimates
+ * in the sketch beat the smallest counter of the list are looked up
+ * in the list, so a flood of spoofed sources only costs the sketch.
+ *
+ * The memory of the summaries is fixed, and they live in the memzone
+ * "gk_talkers_stats_<lcore id>" (see stats_alloc()), which only
+ * the lcore of the GK instance writes. Readers take @seq as a sequence
+ * lock around the list; the counters of the sketch are never torn.
+ * The summaries of the GK instances are merged with gk_talkers_merge()
+ * into a report; see gk_report_talkers().
+ */
+
+/* XXX Sample parameters, need to be tested for better performance. */
+#define GK_TALKERS_TOP   (64)
+#define GK_TALKERS_DEPTH (4)
+#define GK_TALKERS_WIDTH (1024)
+
+/* The slots of the index of the list; a power of 2. */
+#define GK_TALKERS_INDEX_SLOTS (2 * GK_TALKERS_TOP)
+
+/* The protocol of the address, and the address. */
+struct gk_talker_key {
+	uint64_t words[3];
+};
+
+struct gk_talker {
+	struct gk_talker_key key;
+	/*
+	 * The count of @key is at most @count,
+	 * and at least @count - @error.
+	 */
+	uint64_t             count;
+	uint64_t             error;
+	/* The hash of @key that places it in the index. */
+	uint64_t             hash;
+};
+
+struct gk_talkers_summary {
+	/* Odd while the fields up to @index are written. */
+	uint64_t         seq;
+	/* The counts of all addresses. */
+	uint64_t         total;
+
+	uint64_t         num_top;
+	/* The entry of @top with the smallest count. */
+	uint64_t         min_idx;
+	struct gk_talker top[GK_TALKERS_TOP];
+	/* The entries of @top by the hashes of their keys, plus one. */
+	uint8_t          index[GK_TALKERS_INDEX_SLOTS];
+
+	uint64_t         sketch[GK_TALKERS_DEPTH][GK_TALKERS_WIDTH];
+};
+
+struct gk_talkers {
+	/* Packets per source and per destination. */
+	struct gk_talkers_summary srcs;
+	struct gk_talkers_summary dsts;
+	/* New flow entries per destination. */
+	struct gk_talkers_summary dst_flows;
+};
+
+struct gk_talkers *gk_talkers_alloc(unsigned int lcore_id);
+void gk_talkers_free(unsigned int lcore_id);
+void gk_talkers_add_pkts(struct gk_talkers *talkers,
+	const struct ipacket *packets, unsigned int num_pkts);
+void gk_talkers_add_flows(struct gk_talkers *talkers,
+	const struct ip_flow **flows, unsigned int num_flows);
+void gk_talkers_merge(struct gk_talkers_summary *dst,
+	const struct gk_talkers_summary *src);
+
+#endif /* _GATEKEEPER_GK_TALKERS_H_ */
@@ -0,0 +1,143 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <rte_malloc.h>
+
+#include "gatekeeper_main.h"
+#include "wheel.h"
+
+struct gk_wheel *
+gk_wheel_create(uint64_t now, int socket_id)
+{
+	unsigned int i;
+	struct gk_wheel *wheel = rte_malloc_socket("gk_wheel",
+		sizeof(*wheel), 0, socket_id);
+
+	if (wheel == NULL)
+		return NULL;
+
+	wheel->tick_cycles = GK_WHEEL_TICK_MS * cycles_per_ms;
+	wheel->cur_tick = now / wheel->tick_cycles;
+	for (i = 0; i < RTE_DIM(wheel->heads); i++)
+		wheel->heads[i] = GK_WHEEL_NO_ENTRY;
+	return wheel;
+}
+
+void
+gk_wheel_destroy(struct gk_wheel *wheel)
+{
+	rte_free(wheel);
+}
+
+/* Schedule flow entry @idx at @deadline, in cycles. */
+void
+gk_wheel_add(struct gk_wheel *wheel, struct flow_entry *entries,
+	uint32_t idx, uint64_t deadline)
+{
+	uint32_t slot;
+	uint64_t tick = deadline / wheel->tick_cycles;
+	struct flow_entry *fe = &entries[idx];
+
+	if (fe->timer_slot != GK_WHEEL_NO_SLOT)
+		gk_wheel_del(wheel, entries, idx);
+
+	if (tick < wheel->cur_tick)
+		tick = wheel->cur_tick;
+
+	if (tick - wheel->cur_tick < GK_WHEEL_SLOTS)
+		slot = tick & GK_WHEEL_MASK;
+	else if (tick - wheel->cur_tick < GK_WHEEL_SLOTS * GK_WHEEL_SLOTS)
+		slot = GK_WHEEL_SLOTS + ((tick >> GK_WHEEL_BITS) &
+			GK_WHEEL_MASK);
+	else {
+		/* The last slot of the second level to be run in this lap. */
+		slot = GK_WHEEL_SLOTS + (((wheel->cur_tick >> GK_WHEEL_BITS)
+			- 1) & GK_WHEEL_MASK);
+	}
+
+	fe->timer_prev = GK_WHEEL_NO_ENTRY;
+	fe->timer_next = wheel->heads[slot];
+	if (fe->timer_next != GK_WHEEL_NO_ENTRY)
+		entries[fe->timer_next].timer_prev = idx;
+	wheel->heads[slot] = idx;
+	fe->timer_slot = slot + 1;
+}
+
+void
+gk_wheel_del(struct gk_wheel *wheel, struct flow_entry *entries,
+	uint32_t idx)
+{
+	struct flow_entry *fe = &entries[idx];
+
+	if (fe->timer_slot == GK_WHEEL_NO_SLOT)
+		return;
+
+	if (fe->timer_prev == GK_WHEEL_NO_ENTRY)
+		wheel->heads[fe->timer_slot - 1] = fe->timer_next;
+	else
+		entries[fe->timer_prev].timer_next = fe->timer_next;
+	if (fe->timer_next != GK_WHEEL_NO_ENTRY)
+		entries[fe->timer_next].timer_prev = fe->timer_prev;
+	fe->timer_slot = GK_WHEEL_NO_SLOT;
+}
+
+static inline int32_t
+pop_slot(struct gk_wheel *wheel, struct flow_entry *entries, uint32_t slot)
+{
+	uint32_t idx = wheel->heads[slot];
+
+	gk_wheel_del(wheel, entries, idx);
+	return idx;
+}
+
+/*
+ * Remove from @wheel and return the index of a flow entry whose timer
+ * is due at @now, or -1 if there is none. The caller either removes
+ * the entry or schedules it again.
+ *
+ * The entries of a slot of the second level are also returned when
+ * the slot is run, so that they are scheduled in the first level.
+ * Each call does a bounded amount of work, except for skipping
+ * the empty slots of the ticks that have passed.
+ */
+int32_t
+gk_wheel_pop_due(struct gk_wheel *wheel, struct flow_entry *entries,
+	uint64_t now)
+{
+	uint64_t now_tick = now / wheel->tick_cycles;
+
+	/* A tick is only run once it is over. */
+	while (wheel->cur_tick < now_tick) {
+		uint32_t slot = wheel->cur_tick & GK_WHEEL_MASK;
+
+		if (slot == 0) {
+			uint32_t upper = GK_WHEEL_SLOTS +
+				((wheel->cur_tick >> GK_WHEEL_BITS) &
+				GK_WHEEL_MASK);
+			if (wheel->heads[upper] != GK_WHEEL_NO_ENTRY)
+				return pop_slot(wheel, entries, upper);
+		}
+
+		if (wheel->heads[slot] != GK_WHEEL_NO_ENTRY)
+			return pop_slot(wheel, entries, slot);
+
+		wheel->cur_tick++;
+	}
+
+	return -1;
+}
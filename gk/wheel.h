@@ -0,0 +1,79 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GATEKEEPER_GK_WHEEL_H_
+#define _GATEKEEPER_GK_WHEEL_H_
+
+#include <stdint.h>
+
+#include "flow.h"
+
+/*
+ * The timer wheel of a flow table finds the flow entries that
+ * may have expired without looking at the other entries.
+ *
+ * It has two levels of GK_WHEEL_SLOTS slots: a slot of the first level
+ * holds the entries due in one tick, and a slot of the second level
+ * holds the entries due in GK_WHEEL_SLOTS ticks, which are moved to
+ * the first level when their turn comes. Entries due after the range of
+ * the second level wait in its last slot of the current lap.
+ *
+ * The timers are lazy: an entry whose lifetime is extended (e.g. a
+ * flow in request state that keeps sending packets) is not moved,
+ * but rescheduled when its old timer is due. Only timers that are
+ * brought forward must be rescheduled with gk_wheel_add() right away.
+ *
+ * The slots are lists of flow entries linked through the indices of
+ * the flow table, so the wheel needs no memory per entry.
+ */
+
+#define GK_WHEEL_BITS  (8)
+#define GK_WHEEL_SLOTS (1 << GK_WHEEL_BITS)
+#define GK_WHEEL_MASK  (GK_WHEEL_SLOTS - 1)
+
+/* XXX Sample parameter: the duration of a tick of the timer wheels. */
+#define GK_WHEEL_TICK_MS (1)
+
+/* Marks the end of the list of a slot. */
+#define GK_WHEEL_NO_ENTRY (UINT32_MAX)
+
+/*
+ * Value of @timer_slot of a flow entry that is not in a slot;
+ * the slot s of the wheel is kept as s + 1, so zeroed entries
+ * are not in the wheel.
+ */
+#define GK_WHEEL_NO_SLOT (0)
+
+struct gk_wheel {
+	uint64_t tick_cycles;
+	/* The next tick to be run; all ticks before it have run. */
+	uint64_t cur_tick;
+	/* The heads of the slots of both levels, first level first. */
+	uint32_t heads[2 * GK_WHEEL_SLOTS];
+};
+
+struct gk_wheel *gk_wheel_create(uint64_t now, int socket_id);
+void gk_wheel_destroy(struct gk_wheel *wheel);
+void gk_wheel_add(struct gk_wheel *wheel, struct flow_entry *entries,
+	uint32_t idx, uint64_t deadline);
+void gk_wheel_del(struct gk_wheel *wheel, struct flow_entry *entries,
+	uint32_t idx);
+int32_t gk_wheel_pop_due(struct gk_wheel *wheel, struct flow_entry *entries,
+	uint64_t now);
+
+#endif /* _GATEKEEPER_GK_WHEEL_H_ */
@@ -22,9 +22,12 @@
 #include <lauxlib.h>
 
 #include <rte_log.h>
+#include <rte_hash.h>
 #include <rte_ether.h>
 #include <rte_lcore.h>
+#include <rte_cycles.h>
 #include <rte_malloc.h>
+#include <rte_prefetch.h>
 
 #include "gatekeeper_ggu.h"
 #include "gatekeeper_ipip.h"
@@ -34,11 +37,21 @@
 #include "gatekeeper_net.h"
 #include "gatekeeper_launch.h"
 #include "gatekeeper_lls.h"
+#include "gatekeeper_log.h"
+#include "luajit-ffi-cdata.h"
 
 /* TODO Get the install-path via Makefile. */
 #define LUA_POLICY_BASE_DIR "./lua"
 #define GRANTOR_CONFIG_FILE "policy.lua"
 
+#ifdef RTE_MACHINE_CPUFLAG_SSE4_2
+#include <rte_hash_crc.h>
+#define DEFAULT_HASH_FUNC rte_hash_crc
+#else
+#include <rte_jhash.h>
+#define DEFAULT_HASH_FUNC rte_jhash
+#endif
+
 static int
 get_block_idx(struct gt_config *gt_conf, unsigned int lcore_id)
 {
@@ -55,16 +68,16 @@ static int
 gt_setup_rss(struct gt_config *gt_conf)
 {
 	int i;
-	uint8_t port_in = gt_conf->net->front.id;
 	uint16_t gt_queues[gt_conf->num_lcores];
 
 	for (i = 0; i < gt_conf->num_lcores; i++)
 		gt_queues[i] = gt_conf->instances[i].rx_queue;
 
-	return gatekeeper_setup_rss(port_in, gt_queues, gt_conf->num_lcores);
+	return gatekeeper_setup_rss(&gt_conf->net->front, gt_queues,
+		gt_conf->num_lcores);
 }
 
-static int
+int
 gt_parse_incoming_pkt(struct rte_mbuf *pkt, struct gt_packet_headers *info)
 {
 	uint8_t inner_ip_ver;
@@ -85,6 +98,10 @@ gt_parse_incoming_pkt(struct rte_mbuf *pkt, struct gt_packet_headers *info)
 		if (pkt->data_len < parsed_len + sizeof(struct ipv4_hdr))
 			return -1;
 
+		/* The NIC has already verified the outer checksum. */
+		if (unlikely(pkt->ol_flags & PKT_RX_IP_CKSUM_BAD))
+			return -1;
+
 		outer_ipv4_hdr = (struct ipv4_hdr *)info->outer_l3_hdr;
 		parsed_len += sizeof(struct ipv4_hdr);
 		info->priority = (outer_ipv4_hdr->type_of_service >> 2);
@@ -96,8 +113,9 @@ gt_parse_incoming_pkt(struct rte_mbuf *pkt, struct gt_packet_headers *info)
 
 		outer_ipv6_hdr = (struct ipv6_hdr *)info->outer_l3_hdr;
 		parsed_len += sizeof(struct ipv6_hdr);
-		info->priority = (((outer_ipv6_hdr->vtc_flow >> 20)
-			& 0xFF) >> 2);
+		/* The DSCP field is the top 6 bits of the traffic class. */
+		info->priority = (rte_be_to_cpu_32(
+			outer_ipv6_hdr->vtc_flow) >> 22) & 0x3F;
 		encasulated_proto = outer_ipv6_hdr->proto;
 		break;
 	default:
@@ -144,10 +162,121 @@ gt_parse_incoming_pkt(struct rte_mbuf *pkt, struct gt_packet_headers *info)
 	return 0;
 }
 
+static inline void
+fill_decision_key(struct gt_decision_key *key,
+	struct gt_packet_headers *pkt_info, struct ggu_policy *policy)
+{
+	memset(key, 0, sizeof(*key));
+	rte_memcpy(&key->flow, &policy->flow, sizeof(key->flow));
+	key->l4_proto = pkt_info->l4_proto;
+	if (!get_l4_dst_port(pkt_info, &key->dst_port))
+		key->dst_port = 0;
+}
+
+/*
+ * Keep a decision of the Lua policy for as long as
+ * the capability, or the decline, that it grants.
+ */
+static void
+cache_decision(struct gt_instance *instance, struct gt_decision_key *key,
+	struct ggu_policy *policy, uint64_t now)
+{
+	int ret;
+	uint32_t ttl_sec = policy->state == GK_GRANTED
+		? policy->params.u.granted.cap_expire_sec
+		: policy->params.u.declined.expire_sec;
+
+	if (ttl_sec == 0)
+		return;
+
+	ret = rte_hash_add_key(instance->decision_cache, key);
+	if (unlikely(ret == -ENOSPC)) {
+		/*
+		 * The cache is full of decisions of flows that may
+		 * be long gone, so start over instead of looking
+		 * for expired decisions.
+		 */
+		rte_hash_reset(instance->decision_cache);
+		ret = rte_hash_add_key(instance->decision_cache, key);
+	}
+	if (ret < 0)
+		return;
+
+	rte_memcpy(&instance->cached_decisions[ret].policy, policy,
+		sizeof(*policy));
+	instance->cached_decisions[ret].expire_at =
+		now + ttl_sec * cycles_per_sec;
+}
+
+static inline struct gt_recent_decision *
+recent_decision_slot(struct gt_instance *instance,
+	const struct ip_flow *flow)
+{
+	return &instance->recent_decisions[rss_ip_flow_hf(flow, 0, 0) &
+		instance->recent_decisions_mask];
+}
+
+/*
+ * Get the addresses of the outer header of @pkt_info, whose source
+ * identifies the Gatekeeper server that sent the request.
+ */
+static inline void
+get_outer_flow(const struct gt_packet_headers *pkt_info,
+	struct ip_flow *outer)
+{
+	memset(outer, 0, sizeof(*outer));
+	outer->proto = pkt_info->outer_ip_ver;
+	if (outer->proto == ETHER_TYPE_IPv4) {
+		const struct ipv4_hdr *ip4_hdr = pkt_info->outer_l3_hdr;
+
+		outer->f.v4.src = ip4_hdr->src_addr;
+		outer->f.v4.dst = ip4_hdr->dst_addr;
+	} else {
+		const struct ipv6_hdr *ip6_hdr = pkt_info->outer_l3_hdr;
+
+		rte_memcpy(outer->f.v6.src, ip6_hdr->src_addr,
+			sizeof(outer->f.v6.src));
+		rte_memcpy(outer->f.v6.dst, ip6_hdr->dst_addr,
+			sizeof(outer->f.v6.dst));
+	}
+}
+
+/*
+ * Keep @policy, which is about to be sent to the Gatekeeper server
+ * that sent the request of @pkt_info.
+ */
+static inline void
+remember_decision(struct gt_instance *instance,
+	struct ggu_policy *policy, const struct gt_packet_headers *pkt_info,
+	uint64_t now)
+{
+	struct gt_recent_decision *recent =
+		recent_decision_slot(instance, &policy->flow);
+
+	rte_memcpy(&recent->policy, policy, sizeof(recent->policy));
+	get_outer_flow(pkt_info, &recent->outer);
+	recent->decided_at = now;
+}
+
+/* The return of lookup_compiled_decision() for recent decisions. */
+#define GT_DECISION_RECENT (1)
+
+/*
+ * Look up the decision for @pkt_info in the recent decisions,
+ * in the compiled simple policy, and then in the cache of decisions
+ * of the Lua policy.
+ *
+ * Return 0 if there is a decision in @policy, GT_DECISION_RECENT if
+ * the decision in @policy has already been sent to the Gatekeeper
+ * server, or -ENOENT if the Lua policy has to make the decision.
+ */
 static int
-lookup_policy_decision(struct gt_packet_headers *pkt_info,
-	struct ggu_policy *policy, struct gt_instance *instance)
+lookup_compiled_decision(struct gt_packet_headers *pkt_info,
+	struct ggu_policy *policy, struct gt_instance *instance,
+	struct gt_config *gt_conf, uint64_t now)
 {
+	int ret;
+
 	policy->flow.proto = pkt_info->inner_ip_ver;
 	if (pkt_info->inner_ip_ver == ETHER_TYPE_IPv4) {
 		struct ipv4_hdr *ip4_hdr = (struct ipv4_hdr *)pkt_info->inner_l3_hdr;
@@ -165,15 +294,130 @@ lookup_policy_decision(struct gt_packet_headers *pkt_info,
 		rte_panic("Unexpected condition: gt block at lcore %u lookups policy decision for an non-IP packet!\n",
 			rte_lcore_id());
 
-	lua_getglobal(instance->lua_state, "lookup_policy");
-	lua_pushlightuserdata(instance->lua_state, pkt_info);
-	lua_pushlightuserdata(instance->lua_state, policy);
+	if (instance->recent_decisions != NULL) {
+		struct gt_recent_decision *recent =
+			recent_decision_slot(instance, &policy->flow);
+		struct ip_flow outer;
+
+		get_outer_flow(pkt_info, &outer);
+		if (now - recent->decided_at <
+					gt_conf->recent_decision_window_cycles &&
+				ip_flow_cmp_eq(&recent->policy.flow,
+					&policy->flow, 0) == 0 &&
+				ip_flow_cmp_eq(&recent->outer,
+					&outer, 0) == 0) {
+			policy->state = recent->policy.state;
+			rte_memcpy(&policy->params, &recent->policy.params,
+				sizeof(policy->params));
+			return GT_DECISION_RECENT;
+		}
+	}
 
-	if (lua_pcall(instance->lua_state, 2, 0, 0) != 0) {
-		RTE_LOG(ERR, GATEKEEPER,
-			"gt: error running function `lookup_policy': %s, at lcore %u\n",
-			lua_tostring(instance->lua_state, -1), rte_lcore_id());
-		return -1;
+	/* The compiled simple policy needs no call into Lua. */
+	if (lookup_simple_policy(instance->lua_policy.simple_policy,
+			pkt_info, policy) == 0)
+		return 0;
+
+	if (instance->decision_cache != NULL) {
+		struct gt_decision_key key;
+
+		fill_decision_key(&key, pkt_info, policy);
+		ret = rte_hash_lookup(instance->decision_cache, &key);
+		if (ret >= 0) {
+			struct gt_cached_decision *cached =
+				&instance->cached_decisions[ret];
+
+			if (likely(now < cached->expire_at)) {
+				policy->state = cached->policy.state;
+				rte_memcpy(&policy->params,
+					&cached->policy.params,
+					sizeof(policy->params));
+				return 0;
+			}
+		}
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * Let the Lua policy @lp decide the @num_pkts requests in @pkt_infos.
+ *
+ * When the policy defines lookup_policy_burst(), the whole burst
+ * goes through a single call into Lua; otherwise, lookup_policy()
+ * is called for each request.
+ */
+int
+lookup_lua_policy(struct gt_lua_policy *lp,
+	struct gt_packet_headers *pkt_infos, struct ggu_policy *policies,
+	unsigned int num_pkts)
+{
+	unsigned int i;
+	lua_State *l = lp->lua_state;
+
+	if (likely(lp->lua_burst)) {
+		void *cdata;
+
+		lua_getglobal(l, "lookup_policy_burst");
+		cdata = luaL_pushcdata(l, lp->ctypeid_pkt_info_ptr,
+			sizeof(struct gt_packet_headers *));
+		*(struct gt_packet_headers **)cdata = pkt_infos;
+		cdata = luaL_pushcdata(l, lp->ctypeid_policy_ptr,
+			sizeof(struct ggu_policy *));
+		*(struct ggu_policy **)cdata = policies;
+		lua_pushinteger(l, num_pkts);
+
+		if (lua_pcall(l, 3, 0, 0) != 0) {
+			RTE_LOG(ERR, GATEKEEPER,
+				"gt: error running function `lookup_policy_burst': %s, at lcore %u\n",
+				lua_tostring(l, -1), rte_lcore_id());
+			lua_pop(l, 1);
+			return -1;
+		}
+	} else {
+		for (i = 0; i < num_pkts; i++) {
+			lua_getglobal(l, "lookup_policy");
+			lua_pushlightuserdata(l, &pkt_infos[i]);
+			lua_pushlightuserdata(l, &policies[i]);
+
+			if (lua_pcall(l, 2, 0, 0) != 0) {
+				RTE_LOG(ERR, GATEKEEPER,
+					"gt: error running function `lookup_policy': %s, at lcore %u\n",
+					lua_tostring(l, -1), rte_lcore_id());
+				lua_pop(l, 1);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Let the Lua policy of @instance decide the @num_pkts requests
+ * in @pkt_infos, and cache its decisions.
+ */
+static int
+lookup_lua_decisions(struct gt_packet_headers *pkt_infos,
+	struct ggu_policy *policies, unsigned int num_pkts,
+	struct gt_instance *instance)
+{
+	unsigned int i;
+	uint64_t now;
+	int ret = lookup_lua_policy(&instance->lua_policy, pkt_infos,
+		policies, num_pkts);
+
+	if (ret < 0)
+		return ret;
+
+	if (instance->decision_cache != NULL) {
+		now = rte_rdtsc();
+		for (i = 0; i < num_pkts; i++) {
+			struct gt_decision_key key;
+
+			fill_decision_key(&key, &pkt_infos[i], &policies[i]);
+			cache_decision(instance, &key, &policies[i], now);
+		}
 	}
 
 	return 0;
@@ -192,60 +436,38 @@ is_valid_dest_addr(struct gt_config *gt_conf,
 			memcmp(((struct ipv6_hdr *)
 			pkt_info->outer_l3_hdr)->dst_addr,
 			gt_conf->net->front.ip6_addr.s6_addr,
-			sizeof(gt_conf->net->front.ip6_addr) == 0));
+			sizeof(gt_conf->net->front.ip6_addr)) == 0);
 }
 
 static void
 print_ip_err_msg(struct gt_packet_headers *pkt_info)
 {
-	char src[128];
-	char dst[128];
-
 	if (pkt_info->outer_ip_ver == ETHER_TYPE_IPv4) {
-		if (inet_ntop(AF_INET, &((struct ipv4_hdr *)
-				pkt_info->outer_l3_hdr)->src_addr,
-				src, sizeof(struct in_addr)) == NULL) {
-			RTE_LOG(ERR, GATEKEEPER, "gt: %s: failed to convert a number to an IPv4 address (%s)\n",
-				__func__, strerror(errno));
-			return;
-		}
-
-		if (inet_ntop(AF_INET, &((struct ipv4_hdr *)
-				pkt_info->outer_l3_hdr)->dst_addr,
-				dst, sizeof(struct in_addr)) == NULL) {
-			RTE_LOG(ERR, GATEKEEPER, "gt: %s: failed to convert a number to an IPv4 address (%s)\n",
-				__func__, strerror(errno));
-			return;
-		}
+		struct ipv4_hdr *ip4_hdr = pkt_info->outer_l3_hdr;
+		fast_log_ips(LOG_GT_NOT_DESTINED, ETHER_TYPE_IPv4,
+			&ip4_hdr->src_addr, &ip4_hdr->dst_addr);
 	} else {
-		if (inet_ntop(AF_INET6, &((struct ipv6_hdr *)
-				pkt_info->outer_l3_hdr)->src_addr,
-				src, sizeof(struct in6_addr)) == NULL) {
-			RTE_LOG(ERR, GATEKEEPER, "gt: %s: failed to convert a number to an IPv6 address (%s)\n",
-				__func__, strerror(errno));
-			return;
-		}
-
-		if (inet_ntop(AF_INET6, &((struct ipv6_hdr *)
-				pkt_info->outer_l3_hdr)->dst_addr,
-				dst, sizeof(struct in6_addr)) == NULL) {
-			RTE_LOG(ERR, GATEKEEPER, "gt: %s: failed to convert a number to an IPv6 address (%s)\n",
-				__func__, strerror(errno));
-			return;
-		}
+		struct ipv6_hdr *ip6_hdr = pkt_info->outer_l3_hdr;
+		fast_log_ips(LOG_GT_NOT_DESTINED, ETHER_TYPE_IPv6,
+			ip6_hdr->src_addr, ip6_hdr->dst_addr);
 	}
-
-	RTE_LOG(ALERT, GATEKEEPER,
-		"gt: receiving a packet with IP source address %s, and destination address %s, whose destination IP address is not the Grantor server itself.!\n",
-		src, dst);
 }
 
 static int
-fill_eth_hdr(struct rte_mbuf *m,
+fill_eth_hdr(struct rte_mbuf *m, struct gt_instance *instance,
 	struct gt_config *gt_conf, struct gt_packet_headers *pkt_info)
 {
 	uint16_t outer_ip_len;
 	struct ether_hdr *new_eth;
+	struct ether_addr gw_addr;
+	uint64_t gw_state = lls_nh_cache_get(instance->nh_cache,
+		pkt_info->inner_ip_ver == ETHER_TYPE_IPv4
+			? GT_NH_GW_IP4 : GT_NH_GW_IP6,
+		&gw_addr);
+
+	/* The gateway has not been resolved yet. */
+	if (unlikely(!(gw_state & LLS_NH_RESOLVED)))
+		return -1;
 
 	if (pkt_info->outer_ip_ver == ETHER_TYPE_IPv4)
 		outer_ip_len = sizeof(struct ipv4_hdr);
@@ -262,10 +484,7 @@ fill_eth_hdr(struct rte_mbuf *m,
 	new_eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
 	ether_addr_copy(&gt_conf->net->front.eth_addr,
 		&new_eth->s_addr);
-	/*
-	 * TODO The destination MAC address
-	 * comes from LLS block.
-	 */
+	ether_addr_copy(&gw_addr, &new_eth->d_addr);
 
 	new_eth->ether_type =
 		rte_cpu_to_be_16(pkt_info->inner_ip_ver);
@@ -283,17 +502,163 @@ fill_eth_hdr_reverse(struct ether_hdr *eth_hdr,
 	eth_hdr->ether_type = rte_cpu_to_be_16(pkt_info->outer_ip_ver);
 }
 
+static inline size_t
+notify_addr_len(uint16_t proto)
+{
+	return proto == ETHER_TYPE_IPv4
+		? sizeof(((struct ip_flow *)0)->f.v4.src)
+		: sizeof(((struct ip_flow *)0)->f.v6.src);
+}
+
+static inline size_t
+notify_params_len(uint8_t state)
+{
+	return state == GK_DECLINED
+		? sizeof(((struct ggu_policy *)0)->params.u.declined)
+		: sizeof(((struct ggu_policy *)0)->params.u.granted);
+}
+
+/* Append the parameters of @policy in network order to @data. */
+static uint8_t *
+fill_notify_params(uint8_t *data, const struct ggu_policy *policy)
+{
+	uint32_t params[4];
+	size_t params_len = notify_params_len(policy->state);
+
+	if (policy->state == GK_DECLINED)
+		params[0] = rte_cpu_to_be_32(
+			policy->params.u.declined.expire_sec);
+	else {
+		params[0] = rte_cpu_to_be_32(
+			policy->params.u.granted.tx_rate_kb_sec);
+		params[1] = rte_cpu_to_be_32(
+			policy->params.u.granted.cap_expire_sec);
+		params[2] = rte_cpu_to_be_32(
+			policy->params.u.granted.next_renewal_ms);
+		params[3] = rte_cpu_to_be_32(
+			policy->params.u.granted.renewal_step_ms);
+	}
+
+	rte_memcpy(data, params, params_len);
+	return data + params_len;
+}
+
+/* Append the decisions of @buf with @state and @proto to @data. */
+static uint8_t *
+fill_notify_policies(uint8_t *data, struct gt_notify_buf *buf,
+	uint8_t state, uint16_t proto, uint8_t *num)
+{
+	unsigned int i;
+	size_t addr_len = 2 * notify_addr_len(proto);
+
+	*num = 0;
+	for (i = 0; i < buf->num_policies; i++) {
+		struct ggu_policy *policy = &buf->policies[i];
+
+		if (policy->state != state || policy->flow.proto != proto)
+			continue;
+
+		rte_memcpy(data, &policy->flow.f, addr_len);
+		data += addr_len;
+		data = fill_notify_params(data, policy);
+		(*num)++;
+	}
+
+	return data;
+}
+
+/* Whether the decision @prev, if any, has the destination of @policy. */
+static inline bool
+has_same_dst(const struct ggu_policy *prev, const struct ggu_policy *policy)
+{
+	if (prev == NULL || prev->flow.proto != policy->flow.proto)
+		return false;
+
+	if (policy->flow.proto == ETHER_TYPE_IPv4)
+		return prev->flow.f.v4.dst == policy->flow.f.v4.dst;
+	return memcmp(prev->flow.f.v6.dst, policy->flow.f.v6.dst,
+		sizeof(policy->flow.f.v6.dst)) == 0;
+}
+
+/* Return the parameter set of @buf equal to those of @policy, or -1. */
+static int
+find_param_set(const struct gt_notify_buf *buf,
+	const struct ggu_policy *policy)
+{
+	unsigned int i;
+
+	for (i = 0; i < buf->num_param_sets; i++) {
+		const struct ggu_policy *set = &buf->param_sets[i];
+		if (set->state == policy->state &&
+				memcmp(&set->params.u, &policy->params.u,
+				notify_params_len(policy->state)) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/* Fill @data with the decisions of @buf in version 2 of the format. */
+static uint8_t *
+fill_notify_v2(uint8_t *data, struct gt_notify_buf *buf)
+{
+	struct ggu_v2_hdr *hdr = (struct ggu_v2_hdr *)data;
+	unsigned int i;
+
+	RTE_BUILD_BUG_ON(sizeof(*hdr) != sizeof(struct ggu_common_hdr));
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->v1 = GGU_PD_VER2;
+	hdr->num_param_sets = buf->num_param_sets;
+	hdr->num_decisions = rte_cpu_to_be_16(buf->num_policies);
+	data = (uint8_t *)&hdr[1];
+
+	for (i = 0; i < buf->num_param_sets; i++) {
+		*data++ = buf->param_sets[i].state;
+		data = fill_notify_params(data, &buf->param_sets[i]);
+	}
+
+	for (i = 0; i < buf->num_policies; i++) {
+		struct ggu_policy *policy = &buf->policies[i];
+		size_t addr_len = notify_addr_len(policy->flow.proto);
+		bool same_dst = has_same_dst(
+			i > 0 ? &buf->policies[i - 1] : NULL, policy);
+
+		*data++ = buf->param_set_idx[i] |
+			(policy->flow.proto == ETHER_TYPE_IPv6
+				? GGU_V2_IPV6 : 0) |
+			(same_dst ? GGU_V2_SAME_DST : 0);
+
+		if (policy->flow.proto == ETHER_TYPE_IPv4) {
+			rte_memcpy(data, &policy->flow.f.v4.src, addr_len);
+			if (!same_dst)
+				rte_memcpy(data + addr_len,
+					&policy->flow.f.v4.dst, addr_len);
+		} else {
+			rte_memcpy(data, policy->flow.f.v6.src, addr_len);
+			if (!same_dst)
+				rte_memcpy(data + addr_len,
+					policy->flow.f.v6.dst, addr_len);
+		}
+		data += same_dst ? addr_len : 2 * addr_len;
+	}
+
+	return data;
+}
+
 static struct rte_mbuf *
-alloc_and_fill_notify_pkt(unsigned int socket, struct ggu_policy *policy,
-	struct gt_packet_headers *pkt_info, struct gt_config *gt_conf)
+alloc_and_fill_notify_pkt(unsigned int socket, struct gt_notify_buf *buf,
+	struct gt_instance *instance, struct gt_config *gt_conf)
 {
 	uint8_t *data;
-	uint16_t ethertype = pkt_info->outer_ip_ver;
+	uint16_t ethertype = buf->addrs.proto;
 	struct ether_hdr *notify_eth;
-	struct ipv4_hdr *notify_ipv4;
-	struct ipv6_hdr *notify_ipv6;
+	struct ipv4_hdr *notify_ipv4 = NULL;
+	struct ipv6_hdr *notify_ipv6 = NULL;
 	struct udp_hdr *notify_udp;
 	struct ggu_common_hdr *notify_ggu;
+	size_t l2_len = sizeof(struct ether_hdr);
+	size_t l3_len;
 
 	struct rte_mbuf *notify_pkt = rte_pktmbuf_alloc(
 		gt_conf->net->gatekeeper_pktmbuf_pool[socket]);
@@ -303,98 +668,76 @@ alloc_and_fill_notify_pkt(unsigned int socket, struct ggu_policy *policy,
 		return NULL;
 	}
 
+	if (ethertype == ETHER_TYPE_IPv4)
+		l3_len = sizeof(struct ipv4_hdr);
+	else if (ethertype == ETHER_TYPE_IPv6)
+		l3_len = sizeof(struct ipv6_hdr);
+	else
+		rte_panic("Unexpected condition: gt fills up a notify packet with unknown ethernet type %hu\n",
+			ethertype);
+
+	notify_eth = (struct ether_hdr *)rte_pktmbuf_append(notify_pkt,
+		l2_len + l3_len + sizeof(struct udp_hdr) +
+		sizeof(struct ggu_common_hdr) + buf->payload_len);
+	if (notify_eth == NULL) {
+		RTE_LOG(ERR, MEMPOOL,
+			"gt: not enough room for notification packet!\n");
+		rte_pktmbuf_free(notify_pkt);
+		return NULL;
+	}
+
 	if (ethertype == ETHER_TYPE_IPv4) {
-		notify_eth = (struct ether_hdr *)rte_pktmbuf_append(notify_pkt,
-			sizeof(struct ether_hdr) + sizeof(struct ipv4_hdr) +
-			sizeof(struct udp_hdr) + sizeof(struct ggu_common_hdr));
 		notify_ipv4 = (struct ipv4_hdr *)&notify_eth[1];
 		notify_udp = (struct udp_hdr *)&notify_ipv4[1];
-		notify_ggu = (struct ggu_common_hdr *)&notify_udp[1];
-	} else if (ethertype == ETHER_TYPE_IPv6) {
-		notify_eth = (struct ether_hdr *)rte_pktmbuf_append(notify_pkt,
-			sizeof(struct ether_hdr) + sizeof(struct ipv6_hdr) +
-			sizeof(struct udp_hdr) + sizeof(struct ggu_common_hdr));
+	} else {
 		notify_ipv6 = (struct ipv6_hdr *)&notify_eth[1];
 		notify_udp = (struct udp_hdr *)&notify_ipv6[1];
-		notify_ggu = (struct ggu_common_hdr *)&notify_udp[1];
-	} else
-		rte_panic("Unexpected condition: gt fills up a notify packet with unknown ethernet type %hu\n",
-			ethertype);
+	}
+	notify_ggu = (struct ggu_common_hdr *)&notify_udp[1];
 
-	/* Fill up the policy decision. */
-	memset(notify_ggu, 0, sizeof(*notify_ggu));
-	notify_ggu->v1 = GGU_PD_VER1;
-	if (policy->flow.proto == ETHER_TYPE_IPv4
-			&& policy->state == GK_DECLINED) {
-		notify_ggu->n1 = 1;
-		data = (uint8_t *)rte_pktmbuf_append(notify_pkt,
-			sizeof(policy->flow.f.v4) +
-			sizeof(policy->params.u.declined));
-		rte_memcpy(data, &policy->flow.f.v4,
-			sizeof(policy->flow.f.v4));
-		rte_memcpy(data + sizeof(policy->flow.f.v4),
-			&policy->params.u.declined,
-			sizeof(policy->params.u.declined));
-	} else if (policy->flow.proto == ETHER_TYPE_IPv6
-			&& policy->state == GK_DECLINED) {
-		notify_ggu->n2 = 1;
-		data = (uint8_t *)rte_pktmbuf_append(notify_pkt,
-			sizeof(policy->flow.f.v6) +
-			sizeof(policy->params.u.declined));
-		rte_memcpy(data, &policy->flow.f.v6,
-			sizeof(policy->flow.f.v6));
-		rte_memcpy(data + sizeof(policy->flow.f.v6),
-			&policy->params.u.declined,
-			sizeof(policy->params.u.declined));
-	} else if (policy->flow.proto == ETHER_TYPE_IPv4
-			&& policy->state == GK_GRANTED) {
-		notify_ggu->n3 = 1;
-		data = (uint8_t *)rte_pktmbuf_append(notify_pkt,
-			sizeof(policy->flow.f.v4) +
-			sizeof(policy->params.u.granted));
-		rte_memcpy(data, &policy->flow.f.v4,
-			sizeof(policy->flow.f.v4));
-		rte_memcpy(data + sizeof(policy->flow.f.v4),
-			&policy->params.u.granted,
-			sizeof(policy->params.u.granted));
-	} else if (policy->flow.proto == ETHER_TYPE_IPv6
-			&& policy->state == GK_GRANTED) {
-		notify_ggu->n4 = 1;
-		data = (uint8_t *)rte_pktmbuf_append(notify_pkt,
-			sizeof(policy->flow.f.v6) +
-			sizeof(policy->params.u.granted));
-		rte_memcpy(data, &policy->flow.f.v6,
-			sizeof(policy->flow.f.v6));
-		rte_memcpy(data + sizeof(policy->flow.f.v6),
-			&policy->params.u.granted,
-			sizeof(policy->params.u.granted));
-	} else
-		rte_panic("Unexpected condition: gt fills up a notify packet with unexpected policy state %u\n",
-			policy->state);
+	if (gt_conf->ggu_pd_version == GGU_PD_VER2)
+		data = fill_notify_v2((uint8_t *)notify_ggu, buf);
+	else {
+		/*
+		 * Fill up the policy decisions, in the order
+		 * defined by struct ggu_common_hdr.
+		 */
+		memset(notify_ggu, 0, sizeof(*notify_ggu));
+		notify_ggu->v1 = GGU_PD_VER1;
+		data = (uint8_t *)&notify_ggu[1];
+		data = fill_notify_policies(data, buf, GK_DECLINED,
+			ETHER_TYPE_IPv4, &notify_ggu->n1);
+		data = fill_notify_policies(data, buf, GK_DECLINED,
+			ETHER_TYPE_IPv6, &notify_ggu->n2);
+		data = fill_notify_policies(data, buf, GK_GRANTED,
+			ETHER_TYPE_IPv4, &notify_ggu->n3);
+		data = fill_notify_policies(data, buf, GK_GRANTED,
+			ETHER_TYPE_IPv6, &notify_ggu->n4);
+	}
+	RTE_VERIFY(data == (uint8_t *)&notify_ggu[1] + buf->payload_len);
 
 	/* Fill up the Ethernet header. */
-	fill_eth_hdr_reverse(notify_eth, pkt_info);
-	notify_pkt->l2_len = sizeof(struct ether_hdr);
+	rte_memcpy(notify_eth, &buf->eth_hdr, sizeof(*notify_eth));
+	notify_pkt->l2_len = l2_len;
 
 	/* Fill up the IP header. */
 	if (ethertype == ETHER_TYPE_IPv4) {
-		struct ipv4_hdr *ipv4_hdr =
-			(struct ipv4_hdr *)pkt_info->outer_l3_hdr;
 		/* Fill up the IPv4 header. */
 		notify_ipv4->version_ihl = IP_VHL_DEF;
+		notify_ipv4->type_of_service = 0;
 		notify_ipv4->packet_id = 0;
 		notify_ipv4->fragment_offset = IP_DN_FRAGMENT_FLAG;
 		notify_ipv4->time_to_live = IP_DEFTTL;
 		notify_ipv4->next_proto_id = IPPROTO_UDP;
 		/* The source address is the Grantor server IP address. */
-		notify_ipv4->src_addr = ipv4_hdr->dst_addr;
+		notify_ipv4->src_addr = buf->addrs.f.v4.src;
 		/*
 		 * The destination address is the
 		 * Gatekeeper server IP address.
 		 */
-		notify_ipv4->dst_addr = ipv4_hdr->src_addr;
+		notify_ipv4->dst_addr = buf->addrs.f.v4.dst;
 		notify_ipv4->total_length = rte_cpu_to_be_16(
-			notify_pkt->data_len - sizeof(struct ether_hdr));
+			notify_pkt->data_len - l2_len);
 
 		/*
 		 * The IP header checksum filed must be set to 0
@@ -404,32 +747,29 @@ alloc_and_fill_notify_pkt(unsigned int socket, struct ggu_policy *policy,
 
 		notify_pkt->ol_flags |= (PKT_TX_IPV4 |
 			PKT_TX_IP_CKSUM | PKT_TX_UDP_CKSUM);
-		notify_pkt->l3_len = sizeof(struct ipv4_hdr);
+		notify_pkt->l3_len = l3_len;
 
 		/* Offload the UDP checksum. */
 		notify_udp->dgram_cksum =
 			rte_ipv4_phdr_cksum(notify_ipv4,
 			notify_pkt->ol_flags);
-	} else if (ethertype == ETHER_TYPE_IPv6) {
-		struct ipv6_hdr *ipv6_hdr =
-			(struct ipv6_hdr *)pkt_info->outer_l3_hdr;
+	} else {
 		/* Fill up the outer IPv6 header. */
 		notify_ipv6->vtc_flow =
 			rte_cpu_to_be_32(IPv6_DEFAULT_VTC_FLOW);
 		notify_ipv6->proto = IPPROTO_UDP; 
 		notify_ipv6->hop_limits = IPv6_DEFAULT_HOP_LIMITS;
 
-		rte_memcpy(notify_ipv6->src_addr, ipv6_hdr->dst_addr,
+		rte_memcpy(notify_ipv6->src_addr, buf->addrs.f.v6.src,
 			sizeof(notify_ipv6->src_addr));
-		rte_memcpy(notify_ipv6->dst_addr, ipv6_hdr->src_addr,
+		rte_memcpy(notify_ipv6->dst_addr, buf->addrs.f.v6.dst,
 			sizeof(notify_ipv6->dst_addr));
 		notify_ipv6->payload_len =
-			rte_cpu_to_be_16(notify_pkt->data_len -
-			sizeof(struct ether_hdr) - sizeof(struct ipv6_hdr));
+			rte_cpu_to_be_16(notify_pkt->data_len - l2_len - l3_len);
 
 		notify_pkt->ol_flags |= (PKT_TX_IPV6 |
 			PKT_TX_IP_CKSUM | PKT_TX_UDP_CKSUM);
-		notify_pkt->l3_len = sizeof(struct ipv6_hdr);
+		notify_pkt->l3_len = l3_len;
 
 		/* Offload the UDP checksum. */
 		notify_udp->dgram_cksum =
@@ -438,24 +778,378 @@ alloc_and_fill_notify_pkt(unsigned int socket, struct ggu_policy *policy,
 	}
 
 	/* Fill up the UDP header. */
-	notify_udp->src_port = gt_conf->ggu_src_port;
+	notify_udp->src_port = instance->ggu_src_port;
 	notify_udp->dst_port = gt_conf->ggu_dst_port;
 	notify_udp->dgram_len = rte_cpu_to_be_16((uint16_t)(
-		sizeof(*notify_udp) + sizeof(*notify_ggu) +
-		(notify_ggu->n1 + notify_ggu->n3) *
-		sizeof(policy->flow.f.v4) +
-		(notify_ggu->n2 + notify_ggu->n4) *
-		sizeof(policy->flow.f.v6) +
-		(notify_ggu->n1 + notify_ggu->n2) *
-		sizeof(policy->params.u.declined) + 
-		(notify_ggu->n3 + notify_ggu->n4) *
-		sizeof(policy->params.u.granted)));
+		sizeof(*notify_udp) + sizeof(*notify_ggu) + buf->payload_len));
 
 	notify_pkt->l4_len = sizeof(struct udp_hdr);
 
 	return notify_pkt;
 }
 
+/*
+ * Build the notification packet of the decisions in @buf,
+ * add it to @tx_bufs, and empty @buf.
+ */
+static void
+flush_notify_buf(struct gt_notify_buf *buf, struct gt_instance *instance,
+	unsigned int socket, struct gt_config *gt_conf,
+	struct rte_mbuf **tx_bufs, uint16_t *num_tx)
+{
+	struct rte_mbuf *notify_pkt;
+
+	if (buf->num_policies == 0)
+		return;
+
+	notify_pkt = alloc_and_fill_notify_pkt(socket, buf, instance,
+		gt_conf);
+	if (notify_pkt != NULL)
+		tx_bufs[(*num_tx)++] = notify_pkt;
+
+	buf->num_policies = 0;
+	buf->num_param_sets = 0;
+	buf->payload_len = 0;
+}
+
+/*
+ * Build the notification packets of the buffers whose first
+ * decision has waited long enough, or of all buffers if @flush_all.
+ */
+static void
+flush_notify_bufs(struct gt_instance *instance, bool flush_all,
+	unsigned int socket, struct gt_config *gt_conf,
+	struct rte_mbuf **tx_bufs, uint16_t *num_tx)
+{
+	int i;
+	uint64_t now = flush_all ? 0 : rte_rdtsc();
+
+	for (i = 0; i < GT_NUM_NOTIFY_BUFS; i++) {
+		struct gt_notify_buf *buf = &instance->notify_bufs[i];
+
+		if (buf->num_policies == 0)
+			continue;
+
+		if (flush_all || now >= buf->first_decision_at +
+				gt_conf->max_ggu_notify_delay_cycles)
+			flush_notify_buf(buf, instance, socket, gt_conf,
+				tx_bufs, num_tx);
+	}
+}
+
+/*
+ * Return the number of bytes that @policy takes in the packet of @buf,
+ * and in @param_set, for version 2 of the format, the index of
+ * the parameter set of @policy, or -1 if it is not in @buf yet.
+ */
+static size_t
+notify_policy_len(const struct gt_notify_buf *buf,
+	const struct ggu_policy *policy, const struct gt_config *gt_conf,
+	int *param_set)
+{
+	size_t addr_len = notify_addr_len(policy->flow.proto);
+	size_t len;
+
+	if (gt_conf->ggu_pd_version != GGU_PD_VER2)
+		return 2 * addr_len + notify_params_len(policy->state);
+
+	len = 1 + addr_len;
+	if (!has_same_dst(buf->num_policies > 0
+			? &buf->policies[buf->num_policies - 1] : NULL,
+			policy))
+		len += addr_len;
+
+	*param_set = find_param_set(buf, policy);
+	if (*param_set < 0)
+		len += 1 + notify_params_len(policy->state);
+
+	return len;
+}
+
+/*
+ * Add @policy to the buffer of the Gatekeeper server that
+ * sent the request described by @pkt_info.
+ *
+ * A buffer is flushed into @tx_bufs when @policy doesn't fit in
+ * its packet, or when the buffer is taken by another Gatekeeper server.
+ */
+static void
+add_notify_policy(struct ggu_policy *policy,
+	struct gt_packet_headers *pkt_info, struct gt_instance *instance,
+	unsigned int socket, struct gt_config *gt_conf,
+	struct rte_mbuf **tx_bufs, uint16_t *num_tx)
+{
+	struct ip_flow addrs;
+	struct gt_notify_buf *buf;
+	uint32_t idx;
+	size_t max_payload_len;
+	size_t policy_len;
+	int param_set = -1;
+
+	/*
+	 * The notification goes from the Grantor server back to
+	 * the Gatekeeper server, i.e. the reverse of the outer header.
+	 */
+	memset(&addrs, 0, sizeof(addrs));
+	addrs.proto = pkt_info->outer_ip_ver;
+	if (addrs.proto == ETHER_TYPE_IPv4) {
+		struct ipv4_hdr *ipv4_hdr =
+			(struct ipv4_hdr *)pkt_info->outer_l3_hdr;
+		addrs.f.v4.src = ipv4_hdr->dst_addr;
+		addrs.f.v4.dst = ipv4_hdr->src_addr;
+		idx = rte_be_to_cpu_32(addrs.f.v4.dst);
+		max_payload_len = GT_NOTIFY_MAX_PAYLOAD(
+			sizeof(struct ipv4_hdr));
+	} else {
+		struct ipv6_hdr *ipv6_hdr =
+			(struct ipv6_hdr *)pkt_info->outer_l3_hdr;
+		rte_memcpy(addrs.f.v6.src, ipv6_hdr->dst_addr,
+			sizeof(addrs.f.v6.src));
+		rte_memcpy(addrs.f.v6.dst, ipv6_hdr->src_addr,
+			sizeof(addrs.f.v6.dst));
+		idx = ((uint32_t)addrs.f.v6.dst[12] << 24) |
+			((uint32_t)addrs.f.v6.dst[13] << 16) |
+			((uint32_t)addrs.f.v6.dst[14] << 8) |
+			addrs.f.v6.dst[15];
+		max_payload_len = GT_NOTIFY_MAX_PAYLOAD(
+			sizeof(struct ipv6_hdr));
+	}
+
+	buf = &instance->notify_bufs[(idx ^ (idx >> 16)) % GT_NUM_NOTIFY_BUFS];
+	if (buf->num_policies > 0 &&
+			ip_flow_cmp_eq(&buf->addrs, &addrs, 0) != 0)
+		flush_notify_buf(buf, instance, socket, gt_conf, tx_bufs,
+			num_tx);
+
+	policy_len = notify_policy_len(buf, policy, gt_conf, &param_set);
+	if (buf->payload_len + policy_len > max_payload_len ||
+			(param_set < 0 && buf->num_param_sets ==
+				GGU_V2_MAX_PARAM_SETS)) {
+		flush_notify_buf(buf, instance, socket, gt_conf, tx_bufs,
+			num_tx);
+		policy_len = notify_policy_len(buf, policy, gt_conf,
+			&param_set);
+	}
+
+	if (buf->num_policies == 0) {
+		rte_memcpy(&buf->addrs, &addrs, sizeof(buf->addrs));
+		fill_eth_hdr_reverse(&buf->eth_hdr, pkt_info);
+		buf->first_decision_at = rte_rdtsc();
+	}
+
+	if (gt_conf->ggu_pd_version == GGU_PD_VER2) {
+		if (param_set < 0) {
+			param_set = buf->num_param_sets++;
+			rte_memcpy(&buf->param_sets[param_set], policy,
+				sizeof(*policy));
+		}
+		buf->param_set_idx[buf->num_policies] = param_set;
+	}
+
+	rte_memcpy(&buf->policies[buf->num_policies++], policy,
+		sizeof(*policy));
+	buf->payload_len += policy_len;
+}
+
+/*
+ * Reply the policy decision to GK-GT unit unless @notify is false,
+ * and forward the request if its capability has been granted.
+ */
+static void
+process_decision(struct rte_mbuf *m, struct gt_packet_headers *pkt_info,
+	struct ggu_policy *policy, bool notify, uint64_t now,
+	struct gt_instance *instance, unsigned int socket,
+	struct gt_config *gt_conf, struct rte_mbuf **tx_bufs,
+	uint16_t *num_tx)
+{
+	if (likely(notify)) {
+		add_notify_policy(policy, pkt_info, instance,
+			socket, gt_conf, tx_bufs, num_tx);
+		if (instance->recent_decisions != NULL)
+			remember_decision(instance, policy, pkt_info, now);
+	} else
+		instance->stats->notifications_suppressed++;
+
+	if (policy->state == GK_GRANTED)
+		instance->stats->decisions_granted++;
+	else
+		instance->stats->decisions_declined++;
+
+	if (policy->state == GK_GRANTED &&
+			fill_eth_hdr(m, instance, gt_conf, pkt_info) == 0)
+		tx_bufs[(*num_tx)++] = m;
+	else
+		rte_pktmbuf_free(m);
+}
+
+/* The packets of a burst, split by how the GT block handles them. */
+struct gt_burst {
+	/* Granted and legacy packets, forwarded as soon as decapsulated. */
+	unsigned int             num_fwd;
+	struct rte_mbuf          *fwd_pkts[GATEKEEPER_MAX_PKT_BURST];
+	struct gt_packet_headers fwd_infos[GATEKEEPER_MAX_PKT_BURST];
+
+	/* Packets that go through a policy decision. */
+	unsigned int             num_policy;
+	struct rte_mbuf          *policy_pkts[GATEKEEPER_MAX_PKT_BURST];
+	struct gt_packet_headers policy_infos[GATEKEEPER_MAX_PKT_BURST];
+
+	/* Packets that are not tunneled to the Grantor, e.g. ND packets. */
+	unsigned int             num_ctrl;
+	struct rte_mbuf          *ctrl_pkts[GATEKEEPER_MAX_PKT_BURST];
+};
+
+/*
+ * Parse the @num_pkts packets of @pkts in a single pass, and split
+ * them into the sets of @burst. The headers are parsed in place,
+ * so @burst only points into the packets.
+ */
+static void
+gt_classify_burst(struct rte_mbuf **pkts, uint16_t num_pkts,
+	struct gt_burst *burst, struct gt_instance *instance,
+	struct gt_config *gt_conf)
+{
+	uint16_t i;
+
+	burst->num_fwd = 0;
+	burst->num_policy = 0;
+	burst->num_ctrl = 0;
+
+	for (i = 0; i < num_pkts; i++)
+		rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void *));
+
+	for (i = 0; i < num_pkts; i++) {
+		struct rte_mbuf *m = pkts[i];
+		/*
+		 * Parse into the policy set, where most packets go,
+		 * and only move the headers of the other packets.
+		 */
+		struct gt_packet_headers *info =
+			&burst->policy_infos[burst->num_policy];
+
+		if (gt_parse_incoming_pkt(m, info) < 0) {
+			burst->ctrl_pkts[burst->num_ctrl++] = m;
+			continue;
+		}
+
+		if (unlikely(!is_valid_dest_addr(gt_conf, info))) {
+			print_ip_err_msg(info);
+			rte_pktmbuf_free(m);
+			continue;
+		}
+
+		/*
+		 * Only request packets and priority packets
+		 * with capabilities about to expire go through a
+		 * policy decision.
+		 *
+		 * Other packets will be fowarded directly.
+		 */
+		if (info->priority <= 1) {
+			burst->fwd_infos[burst->num_fwd] = *info;
+			burst->fwd_pkts[burst->num_fwd++] = m;
+			continue;
+		}
+
+		capture_pkt(&instance->tap, m, 0);
+		burst->policy_pkts[burst->num_policy++] = m;
+	}
+}
+
+/*
+ * Hand the ND packets among the packets of @pkts over to
+ * the LLS block, and drop the other packets.
+ */
+static void
+process_ctrl_pkts(struct rte_mbuf **pkts, unsigned int num_pkts,
+	struct gt_config *gt_conf)
+{
+	unsigned int i;
+	unsigned int num_nd = 0;
+	unsigned int num_submitted;
+	struct rte_mbuf *nd_bufs[GATEKEEPER_MAX_PKT_BURST];
+
+	for (i = 0; i < num_pkts; i++) {
+		/*
+		 * TODO Forward all IPv6 packets that
+		 * are not encapsulated to an IPv6
+		 * block to do further processing, including
+		 * sending any ND packets to the LLS block.
+		 * For now, extract all needed packet fields
+		 * and pass it to the LLS block.
+		 */
+		struct ipacket packet;
+
+		if (extract_packet_info(pkts[i], &packet) == 0 &&
+				!gt_conf->net->front.hw_nd_filter &&
+				pkt_is_nd(&packet, &gt_conf->net->front)) {
+			nd_bufs[num_nd++] = pkts[i];
+			continue;
+		}
+
+		fast_log(LOG_GT_INVALID_PKT, 0, 0, 0, 0);
+		rte_pktmbuf_free(pkts[i]);
+	}
+
+	if (unlikely(num_nd > 0)) {
+		num_submitted = submit_nd(nd_bufs, num_nd,
+			&gt_conf->net->front);
+		for (i = num_submitted; i < num_nd; i++)
+			rte_pktmbuf_free(nd_bufs[i]);
+	}
+}
+
+/*
+ * Swap in the new policy of @entry, and hand the old policy back.
+ * The decisions of the old policy are no longer valid,
+ * so the decision cache and the recent decisions start over.
+ */
+static void
+update_policy(struct gt_cmd_entry *entry, struct gt_instance *instance)
+{
+	struct gt_lua_policy old_policy = instance->lua_policy;
+
+	instance->lua_policy = entry->u.update.policy;
+	entry->u.update.policy = old_policy;
+	if (instance->decision_cache != NULL)
+		rte_hash_reset(instance->decision_cache);
+	if (instance->recent_decisions != NULL)
+		memset(instance->recent_decisions, 0,
+			(instance->recent_decisions_mask + 1) *
+			sizeof(*instance->recent_decisions));
+	instance->stats->policy_updates++;
+
+	/* The sender must see the old policy before @done. */
+	rte_wmb();
+	entry->u.update.done = true;
+}
+
+static void
+process_gt_cmds(struct gt_instance *instance)
+{
+	int i;
+	int num_cmd;
+	struct gt_cmd_entry *cmds[GT_CMD_BURST_SIZE];
+
+	num_cmd = mb_dequeue_burst(&instance->mb,
+		(void **)cmds, GT_CMD_BURST_SIZE);
+	for (i = 0; i < num_cmd; i++) {
+		switch (cmds[i]->op) {
+		case GT_UPDATE_POLICY:
+			/* The sender frees the entry. */
+			update_policy(cmds[i], instance);
+			break;
+
+		default:
+			RTE_LOG(ERR, GATEKEEPER,
+				"gt: unknown command operation %u\n",
+				cmds[i]->op);
+			mb_free_entry(&instance->mb, cmds[i]);
+			break;
+		}
+	}
+}
+
 static int
 gt_proc(void *arg)
 {
@@ -468,154 +1162,363 @@ gt_proc(void *arg)
 	uint8_t port = get_net_conf()->front.id;
 	uint16_t rx_queue = instance->rx_queue;
 	uint16_t tx_queue = instance->tx_queue;
+	struct poll_state poll;
 
 	RTE_LOG(NOTICE, GATEKEEPER,
 		"gt: the GT block is running at lcore = %u\n", lcore);
 
 	gt_conf_hold(gt_conf);
+	tx_buf_init(&instance->tx_buf, port, tx_queue);
+	poll_init(&poll, &gt_conf->poll, port, rx_queue);
+	poll_enable_rx_intr(&poll, &gt_conf->poll, &instance->mb, "gt");
 
 	while (likely(!exiting)) {
-		int i;
+		unsigned int i;
+		int ret;
 		uint16_t num_rx;
 		uint16_t num_tx = 0;
-		uint16_t num_tx_succ;
+		uint64_t now;
+		unsigned int num_lua = 0;
 		struct rte_mbuf *rx_bufs[GATEKEEPER_MAX_PKT_BURST];
-		struct rte_mbuf *tx_bufs[GATEKEEPER_MAX_PKT_BURST];
+		struct gt_burst burst;
+		/* The decisions for the packets of the policy set. */
+		struct ggu_policy policies[GATEKEEPER_MAX_PKT_BURST];
+		/*
+		 * Each received packet may be forwarded and flush
+		 * a notification packet; at the end of the burst,
+		 * each buffer of notifications may be flushed.
+		 */
+		struct rte_mbuf *tx_bufs[2 * GATEKEEPER_MAX_PKT_BURST +
+			GT_NUM_NOTIFY_BUFS];
 
 		/* Load a set of packets from the front NIC. */
-		num_rx = rte_eth_rx_burst(port, rx_queue, rx_bufs,
-			GATEKEEPER_MAX_PKT_BURST);
+		num_rx = poll_rx(&poll, &gt_conf->poll, rx_bufs);
 
-		if (unlikely(num_rx == 0))
-			continue;
+		if (unlikely(num_rx == 0)) {
+			/* Nothing else to do, so send all decisions. */
+			flush_notify_bufs(instance, true, socket, gt_conf,
+				tx_bufs, &num_tx);
+			goto send;
+		}
 
-		for (i = 0; i < num_rx; i++) {
-			int ret;
-			struct rte_mbuf *m = rx_bufs[i];
-			struct gt_packet_headers pkt_info;
-			struct ggu_policy policy;
-			struct rte_mbuf *notify_pkt;
-
-			/*
-			 * Only request packets and priority packets
-			 * with capabilities about to expire go through a
-			 * policy decision.
-			 *
-			 * Other packets will be fowarded directly.
-			 */
-			ret = gt_parse_incoming_pkt(m, &pkt_info);
-			if (ret < 0) {
-				/*
-				 * TODO Forward all IPv6 packets that
-				 * are not encapsulated to an IPv6
-				 * block to do further processing, including
-				 * sending any ND packets to the LLS block.
-				 * For now, extract all needed packet fields
-				 * and pass it to the LLS block.
-				 */
-				struct ipacket packet;
-				ret = extract_packet_info(m, &packet);
-				if (ret < 0)
-					goto drop;
-
-				if (pkt_is_nd(&packet, &gt_conf->net->front)) {
-					/*
-					 * TODO Use DPDK packet classification
-					 * and distribution here instead.
-					 */
-					if (submit_nd(m,
-						    &gt_conf->net->front) == -1)
-						rte_pktmbuf_free(m);
-					continue;
-				}
-drop:
-				RTE_LOG(ALERT, GATEKEEPER,
-					"gt: parsing an invalid packet!\n");
-				rte_pktmbuf_free(m);
-				continue;
-			}
+		gt_classify_burst(rx_bufs, num_rx, &burst, instance, gt_conf);
+		now = rte_rdtsc();
+
+		for (i = 0; i < burst.num_fwd; i++) {
+			struct rte_mbuf *m = burst.fwd_pkts[i];
 
-			if (unlikely(!is_valid_dest_addr(gt_conf, &pkt_info))) {
-				print_ip_err_msg(&pkt_info);
+			if (fill_eth_hdr(m, instance, gt_conf,
+					&burst.fwd_infos[i]) < 0)
 				rte_pktmbuf_free(m);
-				continue;
-			}
+			else
+				tx_bufs[num_tx++] = m;
+		}
 
-			if (pkt_info.priority <= 1) {
-				ret = fill_eth_hdr(m, gt_conf, &pkt_info);
-				if (ret < 0)
-					rte_pktmbuf_free(m);
-				else
-					tx_bufs[num_tx++] = m;
-				continue;
-			}
+		/*
+		 * Lookup the policy decisions.
+		 *
+		 * The policy, which is defined by a Lua script,
+		 * decides which capabilities to grant or decline,
+		 * the maximum receiving rate of the granted
+		 * capabilities, and when each decision expires.
+		 *
+		 * Requests that need the Lua policy are moved
+		 * to the front of the policy set, and are decided
+		 * together once the compiled decisions are done.
+		 */
+		for (i = 0; i < burst.num_policy; i++) {
+			struct gt_packet_headers *pkt_info =
+				&burst.policy_infos[i];
 
-			/*
-			 * Lookup the policy decision.
-			 *
-			 * The policy, which is defined by a Lua script,
-			 * decides which capabilities to grant or decline,
-			 * the maximum receiving rate of the granted
-			 * capabilities, and when each decision expires.
-			 */
-			ret = lookup_policy_decision(
-				&pkt_info, &policy, instance);
+			ret = lookup_compiled_decision(pkt_info,
+				&policies[num_lua], instance, gt_conf, now);
 			if (ret < 0) {
-				rte_pktmbuf_free(m);
+				if (num_lua != i) {
+					burst.policy_pkts[num_lua] =
+						burst.policy_pkts[i];
+					burst.policy_infos[num_lua] =
+						*pkt_info;
+				}
+				num_lua++;
 				continue;
 			}
 
-			/*
-			 * TODO Reply in a batch.
-			 * Reply the policy decision to GK-GT unit.
-			 */
-			notify_pkt = alloc_and_fill_notify_pkt(
-				socket, &policy, &pkt_info, gt_conf);
-			if (notify_pkt != NULL && rte_eth_tx_burst(
-					port, tx_queue, &notify_pkt, 1) != 1)
-				rte_pktmbuf_free(notify_pkt);
-
-			if (policy.state == GK_GRANTED) {
-				ret = fill_eth_hdr(m, gt_conf, &pkt_info);
-				if (ret < 0)
-					rte_pktmbuf_free(m);
-				else
-					tx_bufs[num_tx++] = m;
-			} else
-				rte_pktmbuf_free(m);
+			process_decision(burst.policy_pkts[i], pkt_info,
+				&policies[num_lua], ret != GT_DECISION_RECENT,
+				now, instance, socket, gt_conf,
+				tx_bufs, &num_tx);
+		}
+
+		if (num_lua > 0) {
+			STATS_CYCLES_BEGIN(start);
+			ret = lookup_lua_decisions(burst.policy_infos,
+				policies, num_lua, instance);
+			STATS_CYCLES_END(
+				&instance->stats->lookup_lua_decisions,
+				start, num_lua);
+			if (unlikely(ret < 0))
+				instance->stats->lua_errors += num_lua;
+			for (i = 0; i < num_lua; i++) {
+				if (ret < 0) {
+					rte_pktmbuf_free(
+						burst.policy_pkts[i]);
+					continue;
+				}
+				process_decision(burst.policy_pkts[i],
+					&burst.policy_infos[i], &policies[i],
+					true, now, instance, socket, gt_conf,
+					tx_bufs, &num_tx);
+			}
 		}
 
-		/* Send burst of TX packets, to second port of pair. */
-		num_tx_succ = rte_eth_tx_burst(port, tx_queue,
-			tx_bufs, num_tx);
+		if (unlikely(burst.num_ctrl > 0))
+			process_ctrl_pkts(burst.ctrl_pkts, burst.num_ctrl,
+				gt_conf);
+
+		flush_notify_bufs(instance, false, socket, gt_conf,
+			tx_bufs, &num_tx);
 
+send:
 		/*
-		 * XXX Do something better here!
-		 * For now, free any unsent packets.
+		 * Notifications and forwarded packets of consecutive
+		 * bursts are sent together.
 		 */
-		if (unlikely(num_tx_succ < num_tx)) {
-			for (i = num_tx_succ; i < num_tx; i++)
-				rte_pktmbuf_free(tx_bufs[i]);
-		}
+		now = rte_rdtsc();
+		tx_buf_add_bulk(&instance->tx_buf, tx_bufs, num_tx, now);
+		tx_buf_drain(&instance->tx_buf, now);
+		instance->stats->tx_dropped = instance->tx_buf.num_dropped;
+
+		/* New policies are only swapped in between bursts. */
+		process_gt_cmds(instance);
+
+		poll_idle(&poll, &gt_conf->poll,
+			num_rx > 0 || instance->tx_buf.num_pkts > 0);
 	}
 
+	/* Do not leave the updater waiting for this instance. */
+	process_gt_cmds(instance);
+	poll_release(&poll);
+	tx_buf_flush(&instance->tx_buf);
+	tx_buf_free(&instance->tx_buf);
+
 	RTE_LOG(NOTICE, GATEKEEPER,
 		"gt: the GT block at lcore = %u is exiting\n", lcore);
 
 	return gt_conf_put(gt_conf);
 }
 
+/*
+ * Set the gateway of the front interface, to which the packets of
+ * granted flows of the IP version of @ip_addr are forwarded.
+ */
+int
+gt_set_front_gateway(const char *ip_addr, struct gt_config *gt_conf)
+{
+	if (inet_pton(AF_INET, ip_addr, &gt_conf->front_gw4) == 1) {
+		gt_conf->front_gw_proto |= GK_CONFIGURED_IPV4;
+		return 0;
+	}
+
+	if (inet_pton(AF_INET6, ip_addr, &gt_conf->front_gw6) == 1) {
+		gt_conf->front_gw_proto |= GK_CONFIGURED_IPV6;
+		return 0;
+	}
+
+	RTE_LOG(ERR, GATEKEEPER,
+		"gt: invalid front gateway address \"%s\"\n", ip_addr);
+	return -1;
+}
+
 struct gt_config *
 alloc_gt_conf(void)
 {
 	return rte_calloc("gt_config", 1, sizeof(struct gt_config), 0);
 }
 
+void
+destroy_lua_policy(struct gt_lua_policy *lp)
+{
+	destroy_simple_policy(lp->simple_policy);
+	lp->simple_policy = NULL;
+
+	if (lp->lua_state != NULL) {
+		lua_close(lp->lua_state);
+		lp->lua_state = NULL;
+	}
+}
+
+/*
+ * Load the Lua policy script into a new Lua state for the
+ * GT instance at @lcore_id, and let it compile its simple policy.
+ *
+ * It does not touch the GT instance, so it can run at any lcore
+ * while the GT instance enforces another policy.
+ */
+int
+load_lua_policy(unsigned int lcore_id, uint64_t version,
+	struct gt_lua_policy *lp)
+{
+	int ret;
+	char lua_entry_path[128];
+
+	memset(lp, 0, sizeof(*lp));
+
+	ret = snprintf(lua_entry_path, sizeof(lua_entry_path), \
+			"%s/%s", LUA_POLICY_BASE_DIR, GRANTOR_CONFIG_FILE);
+	RTE_VERIFY(ret > 0 && ret < (int)sizeof(lua_entry_path));
+
+	lp->lua_state = luaL_newstate();
+	if (lp->lua_state == NULL) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gt: failed to create new Lua state at lcore %u!\n",
+			lcore_id);
+		return -1;
+	}
+
+	luaL_openlibs(lp->lua_state);
+	set_lua_path(lp->lua_state, LUA_POLICY_BASE_DIR);
+	ret = luaL_loadfile(lp->lua_state, lua_entry_path);
+	if (ret != 0) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gt: %s!\n", lua_tostring(lp->lua_state, -1));
+		goto policy;
+	}
+
+	/* Run the loaded chunk. */
+	ret = lua_pcall(lp->lua_state, 0, 0, 0);
+	if (ret != 0) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gt: %s!\n", lua_tostring(lp->lua_state, -1));
+		goto policy;
+	}
+
+	lp->simple_policy = create_simple_policy(lcore_id, version);
+	if (lp->simple_policy == NULL)
+		goto policy;
+
+	/* Let the policy compile its simple policy, if it has one. */
+	lua_getglobal(lp->lua_state, "compile_policy");
+	if (lua_isfunction(lp->lua_state, -1)) {
+		lua_pushlightuserdata(lp->lua_state, lp->simple_policy);
+		ret = lua_pcall(lp->lua_state, 1, 0, 0);
+		if (ret != 0) {
+			RTE_LOG(ERR, GATEKEEPER,
+				"gt: error running function `compile_policy': %s, at lcore %u\n",
+				lua_tostring(lp->lua_state, -1), lcore_id);
+			goto policy;
+		}
+	} else
+		lua_pop(lp->lua_state, 1);
+
+	/*
+	 * Prefer the burst entry point of the policy, and keep
+	 * lookup_policy() for policies that don't define it.
+	 */
+	lua_getglobal(lp->lua_state, "lookup_policy_burst");
+	lp->lua_burst = lua_isfunction(lp->lua_state, -1);
+	lua_pop(lp->lua_state, 1);
+	if (lp->lua_burst) {
+		lp->ctypeid_pkt_info_ptr = luaL_get_ctypeid(
+			lp->lua_state, "struct gt_packet_headers *");
+		lp->ctypeid_policy_ptr = luaL_get_ctypeid(
+			lp->lua_state, "struct ggu_policy *");
+	}
+
+	return 0;
+
+policy:
+	destroy_lua_policy(lp);
+	return -1;
+}
+
 static inline void
-cleanup_gt_instance(struct gt_instance *instance)
+cleanup_gt_instance(struct gt_instance *instance, unsigned int lcore_id)
+{
+	if (instance->stats != NULL) {
+		stats_free("gt", lcore_id);
+		instance->stats = NULL;
+	}
+
+	lls_nh_cache_release(instance->nh_cache);
+	instance->nh_cache = NULL;
+
+	rte_hash_free(instance->decision_cache);
+	instance->decision_cache = NULL;
+	rte_free(instance->cached_decisions);
+	instance->cached_decisions = NULL;
+
+	rte_free(instance->recent_decisions);
+	instance->recent_decisions = NULL;
+
+	destroy_mailbox(&instance->mb);
+	memset(&instance->mb, 0, sizeof(instance->mb));
+
+	destroy_lua_policy(&instance->lua_policy);
+}
+
+static int
+init_decision_cache(struct gt_config *gt_conf, unsigned int lcore_id)
+{
+	int ret;
+	char name[64];
+	unsigned int block_idx = get_block_idx(gt_conf, lcore_id);
+	struct gt_instance *instance = &gt_conf->instances[block_idx];
+	struct rte_hash_parameters cache_params = {
+		.name = name,
+		.entries = gt_conf->decision_cache_size,
+		.reserved = 0,
+		.key_len = sizeof(struct gt_decision_key),
+		.hash_func = DEFAULT_HASH_FUNC,
+		.hash_func_init_val = 0,
+		.socket_id = rte_lcore_to_socket_id(lcore_id),
+		.extra_flag = 0,
+	};
+
+	ret = snprintf(name, sizeof(name), "gt_decision_cache_%u", lcore_id);
+	RTE_VERIFY(ret > 0 && ret < (int)sizeof(name));
+	instance->decision_cache = rte_hash_create(&cache_params);
+	if (instance->decision_cache == NULL) {
+		RTE_LOG(ERR, HASH,
+			"gt: cannot create the decision cache at lcore %u!\n",
+			lcore_id);
+		return -1;
+	}
+
+	instance->cached_decisions = rte_calloc_socket(
+		"gt_cached_decisions", gt_conf->decision_cache_size,
+		sizeof(struct gt_cached_decision), 0,
+		rte_lcore_to_socket_id(lcore_id));
+	if (instance->cached_decisions == NULL) {
+		RTE_LOG(ERR, MALLOC,
+			"gt: cannot allocate the decision cache at lcore %u!\n",
+			lcore_id);
+		rte_hash_free(instance->decision_cache);
+		instance->decision_cache = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+init_recent_decisions(struct gt_config *gt_conf, unsigned int lcore_id)
 {
-	lua_close(instance->lua_state);
-	instance->lua_state = NULL;
+	unsigned int block_idx = get_block_idx(gt_conf, lcore_id);
+	struct gt_instance *instance = &gt_conf->instances[block_idx];
+	uint32_t size = rte_align32pow2(gt_conf->recent_decisions_size);
+
+	instance->recent_decisions = rte_calloc_socket("gt_recent_decisions",
+		size, sizeof(struct gt_recent_decision), 0,
+		rte_lcore_to_socket_id(lcore_id));
+	if (instance->recent_decisions == NULL) {
+		RTE_LOG(ERR, MALLOC,
+			"gt: cannot allocate the recent decisions at lcore %u!\n",
+			lcore_id);
+		return -1;
+	}
+	instance->recent_decisions_mask = size - 1;
+
+	return 0;
 }
 
 static int
@@ -623,7 +1526,8 @@ cleanup_gt(struct gt_config *gt_conf)
 {
 	int i;
 	for (i = 0; i < gt_conf->num_lcores; i++)
-		cleanup_gt_instance(&gt_conf->instances[i]);
+		cleanup_gt_instance(&gt_conf->instances[i],
+			gt_conf->lcores[i]);
 
 	rte_free(gt_conf->instances);
 	rte_free(gt_conf->lcores);
@@ -645,51 +1549,103 @@ gt_conf_put(struct gt_config *gt_conf)
 	return 0;
 }
 
+/* Resolve the gateways of the front interface through the LLS block. */
+static int
+init_nh_cache(struct gt_config *gt_conf, unsigned int lcore_id)
+{
+	unsigned int block_idx = get_block_idx(gt_conf, lcore_id);
+	struct gt_instance *instance = &gt_conf->instances[block_idx];
+
+	instance->nh_cache = lls_nh_cache_create(GT_NH_MAX, lcore_id);
+	if (instance->nh_cache == NULL)
+		return -1;
+
+	if (gt_conf->front_gw_proto & GK_CONFIGURED_IPV4 &&
+			lls_nh_cache_hold(instance->nh_cache, GT_NH_GW_IP4,
+			ETHER_TYPE_IPv4, &gt_conf->front_gw4) < 0)
+		goto nh_cache;
+
+	if (gt_conf->front_gw_proto & GK_CONFIGURED_IPV6 &&
+			lls_nh_cache_hold(instance->nh_cache, GT_NH_GW_IP6,
+			ETHER_TYPE_IPv6, &gt_conf->front_gw6) < 0)
+		goto nh_cache;
+
+	return 0;
+
+nh_cache:
+	lls_nh_cache_release(instance->nh_cache);
+	instance->nh_cache = NULL;
+	return -1;
+}
+
 static int
 config_gt_instance(struct gt_config *gt_conf, unsigned int lcore_id)
 {
 	int ret;
-	char lua_entry_path[128];
 	unsigned int block_idx = get_block_idx(gt_conf, lcore_id);
 	struct gt_instance *instance = &gt_conf->instances[block_idx];
+	struct mailbox_params mb_params = {
+		.max_entries = GT_MAILBOX_MAX_ENTRIES,
+		.mem_cache_size = 0,
+		.watermark = 0,
+	};
 
-	ret = snprintf(lua_entry_path, sizeof(lua_entry_path), \
-			"%s/%s", LUA_POLICY_BASE_DIR, GRANTOR_CONFIG_FILE);
-	RTE_VERIFY(ret > 0 && ret < (int)sizeof(lua_entry_path));
+	ret = capture_tap_init(&instance->tap, &gt_conf->capture, "gt",
+		lcore_id);
+	if (ret < 0)
+		goto out;
 
-	instance->lua_state = luaL_newstate();
-	if (instance->lua_state == NULL) {
-		RTE_LOG(ERR, GATEKEEPER,
-			"gt: failed to create new Lua state at lcore %u!\n",
-			lcore_id);
-		ret = -1;
+	ret = load_lua_policy(lcore_id, 0, &instance->lua_policy);
+	if (ret < 0)
 		goto out;
+
+	ret = init_mailbox("gt", &mb_params, sizeof(struct gt_cmd_entry),
+		lcore_id, &instance->mb);
+	if (ret < 0)
+		goto lua_policy;
+
+	if (gt_conf->decision_cache_size > 0) {
+		ret = init_decision_cache(gt_conf, lcore_id);
+		if (ret < 0)
+			goto mailbox;
 	}
 
-	luaL_openlibs(instance->lua_state);
-	set_lua_path(instance->lua_state, LUA_POLICY_BASE_DIR);
-	ret = luaL_loadfile(instance->lua_state, lua_entry_path);
-	if (ret != 0) {
-		RTE_LOG(ERR, GATEKEEPER,
-			"gt: %s!\n", lua_tostring(instance->lua_state, -1));
-		ret = -1;
-		goto free_lua_state;
+	if (gt_conf->recent_decisions_size > 0) {
+		ret = init_recent_decisions(gt_conf, lcore_id);
+		if (ret < 0)
+			goto decision_cache;
 	}
 
-	/* Run the loaded chunk. */
-	ret = lua_pcall(instance->lua_state, 0, 0, 0);
-	if (ret != 0) {
-		RTE_LOG(ERR, GATEKEEPER,
-			"gt: %s!\n", lua_tostring(instance->lua_state, -1));
+	ret = init_nh_cache(gt_conf, lcore_id);
+	if (ret < 0)
+		goto recent_decisions;
+
+	instance->stats = stats_alloc("gt", lcore_id,
+		sizeof(*instance->stats));
+	if (instance->stats == NULL) {
 		ret = -1;
-		goto free_lua_state;
+		goto nh_cache;
 	}
 
+	ret = 0;
 	goto out;
 
-free_lua_state:
-	lua_close(instance->lua_state);
-	instance->lua_state = NULL;
+nh_cache:
+	lls_nh_cache_release(instance->nh_cache);
+	instance->nh_cache = NULL;
+recent_decisions:
+	rte_free(instance->recent_decisions);
+	instance->recent_decisions = NULL;
+decision_cache:
+	rte_hash_free(instance->decision_cache);
+	instance->decision_cache = NULL;
+	rte_free(instance->cached_decisions);
+	instance->cached_decisions = NULL;
+mailbox:
+	destroy_mailbox(&instance->mb);
+	memset(&instance->mb, 0, sizeof(instance->mb));
+lua_policy:
+	destroy_lua_policy(&instance->lua_policy);
 out:
 	return ret;
 }
@@ -707,7 +1663,8 @@ init_gt_instances(struct gt_config *gt_conf)
 		unsigned int lcore = gt_conf->lcores[i];
 		inst_ptr = &gt_conf->instances[i];
 
-		ret = get_queue_id(&gt_conf->net->front, QUEUE_TYPE_RX, lcore);
+		ret = get_queue_id(&gt_conf->net->front, QUEUE_TYPE_RX, lcore,
+			gt_conf->poll.num_rx_desc);
 		if (ret < 0) {
 			RTE_LOG(ERR, GATEKEEPER, "gt: cannot assign an RX queue for the front interface for lcore %u\n",
 				lcore);
@@ -715,7 +1672,8 @@ init_gt_instances(struct gt_config *gt_conf)
 		}
 		inst_ptr->rx_queue = ret;
 
-		ret = get_queue_id(&gt_conf->net->front, QUEUE_TYPE_TX, lcore);
+		ret = get_queue_id(&gt_conf->net->front, QUEUE_TYPE_TX, lcore,
+			gt_conf->poll.num_tx_desc);
 		if (ret < 0) {
 			RTE_LOG(ERR, GATEKEEPER, "gt: cannot assign a TX queue for the front interface for lcore %u\n",
 				lcore);
@@ -723,6 +1681,13 @@ init_gt_instances(struct gt_config *gt_conf)
 		}
 		inst_ptr->tx_queue = ret;
 
+		/*
+		 * Keep the notifications of an instance on a single
+		 * source port, so a single GGU instance receives them.
+		 */
+		inst_ptr->ggu_src_port = rte_cpu_to_be_16(
+			gt_conf->ggu_src_port + i % gt_conf->num_ggu_src_ports);
+
 		/*
 		 * Set up the lua state for each instance,
 		 * and initialize the policy tables.
@@ -739,7 +1704,8 @@ init_gt_instances(struct gt_config *gt_conf)
 
 free_lua_state:
 	for (i = 0; i < num_succ_instances; i++)
-		cleanup_gt_instance(&gt_conf->instances[i]);
+		cleanup_gt_instance(&gt_conf->instances[i],
+			gt_conf->lcores[i]);
 out:
 	return ret;
 }
@@ -750,8 +1716,9 @@ gt_stage1(void *arg)
 	int ret;
 	struct gt_config *gt_conf = arg;
 
-	gt_conf->instances = rte_calloc(__func__, gt_conf->num_lcores,
-		sizeof(struct gt_instance), 0);
+	gt_conf->instances = rte_calloc_socket(__func__, gt_conf->num_lcores,
+		sizeof(struct gt_instance), 0,
+		get_lcores_socket_id(gt_conf->lcores, gt_conf->num_lcores));
 	if (gt_conf->instances == NULL) {
 		ret = -1;
 		goto out;
@@ -783,19 +1750,58 @@ int
 run_gt(struct net_config *net_conf, struct gt_config *gt_conf)
 {
 	int ret, i;
+	size_t before = heap_allocated();
 
 	if (net_conf == NULL || gt_conf == NULL) {
 		ret = -1;
 		goto out;
 	}
 
+	if (gt_conf->ggu_pd_version != GGU_PD_VER1 &&
+			gt_conf->ggu_pd_version != GGU_PD_VER2) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gt: unknown version %u of the notification packets\n",
+			gt_conf->ggu_pd_version);
+		ret = -1;
+		goto out;
+	}
+
+	/* A single source port is the behavior of older configurations. */
+	if (gt_conf->num_ggu_src_ports == 0)
+		gt_conf->num_ggu_src_ports = 1;
+
+	if ((uint32_t)gt_conf->ggu_src_port +
+			gt_conf->num_ggu_src_ports - 1 > UINT16_MAX) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gt: the %hu source ports starting at %hu do not fit in the port space\n",
+			gt_conf->num_ggu_src_ports, gt_conf->ggu_src_port);
+		ret = -1;
+		goto out;
+	}
+
+	if (gt_conf->recent_decisions_size > (1U << 31)) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gt: at most %u recent decisions can be kept, not %u\n",
+			1U << 31, gt_conf->recent_decisions_size);
+		ret = -1;
+		goto out;
+	}
+
+	ret = check_poll_config(&gt_conf->poll, &net_conf->front, "gt");
+	if (ret < 0)
+		goto out;
+
 	gt_conf->net = net_conf;
+	gt_conf->max_ggu_notify_delay_cycles =
+		gt_conf->max_ggu_notify_delay_ms * cycles_per_ms;
+	gt_conf->recent_decision_window_cycles =
+		(uint64_t)gt_conf->recent_decision_window_ms * cycles_per_ms;
 
 	if (gt_conf->num_lcores <= 0)
 		goto success;
 
 	ret = net_launch_at_stage1(net_conf, gt_conf->num_lcores,
-		gt_conf->num_lcores, 0, 0, gt_stage1, gt_conf);
+		gt_conf->num_lcores, 0, 0, "gt", gt_stage1, gt_conf);
 	if (ret < 0)
 		goto out;
 
@@ -830,5 +1836,115 @@ out:
 
 success:
 	rte_atomic32_init(&gt_conf->ref_cnt);
+	log_heap_reserved("gt", "at configuration", before);
+	return 0;
+}
+
+/*
+ * Wait until the GT instance of @mb has swapped in the policy of @entry,
+ * and free the old policy that it handed back.
+ *
+ * When Gatekeeper is exiting, the GT instance may never process
+ * @entry, so @entry and its policy are left behind.
+ */
+static int
+retire_lua_policy(struct mailbox *mb, struct gt_cmd_entry *entry)
+{
+	while (!entry->u.update.done) {
+		if (unlikely(exiting))
+			return -1;
+		rte_pause();
+	}
+
+	/* Pairs with the barrier in update_policy(). */
+	rte_rmb();
+	destroy_lua_policy(&entry->u.update.policy);
+	mb_free_entry(mb, entry);
 	return 0;
 }
+
+/*
+ * Load the Lua policy script again for all GT instances, and swap
+ * the new policies in while the GT instances keep processing packets.
+ *
+ * The new policies are built at the calling lcore, which should not
+ * run a GT instance, e.g. the lcore of the Dynamic Config block.
+ * Each GT instance swaps in its new policy between two bursts, and
+ * the old policies are freed here once they have been swapped out.
+ * If any policy fails to load, all GT instances keep their policies.
+ */
+int
+gt_reload_policy(struct gt_config *gt_conf)
+{
+	int i;
+	int ret = 0;
+	uint64_t version = gt_conf->policy_version + 1;
+	struct gt_cmd_entry **entries;
+
+	/* Before stage 1, there are no GT instances. */
+	if (gt_conf->instances == NULL) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gt: there are no GT instances to reload the policy\n");
+		return -1;
+	}
+
+	entries = rte_calloc("gt_policy_updates", gt_conf->num_lcores,
+		sizeof(*entries), 0);
+	if (entries == NULL) {
+		RTE_LOG(ERR, MALLOC,
+			"gt: out of memory to reload the policy\n");
+		return -1;
+	}
+
+	for (i = 0; i < gt_conf->num_lcores; i++) {
+		struct gt_instance *instance = &gt_conf->instances[i];
+
+		entries[i] = mb_alloc_entry(&instance->mb);
+		if (entries[i] == NULL)
+			goto entries;
+
+		entries[i]->op = GT_UPDATE_POLICY;
+		entries[i]->u.update.done = false;
+		if (load_lua_policy(gt_conf->lcores[i], version,
+				&entries[i]->u.update.policy) < 0) {
+			mb_free_entry(&instance->mb, entries[i]);
+			goto entries;
+		}
+	}
+	gt_conf->policy_version = version;
+
+	/* All new policies have loaded, so send them together. */
+	for (i = 0; i < gt_conf->num_lcores; i++) {
+		struct gt_lua_policy new_policy = entries[i]->u.update.policy;
+
+		if (mb_send_entry(&gt_conf->instances[i].mb, entries[i]) < 0) {
+			RTE_LOG(ERR, GATEKEEPER,
+				"gt: the GT instance at lcore %u keeps its policy\n",
+				gt_conf->lcores[i]);
+			destroy_lua_policy(&new_policy);
+			entries[i] = NULL;
+			ret = -1;
+		}
+	}
+
+	for (i = 0; i < gt_conf->num_lcores; i++) {
+		if (entries[i] != NULL && retire_lua_policy(
+				&gt_conf->instances[i].mb, entries[i]) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+
+	rte_free(entries);
+	return ret;
+
+entries:
+	while (--i >= 0) {
+		destroy_lua_policy(&entries[i]->u.update.policy);
+		mb_free_entry(&gt_conf->instances[i].mb, entries[i]);
+	}
+	rte_free(entries);
+	RTE_LOG(ERR, GATEKEEPER,
+		"gt: failed to reload the policy, the GT instances keep their policies\n");
+	return -1;
+}
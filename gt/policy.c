@@ -0,0 +1,328 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+
+#include <rte_log.h>
+#include <rte_hash.h>
+#include <rte_lpm.h>
+#include <rte_lpm6.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+
+#include "gatekeeper_gk.h"
+#include "gatekeeper_gt.h"
+
+#ifdef RTE_MACHINE_CPUFLAG_SSE4_2
+#include <rte_hash_crc.h>
+#define DEFAULT_HASH_FUNC rte_hash_crc
+#else
+#include <rte_jhash.h>
+#define DEFAULT_HASH_FUNC rte_jhash
+#endif
+
+/* XXX Sample parameter, need to be tested for better performance. */
+#define GT_SIMPLE_POLICY_NUM_TBL8S (256)
+
+/* The key of the table of destination ports of a simple policy. */
+struct gt_port_key {
+	uint16_t ip_ver;
+	uint16_t dst_port;
+	uint8_t  l4_proto;
+};
+
+static inline void
+fill_port_key(struct gt_port_key *key, uint16_t ip_ver,
+	uint8_t l4_proto, uint16_t dst_port)
+{
+	memset(key, 0, sizeof(*key));
+	key->ip_ver = ip_ver;
+	key->dst_port = dst_port;
+	key->l4_proto = l4_proto;
+}
+
+/*
+ * Create an empty simple policy for the GT instance at @lcore_id.
+ * The tables of each @version of the policy have distinct names,
+ * so a new version can be built while the current one is in use.
+ */
+struct gt_simple_policy *
+create_simple_policy(unsigned int lcore_id, uint64_t version)
+{
+	int ret;
+	char name[64];
+	int socket_id = rte_lcore_to_socket_id(lcore_id);
+	struct gt_simple_policy *policy;
+	struct rte_hash_parameters port_params = {
+		.name = name,
+		.entries = GT_SIMPLE_POLICY_MAX_PORTS,
+		.reserved = 0,
+		.key_len = sizeof(struct gt_port_key),
+		.hash_func = DEFAULT_HASH_FUNC,
+		.hash_func_init_val = 0,
+		.socket_id = socket_id,
+		.extra_flag = 0,
+	};
+	struct rte_lpm_config ip4_params = {
+		.max_rules = GT_SIMPLE_POLICY_MAX_PREFIXES,
+		.number_tbl8s = GT_SIMPLE_POLICY_NUM_TBL8S,
+		.flags = 0,
+	};
+	struct rte_lpm6_config ip6_params = {
+		.max_rules = GT_SIMPLE_POLICY_MAX_PREFIXES,
+		.number_tbl8s = GT_SIMPLE_POLICY_NUM_TBL8S,
+		.flags = 0,
+	};
+
+	policy = rte_zmalloc_socket("gt_simple_policy", sizeof(*policy),
+		0, socket_id);
+	if (policy == NULL) {
+		RTE_LOG(ERR, MALLOC,
+			"gt: failed to allocate the simple policy at lcore %u!\n",
+			lcore_id);
+		goto out;
+	}
+	policy->default_group = -1;
+
+	ret = snprintf(name, sizeof(name), "gt_policy_ports_%u_%" PRIu64,
+		lcore_id, version);
+	RTE_VERIFY(ret > 0 && ret < (int)sizeof(name));
+	policy->ports = rte_hash_create(&port_params);
+	if (policy->ports == NULL) {
+		RTE_LOG(ERR, HASH,
+			"gt: cannot create the port table of the simple policy at lcore %u!\n",
+			lcore_id);
+		goto policy;
+	}
+
+	ret = snprintf(name, sizeof(name), "gt_policy_ip4_%u_%" PRIu64,
+		lcore_id, version);
+	RTE_VERIFY(ret > 0 && ret < (int)sizeof(name));
+	policy->ip4_prefixes = rte_lpm_create(name, socket_id, &ip4_params);
+	if (policy->ip4_prefixes == NULL) {
+		RTE_LOG(ERR, LPM,
+			"gt: cannot create the IPv4 prefix table of the simple policy at lcore %u!\n",
+			lcore_id);
+		goto ports;
+	}
+
+	ret = snprintf(name, sizeof(name), "gt_policy_ip6_%u_%" PRIu64,
+		lcore_id, version);
+	RTE_VERIFY(ret > 0 && ret < (int)sizeof(name));
+	policy->ip6_prefixes = rte_lpm6_create(name, socket_id, &ip6_params);
+	if (policy->ip6_prefixes == NULL) {
+		RTE_LOG(ERR, LPM,
+			"gt: cannot create the IPv6 prefix table of the simple policy at lcore %u!\n",
+			lcore_id);
+		goto ip4;
+	}
+
+	return policy;
+
+ip4:
+	rte_lpm_free(policy->ip4_prefixes);
+ports:
+	rte_hash_free(policy->ports);
+policy:
+	rte_free(policy);
+out:
+	return NULL;
+}
+
+void
+destroy_simple_policy(struct gt_simple_policy *policy)
+{
+	if (policy == NULL)
+		return;
+
+	rte_lpm6_free(policy->ip6_prefixes);
+	rte_lpm_free(policy->ip4_prefixes);
+	rte_hash_free(policy->ports);
+	rte_free(policy);
+}
+
+static inline void
+fill_group_decision(struct gt_simple_policy *policy, uint8_t group_id,
+	struct ggu_policy *decision)
+{
+	decision->state = policy->groups[group_id].state;
+	rte_memcpy(&decision->params, &policy->groups[group_id].params,
+		sizeof(decision->params));
+}
+
+int
+lookup_simple_policy(struct gt_simple_policy *policy,
+	struct gt_packet_headers *pkt_info, struct ggu_policy *decision)
+{
+	int ret;
+	uint16_t dst_port;
+
+	if (get_l4_dst_port(pkt_info, &dst_port)) {
+		struct gt_port_key key;
+
+		fill_port_key(&key, pkt_info->inner_ip_ver,
+			pkt_info->l4_proto, dst_port);
+		ret = rte_hash_lookup(policy->ports, &key);
+		if (ret >= 0) {
+			fill_group_decision(policy,
+				policy->port_groups[ret], decision);
+			return 0;
+		}
+	}
+
+	if (pkt_info->inner_ip_ver == ETHER_TYPE_IPv4) {
+		struct ipv4_hdr *ip4_hdr =
+			(struct ipv4_hdr *)pkt_info->inner_l3_hdr;
+		uint32_t group_id;
+
+		ret = rte_lpm_lookup(policy->ip4_prefixes,
+			rte_be_to_cpu_32(ip4_hdr->dst_addr), &group_id);
+		if (ret == 0) {
+			fill_group_decision(policy, group_id, decision);
+			return 0;
+		}
+	} else if (likely(pkt_info->inner_ip_ver == ETHER_TYPE_IPv6)) {
+		struct ipv6_hdr *ip6_hdr =
+			(struct ipv6_hdr *)pkt_info->inner_l3_hdr;
+		uint8_t group_id;
+
+		ret = rte_lpm6_lookup(policy->ip6_prefixes,
+			ip6_hdr->dst_addr, &group_id);
+		if (ret == 0) {
+			fill_group_decision(policy, group_id, decision);
+			return 0;
+		}
+	}
+
+	if (policy->default_group >= 0) {
+		fill_group_decision(policy, policy->default_group, decision);
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * The functions below are called by the Lua policy through FFI
+ * while it compiles its simple policy.
+ */
+
+int
+gt_simple_policy_add_group(struct gt_simple_policy *policy,
+	uint8_t group_id, const struct ggu_policy *params)
+{
+	if (params->state != GK_GRANTED && params->state != GK_DECLINED) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"gt: group %hhu of the simple policy has an invalid action %hhu!\n",
+			group_id, params->state);
+		return -1;
+	}
+
+	policy->groups[group_id].state = params->state;
+	rte_memcpy(&policy->groups[group_id].params, &params->params,
+		sizeof(params->params));
+	policy->group_defined[group_id] = true;
+	return 0;
+}
+
+static inline bool
+is_group_defined(struct gt_simple_policy *policy, uint8_t group_id)
+{
+	if (likely(policy->group_defined[group_id]))
+		return true;
+
+	RTE_LOG(ERR, GATEKEEPER,
+		"gt: group %hhu of the simple policy is not defined!\n",
+		group_id);
+	return false;
+}
+
+int
+gt_simple_policy_add_port(struct gt_simple_policy *policy, uint16_t ip_ver,
+	uint8_t l4_proto, uint16_t dst_port, uint8_t group_id)
+{
+	int ret;
+	struct gt_port_key key;
+
+	if (!is_group_defined(policy, group_id))
+		return -1;
+
+	fill_port_key(&key, ip_ver, l4_proto, dst_port);
+	ret = rte_hash_add_key(policy->ports, &key);
+	if (ret < 0) {
+		RTE_LOG(ERR, HASH,
+			"gt: cannot add port %hu to the simple policy (err = %d)!\n",
+			dst_port, ret);
+		return -1;
+	}
+
+	policy->port_groups[ret] = group_id;
+	return 0;
+}
+
+int
+gt_simple_policy_add_prefix(struct gt_simple_policy *policy,
+	const char *ip_addr, uint8_t prefix_len, uint8_t group_id)
+{
+	int ret;
+	struct in_addr ip4_addr;
+	struct in6_addr ip6_addr;
+
+	if (!is_group_defined(policy, group_id))
+		return -1;
+
+	if (inet_pton(AF_INET, ip_addr, &ip4_addr) == 1) {
+		if (prefix_len > 32) {
+			ret = -EINVAL;
+			goto error;
+		}
+		ret = rte_lpm_add(policy->ip4_prefixes,
+			rte_be_to_cpu_32(ip4_addr.s_addr), prefix_len,
+			group_id);
+	} else if (inet_pton(AF_INET6, ip_addr, &ip6_addr) == 1) {
+		if (prefix_len > 128) {
+			ret = -EINVAL;
+			goto error;
+		}
+		ret = rte_lpm6_add(policy->ip6_prefixes, ip6_addr.s6_addr,
+			prefix_len, group_id);
+	} else
+		ret = -EINVAL;
+
+	if (ret == 0)
+		return 0;
+
+error:
+	RTE_LOG(ERR, LPM,
+		"gt: cannot add prefix %s/%hhu to the simple policy (err = %d)!\n",
+		ip_addr, prefix_len, ret);
+	return -1;
+}
+
+int
+gt_simple_policy_set_default(struct gt_simple_policy *policy,
+	uint8_t group_id)
+{
+	if (!is_group_defined(policy, group_id))
+		return -1;
+
+	policy->default_group = group_id;
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GATEKEEPER_CAPTURE_H_
+#define _GATEKEEPER_CAPTURE_H_
+
+#include <stdint.h>
+
+#include <rte_ring.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+#include <rte_branch_prediction.h>
+
+/*
+ * Packet capture.
+ *
+ * A block samples the packets it receives through a tap, which clones
+ * the sampled packets, i.e. shares their data instead of copying them,
+ * into a ring of the lcore of the block. The master lcore writes
+ * the packets of the rings into the pcap file opened by capture_open(),
+ * along with the fast logs (see run_log_writer()).
+ *
+ * The captured packets are the packets as received, except that
+ * the blocks may rewrite their headers in place before the master
+ * lcore writes them; e.g. the GT blocks write the Ethernet header of
+ * the decapsulated packets over the end of their outer IP header.
+ */
+
+/* XXX Sample parameters, need to be tested for better performance. */
+#define CAPTURE_RING_SIZE   (1024)
+#define CAPTURE_WRITE_BURST (32)
+
+/*
+ * The samples in flight at each lcore. A sample is a clone that pins
+ * the mbuf of its packet, which comes from the pool of the NUMA node
+ * of the block (see GATEKEEPER_MBUF_SIZE), so the samples must not
+ * starve the RX queues of that pool while the master lcore is behind.
+ */
+#define CAPTURE_MAX_CLONES  (255)
+
+/* The headers of the pcap format, which the benchmarks also read. */
+#define PCAP_MAGIC         (0xa1b2c3d4)
+#define PCAP_VERSION_MAJOR (2)
+#define PCAP_VERSION_MINOR (4)
+#define PCAP_SNAPLEN       (65535)
+#define PCAP_LINKTYPE_ETH  (1)
+
+struct pcap_file_hdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t  thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_rec_hdr {
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t incl_len;
+	uint32_t orig_len;
+};
+
+/* How a block samples the packets it receives. */
+struct capture_config {
+	/* Capture one out of @sample_rate packets; zero disables the tap. */
+	unsigned int sample_rate;
+
+	/*
+	 * The classes of the packets that are sampled, as bits
+	 * (1 << class); zero samples all classes. The GK blocks classify
+	 * the packets by the state of their flows, e.g. GK_REQUEST.
+	 */
+	unsigned int classes;
+};
+
+/* The tap of a block, only used by the lcore of the block. */
+struct capture_tap {
+	/* Zero when the tap is disabled. */
+	unsigned int       sample_rate;
+	unsigned int       classes;
+	/* Packets to skip before the next sample. */
+	unsigned int       countdown;
+
+	struct rte_ring    *ring;
+	struct rte_mempool *clone_pool;
+
+	/* Samples lost because the ring or the pool ran out of room. */
+	uint64_t           num_dropped;
+};
+
+int capture_open(const char *path);
+void capture_close(void);
+int capture_tap_init(struct capture_tap *tap,
+	const struct capture_config *conf, const char *block,
+	unsigned int lcore_id);
+void capture_enqueue(struct capture_tap *tap, struct rte_mbuf *pkt);
+void capture_write(void);
+
+/*
+ * Sample @pkt, of class @class, through @tap.
+ * It only costs a branch when the tap is disabled.
+ */
+static inline void
+capture_pkt(struct capture_tap *tap, struct rte_mbuf *pkt, unsigned int class)
+{
+	if (likely(tap->sample_rate == 0))
+		return;
+
+	if (tap->classes != 0 && !(tap->classes & (1U << class)))
+		return;
+
+	if (--tap->countdown > 0)
+		return;
+	tap->countdown = tap->sample_rate;
+
+	capture_enqueue(tap, pkt);
+}
+
+#endif /* _GATEKEEPER_CAPTURE_H_ */
@@ -17,10 +17,13 @@
  */
 
 #include <lua.h>
+#include <netinet/in.h>
 
 #ifndef _GATEKEEPER_CONFIG_H_
 #define _GATEKEEPER_CONFIG_H_
 
+#include "gatekeeper_mailbox.h"
+
 /* 
  * XXX Sample parameters for test only. 
  * They should be configured in the configuration step.
@@ -28,16 +31,6 @@
 #define GATEKEEPER_MAX_PORTS	(4)
 #define GATEKEEPER_MAX_QUEUES	(4)
 
-/*
- * XXX Sample parameters for test only.
- * They should be analyzed or tested further to find optimal values.
- *
- * Larger queue size can mitigate bursty behavior, but can also increase 
- * pressure on cache and lead to lower performance.
- */
-#define GATEKEEPER_NUM_RX_DESC	(128)
-#define GATEKEEPER_NUM_TX_DESC	(512)
-
 /* 
  * XXX Sample parameter for the number of elements in the mbuf pool.
  * This should be analyzed or tested further to find optimal value.
@@ -47,10 +40,11 @@
  *
  * Need to provision enough memory for the worst case,
  * since each queue needs at least
- * GATEKEEPER_NUM_RX_DESC + GATEKEEPER_NUM_TX_DESC + GATEKEEPER_MAX_PKT_BURST
- * descriptors. i.e., GATEKEEPER_DESC_PER_QUEUE =
+ * GATEKEEPER_NUM_RX_DESC + GATEKEEPER_NUM_TX_DESC + GATEKEEPER_DEF_PKT_BURST
+ * descriptors with the default struct poll_config (see gatekeeper_poll.h),
+ * i.e., GATEKEEPER_DESC_PER_QUEUE =
  * (GATEKEEPER_NUM_RX_DESC + GATEKEEPER_NUM_TX_DESC \
- *		+ GATEKEEPER_MAX_PKT_BURST (let's say 32)) = 672.
+ *		+ GATEKEEPER_DEF_PKT_BURST (let's say 32)) = 672.
  *
  * So, the pool size should be at least the maximum number of queues * 
  *		number of descriptors per queue, i.e., 
@@ -79,15 +73,82 @@
  */
 #define GATEKEEPER_CACHE_SIZE	(512)
 
-#define GATEKEEPER_MAX_PKT_BURST (32)
-
 /* Configuration for the Dynamic Config functional block. */
 struct dynamic_config {
-	unsigned int	lcore_id;
+	unsigned int	 lcore_id;
+
+	/* Parameters of the mailbox of the block. */
+	unsigned int     mailbox_max_entries;
+	unsigned int     mailbox_mem_cache_size;
+	unsigned int     mailbox_watermark;
+
+	/*
+	 * The fields below are for internal use.
+	 * Configuration files should not refer to them.
+	 */
+
+	/* The GK blocks whose FIBs are updated, on a Gatekeeper server. */
+	struct gk_config *gk;
+
+	/* The GT blocks whose policies are reloaded, on a Grantor server. */
+	struct gt_config *gt;
+
+	/* Commands to the block. */
+	struct mailbox   mb;
+};
+
+/* Define the possible command operations for the Dynamic Config block. */
+enum dy_cmd_op {
+	DY_FIB_ADD,
+	DY_FIB_DEL,
+	DY_FLOWS_EXPORT,
+	DY_FLOWS_IMPORT,
+	DY_GT_POLICY_RELOAD,
+	DY_TALKERS_REPORT,
+};
+
+/* Room for an IPv6 address and a prefix length, e.g. "/128". */
+#define DY_PREFIX_STR_LEN (INET6_ADDRSTRLEN + 4)
+
+/* XXX Sample parameter: the longest path of a flow snapshot. */
+#define DY_PATH_STR_LEN (256)
+
+struct dy_cmd_entry {
+	enum dy_cmd_op  op;
+
+	union {
+		struct {
+			char prefix[DY_PREFIX_STR_LEN];
+			/* Empty for GK_DROP. */
+			char gateway[INET6_ADDRSTRLEN];
+			/* See enum gk_fib_action. */
+			int  action;
+		} fib;
+
+		struct {
+			/*
+			 * The flow snapshot, see gk_export_flows(),
+			 * or the report of gk_report_talkers().
+			 */
+			char path[DY_PATH_STR_LEN];
+		} flows;
+	} u;
 };
 
+struct gk_config;
+struct gt_config;
+
 int config_gatekeeper(void);
 int set_lua_path(lua_State *l, const char *path);
-int run_dynamic_config(const struct dynamic_config *dy_conf);
+struct dynamic_config *alloc_dy_conf(void);
+int run_dynamic_config(struct gk_config *gk_conf, struct gt_config *gt_conf,
+	struct dynamic_config *dy_conf);
+int dy_add_fib_entry(const char *prefix, const char *gateway,
+	int action, struct dynamic_config *dy_conf);
+int dy_del_fib_entry(const char *prefix, struct dynamic_config *dy_conf);
+int dy_export_flows(const char *path, struct dynamic_config *dy_conf);
+int dy_import_flows(const char *path, struct dynamic_config *dy_conf);
+int dy_reload_gt_policy(struct dynamic_config *dy_conf);
+int dy_report_talkers(const char *path, struct dynamic_config *dy_conf);
 
 #endif /* _GATEKEEPER_CONFIG_H_ */
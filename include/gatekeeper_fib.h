@@ -0,0 +1,178 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GATEKEEPER_FIB_H_
+#define _GATEKEEPER_FIB_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <rte_lpm.h>
+#include <rte_lpm6.h>
+#include <rte_spinlock.h>
+
+#include "gatekeeper_ipip.h"
+
+/*
+ * The next hops are the values of the LPM tables, and rte_lpm6
+ * only supports 8-bit next hops, so this is also the limit of
+ * the distinct (action, gateway) pairs of a FIB.
+ */
+#define GK_FIB_MAX_NEXTHOPS (256)
+
+/* What a GK block does with the packets to a destination prefix. */
+enum gk_fib_action {
+	/* Enforce the policy of the Grantor server of the prefix. */
+	GK_FWD_GRANTOR,
+	/* Forward the packets to the gateway on the back interface. */
+	GK_FWD_BACK,
+	/* Drop the packets. */
+	GK_DROP,
+};
+
+/* The action of the next hops that no rule refers to. */
+#define GK_FIB_FREE (UINT8_MAX)
+
+struct gk_fib_nexthop {
+	/* The action of the next hop (i.e. enum gk_fib_action). */
+	uint8_t                 action;
+
+	/*
+	 * Bumped whenever the next hop is freed, so the flow entries
+	 * that refer to a freed next hop can tell that its ID now
+	 * belongs to another next hop (see gk_fib_nexthop_ref()).
+	 */
+	uint8_t                 gen;
+
+	/*
+	 * For GK_FWD_GRANTOR, the tunnel to the Grantor server,
+	 * whose address is @tunnel.flow.f.*.dst. For GK_FWD_BACK,
+	 * only the MAC addresses of @tunnel are used, and
+	 * @tunnel.flow.f.*.dst is the address of the gateway.
+	 */
+	struct ipip_tunnel_info tunnel;
+};
+
+/*
+ * The FIB of the GK blocks: the destination prefixes, each one
+ * mapped to a next hop. There is one copy of the FIB on each NUMA node
+ * that runs GK blocks, shared by all the GK blocks of that node.
+ *
+ * A published FIB is never modified. Updates build a new version of
+ * the FIB from the RIB (see struct gk_rib), publish it, and free the
+ * old version once all GK blocks have passed a quiescent point,
+ * so the GK blocks read the FIB without locks.
+ */
+struct gk_fib {
+	/* DIR-24-8 LPM table for IPv4 destinations. */
+	struct rte_lpm         *ip4;
+	struct rte_lpm6        *ip6;
+
+	unsigned int           num_nexthops;
+	struct gk_fib_nexthop  nexthops[GK_FIB_MAX_NEXTHOPS];
+};
+
+/*
+ * Version of a GK instance that holds no FIB, i.e. it is in
+ * a quiescent state until it loads a FIB again.
+ */
+#define GK_FIB_QUIESCENT (UINT64_MAX)
+
+/*
+ * The flow entries refer to their next hops by the ID of the next hop
+ * in the lower byte, and its generation in the upper byte.
+ */
+static inline uint16_t
+gk_fib_nexthop_ref(const struct gk_fib *fib, unsigned int nexthop_id)
+{
+	return (uint16_t)fib->nexthops[nexthop_id].gen << 8 | nexthop_id;
+}
+
+static inline unsigned int
+gk_fib_ref_to_nexthop_id(uint16_t ref)
+{
+	return ref & 0xFF;
+}
+
+/* Whether the next hop that @ref refers to is still in @fib. */
+static inline bool
+gk_fib_ref_is_current(const struct gk_fib *fib, uint16_t ref)
+{
+	return fib->nexthops[gk_fib_ref_to_nexthop_id(ref)].gen == ref >> 8;
+}
+
+struct gk_rib_rule {
+	/* The prefix is @prefix.f.*.dst, and its IP version @prefix.proto. */
+	struct ip_flow prefix;
+	uint8_t        prefix_len;
+	uint8_t        nexthop_id;
+};
+
+/*
+ * The RIB is the source of the FIB versions: the rules, and
+ * the next hops they refer to. It is only used by the updaters.
+ *
+ * Updates change @staged_rules and @staged_nexthops, which are either
+ * committed, i.e. become @rules and @nexthops and are published in
+ * a new FIB version, or dropped.
+ *
+ * The commits free the next hops that no rule refers to anymore,
+ * and new next hops take the free IDs first, so the IDs stay below
+ * GK_FIB_MAX_NEXTHOPS however the routes change. The IDs of the next
+ * hops in use never change.
+ */
+struct gk_rib {
+	/* Serializes the updaters. */
+	rte_spinlock_t        lock;
+
+	unsigned int          max_rules;
+	unsigned int          num_rules;
+	struct gk_rib_rule    *rules;
+
+	unsigned int          num_staged_rules;
+	unsigned int          num_staged_ip4_rules;
+	unsigned int          num_staged_ip6_rules;
+	struct gk_rib_rule    *staged_rules;
+
+	/* The IDs at and after @num_nexthops have never been used. */
+	unsigned int          num_nexthops;
+	struct gk_fib_nexthop nexthops[GK_FIB_MAX_NEXTHOPS];
+
+	unsigned int          num_staged_nexthops;
+	struct gk_fib_nexthop staged_nexthops[GK_FIB_MAX_NEXTHOPS];
+};
+
+struct gk_config;
+
+int init_gk_fibs(struct gk_config *gk_conf);
+void destroy_gk_fibs(struct gk_config *gk_conf);
+void gk_fib_set_source_mac(struct gk_config *gk_conf);
+
+void gk_fib_update_begin(struct gk_config *gk_conf);
+int gk_fib_stage_add(const char *prefix, const char *gateway,
+	int action, struct gk_config *gk_conf);
+int gk_fib_stage_del(const char *prefix, struct gk_config *gk_conf);
+int gk_fib_update_commit(struct gk_config *gk_conf);
+void gk_fib_update_abort(struct gk_config *gk_conf);
+
+int add_fib_entry(const char *prefix, const char *gateway,
+	int action, struct gk_config *gk_conf);
+int del_fib_entry(const char *prefix, struct gk_config *gk_conf);
+int gk_fib_lookup(struct gk_fib *fib, const struct ip_flow *flow);
+
+#endif /* _GATEKEEPER_FIB_H_ */
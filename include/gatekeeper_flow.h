@@ -39,9 +39,25 @@ struct ip_flow {
 	} f;
 };
 
+/*
+ * Build the lookup tables of the RSS hash functions below.
+ * It must be called after @rss_key_be is set, and before any
+ * of the hash functions is called.
+ */
+void init_ip_flow_hash(void);
+
 uint32_t rss_ip_flow_hf(const void *data,
 	uint32_t data_len, uint32_t init_val);
 
+/*
+ * Hash functions for keys that are only the addresses of a flow,
+ * i.e. the field @f of struct ip_flow of an IPv4 or an IPv6 flow.
+ */
+uint32_t rss_ip4_flow_hf(const void *data,
+	uint32_t data_len, uint32_t init_val);
+uint32_t rss_ip6_flow_hf(const void *data,
+	uint32_t data_len, uint32_t init_val);
+
 int ip_flow_cmp_eq(const void *key1, const void *key2, size_t key_len);
 
 #endif /* _GATEKEEPER_FLOW_H_ */
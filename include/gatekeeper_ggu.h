@@ -19,28 +19,86 @@
 #ifndef _GATEKEEPER_GGU_H_
 #define _GATEKEEPER_GGU_H_
 
+#include <rte_atomic.h>
+
 #include "gatekeeper_net.h"
 #include "gatekeeper_flow.h"
+#include "gatekeeper_mailbox.h"
+#include "gatekeeper_poll.h"
+#include "gatekeeper_stats.h"
 
 #define GGU_PD_VER1 (1)
+#define GGU_PD_VER2 (2)
+
+/* Statistics of the GK-GT Unit; see gatekeeper_stats.h. */
+struct ggu_stats {
+	/* Decisions received, and those that could not reach a GK block. */
+	uint64_t decisions_received;
+	uint64_t decisions_dropped;
+
+	/* Packets that are not valid notifications. */
+	uint64_t pkts_invalid;
+
+	/* Only kept when built with CYCLE_STATS=y. */
+	struct stats_cycle_hist process_single_packet;
+} __rte_cache_aligned;
+
+/* Structures for each GK-GT Unit instance. */
+struct ggu_instance {
+	/* RX queue on the back interface. */
+	uint16_t          rx_queue_back;
+
+	/* Staging buffers for the mailbox of each GK instance. */
+	struct mb_stage   *gk_stages;
+
+	/* The decisions of the burst being processed. */
+	struct ggu_decisions *dec;
+
+	/* Only written by the lcore of the instance. */
+	struct ggu_stats  *stats;
+};
 
 /* Configuration for the GK-GT Unit functional block. */
 struct ggu_config {
-	unsigned int      lcore_id;
-
-	/* The UDP source and destination port numbers for GGU. */
+	/*
+	 * The UDP source and destination port numbers for GGU.
+	 * The notifications may come from any of the
+	 * @num_ggu_src_ports source ports starting at @ggu_src_port,
+	 * which are spread over the GGU instances, so the Grantor servers
+	 * must use the same range (see struct gt_config).
+	 */
 	uint16_t          ggu_src_port;
 	uint16_t          ggu_dst_port;
+	uint16_t          num_ggu_src_ports;
+
+	/*
+	 * When non-zero, the decisions for a GK block whose mailbox
+	 * is congested are held back while packets keep arriving,
+	 * and a new decision for a flow replaces the decision
+	 * held back for the same flow.
+	 */
+	int               coalesce_decisions;
+
+	/* How the GK-GT Unit polls its RX queues on the back interface. */
+	struct poll_config poll;
 
 	/*
 	 * The fields below are for internal use.
 	 * Configuration files should not refer to them.
 	 */
+	rte_atomic32_t    ref_cnt;
+
+	/* The lcore ids at which each instance runs. */
+	unsigned int      *lcores;
+
+	/* The number of lcore ids in @lcores. */
+	int               num_lcores;
 
-	/* RX queue on the back interface. */
-	uint16_t          rx_queue_back;
 	struct net_config *net;
 	struct gk_config  *gk;
+
+	/* The GGU instances. */
+	struct ggu_instance *instances;
 };
 
 /*
@@ -74,6 +132,39 @@ struct ggu_common_hdr {
 	uint8_t reserved[3];
 }__attribute__((packed));
 
+/*
+ * Version 2 of the format shrinks the decisions, which typically share
+ * a few parameter sets (e.g. one per group of a simple policy) and,
+ * under attack, a few destinations. In the UDP payload:
+ *  struct ggu_v2_hdr, whose field v1 is 2;
+ *  @num_param_sets parameter sets, each one a byte with the state
+ *   (GK_GRANTED or GK_DECLINED) followed by the parameters of
+ *   that state;
+ *  @num_decisions decisions, each one a descriptor byte followed by
+ *   the source address and, unless GGU_V2_SAME_DST is set,
+ *   the destination address of the flow.
+ *
+ * The low bits of the descriptor index the parameter set of
+ * the decision, GGU_V2_IPV6 tells that the flow is IPv6, and
+ * GGU_V2_SAME_DST tells that the destination is the one of
+ * the previous decision, which must have the same IP version.
+ *
+ * All multi-byte fields are in network order, and the fields after
+ * struct ggu_v2_hdr are not aligned. struct ggu_v2_hdr has the size of
+ * struct ggu_common_hdr, so both versions fit the same payload.
+ */
+struct ggu_v2_hdr {
+	uint8_t  v1;
+	uint8_t  num_param_sets;
+	uint16_t num_decisions;
+	uint8_t  reserved[4];
+}__attribute__((packed));
+
+#define GGU_V2_PARAM_SET_MASK	(0x3F)
+#define GGU_V2_IPV6		(0x40)
+#define GGU_V2_SAME_DST		(0x80)
+#define GGU_V2_MAX_PARAM_SETS	(GGU_V2_PARAM_SET_MASK + 1)
+
 struct ggu_policy {
 	uint8_t  state;
 	struct ip_flow flow;
@@ -121,6 +212,16 @@ struct ggu_policy {
 struct ggu_config *alloc_ggu_conf(void);
 int run_ggu(struct net_config *net_conf,
 	struct gk_config *gk_conf, struct ggu_config *ggu_conf);
-int cleanup_ggu(struct ggu_config *ggu_conf);
+int ggu_conf_put(struct ggu_config *ggu_conf);
+int ggu_bench_instance_setup(struct net_config *net_conf,
+	struct gk_config *gk_conf, struct ggu_config *ggu_conf);
+void ggu_bench_instance_process(struct ggu_config *ggu_conf,
+	struct rte_mbuf **pkts, uint16_t num_pkts);
+
+static inline void
+ggu_conf_hold(struct ggu_config *ggu_conf)
+{
+	rte_atomic32_inc(&ggu_conf->ref_cnt);
+}
 
 #endif /* _GATEKEEPER_GGU_H_ */
@@ -19,11 +19,18 @@
 #ifndef _GATEKEEPER_GK_H_
 #define _GATEKEEPER_GK_H_
 
+#include <stdbool.h>
+
 #include <rte_atomic.h>
 
+#include "gatekeeper_capture.h"
+#include "gatekeeper_fib.h"
 #include "gatekeeper_ipip.h"
 #include "gatekeeper_ggu.h"
 #include "gatekeeper_mailbox.h"
+#include "gatekeeper_poll.h"
+#include "gatekeeper_stats.h"
+#include "gatekeeper_tx.h"
 
 /*
  * A flow entry can be in one of three states:
@@ -31,28 +38,257 @@
  */
 enum gk_flow_state { GK_REQUEST, GK_GRANTED, GK_DECLINED };
 
+struct gk_flow_file;
+struct gk_wheel;
+
+/*
+ * A flow table is a hash table of flows and the table of flow entries
+ * indexed by the positions returned by the hash table.
+ */
+struct gk_flow_table {
+	struct rte_hash   *hash_table;
+	struct flow_entry *entry_table;
+	/* The timers of the expiration of the entries. */
+	struct gk_wheel   *wheel;
+	/* Where the sampling of entries to evict resumes. */
+	uint32_t          scan_next;
+
+	/*
+	 * When the flow table persists across restarts (see gk/persist.h),
+	 * @entry_table is part of the mapping of @file_len bytes at @file,
+	 * otherwise @file is NULL.
+	 */
+	struct gk_flow_file *file;
+	size_t            file_len;
+	uint32_t          num_entries;
+	uint32_t          key_len;
+};
+
+struct gk_sched;
+struct gk_offload;
+struct gk_talkers;
+struct lls_nh_cache;
+
+/* The tunnel of a next hop of the FIB, as used by a GK instance. */
+struct gk_tunnel {
+	/* The state of the next hop in the next-hop cache. */
+	uint64_t                nh_state;
+	/* The generation of the next hop of the tunnel in the FIB. */
+	uint8_t                 gen;
+	struct ipip_tunnel_info info;
+};
+
+/* Statistics of a GK instance; see gatekeeper_stats.h. */
+struct gk_stats {
+	/* Packets per state of their flow entries. */
+	uint64_t pkts_request;
+	uint64_t pkts_granted;
+	uint64_t pkts_declined;
+
+	/* Packets without flow entries that were forwarded or dropped. */
+	uint64_t pkts_fwd_back;
+	uint64_t pkts_no_route;
+
+	uint64_t flows_added;
+	/* Packets dropped because their flow tables were full. */
+	uint64_t flows_table_full;
+
+	/*
+	 * Packets dropped by the request queue of the egress scheduler,
+	 * and packets dropped because the TX queue stayed full.
+	 */
+	uint64_t req_dropped;
+	uint64_t tx_dropped;
+
+	/* Packets dropped because they could not be encapsulated. */
+	uint64_t encap_failed;
+
+	/*
+	 * Commands of the mailbox processed, and the times the budget
+	 * of commands ran out while commands were still waiting.
+	 */
+	uint64_t cmds_processed;
+	uint64_t cmds_out_of_budget;
+
+	/*
+	 * Declined flows whose packets the NIC has been set to drop,
+	 * and the number of flows that the NIC drops now.
+	 */
+	uint64_t flows_offloaded;
+	uint64_t flows_in_nic;
+
+	/* Only kept when built with CYCLE_STATS=y. */
+	struct stats_cycle_hist process_request;
+	struct stats_cycle_hist process_granted;
+	struct stats_cycle_hist process_declined;
+} __rte_cache_aligned;
+
+/* The priorities of requests before they are adjusted for DSCP. */
+#define GK_PRIORITY_LEVELS (64)
+
 /* Structures for each GK instance. */
 struct gk_instance {
-	struct rte_hash   *ip_flow_hash_table;
-	struct flow_entry *ip_flow_entry_table;
+	/* IPv4 and IPv6 flows are kept in separate flow tables. */
+	struct gk_flow_table ip4_flows;
+	struct gk_flow_table ip6_flows;
 	/* RX queue on the front interface. */
 	uint16_t          rx_queue_front;
 	/* TX queue on the back interface. */
 	uint16_t          tx_queue_back;
+	/* Buffer of the packets sent through @tx_queue_back. */
+	struct gatekeeper_tx_buf tx_buf;
 	struct mailbox    mb; 
+	/* Egress scheduler of the packets sent to the back interface. */
+	struct gk_sched   *sched;
+	/* The declined flows dropped by the NIC, or NULL; see gk/offload.h. */
+	struct gk_offload *offload;
+	/*
+	 * The FIB of the NUMA node of the instance, reloaded
+	 * at the quiescent point of each iteration of the main loop
+	 * when a new version is published.
+	 */
+	struct gk_fib     *fib;
+	/* The version of @fib, or GK_FIB_QUIESCENT. */
+	volatile uint64_t fib_version;
+
+	/*
+	 * The Ethernet addresses of the next hops of the FIB,
+	 * indexed by next-hop ID, and the version of the cache
+	 * that @tunnels reflect.
+	 */
+	struct lls_nh_cache *nh_cache;
+	uint32_t          nh_cache_version;
+
+	/*
+	 * The tunnels of the next hops of @fib, with the Ethernet
+	 * addresses of @nh_cache, indexed by next-hop ID. Only tunnels
+	 * whose next hop has been resolved may be used.
+	 */
+	unsigned int      num_tunnels;
+	struct gk_tunnel  *tunnels;
+
+	/* Only written by the lcore of the instance. */
+	struct gk_stats   *stats;
+	/* The top talkers, or NULL; see gk/talkers.h. */
+	struct gk_talkers *talkers;
+
+	/* Samples the packets by the state of their flows. */
+	struct capture_tap tap;
+
+	/*
+	 * The smallest time, in cycles, between two packets of
+	 * a flow for each priority of requests, and the priority
+	 * of one cycle; see priority_from_delta_time().
+	 */
+	uint8_t           priority_offset;
+	uint64_t          priority_cycles[GK_PRIORITY_LEVELS];
+} __rte_cache_aligned;
+
+/*
+ * Map from the RSS hash of a flow to the index of
+ * the GK instance that receives the packets of that flow.
+ */
+struct gk_rss_dispatch {
+	/* (RETA size - 1); RETA sizes are powers of 2. */
+	uint32_t reta_mask;
+	/* GK instance index of each entry of the RETA. */
+	uint16_t instance_idx[ETH_RSS_RETA_SIZE_512];
 };
 
 /* Configuration for the GK functional block. */
 struct gk_config {
-	/* Specify the size of the flow hash table. */
+	/*
+	 * Specify the size of the flow hash table.
+	 * Each protocol (i.e. IPv4 and IPv6) has a table of this size.
+	 */
 	unsigned int	   flow_ht_size;
 
+	/*
+	 * Flow entries in request state whose last packet was seen
+	 * more than @request_timeout_sec seconds ago are removed.
+	 */
+	unsigned int       request_timeout_sec;
+
+	/*
+	 * The maximum number of flow entries of each flow table whose
+	 * expiration timers are handled at each iteration of the main loop.
+	 */
+	unsigned int       flow_table_scan_iter;
+
+	/* Parameters of the mailbox of each GK instance. */
+	unsigned int       mailbox_max_entries;
+	unsigned int       mailbox_mem_cache_size;
+	unsigned int       mailbox_watermark;
+
+	/*
+	 * Each loop of a GK block processes at least one burst of
+	 * commands of its mailbox, and keeps processing bursts for
+	 * at most @cmd_budget_us microseconds. The budget is
+	 * @cmd_drain_budget_us while the mailbox is at or above
+	 * @mailbox_watermark, or while there are no packets to process,
+	 * so new policy decisions are installed quickly while the latency
+	 * of the packets stays bounded.
+	 */
+	unsigned int       cmd_budget_us;
+	unsigned int       cmd_drain_budget_us;
+
+	/*
+	 * Request packets wait in a priority queue of at most
+	 * @request_queue_len packets of each GK instance, and leave it
+	 * at most at @request_rate_kb_sec, with bursts of at most
+	 * @request_burst_kb, which must hold an encapsulated frame of
+	 * the MTU of the front interface. Granted packets are not limited.
+	 * A zero @request_rate_kb_sec disables the limit.
+	 */
+	unsigned int       request_queue_len;
+	unsigned int       request_rate_kb_sec;
+	unsigned int       request_burst_kb;
+
+	/* Sizes of the IPv4 and IPv6 LPM tables of the FIB. */
+	unsigned int       max_num_ipv4_rules;
+	unsigned int       num_ipv4_tbl8s;
+	unsigned int       max_num_ipv6_rules;
+	unsigned int       num_ipv6_tbl8s;
+
+	/*
+	 * The NIC of the front interface drops the packets of at most
+	 * @offload_max_rules declined IPv4 flows, shared evenly by
+	 * the GK blocks, once the GK blocks have dropped
+	 * @offload_min_drops packets of each of these flows.
+	 * A zero @offload_max_rules keeps all flows in software.
+	 */
+	unsigned int       offload_max_rules;
+	unsigned int       offload_min_drops;
+
+	/*
+	 * Whether the GK blocks track the sources and the destinations
+	 * with the most packets, and the destinations with the most new
+	 * flows; see gk_report_talkers().
+	 */
+	bool               track_talkers;
+
+	/* How the GK blocks poll their RX queues on the front interface. */
+	struct poll_config poll;
+
+	/*
+	 * How the GK blocks sample the packets of the front interface;
+	 * the classes are the states of the flows, e.g. GK_REQUEST.
+	 */
+	struct capture_config capture;
+
 	/*
 	 * The fields below are for internal use.
 	 * Configuration files should not refer to them.
 	 */
 	rte_atomic32_t	   ref_cnt;
 
+	/* @request_timeout_sec in cycles. */
+	uint64_t           request_timeout_cycles;
+
+	/* @cmd_budget_us and @cmd_drain_budget_us in cycles. */
+	uint64_t           cmd_budget_cycles;
+	uint64_t           cmd_drain_budget_cycles;
+
 	/* The lcore ids at which each instance runs. */
 	unsigned int       *lcores;
 
@@ -62,10 +298,56 @@ struct gk_config {
 	struct gk_instance *instances;
 	struct net_config  *net;
 	struct gatekeeper_rss_config rss_conf;
+
+	/*
+	 * The map in use is pointed by @rss_dispatch_cur;
+	 * the other one is filled when the RETA changes, and then swapped.
+	 */
+	struct gk_rss_dispatch rss_dispatch[2];
+	struct gk_rss_dispatch *volatile rss_dispatch_cur;
+
+	/*
+	 * The published copy of the FIB of each NUMA node that runs
+	 * GK blocks, and its version, increased at every update.
+	 */
+	struct gk_fib      *volatile fibs[RTE_MAX_NUMA_NODES];
+	volatile uint64_t  fib_version;
+
+	/* The rules and next hops the FIBs are built from. */
+	struct gk_rib      rib;
+
+	/*
+	 * Where the flow tables are kept across restarts, or NULL
+	 * if they are not; see gk_set_flow_persist_dir().
+	 */
+	char               *flow_persist_dir;
 };
 
 /* Define the possible command operations for GK block. */
-enum gk_cmd_op { GGU_POLICY_ADD, };
+enum gk_cmd_op { GGU_POLICY_ADD, GK_FLOW_DUMP, };
+
+/* XXX Sample parameter: the flow entries a GK block scans per dump. */
+#define GK_FLOW_DUMP_SCAN (256)
+
+/*
+ * A chunk of a flow snapshot: the granted and declined flows found
+ * by a GK block in the next GK_FLOW_DUMP_SCAN entries of one of its
+ * flow tables, as policies with the remaining lifetimes of the entries.
+ */
+struct gk_flow_dump {
+	/* Set by the requester. */
+	uint16_t          proto;
+	/* Iterator of the flow table, kept across the chunks. */
+	uint32_t          iter;
+
+	/* Set by the GK block. */
+	unsigned int      num_policies;
+	/* Whether the scan reached the end of the flow table. */
+	bool              end;
+	/* Set last, once the fields above are ready. */
+	volatile int      done;
+	struct ggu_policy policies[GK_FLOW_DUMP_SCAN];
+};
 
 /*
  * XXX Structure for each command. Add new fields to support more commands.
@@ -77,14 +359,26 @@ struct gk_cmd_entry {
 
 	union {
 		struct ggu_policy ggu;
+		struct gk_flow_dump *dump;
 	} u;
 };
 
 struct gk_config *alloc_gk_conf(void);
 int gk_conf_put(struct gk_config *gk_conf);
 int run_gk(struct net_config *net_conf, struct gk_config *gk_conf);
+int gk_set_flow_persist_dir(struct gk_config *gk_conf, const char *dir);
+int gk_update_rss_dispatch(struct gk_config *gk_conf);
+unsigned int get_responsible_gk_idx(const struct ip_flow *flow,
+	const struct gk_config *gk_conf);
 struct mailbox *get_responsible_gk_mailbox(
 	const struct ip_flow *flow, const struct gk_config *gk_conf);
+int gk_export_flows(struct gk_config *gk_conf, const char *path);
+int gk_import_flows(struct gk_config *gk_conf, const char *path);
+int gk_report_talkers(struct gk_config *gk_conf, const char *path);
+int gk_bench_instance_setup(struct net_config *net_conf,
+	struct gk_config *gk_conf);
+uint16_t gk_bench_instance_process(struct gk_config *gk_conf,
+	struct rte_mbuf **pkts, uint16_t num_pkts, struct rte_mbuf **tx_bufs);
 
 static inline void
 gk_conf_hold(struct gk_config *gk_conf)
@@ -20,13 +20,19 @@
 #define _GATEKEEPER_GT_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include <rte_ip.h>
 #include <rte_tcp.h>
 #include <rte_udp.h>
 #include <rte_atomic.h>
 
+#include "gatekeeper_capture.h"
 #include "gatekeeper_config.h"
+#include "gatekeeper_ggu.h"
+#include "gatekeeper_poll.h"
+#include "gatekeeper_stats.h"
+#include "gatekeeper_tx.h"
 
 struct gt_packet_headers {
 	uint16_t outer_ip_ver;
@@ -40,6 +46,234 @@ struct gt_packet_headers {
 	void *l4_hdr;
 };
 
+/*
+ * Get the destination port of the transport header of a request
+ * in CPU order. Return false if the transport protocol has no ports.
+ *
+ * gt_parse_incoming_pkt() guarantees that at least the first
+ * four bytes of the transport header are in the packet.
+ */
+static inline bool
+get_l4_dst_port(struct gt_packet_headers *pkt_info, uint16_t *dst_port)
+{
+	switch (pkt_info->l4_proto) {
+	case IPPROTO_TCP:
+		*dst_port = rte_be_to_cpu_16(
+			((struct tcp_hdr *)pkt_info->l4_hdr)->dst_port);
+		return true;
+	case IPPROTO_UDP:
+		*dst_port = rte_be_to_cpu_16(
+			((struct udp_hdr *)pkt_info->l4_hdr)->dst_port);
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* The key of the cache of policy decisions. */
+struct gt_decision_key {
+	/* The inner source and destination addresses. */
+	struct ip_flow flow;
+	uint16_t       dst_port;
+	uint8_t        l4_proto;
+};
+
+/* A policy decision of the Lua policy kept in the cache. */
+struct gt_cached_decision {
+	struct ggu_policy policy;
+
+	/* When the decision has to be looked up again. */
+	uint64_t          expire_at;
+};
+
+/*
+ * A decision recently sent to a Gatekeeper server; see
+ * the field @recent_decisions_size of struct gt_config.
+ */
+struct gt_recent_decision {
+	struct ggu_policy policy;
+
+	/*
+	 * The outer addresses of the request, so that a decision sent
+	 * to a Gatekeeper server does not suppress the notification of
+	 * another server that asks about the same flow.
+	 */
+	struct ip_flow    outer;
+
+	/* When the decision was made; zero if the slot was never used. */
+	uint64_t          decided_at;
+};
+
+/* XXX Sample parameters, need to be tested for better performance. */
+#define GT_MAX_POLICY_GROUPS          (256)
+#define GT_SIMPLE_POLICY_MAX_PORTS    (1024)
+#define GT_SIMPLE_POLICY_MAX_PREFIXES (1024)
+
+/*
+ * The simple policy of the Lua policy compiled into lookup
+ * structures at load time: a decision comes from the group of
+ * the destination port if there is one, then from the group of
+ * the longest prefix of the destination address, and finally
+ * from the default group.
+ */
+struct gt_simple_policy {
+	/* The state and parameters of the decision of each group. */
+	struct ggu_policy groups[GT_MAX_POLICY_GROUPS];
+	bool              group_defined[GT_MAX_POLICY_GROUPS];
+
+	/* The default group, or -1 to fall back to the Lua policy. */
+	int               default_group;
+
+	/* The group of each key of @ports. */
+	struct rte_hash   *ports;
+	uint8_t           port_groups[GT_SIMPLE_POLICY_MAX_PORTS];
+
+	/* The groups of the destination prefixes. */
+	struct rte_lpm    *ip4_prefixes;
+	struct rte_lpm6   *ip6_prefixes;
+};
+
+struct gt_simple_policy *create_simple_policy(unsigned int lcore_id,
+	uint64_t version);
+void destroy_simple_policy(struct gt_simple_policy *policy);
+int lookup_simple_policy(struct gt_simple_policy *policy,
+	struct gt_packet_headers *pkt_info, struct ggu_policy *decision);
+
+/* Functions for the Lua policy to compile its simple policy. */
+int gt_simple_policy_add_group(struct gt_simple_policy *policy,
+	uint8_t group_id, const struct ggu_policy *params);
+int gt_simple_policy_add_port(struct gt_simple_policy *policy,
+	uint16_t ip_ver, uint8_t l4_proto, uint16_t dst_port,
+	uint8_t group_id);
+int gt_simple_policy_add_prefix(struct gt_simple_policy *policy,
+	const char *ip_addr, uint8_t prefix_len, uint8_t group_id);
+int gt_simple_policy_set_default(struct gt_simple_policy *policy,
+	uint8_t group_id);
+
+/*
+ * XXX Sample parameter, need to be tested for better performance.
+ * The number of Gatekeeper servers to which a GT instance can
+ * aggregate policy decisions at the same time.
+ */
+#define GT_NUM_NOTIFY_BUFS (8)
+
+/*
+ * The room for policy decisions in a notification packet
+ * whose IP header is @ip_hdr_len bytes long.
+ */
+#define GT_NOTIFY_MAX_PAYLOAD(ip_hdr_len) (ETHER_MTU - (ip_hdr_len) - \
+	sizeof(struct udp_hdr) - sizeof(struct ggu_common_hdr))
+
+/*
+ * The largest number of decisions in a notification packet,
+ * i.e. IPv4 decisions of version 2 of the format that share
+ * their destination and parameter set.
+ */
+#define GT_MAX_NOTIFY_POLICIES \
+	(GT_NOTIFY_MAX_PAYLOAD(sizeof(struct ipv4_hdr)) / \
+	(1 + sizeof(((struct ip_flow *)0)->f.v4.src)))
+
+/* Policy decisions waiting to be sent to a Gatekeeper server. */
+struct gt_notify_buf {
+	/*
+	 * The source and destination addresses of the notification
+	 * packets, that is, the Grantor server and the Gatekeeper server.
+	 * They are only meaningful when @num_policies is not zero.
+	 */
+	struct ip_flow    addrs;
+
+	/* The Ethernet header of the notification packets. */
+	struct ether_hdr  eth_hdr;
+
+	/* When the first decision in the buffer was added. */
+	uint64_t          first_decision_at;
+
+	/* The number of bytes that the decisions take in a packet. */
+	uint16_t          payload_len;
+
+	unsigned int      num_policies;
+	struct ggu_policy policies[GT_MAX_NOTIFY_POLICIES];
+
+	/*
+	 * For version 2 of the format, the distinct parameter sets of
+	 * the decisions (their fields @flow are not used), and the index
+	 * of the parameter set of each decision.
+	 */
+	unsigned int      num_param_sets;
+	struct ggu_policy param_sets[GGU_V2_MAX_PARAM_SETS];
+	uint8_t           param_set_idx[GT_MAX_NOTIFY_POLICIES];
+};
+
+/* A policy loaded from the Lua policy script. */
+struct gt_lua_policy {
+	/* The Lua state that runs the policy. */
+	lua_State               *lua_state;
+
+	/* Whether the Lua policy defines lookup_policy_burst(). */
+	bool                    lua_burst;
+
+	/*
+	 * The FFI types of the arguments of lookup_policy_burst():
+	 * struct gt_packet_headers * and struct ggu_policy *.
+	 */
+	uint32_t                ctypeid_pkt_info_ptr;
+	uint32_t                ctypeid_policy_ptr;
+
+	/* The simple policy compiled by the Lua policy. */
+	struct gt_simple_policy *simple_policy;
+};
+
+/* XXX Sample parameters for the mailbox of a GT instance. */
+#define GT_MAILBOX_MAX_ENTRIES (64)
+#define GT_CMD_BURST_SIZE      (8)
+
+/* Define the possible command operations for a GT instance. */
+enum gt_cmd_op { GT_UPDATE_POLICY, };
+
+struct gt_cmd_entry {
+	enum gt_cmd_op op;
+
+	union {
+		/*
+		 * The GT instance swaps @policy with the policy that it
+		 * enforces between two bursts, and then sets @done.
+		 * From then on, @policy holds the old policy, and both
+		 * the old policy and the entry belong to the sender again.
+		 */
+		struct {
+			struct gt_lua_policy policy;
+			volatile bool        done;
+		} update;
+	} u;
+};
+
+struct lls_nh_cache;
+
+/* Statistics of a GT instance; see gatekeeper_stats.h. */
+struct gt_stats {
+	/* Decisions taken for the packets that went through a policy. */
+	uint64_t decisions_granted;
+	uint64_t decisions_declined;
+
+	/* Packets dropped because the Lua policy failed to decide them. */
+	uint64_t lua_errors;
+
+	/* Packets dropped because the TX queue stayed full. */
+	uint64_t tx_dropped;
+
+	/* Policies loaded since the instance started. */
+	uint64_t policy_updates;
+
+	/*
+	 * Requests decided by a recent decision of the same flow,
+	 * for which no notification was sent.
+	 */
+	uint64_t notifications_suppressed;
+
+	/* Only kept when built with CYCLE_STATS=y. */
+	struct stats_cycle_hist lookup_lua_decisions;
+} __rte_cache_aligned;
+
 /* Structures for each GT instance. */
 struct gt_instance {
 	/* RX queue on the front interface. */
@@ -48,15 +282,101 @@ struct gt_instance {
 	/* TX queue on the front interface. */
 	uint16_t      tx_queue;
 
-	/* The lua state that belongs to the instance. */
-	lua_State     *lua_state;
-};
+	/* The UDP source port of the notifications, in network order. */
+	uint16_t      ggu_src_port;
+
+	/* Buffer of the packets sent through @tx_queue. */
+	struct gatekeeper_tx_buf tx_buf;
+
+	/* The policy that the instance enforces. */
+	struct gt_lua_policy lua_policy;
+
+	/* Commands to the instance; see struct gt_cmd_entry. */
+	struct mailbox       mb;
+
+	/* The decisions of the Lua policy, keyed by struct gt_decision_key. */
+	struct rte_hash           *decision_cache;
+	struct gt_cached_decision *cached_decisions;
+
+	/*
+	 * The recent decisions, in a direct-mapped table indexed by
+	 * the hash of the flow masked by @recent_decisions_mask.
+	 */
+	struct gt_recent_decision *recent_decisions;
+	uint32_t                  recent_decisions_mask;
+
+	/* The decisions waiting to be sent to each Gatekeeper server. */
+	struct gt_notify_buf notify_bufs[GT_NUM_NOTIFY_BUFS];
+
+	/*
+	 * The Ethernet addresses of the gateways of the front interface,
+	 * at GT_NH_GW_IP4 and GT_NH_GW_IP6.
+	 */
+	struct lls_nh_cache  *nh_cache;
+
+	/* Only written by the lcore of the instance. */
+	struct gt_stats      *stats;
+
+	/* Samples the requests that go through a policy decision. */
+	struct capture_tap   tap;
+} __rte_cache_aligned;
 
 /* Configuration for the GT functional block. */
 struct gt_config {
-	/* The UDP source and destination port numbers for GK-GT Unit. */
+	/*
+	 * The UDP source and destination port numbers for GK-GT Unit.
+	 * Each GT instance sends its notifications from one of the
+	 * @num_ggu_src_ports source ports starting at @ggu_src_port,
+	 * so they are spread over the GGU instances of the Gatekeeper
+	 * servers, which must use the same range (see struct ggu_config).
+	 */
 	uint16_t           ggu_src_port;
 	uint16_t           ggu_dst_port;
+	uint16_t           num_ggu_src_ports;
+
+	/*
+	 * Policy decisions are sent to a Gatekeeper server in batches.
+	 * A batch is sent once it fills up a packet, when there are no
+	 * packets to process, or when its first decision has waited for
+	 * @max_ggu_notify_delay_ms milliseconds at the end of a burst.
+	 */
+	unsigned int       max_ggu_notify_delay_ms;
+
+	/*
+	 * The number of decisions of the Lua policy that each
+	 * GT instance caches; zero disables the cache. A cached decision
+	 * is reused until its capability, or its decline, expires.
+	 */
+	unsigned int       decision_cache_size;
+
+	/*
+	 * The number of recent decisions that each GT instance keeps,
+	 * rounded up to a power of two; zero disables them.
+	 * The requests of a flow decided less than
+	 * @recent_decision_window_ms milliseconds earlier take
+	 * the same decision without going through the policy,
+	 * and send no notification, since the Gatekeeper server is
+	 * already installing the decision. Recent decisions are kept
+	 * in a direct-mapped table, so colliding flows evict each other.
+	 */
+	unsigned int       recent_decisions_size;
+	unsigned int       recent_decision_window_ms;
+
+	/*
+	 * The version of the format of the notification packets,
+	 * GGU_PD_VER1 or GGU_PD_VER2. Version 2 takes much less room,
+	 * but needs all Gatekeeper servers to understand it.
+	 */
+	unsigned int       ggu_pd_version;
+
+	/* How the GT blocks poll their RX queues. */
+	struct poll_config poll;
+
+	/*
+	 * How the GT blocks sample the requests that go through
+	 * a policy decision; there is a single class.
+	 */
+	struct capture_config capture;
 
 	/*
 	 * The fields below are for internal use.
@@ -75,11 +395,51 @@ struct gt_config {
 
 	/* The gt instances. */
 	struct gt_instance *instances;
+
+	/* @max_ggu_notify_delay_ms in cycles. */
+	uint64_t           max_ggu_notify_delay_cycles;
+
+	/* @recent_decision_window_ms in cycles. */
+	uint64_t           recent_decision_window_cycles;
+
+	/*
+	 * The gateways to which the packets of granted flows are
+	 * forwarded on the front interface, set by gt_set_front_gateway().
+	 * @front_gw_proto has GK_CONFIGURED_IPV4 and/or GK_CONFIGURED_IPV6
+	 * for the gateways that are set.
+	 */
+	uint8_t            front_gw_proto;
+	struct in_addr     front_gw4;
+	struct in6_addr    front_gw6;
+
+	/*
+	 * The number of policies loaded after the first one.
+	 * Only the updater, i.e. gt_reload_policy(), uses it.
+	 */
+	uint64_t           policy_version;
 };
 
+/* Entries of the next-hop cache of a GT instance. */
+enum { GT_NH_GW_IP4, GT_NH_GW_IP6, GT_NH_MAX };
+
 struct gt_config *alloc_gt_conf(void);
+int gt_set_front_gateway(const char *ip_addr, struct gt_config *gt_conf);
 int gt_conf_put(struct gt_config *gt_conf);
 int run_gt(struct net_config *net_conf, struct gt_config *gt_conf);
+int gt_reload_policy(struct gt_config *gt_conf);
+
+/*
+ * The steps of the GT blocks on their own, e.g. for benchmarks.
+ * The Lua policy must be loaded at the lcore that uses it.
+ */
+int gt_parse_incoming_pkt(struct rte_mbuf *pkt,
+	struct gt_packet_headers *info);
+int load_lua_policy(unsigned int lcore_id, uint64_t version,
+	struct gt_lua_policy *lp);
+void destroy_lua_policy(struct gt_lua_policy *lp);
+int lookup_lua_policy(struct gt_lua_policy *lp,
+	struct gt_packet_headers *pkt_infos, struct ggu_policy *policies,
+	unsigned int num_pkts);
 
 static inline void
 gt_conf_hold(struct gt_config *gt_conf)
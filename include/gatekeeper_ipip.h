@@ -19,6 +19,8 @@
 #ifndef _GATEKEEPER_IPIP_H_
 #define _GATEKEEPER_IPIP_H_
 
+#include <rte_ip.h>
+#include <rte_mbuf.h>
 #include <rte_ether.h>
 
 #include "gatekeeper_flow.h"
@@ -31,14 +33,32 @@
 #define IP_VHL_DEF              (IP_VERSION | IP_HDRLEN)
 #define IP_DN_FRAGMENT_FLAG     (0x0040)
 
+/* Length of the outer headers of the IPv4 and IPv6 tunnels. */
+#define IPIP_IP4_HDRS_LEN \
+	(sizeof(struct ether_hdr) + sizeof(struct ipv4_hdr))
+#define IPIP_IP6_HDRS_LEN \
+	(sizeof(struct ether_hdr) + sizeof(struct ipv6_hdr))
+
 struct ipip_tunnel_info {
 	struct ip_flow	     flow;
 	struct ether_addr    source_mac;
 	/* TODO The MAC addresses must come from the LLS block. */
 	struct ether_addr    nexthop_mac;
+
+	/*
+	 * The outer headers of the packets of the tunnel, built from
+	 * the fields above by ipip_tunnel_refresh(), so encapsulate()
+	 * only needs to copy them and fill in the length and priority.
+	 * ipip_tunnel_refresh() must be called whenever a field above
+	 * changes.
+	 */
+	uint8_t              hdrs[IPIP_IP6_HDRS_LEN] __rte_aligned(16);
 };
 
-int encapsulate(struct rte_mbuf *pkt, uint8_t priority,
+void ipip_tunnel_refresh(struct ipip_tunnel_info *info);
+struct rte_mbuf *encapsulate(struct rte_mbuf *pkt, uint8_t priority,
 	struct ipip_tunnel_info *info);
+unsigned int encapsulate_bulk(struct rte_mbuf **pkts, uint8_t *priorities,
+	struct ipip_tunnel_info **infos, unsigned int num_pkts);
 
 #endif /* _GATEKEEPER_IPIP_H_ */
@@ -19,6 +19,8 @@
 #ifndef _GATEKEEPER_LAUNCH_H_
 #define _GATEKEEPER_LAUNCH_H_
 
+#include <stddef.h>
+
 #include <rte_launch.h>
 
 /*
@@ -32,16 +34,36 @@
  * the network devices. HOWEVER, if you're going to allocate any queue,
  * DO NOT call this function, but net_launch_at_stage1() instead!
  *
+ * The memory that f() reserves is logged under @name, which must
+ * outlive stage 1.
+ *
  * RETURN
  *	Return 0 if success; otherwise -1.
  */
 int
-launch_at_stage1(lcore_function_t *f, void *arg);
+launch_at_stage1(const char *name, lcore_function_t *f, void *arg);
 
 /* Drop the @n last entries of stage1. */
 void
 pop_n_at_stage1(int n);
 
+/*
+ * The memory allocated from the DPDK heaps of all NUMA nodes,
+ * which includes the memzones, and thus the mbuf pools.
+ */
+size_t
+heap_allocated(void);
+
+/*
+ * Log the memory that @name reserved @when, e.g. "at configuration",
+ * since heap_allocated() returned @before.
+ *
+ * The run_*() functions of the blocks reserve memory before stage 1,
+ * e.g. the FIBs of the GK blocks, so they log it themselves.
+ */
+void
+log_heap_reserved(const char *name, const char *when, size_t before);
+
 /*
  * Once stage 1 finishes, the network devices are started, and
  * stage 2 begins.
@@ -81,4 +103,7 @@ pop_n_at_stage3(int n);
 int
 launch_gatekeeper(void);
 
+int
+get_lcores_socket_id(const unsigned int *lcores, int num_lcores);
+
 #endif /* _GATEKEEPER_LAUNCH_H_ */
@@ -19,13 +19,19 @@
 #ifndef _GATEKEEPER_LLS_H_
 #define _GATEKEEPER_LLS_H_
 
+#include <stdbool.h>
 #include <netinet/in.h>
 
 #include <rte_ip.h>
+#include <rte_ring.h>
 #include <rte_timer.h>
+#include <rte_atomic.h>
 
 #include "gatekeeper_mailbox.h"
 #include "gatekeeper_net.h"
+#include "gatekeeper_poll.h"
+#include "gatekeeper_tx.h"
+#include "gatekeeper_stats.h"
 
 /*
  * Maximum key length (in bytes) for an LLS map. It should be set
@@ -34,8 +40,8 @@
  */
 #define LLS_MAX_KEY_LEN (16)
 
-/* Number of records that a LLS cache can hold. */
-#define LLS_CACHE_RECORDS (1024)
+/* Marks the end of a list of holds of an LLS cache. */
+#define LLS_NO_HOLD (UINT32_MAX)
 
 /* Requests that can be made to the LLS block. */
 enum lls_req_ty {
@@ -47,8 +53,6 @@ enum lls_req_ty {
 	 * be invoked again.
 	 */
 	LLS_REQ_PUT,
-	/* Request to handle an ND packet received from another block. */
-	LLS_REQ_ND,
 };
 
 /* Replies that come from the LLS block. */
@@ -56,8 +60,9 @@ enum lls_reply_ty {
 	/* The reply represents a map resolution (or update to one). */
 	LLS_REPLY_RESOLUTION,
 	/*
-	 * The reply is a notification that the hold is
-	 * removed, so the requester can free state as needed.
+	 * The reply is a notification that the hold is removed,
+	 * or that it could not be placed, so the requester can
+	 * free state as needed.
 	 */
 	LLS_REPLY_FREE,
 };
@@ -106,6 +111,9 @@ struct lls_hold {
 
 	/* The lcore that requested this hold. */
 	unsigned int lcore_id;
+
+	/* The next hold of the same record, or LLS_NO_HOLD. */
+	uint32_t     next;
 };
 
 struct lls_record {
@@ -115,6 +123,9 @@ struct lls_record {
 	 /* Timestamp of the last update to the map. */
 	time_t          ts;
 
+	/* Whether the key of the record is in the hash of the cache. */
+	bool            in_use;
+
 	/*
 	 * Number of requests to hold this map. Blocks
 	 * should only request a hold for a map once
@@ -122,8 +133,11 @@ struct lls_record {
 	 */
 	uint32_t        num_holds;
 
-	/* Holds for @map. */
-	struct lls_hold holds[RTE_MAX_LCORE];
+	/*
+	 * Holds for @map: the index of the first hold in
+	 * the holds of the cache, or LLS_NO_HOLD.
+	 */
+	uint32_t        holds;
 };
 
 struct lls_cache {
@@ -140,8 +154,28 @@ struct lls_cache {
 	/* Name string (needed for cache hash). */
 	const char        *name;
 
+	/*
+	 * Number of records of the cache, i.e. the sum of
+	 * the cache sizes of the interfaces that use it.
+	 */
+	uint32_t          max_records;
+
 	/* Array of cache records indexed using @hash. */
-	struct lls_record records[LLS_CACHE_RECORDS];
+	struct lls_record *records;
+
+	/*
+	 * The holds of all records, which are linked in lists through
+	 * struct lls_hold.next; @free_holds is the list of free holds.
+	 * Most records are held by a few lcores, if any, so the holds
+	 * are shared instead of reserving room for all lcores
+	 * in each record.
+	 */
+	uint32_t          max_holds;
+	struct lls_hold   *holds;
+	uint32_t          free_holds;
+
+	/* The next record that lls_cache_scan() visits. */
+	uint32_t          scan_next;
 
 	/* Hash instance that maps IP address keys to LLS cache records. */
 	struct rte_hash   *hash;
@@ -168,13 +202,32 @@ struct lls_cache {
 	 * Otherwise, unicast to @ha.
 	 */
 	void (*xmit_req)(struct gatekeeper_if *iface, const uint8_t *ip_be,
-		const struct ether_addr *ha, uint16_t tx_queue);
+		const struct ether_addr *ha, struct gatekeeper_tx_buf *tx_buf);
 
 	/* Function to print a cache record. */
 	void (*print_record)(struct lls_cache *cache,
 		struct lls_record *record);
 };
 
+/* Statistics of the LLS block; see gatekeeper_stats.h. */
+struct lls_stats {
+	/* Packets received, and those that were dropped. */
+	uint64_t pkts_rx;
+	uint64_t pkts_dropped;
+
+	/* Requests of the other blocks processed. */
+	uint64_t requests;
+
+	/* ND packets submitted by the other blocks. */
+	uint64_t nd_submitted;
+
+	/* Packets dropped because the TX queues stayed full. */
+	uint64_t tx_dropped;
+
+	/* Holds that could not be placed. */
+	uint64_t holds_failed;
+} __rte_cache_aligned;
+
 struct lls_config {
 	/* lcore that the LLS block runs on. */
 	unsigned int      lcore_id;
@@ -185,6 +238,21 @@ struct lls_config {
 	 */
 	int               debug;
 
+	/* Parameters of the mailbox of requests. */
+	unsigned int      mailbox_max_entries;
+	unsigned int      mailbox_mem_cache_size;
+	unsigned int      mailbox_watermark;
+
+	/* The number of holds that each cache can keep. */
+	unsigned int      max_holds;
+
+	/*
+	 * How the LLS block polls its RX queues. Since the block also
+	 * serves the requests and ND packets of the other blocks,
+	 * it never sleeps on RX interrupts.
+	 */
+	struct poll_config poll;
+
 	/*
 	 * The fields below are for internal use.
 	 * Configuration files should not refer to them.
@@ -194,6 +262,13 @@ struct lls_config {
 	/* Mailbox to hold requests from other blocks. */
 	struct mailbox    requests;
 
+	/*
+	 * Ring of the ND packets that the other blocks classify
+	 * in software (see struct gatekeeper_if). These packets are
+	 * always received on the front interface.
+	 */
+	struct rte_ring   *nd_ring;
+
 	/* Cache of entries that map IPv4 addresses to Ethernet addresses. */
 	struct lls_cache  arp_cache;
 
@@ -209,6 +284,17 @@ struct lls_config {
 	uint16_t          rx_queue_back;
 	uint16_t          tx_queue_back;
 
+	/* The state of the polling of the RX queues. */
+	struct poll_state poll_front;
+	struct poll_state poll_back;
+
+	/* Buffers of the packets sent through the TX queues. */
+	struct gatekeeper_tx_buf tx_buf_front;
+	struct gatekeeper_tx_buf tx_buf_back;
+
+	/* Only written by the lcore of the LLS block. */
+	struct lls_stats  *stats;
+
 	/*
 	 * TODO Have a different block use RSS on the back interface,
 	 * and pass ND packets to the LLS block.
@@ -281,8 +367,14 @@ int hold_nd(lls_req_cb cb, void *arg, struct in6_addr *ip_be,
 	unsigned int lcore_id);
 int put_nd(struct in6_addr *ip_be, unsigned int lcore_id);
 
-/* Submit an ND packet to the LLS block. */
-int submit_nd(struct rte_mbuf *pkt, struct gatekeeper_if *iface);
+/*
+ * Submit the ND packets @pkts, received on @iface, to the LLS block.
+ *
+ * Return the number of packets submitted, which are owned by
+ * the LLS block from then on; the caller still owns the others.
+ */
+unsigned int submit_nd(struct rte_mbuf **pkts, unsigned int num_pkts,
+	struct gatekeeper_if *iface);
 
 static inline int
 ipv6_addrs_equal(const uint8_t *addr1, const uint8_t *addr2)
@@ -298,4 +390,82 @@ int pkt_is_nd(struct ipacket *packet, struct gatekeeper_if *iface);
 struct lls_config *get_lls_conf(void);
 int run_lls(struct net_config *net_conf, struct lls_config *lls_conf);
 
+/*
+ * The state of an entry of a next-hop cache keeps the Ethernet address
+ * in its lower 48 bits, and the flags below in its upper bits.
+ */
+#define LLS_NH_RESOLVED (1ULL << 48)
+#define LLS_NH_STALE    (1ULL << 49)
+
+struct lls_nh_cache;
+
+struct lls_nh_entry {
+	/*
+	 * The Ethernet address and flags of the next hop, or zero
+	 * if it has never been resolved. It is only written by
+	 * the LLS block, with a single store.
+	 */
+	volatile uint64_t   state;
+
+	/* The IP version of the next hop, or zero if the entry is free. */
+	uint16_t            proto;
+
+	/* IP address of the next hop, in network ordering. */
+	uint8_t             ip_be[LLS_MAX_KEY_LEN];
+
+	struct lls_nh_cache *cache;
+};
+
+/*
+ * Next-hop cache of a functional block running on lcore @lcore_id.
+ *
+ * The block places a hold on the map of each of its next hops, and the
+ * callback of the hold, run by the LLS block, writes the entry of the
+ * next hop and bumps @version. So the block resolves its next hops by
+ * only reading its own cache, with no locks or mailbox round trips;
+ * it only needs to check @version to learn that an entry changed.
+ *
+ * Stale maps keep their last Ethernet address, flagged with
+ * LLS_NH_STALE, while the LLS block tries to resolve them again.
+ */
+struct lls_nh_cache {
+	volatile uint32_t   version;
+
+	unsigned int        lcore_id;
+	unsigned int        max_entries;
+	struct lls_nh_entry *entries;
+
+	/*
+	 * One reference for the owner of the cache, and one for each
+	 * hold, so the LLS block never calls back into a freed cache.
+	 */
+	rte_atomic32_t      ref_cnt;
+};
+
+struct lls_nh_cache *lls_nh_cache_create(unsigned int max_entries,
+	unsigned int lcore_id);
+void lls_nh_cache_release(struct lls_nh_cache *cache);
+int lls_nh_cache_hold(struct lls_nh_cache *cache, unsigned int idx,
+	uint16_t proto, const void *ip_be);
+void lls_nh_cache_put(struct lls_nh_cache *cache, unsigned int idx);
+
+/*
+ * Read the Ethernet address of the entry @idx of @cache into @ha.
+ * Return the state of the entry, which is zero, and @ha untouched,
+ * if the next hop has never been resolved.
+ */
+static inline uint64_t
+lls_nh_cache_get(const struct lls_nh_cache *cache, unsigned int idx,
+	struct ether_addr *ha)
+{
+	unsigned int i;
+	uint64_t state = cache->entries[idx].state;
+
+	if (likely(state & LLS_NH_RESOLVED)) {
+		for (i = 0; i < ETHER_ADDR_LEN; i++)
+			ha->addr_bytes[i] = state >> (8 * i);
+	}
+	return state;
+}
+
 #endif /* _GATEKEEPER_LLS_H_ */
@@ -0,0 +1,69 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GATEKEEPER_LOG_H_
+#define _GATEKEEPER_LOG_H_
+
+#include <stdint.h>
+
+/*
+ * Logging of the errors that packets cause on the fast path.
+ *
+ * Since an attacker can send packets that trigger these errors on
+ * purpose, the lcores of the functional blocks do not format them.
+ * Instead, fast_log() pushes a compact binary record into a ring of
+ * the lcore, and the master lcore formats and writes the records
+ * (see run_log_writer()). Each message has a rate limit per lcore;
+ * the records that go over the limit are only counted, and their number
+ * is reported along with the next record of the same message.
+ */
+
+/* Messages that may be logged on the fast path. */
+enum log_msg_id {
+	LOG_NET_IP4_TOO_SHORT,
+	LOG_NET_IP6_TOO_SHORT,
+	LOG_NET_UNKNOWN_PROTO,
+	LOG_GK_ADD_FLOW_FAILED,
+	LOG_GK_UNKNOWN_STATE,
+	LOG_GT_INVALID_PKT,
+	LOG_GT_NOT_DESTINED,
+	LOG_GGU_UNKNOWN_PROTO,
+	LOG_GGU_TOO_SHORT,
+	LOG_GGU_NON_UDP_IP4,
+	LOG_GGU_NON_UDP_IP6,
+	LOG_GGU_NOT_DESTINED,
+	LOG_GGU_UNKNOWN_PORTS,
+	LOG_GGU_UNKNOWN_FORMAT,
+	LOG_GGU_BAD_PAYLOAD_LEN,
+	LOG_GGU_BAD_V2_FIELD,
+	LOG_MSG_MAX,
+};
+
+int init_log(void);
+void run_log_writer(void);
+
+void fast_log(enum log_msg_id msg_id, uint64_t arg0, uint64_t arg1,
+	uint64_t arg2, uint64_t arg3);
+/*
+ * Log the IP source and destination addresses @src and @dst
+ * of a packet whose IP version is @proto (i.e. ETHER_TYPE_IPv*).
+ */
+void fast_log_ips(enum log_msg_id msg_id, uint16_t proto,
+	const void *src, const void *dst);
+
+#endif /* _GATEKEEPER_LOG_H_ */
@@ -20,29 +20,136 @@
 #define _GATEKEEPER_MAILBOX_H_
 
 #include <rte_ring.h>
+#include <rte_atomic.h>
 #include <rte_mempool.h>
 
 #include "gatekeeper_main.h"
 
 /*
- * XXX Sample parameters, all mailboxes have 128 entries by default.
- * rte_ring_create() requires that the ring size (i.e., parameter count)
- * must be a power of two. Moreover, the real usable ring size is count-1
- * instead of count to differentiate a free ring from an empty ring.
+ * XXX Sample parameter, need to be tested for better performance.
+ * The number of entries that a staging buffer holds.
  */
-#define MAILBOX_MAX_ENTRIES (128)
+#define MAILBOX_STAGE_SIZE (16)
 
 struct mailbox {
 	struct rte_ring    *ring;
 	struct rte_mempool *pool;
+
+	/*
+	 * When the ring holds at least @watermark entries,
+	 * the mailbox is congested; see mb_congested().
+	 */
+	unsigned int       watermark;
+
+	/* Number of entries that could not be allocated from @pool. */
+	rte_atomic64_t     alloc_failures;
+	/* Number of entries dropped because @ring was full. */
+	rte_atomic64_t     send_drops;
+
+	/*
+	 * Eventfd that producers signal when they send entries while
+	 * the consumer is sleeping, i.e. @sleeping is set, so that
+	 * a block sleeping on its RX interrupt also wakes up for its
+	 * mailbox; see poll_sleep().
+	 */
+	int                efd;
+	rte_atomic32_t     sleeping;
+};
+
+/*
+ * Staging buffer of a producer of a mailbox.
+ *
+ * Entries are allocated from the mailbox, and sent to it, in bulk,
+ * so a producer that sends many entries pays for a few mempool and
+ * ring operations instead of one of each per entry.
+ * Producers must call mb_stage_flush() once they are done with a batch
+ * of entries (e.g. at the end of an RX burst), so entries don't linger
+ * in the staging buffer.
+ *
+ * A staging buffer must only be used by a single lcore.
+ */
+struct mb_stage {
+	struct mailbox *mb;
+
+	/* Entries allocated from @mb, but not handed out yet. */
+	unsigned int   num_free;
+	void           *free_entries[MAILBOX_STAGE_SIZE];
+
+	/* Entries waiting to be sent to @mb. */
+	unsigned int   num_staged;
+	void           *staged_entries[MAILBOX_STAGE_SIZE];
+};
+
+/*
+ * Parameters of a mailbox; blocks that own a mailbox
+ * take these values from their configuration.
+ */
+struct mailbox_params {
+	/*
+	 * The number of entries of the mailbox.
+	 * rte_ring_create() requires that the ring size (i.e., parameter
+	 * count) must be a power of two. Moreover, the real usable ring size
+	 * is count-1 instead of count to differentiate a free ring from
+	 * an empty ring.
+	 */
+	unsigned int max_entries;
+	/* The size of the per-lcore cache of the mempool of entries. */
+	unsigned int mem_cache_size;
+	/*
+	 * The number of entries in the ring above which producers
+	 * should back off; zero disables it.
+	 */
+	unsigned int watermark;
 };
 
 int init_mailbox(
-	const char *tag, int ele_count,
+	const char *tag, const struct mailbox_params *params,
 	int ele_size, unsigned int lcore_id, struct mailbox *mb);
 void *mb_alloc_entry(struct mailbox *mb);
 int mb_send_entry(struct mailbox *mb, void *obj);
+int mb_alloc_entries(struct mailbox *mb, void **obj_table, unsigned int n);
+unsigned int mb_send_entries(struct mailbox *mb, void **obj_table,
+	unsigned int n);
 void destroy_mailbox(struct mailbox *mb);
+void mb_wake(struct mailbox *mb);
+
+void mb_stage_init(struct mb_stage *st, struct mailbox *mb);
+int mb_stage_refill(struct mb_stage *st);
+void mb_stage_flush(struct mb_stage *st);
+void mb_stage_release(struct mb_stage *st);
+
+static inline void *
+mb_stage_alloc_entry(struct mb_stage *st)
+{
+	if (unlikely(st->num_free == 0) && mb_stage_refill(st) < 0)
+		return NULL;
+	return st->free_entries[--st->num_free];
+}
+
+/* Give back an entry obtained from mb_stage_alloc_entry(). */
+static inline void
+mb_stage_free_entry(struct mb_stage *st, void *obj)
+{
+	st->free_entries[st->num_free++] = obj;
+}
+
+static inline void
+mb_stage_send_entry(struct mb_stage *st, void *obj)
+{
+	st->staged_entries[st->num_staged++] = obj;
+	if (unlikely(st->num_staged == MAILBOX_STAGE_SIZE))
+		mb_stage_flush(st);
+}
+
+/*
+ * Backpressure signal: producers should hold back and coalesce entries
+ * sent to a congested mailbox instead of adding more entries to it.
+ */
+static inline int
+mb_congested(const struct mailbox *mb)
+{
+	return rte_ring_count(mb->ring) >= mb->watermark;
+}
 
 static inline int
 mb_dequeue_burst(struct mailbox *mb, void **obj_table, unsigned n)
@@ -56,4 +163,10 @@ mb_free_entry(struct mailbox *mb, void *obj)
 	rte_mempool_put(mb->pool, obj);
 }
 
+static inline void
+mb_free_entries(struct mailbox *mb, void **obj_table, unsigned int n)
+{
+	rte_mempool_put_bulk(mb->pool, obj_table, n);
+}
+
 #endif /* _GATEKEEPER_MAILBOX_H_ */
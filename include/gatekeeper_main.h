@@ -28,7 +28,12 @@
  */
 #define RTE_LOGTYPE_GATEKEEPER RTE_LOGTYPE_USER1
 
-#define GATEKEEPER_MAX_PKT_BURST (32)
+/*
+ * The largest burst of packets of any block, which sizes the arrays
+ * of packets on the stack; see struct poll_config for the bursts
+ * that the blocks actually use.
+ */
+#define GATEKEEPER_MAX_PKT_BURST (128)
 
 extern volatile int exiting;
 
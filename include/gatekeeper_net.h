@@ -20,6 +20,7 @@
 #define _GATEKEEPER_NET_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <netinet/in.h>
 
 #include <rte_ethdev.h>
@@ -39,7 +40,7 @@ struct ipacket {
 	struct ip_flow  flow;
 	/* Pointer to the packet itself. */
 	struct rte_mbuf *pkt;
-	/* The length of the packet. */
+	/* The length of the first segment, which holds the headers. */
 	uint16_t        len;
 	/* The type of the next header, if present. */
 	uint8_t         next_hdr;
@@ -85,6 +86,49 @@ struct gatekeeper_if {
 	uint32_t	arp_cache_timeout_sec;
 	uint32_t	nd_cache_timeout_sec;
 
+	/* Number of neighbors that Link Layer Support tracks. */
+	uint32_t	arp_cache_max_entries;
+	uint32_t	nd_cache_max_entries;
+
+	/*
+	 * Whether the NIC should steer the ND packets of this interface
+	 * to the queue of the LLS block (see steer_nd()). Otherwise,
+	 * or if the NIC cannot do it, the blocks that receive packets
+	 * from this interface look for ND packets, and submit them to
+	 * the LLS block.
+	 *
+	 * The NIC cannot match IPv6 addresses nor ICMPv6 types, so
+	 * all ICMPv6 packets go to the LLS block, which drops those
+	 * that are not ND packets.
+	 */
+	bool            hw_nd_filter;
+
+	/*
+	 * Whether the RX queues of this interface raise interrupts,
+	 * so that idle blocks can sleep on them (see struct poll_config).
+	 */
+	bool            rx_intr;
+
+	/*
+	 * How the ports of this interface are bonded, if it has more than
+	 * one: BONDING_MODE_8023AD (LACP), BONDING_MODE_BALANCE (XOR), or
+	 * BONDING_MODE_ROUND_ROBIN, which reorders the packets of flows.
+	 * The first two send each flow through a single slave.
+	 *
+	 * With LACP, the blocks that poll the interface must do so at
+	 * least every 100ms, or the bond loses its partner; so must
+	 * rx_intr_timeout_ms in the configuration of the blocks.
+	 */
+	uint8_t         bonding_mode;
+
+	/*
+	 * The MTU of this interface. Above ETHER_MTU, the ports receive
+	 * jumbo frames in chains of mbufs. The MTU of the back interface
+	 * should leave room for the outer IP header that the GK blocks
+	 * prepend to the packets of the front interface.
+	 */
+	uint16_t        mtu;
+
 	/*
 	 * The fields below are for internal use.
 	 * Configuration files should not refer to them.
@@ -109,6 +153,12 @@ struct gatekeeper_if {
 	int16_t         rx_queues[RTE_MAX_LCORE];
 	int16_t         tx_queues[RTE_MAX_LCORE];
 
+	/*
+	 * The RX queue that no block polls, so the NIC drops
+	 * the packets steered to it; see get_drop_queue_id().
+	 */
+	int16_t         drop_queue;
+
 	/*
 	 * The next RX and TX queues to be assigned on this interface.
 	 * We need atomic here in case multiple blocks are trying to
@@ -197,8 +247,12 @@ enum queue_type {
 	QUEUE_TYPE_MAX,
 };
 
+/* XXX Sample parameter, need to be tested for better performance. */
+#define GATEKEEPER_NUM_DROP_DESC (64)
+
 int get_queue_id(struct gatekeeper_if *iface, enum queue_type ty,
-	unsigned int lcore);
+	unsigned int lcore, uint16_t num_desc);
+int get_drop_queue_id(struct gatekeeper_if *iface, unsigned int lcore);
 
 /* Configuration for the Network. */
 struct net_config {
@@ -253,11 +307,21 @@ int ethertype_filter_add(uint8_t port_id, uint16_t ether_type,
 	uint16_t queue_id);
 int ntuple_filter_add(uint8_t portid, uint32_t dst_ip,
 	uint16_t src_port, uint16_t dst_port, uint16_t queue_id);
+int icmpv6_filter_add(uint8_t port_id, uint16_t queue_id);
+int ip4_flow_filter_add(uint8_t port_id, uint32_t src_ip, uint32_t dst_ip,
+	uint16_t queue_id);
+int ip4_flow_filter_del(uint8_t port_id, uint32_t src_ip, uint32_t dst_ip,
+	uint16_t queue_id);
+int steer_arp(struct gatekeeper_if *iface, uint16_t queue_id);
+int steer_nd(struct gatekeeper_if *iface, uint16_t queue_id);
+int steer_ggu(struct gatekeeper_if *iface, uint16_t src_port_be,
+	uint16_t dst_port_be, uint16_t queue_id);
 struct net_config *get_net_conf(void);
 struct gatekeeper_if *get_if_front(struct net_config *net_conf);
 struct gatekeeper_if *get_if_back(struct net_config *net_conf);
-int gatekeeper_setup_rss(uint8_t portid, uint16_t *queues, uint16_t num_queues);
-int gatekeeper_get_rss_config(uint8_t portid,
+int gatekeeper_setup_rss(struct gatekeeper_if *iface, uint16_t *queues,
+	uint16_t num_queues);
+int gatekeeper_get_rss_config(struct gatekeeper_if *iface,
 	struct gatekeeper_rss_config *rss_conf);
 int gatekeeper_init_network(struct net_config *net_conf);
 void gatekeeper_free_network(void);
@@ -279,6 +343,8 @@ void gatekeeper_free_network(void);
  * If the back interface is not enabled, the parameters back_rx_queues and
  * back_tx_queues are ignored.
  *
+ * @name is passed on to launch_at_stage1().
+ *
  * RETURN
  *	Return 0 if success; otherwise -1.
  */
@@ -286,6 +352,6 @@ int
 net_launch_at_stage1(struct net_config *net,
 	int front_rx_queues, int front_tx_queues,
 	int back_rx_queues, int back_tx_queues,
-	lcore_function_t *f, void *arg);
+	const char *name, lcore_function_t *f, void *arg);
 
 #endif /* _GATEKEEPER_NET_H_ */
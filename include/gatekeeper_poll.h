@@ -0,0 +1,161 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GATEKEEPER_POLL_H_
+#define _GATEKEEPER_POLL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_mbuf.h>
+#include <rte_ethdev.h>
+#include <rte_atomic.h>
+#include <rte_interrupts.h>
+
+#include "gatekeeper_main.h"
+#include "gatekeeper_mailbox.h"
+#include "gatekeeper_net.h"
+
+/* XXX Sample parameters, need to be tested for better performance. */
+#define GATEKEEPER_DEF_PKT_BURST (32)
+#define GATEKEEPER_NUM_RX_DESC	 (128)
+#define GATEKEEPER_NUM_TX_DESC	 (512)
+
+/*
+ * How a functional block polls its RX queue(s).
+ *
+ * Zero fields take the defaults above, except @max_idle_pauses and
+ * @rx_intr_timeout_ms, which disable the backoff when they are zero.
+ */
+struct poll_config {
+	/*
+	 * The number of descriptors of the RX and TX queues of the block.
+	 * Larger queues mitigate bursty traffic, but put more pressure
+	 * on the cache.
+	 */
+	uint16_t     num_rx_desc;
+	uint16_t     num_tx_desc;
+
+	/*
+	 * The RX bursts start at @max_pkt_burst packets. While bursts
+	 * come back with less than half of the packets asked for,
+	 * the burst shrinks down to @min_pkt_burst, and it doubles back
+	 * while bursts come back full. Both are at most
+	 * GATEKEEPER_MAX_PKT_BURST, and a zero @min_pkt_burst
+	 * disables the adaptation.
+	 */
+	uint16_t     min_pkt_burst;
+	uint16_t     max_pkt_burst;
+
+	/*
+	 * After each loop that finds no work, the block calls rte_pause()
+	 * a number of times that doubles up to @max_idle_pauses, so
+	 * an idle block frees the resources of its hyperthread sibling
+	 * and saves power, while still servicing its mailbox and timers.
+	 */
+	uint32_t     max_idle_pauses;
+
+	/*
+	 * When non-zero, once a block has backed off all the way, it
+	 * sleeps on the RX interrupt of its queue, and on its mailbox
+	 * if it has one, for at most @rx_intr_timeout_ms milliseconds.
+	 * The interface must have
+	 * @rx_intr set, and the NIC must support it; otherwise,
+	 * the block keeps pausing.
+	 */
+	uint32_t     rx_intr_timeout_ms;
+};
+
+/* The state of the polling of an RX queue; see struct poll_config. */
+struct poll_state {
+	uint8_t      port_id;
+	uint16_t     queue_id;
+	uint16_t     burst;
+	uint32_t     idle_pauses;
+
+	/* Whether the RX interrupt of the queue is registered. */
+	bool         rx_intr;
+
+	/*
+	 * The mailbox of the block, whose eventfd is registered
+	 * along with the RX interrupt, or NULL.
+	 */
+	struct mailbox          *mb;
+	struct rte_epoll_event  mb_event;
+};
+
+int check_poll_config(struct poll_config *conf,
+	const struct gatekeeper_if *iface, const char *block);
+void poll_init(struct poll_state *st, const struct poll_config *conf,
+	uint8_t port_id, uint16_t queue_id);
+int poll_enable_rx_intr(struct poll_state *st,
+	const struct poll_config *conf, struct mailbox *mb,
+	const char *block);
+void poll_release(struct poll_state *st);
+void poll_sleep(struct poll_state *st, const struct poll_config *conf);
+
+/* Receive a burst of packets, and adapt the size of the next one. */
+static inline uint16_t
+poll_rx(struct poll_state *st, const struct poll_config *conf,
+	struct rte_mbuf **pkts)
+{
+	uint16_t num_rx = rte_eth_rx_burst(st->port_id, st->queue_id,
+		pkts, st->burst);
+
+	if (conf->min_pkt_burst == conf->max_pkt_burst)
+		return num_rx;
+
+	if (num_rx == st->burst) {
+		st->burst = RTE_MIN(2 * st->burst, conf->max_pkt_burst);
+	} else if (num_rx < st->burst / 2) {
+		st->burst = RTE_MAX(st->burst / 2, conf->min_pkt_burst);
+	}
+
+	return num_rx;
+}
+
+/*
+ * Back off at the end of a loop of a block if it found no work,
+ * i.e. @busy is false. The caller must have serviced its mailbox
+ * and flushed what it does not want to wait for a sleep.
+ */
+static inline void
+poll_idle(struct poll_state *st, const struct poll_config *conf, bool busy)
+{
+	uint32_t i;
+
+	if (likely(busy)) {
+		st->idle_pauses = 0;
+		return;
+	}
+
+	if (conf->max_idle_pauses == 0)
+		return;
+
+	if (st->idle_pauses == conf->max_idle_pauses && st->rx_intr) {
+		poll_sleep(st, conf);
+		return;
+	}
+
+	st->idle_pauses = st->idle_pauses == 0 ? 1
+		: RTE_MIN(2 * st->idle_pauses, conf->max_idle_pauses);
+	for (i = 0; i < st->idle_pauses; i++)
+		rte_pause();
+}
+
+#endif /* _GATEKEEPER_POLL_H_ */
@@ -0,0 +1,97 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GATEKEEPER_STATS_H_
+#define _GATEKEEPER_STATS_H_
+
+#include <stdint.h>
+
+#include <rte_cycles.h>
+
+/*
+ * Statistics of the functional blocks.
+ *
+ * Each lcore of a block keeps its own statistics in a memzone named
+ * "<block>_stats_<lcore id>" (see stats_alloc()), on the NUMA node
+ * of the lcore. Only the owning lcore writes its counters, and it does
+ * so with plain increments, so there are no atomics on the fast path.
+ * Other lcores, e.g. the Dynamic Config block, and secondary processes
+ * attached through rte_memzone_lookup() read them with stats_read().
+ *
+ * The counters of a reading may be from slightly different instants,
+ * but since each counter is a naturally aligned 64-bit word,
+ * no counter is ever torn.
+ */
+
+/* Number of buckets of the cycle histograms. */
+#define STATS_CYCLE_HIST_BUCKETS (24)
+
+/*
+ * Histogram of the cycles spent per packet in a function.
+ * Bucket i counts the packets that took [2^i, 2^(i + 1)) cycles;
+ * the last bucket also counts all the slower packets.
+ */
+struct stats_cycle_hist {
+	uint64_t num_pkts;
+	uint64_t cycles;
+	uint64_t buckets[STATS_CYCLE_HIST_BUCKETS];
+};
+
+static inline void
+stats_cycle_hist_add(struct stats_cycle_hist *hist, uint64_t cycles,
+	unsigned int num_pkts)
+{
+	unsigned int bucket;
+	uint64_t cycles_per_pkt;
+
+	if (unlikely(num_pkts == 0))
+		return;
+
+	cycles_per_pkt = cycles / num_pkts;
+	bucket = cycles_per_pkt == 0
+		? 0 : 63 - __builtin_clzll(cycles_per_pkt);
+	if (bucket >= STATS_CYCLE_HIST_BUCKETS)
+		bucket = STATS_CYCLE_HIST_BUCKETS - 1;
+
+	hist->num_pkts += num_pkts;
+	hist->cycles += cycles;
+	hist->buckets[bucket] += num_pkts;
+}
+
+/*
+ * The cycle histograms are only kept when Gatekeeper is built with
+ * CYCLE_STATS=y, since reading the TSC around every call is not free.
+ *
+ * STATS_CYCLES_BEGIN() declares @start, so it must be used
+ * at the beginning of a block of code.
+ */
+#ifdef GATEKEEPER_CYCLE_STATS
+#define STATS_CYCLES_BEGIN(start) uint64_t start = rte_rdtsc()
+#define STATS_CYCLES_END(hist, start, num_pkts) \
+	stats_cycle_hist_add(hist, rte_rdtsc() - (start), num_pkts)
+#else
+#define STATS_CYCLES_BEGIN(start) do { } while (0)
+#define STATS_CYCLES_END(hist, start, num_pkts) do { } while (0)
+#endif
+
+void *stats_alloc(const char *block_name, unsigned int lcore_id,
+	size_t size);
+void stats_free(const char *block_name, unsigned int lcore_id);
+void stats_read(void *dst, const void *src, size_t size);
+
+#endif /* _GATEKEEPER_STATS_H_ */
@@ -0,0 +1,96 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GATEKEEPER_TX_H_
+#define _GATEKEEPER_TX_H_
+
+#include <stdint.h>
+
+#include <rte_mbuf.h>
+
+#include "gatekeeper_main.h"
+
+/* XXX Sample parameters, need to be tested for better performance. */
+#define GATEKEEPER_TX_BUF_MAX_PKTS    (32)
+#define GATEKEEPER_TX_BUF_FLUSH_US    (100)
+#define GATEKEEPER_TX_BUF_MAX_RETRIES (8)
+
+/*
+ * Transmit buffer of a TX queue of a port.
+ *
+ * Packets accumulate across bursts until there are
+ * GATEKEEPER_TX_BUF_MAX_PKTS of them, or until the oldest one has
+ * waited GATEKEEPER_TX_BUF_FLUSH_US, so that the NIC is not notified
+ * for tiny bursts. When the TX ring is short of descriptors,
+ * the unsent packets are retried GATEKEEPER_TX_BUF_MAX_RETRIES times
+ * before they are dropped.
+ *
+ * A buffer must only be used by the lcore that owns its queue.
+ */
+struct gatekeeper_tx_buf {
+	uint8_t         port_id;
+	uint16_t        queue_id;
+
+	uint16_t        num_pkts;
+	/* When the buffered packets must be sent. */
+	uint64_t        flush_at;
+	uint64_t        flush_cycles;
+
+	/* Statistics. */
+	uint64_t        num_sent;
+	uint64_t        num_retries;
+	uint64_t        num_dropped;
+
+	struct rte_mbuf *pkts[GATEKEEPER_TX_BUF_MAX_PKTS];
+};
+
+void tx_buf_init(struct gatekeeper_tx_buf *buf, uint8_t port_id,
+	uint16_t queue_id);
+uint16_t tx_buf_flush(struct gatekeeper_tx_buf *buf);
+void tx_buf_free(struct gatekeeper_tx_buf *buf);
+
+static inline void
+tx_buf_add(struct gatekeeper_tx_buf *buf, struct rte_mbuf *pkt,
+	uint64_t now)
+{
+	if (buf->num_pkts == 0)
+		buf->flush_at = now + buf->flush_cycles;
+	buf->pkts[buf->num_pkts++] = pkt;
+	if (unlikely(buf->num_pkts == GATEKEEPER_TX_BUF_MAX_PKTS))
+		tx_buf_flush(buf);
+}
+
+static inline void
+tx_buf_add_bulk(struct gatekeeper_tx_buf *buf, struct rte_mbuf **pkts,
+	uint16_t num_pkts, uint64_t now)
+{
+	uint16_t i;
+
+	for (i = 0; i < num_pkts; i++)
+		tx_buf_add(buf, pkts[i], now);
+}
+
+/* Send the buffered packets if the oldest one has waited enough. */
+static inline void
+tx_buf_drain(struct gatekeeper_tx_buf *buf, uint64_t now)
+{
+	if (buf->num_pkts > 0 && now >= buf->flush_at)
+		tx_buf_flush(buf);
+}
+
+#endif /* _GATEKEEPER_TX_H_ */
@@ -0,0 +1,242 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <rte_log.h>
+#include <rte_lcore.h>
+#include <rte_cycles.h>
+
+#include "gatekeeper_capture.h"
+#include "gatekeeper_main.h"
+
+static FILE *capture_file;
+
+/* The time of the file, to convert the cycles of the samples. */
+static uint64_t        capture_start_cycles;
+static struct timespec capture_start_time;
+
+/*
+ * The rings and the pools of the taps, indexed by lcore.
+ * They are only freed by capture_close(), once the blocks are done.
+ */
+static struct {
+	struct rte_ring    *ring;
+	struct rte_mempool *clone_pool;
+} capture_rings[RTE_MAX_LCORE];
+
+/*
+ * Open the pcap file that receives the packets of the taps.
+ * It must be called before the blocks that have taps are configured.
+ */
+int
+capture_open(const char *path)
+{
+	struct pcap_file_hdr hdr = {
+		.magic = PCAP_MAGIC,
+		.version_major = PCAP_VERSION_MAJOR,
+		.version_minor = PCAP_VERSION_MINOR,
+		.thiszone = 0,
+		.sigfigs = 0,
+		.snaplen = PCAP_SNAPLEN,
+		.linktype = PCAP_LINKTYPE_ETH,
+	};
+
+	if (capture_file != NULL) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"capture: the capture file is already open\n");
+		return -1;
+	}
+
+	capture_file = fopen(path, "w");
+	if (capture_file == NULL) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"capture: cannot open %s (errno = %d)\n", path, errno);
+		return -1;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, capture_file) != 1) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"capture: cannot write the header of %s\n", path);
+		fclose(capture_file);
+		capture_file = NULL;
+		return -1;
+	}
+
+	capture_start_cycles = rte_rdtsc();
+	clock_gettime(CLOCK_REALTIME, &capture_start_time);
+	return 0;
+}
+
+int
+capture_tap_init(struct capture_tap *tap, const struct capture_config *conf,
+	const char *block, unsigned int lcore_id)
+{
+	char name[64];
+	int socket_id = rte_lcore_to_socket_id(lcore_id);
+
+	memset(tap, 0, sizeof(*tap));
+	if (conf->sample_rate == 0)
+		return 0;
+
+	if (capture_file == NULL) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"%s: packets can only be captured after capture_open()\n",
+			block);
+		return -1;
+	}
+
+	if (capture_rings[lcore_id].ring == NULL) {
+		snprintf(name, sizeof(name), "capture_ring_%u", lcore_id);
+		capture_rings[lcore_id].ring = rte_ring_create(name,
+			CAPTURE_RING_SIZE, socket_id,
+			RING_F_SP_ENQ | RING_F_SC_DEQ);
+		if (capture_rings[lcore_id].ring == NULL) {
+			RTE_LOG(ERR, RING,
+				"%s: cannot create the capture ring at lcore %u\n",
+				block, lcore_id);
+			return -1;
+		}
+
+		/*
+		 * The clones only need their headers, and the samples
+		 * beyond CAPTURE_MAX_CLONES are dropped.
+		 */
+		snprintf(name, sizeof(name), "capture_pool_%u", lcore_id);
+		capture_rings[lcore_id].clone_pool = rte_pktmbuf_pool_create(
+			name, CAPTURE_MAX_CLONES, 0, 0, 0, socket_id);
+		if (capture_rings[lcore_id].clone_pool == NULL) {
+			RTE_LOG(ERR, MALLOC,
+				"%s: cannot create the capture pool at lcore %u\n",
+				block, lcore_id);
+			rte_ring_free(capture_rings[lcore_id].ring);
+			capture_rings[lcore_id].ring = NULL;
+			return -1;
+		}
+	}
+
+	tap->sample_rate = conf->sample_rate;
+	tap->classes = conf->classes;
+	tap->countdown = conf->sample_rate;
+	tap->ring = capture_rings[lcore_id].ring;
+	tap->clone_pool = capture_rings[lcore_id].clone_pool;
+	return 0;
+}
+
+void
+capture_enqueue(struct capture_tap *tap, struct rte_mbuf *pkt)
+{
+	struct rte_mbuf *clone = rte_pktmbuf_clone(pkt, tap->clone_pool);
+
+	if (unlikely(clone == NULL)) {
+		tap->num_dropped++;
+		return;
+	}
+
+	/* The clone is only seen by the capture, so keep the time there. */
+	clone->udata64 = rte_rdtsc();
+	if (unlikely(rte_ring_sp_enqueue(tap->ring, clone) == -ENOBUFS)) {
+		rte_pktmbuf_free(clone);
+		tap->num_dropped++;
+	}
+}
+
+static void
+write_pkt(struct rte_mbuf *pkt)
+{
+	struct pcap_rec_hdr hdr;
+	struct rte_mbuf *seg;
+	uint64_t elapsed = pkt->udata64 - capture_start_cycles;
+	uint64_t usec = capture_start_time.tv_nsec / 1000 +
+		(elapsed % cycles_per_sec) * 1000000 / cycles_per_sec;
+
+	hdr.ts_sec = capture_start_time.tv_sec + elapsed / cycles_per_sec +
+		usec / 1000000;
+	hdr.ts_usec = usec % 1000000;
+	hdr.orig_len = rte_pktmbuf_pkt_len(pkt);
+	hdr.incl_len = RTE_MIN(hdr.orig_len, (uint32_t)PCAP_SNAPLEN);
+
+	fwrite(&hdr, sizeof(hdr), 1, capture_file);
+	for (seg = pkt; seg != NULL && hdr.incl_len > 0; seg = seg->next) {
+		uint32_t len = RTE_MIN((uint32_t)rte_pktmbuf_data_len(seg),
+			hdr.incl_len);
+
+		fwrite(rte_pktmbuf_mtod(seg, void *), len, 1, capture_file);
+		hdr.incl_len -= len;
+	}
+}
+
+/* Write the packets of all taps; it runs on the master lcore. */
+void
+capture_write(void)
+{
+	unsigned int lcore_id;
+	bool written = false;
+
+	if (capture_file == NULL)
+		return;
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		struct rte_ring *ring = capture_rings[lcore_id].ring;
+		struct rte_mbuf *pkts[CAPTURE_WRITE_BURST];
+		unsigned int i, num_pkts;
+
+		if (ring == NULL)
+			continue;
+
+		while ((num_pkts = rte_ring_sc_dequeue_burst(ring,
+				(void **)pkts, CAPTURE_WRITE_BURST)) > 0) {
+			for (i = 0; i < num_pkts; i++) {
+				write_pkt(pkts[i]);
+				rte_pktmbuf_free(pkts[i]);
+			}
+			written = true;
+		}
+	}
+
+	if (written)
+		fflush(capture_file);
+}
+
+/*
+ * Write the last packets of the taps, and free them.
+ * It must only be called once the blocks are done.
+ */
+void
+capture_close(void)
+{
+	unsigned int lcore_id;
+
+	capture_write();
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		rte_ring_free(capture_rings[lcore_id].ring);
+		capture_rings[lcore_id].ring = NULL;
+		rte_mempool_free(capture_rings[lcore_id].clone_pool);
+		capture_rings[lcore_id].clone_pool = NULL;
+	}
+
+	if (capture_file != NULL) {
+		fclose(capture_file);
+		capture_file = NULL;
+	}
+}
@@ -16,9 +16,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include <rte_thash.h>
 #include <rte_debug.h>
 #include <rte_ether.h>
+#include <rte_memory.h>
 
 #include "gatekeeper_net.h"
 #include "gatekeeper_flow.h"
@@ -74,6 +77,81 @@ gk_softrss_be(const uint32_t *input_tuple, uint32_t input_len,
 	return ret;
 }
 
+/* The largest input of the RSS hash: the addresses of an IPv6 flow. */
+#define RSS_MAX_INPUT_LEN (sizeof(((struct ip_flow *)0)->f))
+
+/*
+ * Lookup tables of the RSS hash derived from @rss_key_be.
+ *
+ * The Toeplitz hash is linear over XOR, so the hash of an input is
+ * the XOR of the hashes of each of its bytes alone at their positions.
+ * @rss_tbl[i][v] is the hash of an input whose byte @i is @v and
+ * whose other bytes are zero.
+ */
+static uint32_t rss_tbl[RSS_MAX_INPUT_LEN][256] __rte_cache_aligned;
+
+void
+init_ip_flow_hash(void)
+{
+	unsigned int i, v;
+
+	/*
+	 * The tables are built with gk_softrss_be(), so gk_softrss_tbl()
+	 * gives the very same results, i.e. the NIC RSS hash values.
+	 */
+	for (i = 0; i < RSS_MAX_INPUT_LEN; i++) {
+		for (v = 0; v < 256; v++) {
+			uint32_t input[RSS_MAX_INPUT_LEN / sizeof(uint32_t)];
+
+			memset(input, 0, sizeof(input));
+			((uint8_t *)input)[i] = v;
+			rss_tbl[i][v] = gk_softrss_be(input,
+				i / sizeof(uint32_t) + 1, rss_key_be);
+		}
+	}
+}
+
+/*
+ * Table-driven implementation of gk_softrss_be().
+ * It takes one lookup per byte of input instead of
+ * one conditional step per bit.
+ * @param input
+ *   Pointer to input tuple with network order.
+ * @param input_len
+ *   Length of input in bytes; at most RSS_MAX_INPUT_LEN.
+ * @return
+ *   Calculated hash value.
+ */
+static inline uint32_t
+gk_softrss_tbl(const uint8_t *input, uint32_t input_len)
+{
+	uint32_t i;
+	uint32_t ret = 0;
+
+	for (i = 0; i < input_len; i++)
+		ret ^= rss_tbl[i][input[i]];
+
+	return ret;
+}
+
+uint32_t
+rss_ip4_flow_hf(const void *data,
+	__attribute__((unused)) uint32_t data_len,
+	__attribute__((unused)) uint32_t init_val)
+{
+	return gk_softrss_tbl((const uint8_t *)data,
+		sizeof(((struct ip_flow *)0)->f.v4));
+}
+
+uint32_t
+rss_ip6_flow_hf(const void *data,
+	__attribute__((unused)) uint32_t data_len,
+	__attribute__((unused)) uint32_t init_val)
+{
+	return gk_softrss_tbl((const uint8_t *)data,
+		sizeof(((struct ip_flow *)0)->f.v6));
+}
+
 uint32_t
 rss_ip_flow_hf(const void *data,
 	__attribute__((unused)) uint32_t data_len,
@@ -82,11 +160,9 @@ rss_ip_flow_hf(const void *data,
 	const struct ip_flow *flow = (const struct ip_flow *)data;
 
 	if (flow->proto == ETHER_TYPE_IPv4)
-		return gk_softrss_be((const uint32_t *)&flow->f,
-				(sizeof(flow->f.v4)/sizeof(uint32_t)), rss_key_be);
+		return rss_ip4_flow_hf(&flow->f, 0, 0);
 	else if (flow->proto == ETHER_TYPE_IPv6)
-		return gk_softrss_be((const uint32_t *)&flow->f,
-				(sizeof(flow->f.v6)/sizeof(uint32_t)), rss_key_be);
+		return rss_ip6_flow_hf(&flow->f, 0, 0);
 	else
 		rte_panic("Unexpected protocol: %i\n", flow->proto);
 
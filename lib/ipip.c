@@ -16,46 +16,35 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include <rte_ip.h>
 #include <rte_mbuf.h>
 #include <rte_memcpy.h>
+#include <rte_prefetch.h>
 #include <rte_byteorder.h>
 
 #include "gatekeeper_ipip.h"
 #include "gatekeeper_net.h"
 
-int
-encapsulate(struct rte_mbuf *pkt, uint8_t priority,
-	struct ipip_tunnel_info *info)
+/* Build the template of the outer headers of the tunnel @info. */
+void
+ipip_tunnel_refresh(struct ipip_tunnel_info *info)
 {
-	struct ether_hdr *new_eth;
-	struct ipv4_hdr *outer_ip4hdr;
-	struct ipv6_hdr *outer_ip6hdr;
+	struct ether_hdr *eth_hdr = (struct ether_hdr *)info->hdrs;
 
-	if (info->flow.proto == ETHER_TYPE_IPv4) {
-		/* Allocate space for outer IPv4 header. */
-		new_eth = (struct ether_hdr *)rte_pktmbuf_prepend(pkt,
-			sizeof(struct ipv4_hdr));
-		if (new_eth == NULL) {
-			RTE_LOG(ERR, MBUF,
-				"Not enough headroom space in the first segment!\n");
-			return -1;
-		}
+	memset(info->hdrs, 0, sizeof(info->hdrs));
 
-		outer_ip4hdr = (struct ipv4_hdr *)&new_eth[1];
+	ether_addr_copy(&info->source_mac, &eth_hdr->s_addr);
+	/* Fill up the destination MAC address via Gateway MAC. */
+	ether_addr_copy(&info->nexthop_mac, &eth_hdr->d_addr);
 
-		/* Fill up the new Ethernet header. */
-		rte_memcpy(&new_eth->s_addr, &info->source_mac,
-			sizeof(new_eth->s_addr));
-		/* Fill up the destination MAC address via Gateway MAC. */
-		rte_memcpy(&new_eth->d_addr, &info->nexthop_mac,
-			sizeof(new_eth->d_addr));
+	if (info->flow.proto == ETHER_TYPE_IPv4) {
+		struct ipv4_hdr *outer_ip4hdr = (struct ipv4_hdr *)&eth_hdr[1];
 
-		new_eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
+		eth_hdr->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
 
-		/* Fill up the outer IP header. */
 		outer_ip4hdr->version_ihl = IP_VHL_DEF;
-		outer_ip4hdr->type_of_service = (priority << 2);
 		outer_ip4hdr->packet_id = 0;
 		outer_ip4hdr->fragment_offset = IP_DN_FRAGMENT_FLAG;
 		outer_ip4hdr->time_to_live = IP_DEFTTL;
@@ -64,60 +53,176 @@ encapsulate(struct rte_mbuf *pkt, uint8_t priority,
 		outer_ip4hdr->src_addr = info->flow.f.v4.src;
 		/* The destination address is the Grantor server IP address. */
 		outer_ip4hdr->dst_addr = info->flow.f.v4.dst;
-
-		outer_ip4hdr->total_length = rte_cpu_to_be_16(pkt->data_len
-			- sizeof(struct ether_hdr));
-
 		/*
 		 * The IP header checksum filed must be set to 0
 		 * in order to offload the checksum calculation.
 		 */
 		outer_ip4hdr->hdr_checksum = 0;
-
-		pkt->outer_l2_len = sizeof(struct ether_hdr);
-		pkt->outer_l3_len = sizeof(struct ipv4_hdr);
-		/* Offload checksum computation for the outer IPv4 header. */
-		pkt->ol_flags |= (PKT_TX_IPV4 |
-			PKT_TX_IP_CKSUM | PKT_TX_OUTER_IPV4);
 	} else if (info->flow.proto == ETHER_TYPE_IPv6) {
-		/* Allocate space for new IPv6 header. */
-		new_eth = (struct ether_hdr *)rte_pktmbuf_prepend(pkt,
-			sizeof(struct ipv6_hdr));
-		if (new_eth == NULL) {
-			RTE_LOG(ERR, MBUF,
-				"Not enough headroom space in the first segment!\n");
-			return -1;
-		}
-
-		outer_ip6hdr = (struct ipv6_hdr *)&new_eth[1];
-
-		/* Fill up the new Ethernet header. */
-		rte_memcpy(&new_eth->s_addr, &info->source_mac,
-			sizeof(new_eth->s_addr));
-		/* Fill up the destination MAC address via Gateway MAC. */
-		rte_memcpy(&new_eth->d_addr, &info->nexthop_mac,
-			sizeof(new_eth->d_addr));
+		struct ipv6_hdr *outer_ip6hdr = (struct ipv6_hdr *)&eth_hdr[1];
 
-		new_eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv6);
+		eth_hdr->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv6);
 
-		/* Fill up the outer IP header. */
-		outer_ip6hdr->vtc_flow = rte_cpu_to_be_32(
-			IPv6_DEFAULT_VTC_FLOW | (priority << 22));
-		outer_ip6hdr->proto = IPPROTO_IPIP; 
+		outer_ip6hdr->vtc_flow = rte_cpu_to_be_32(IPv6_DEFAULT_VTC_FLOW);
+		outer_ip6hdr->proto = IPPROTO_IPIP;
 		outer_ip6hdr->hop_limits = IPv6_DEFAULT_HOP_LIMITS;
-
 		rte_memcpy(outer_ip6hdr->src_addr, info->flow.f.v6.src,
 			sizeof(info->flow.f.v6.src));
 		rte_memcpy(outer_ip6hdr->dst_addr, info->flow.f.v6.dst,
 			sizeof(info->flow.f.v6.dst));
+	}
+}
+
+/*
+ * Prepend the outer headers of @hdrs_len bytes to @pkt, and return
+ * the first segment of the encapsulated packet.
+ *
+ * The outer IP header goes into the headroom of @pkt, in front of its
+ * Ethernet header, which the template overwrites. When the headroom
+ * is short, or the data of @pkt is shared with other mbufs and must
+ * not be written, the outer headers go into a new segment, chained in
+ * front of @pkt without its Ethernet header. The data is shared when
+ * @pkt is indirect, or when it has clones, e.g. the samples of
+ * a capture tap, which keep the reference count of @pkt above one.
+ */
+static struct rte_mbuf *
+prepend_outer_hdrs(struct rte_mbuf *pkt, uint16_t hdrs_len)
+{
+	struct rte_mbuf *hdr;
+	uint16_t outer_ip_len = hdrs_len - sizeof(struct ether_hdr);
+
+	if (likely(RTE_MBUF_DIRECT(pkt) &&
+			rte_mbuf_refcnt_read(pkt) == 1 &&
+			rte_pktmbuf_headroom(pkt) >= outer_ip_len)) {
+		rte_pktmbuf_prepend(pkt, outer_ip_len);
+		return pkt;
+	}
+
+	if (unlikely(pkt->nb_segs == UINT8_MAX))
+		return NULL;
+
+	hdr = rte_pktmbuf_alloc(pkt->pool);
+	if (unlikely(hdr == NULL))
+		return NULL;
+
+	if (unlikely(rte_pktmbuf_append(hdr, hdrs_len) == NULL)) {
+		rte_pktmbuf_free(hdr);
+		return NULL;
+	}
+	rte_pktmbuf_adj(pkt, sizeof(struct ether_hdr));
+
+	hdr->next = pkt;
+	hdr->nb_segs = pkt->nb_segs + 1;
+	hdr->pkt_len += pkt->pkt_len;
+	hdr->port = pkt->port;
+	hdr->ol_flags = pkt->ol_flags;
+	pkt->pkt_len = pkt->data_len;
+	return hdr;
+}
+
+/*
+ * Encapsulate @pkt into the tunnel @info with the DSCP @priority.
+ *
+ * The outer headers are copied from the template of @info,
+ * so only the length and the priority are written per packet.
+ * @pkt may have several segments, and the outer length is the length
+ * of the whole chain.
+ *
+ * Return the first segment of the encapsulated packet, which is not
+ * @pkt when the outer headers need their own segment, or NULL when
+ * @pkt cannot be encapsulated; @pkt is not freed in that case.
+ * Failures are not logged, since they happen per packet when the mbuf
+ * pool runs out; the callers count them instead.
+ */
+struct rte_mbuf *
+encapsulate(struct rte_mbuf *pkt, uint8_t priority,
+	struct ipip_tunnel_info *info)
+{
+	struct ether_hdr *new_eth;
+	struct ipv4_hdr *outer_ip4hdr;
+	struct ipv6_hdr *outer_ip6hdr;
+
+	if (info->flow.proto == ETHER_TYPE_IPv4) {
+		/* Allocate space for outer IPv4 header. */
+		pkt = prepend_outer_hdrs(pkt, IPIP_IP4_HDRS_LEN);
+		if (pkt == NULL)
+			return NULL;
+
+		new_eth = rte_pktmbuf_mtod(pkt, struct ether_hdr *);
+		rte_memcpy(new_eth, info->hdrs, IPIP_IP4_HDRS_LEN);
+
+		outer_ip4hdr = (struct ipv4_hdr *)&new_eth[1];
+		outer_ip4hdr->type_of_service = (priority << 2);
+		outer_ip4hdr->total_length = rte_cpu_to_be_16(pkt->pkt_len
+			- sizeof(struct ether_hdr));
+
+		/*
+		 * The inner packet is forwarded as received, so the outer
+		 * header is the only one the NIC must know about; it is
+		 * described as a plain IPv4 header, which all NICs that
+		 * offload the IPv4 checksum support, not as a tunnel.
+		 */
+		pkt->l2_len = sizeof(struct ether_hdr);
+		pkt->l3_len = sizeof(struct ipv4_hdr);
+		pkt->outer_l2_len = 0;
+		pkt->outer_l3_len = 0;
+		/* Offload checksum computation for the outer IPv4 header. */
+		pkt->ol_flags |= (PKT_TX_IPV4 | PKT_TX_IP_CKSUM);
+	} else if (info->flow.proto == ETHER_TYPE_IPv6) {
+		/* Allocate space for new IPv6 header. */
+		pkt = prepend_outer_hdrs(pkt, IPIP_IP6_HDRS_LEN);
+		if (pkt == NULL)
+			return NULL;
+
+		new_eth = rte_pktmbuf_mtod(pkt, struct ether_hdr *);
+		rte_memcpy(new_eth, info->hdrs, IPIP_IP6_HDRS_LEN);
 
-		outer_ip6hdr->payload_len = rte_cpu_to_be_16(pkt->data_len
+		outer_ip6hdr = (struct ipv6_hdr *)&new_eth[1];
+		outer_ip6hdr->vtc_flow |= rte_cpu_to_be_32(priority << 22);
+		outer_ip6hdr->payload_len = rte_cpu_to_be_16(pkt->pkt_len
 			- sizeof(struct ether_hdr) - sizeof(struct ipv6_hdr));
 
-		pkt->outer_l2_len = sizeof(struct ether_hdr);
-		pkt->outer_l3_len = sizeof(struct ipv6_hdr);
+		/* IPv6 headers have no checksum to offload. */
+		pkt->l2_len = sizeof(struct ether_hdr);
+		pkt->l3_len = sizeof(struct ipv6_hdr);
+		pkt->outer_l2_len = 0;
+		pkt->outer_l3_len = 0;
+		pkt->ol_flags |= PKT_TX_IPV6;
 	} else 
-		return -1;
+		return NULL;
+
+	return pkt;
+}
+
+/*
+ * Encapsulate each packet @pkts[i] into the tunnel @infos[i]
+ * with the DSCP @priorities[i].
+ *
+ * The packets that cannot be encapsulated are freed, and the remaining
+ * ones, with their priorities, are moved to the first positions of
+ * @pkts and @priorities. Return the number of encapsulated packets.
+ */
+unsigned int
+encapsulate_bulk(struct rte_mbuf **pkts, uint8_t *priorities,
+	struct ipip_tunnel_info **infos, unsigned int num_pkts)
+{
+	unsigned int i;
+	unsigned int num_encap = 0;
+
+	for (i = 0; i < num_pkts; i++)
+		rte_prefetch0(infos[i]->hdrs);
+
+	for (i = 0; i < num_pkts; i++) {
+		struct rte_mbuf *pkt = encapsulate(pkts[i], priorities[i],
+			infos[i]);
+
+		if (unlikely(pkt == NULL)) {
+			rte_pktmbuf_free(pkts[i]);
+			continue;
+		}
+		pkts[num_encap] = pkt;
+		priorities[num_encap++] = priorities[i];
+	}
 
-	return 0;
+	return num_encap;
 }
@@ -40,12 +40,13 @@ static struct launch_heads {
 
 struct stage1_entry {
 	struct list_head list;
+	const char       *name;
 	lcore_function_t *f;
 	void             *arg;
 };
 
 int
-launch_at_stage1(lcore_function_t *f, void *arg)
+launch_at_stage1(const char *name, lcore_function_t *f, void *arg)
 {
 	struct stage1_entry *entry;
 
@@ -55,25 +56,64 @@ launch_at_stage1(lcore_function_t *f, void *arg)
 		return -1;
 	}
 
+	entry->name = name;
 	entry->f = f;
 	entry->arg = arg;
 	list_add_tail(&entry->list, &launch_heads.stage1);
 	return 0;
 }
 
+size_t
+heap_allocated(void)
+{
+	int i;
+	size_t total = 0;
+
+	for (i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+		struct rte_malloc_socket_stats stats;
+
+		if (rte_malloc_get_socket_stats(i, &stats) < 0)
+			continue;
+		total += stats.heap_allocsz_bytes;
+	}
+
+	return total;
+}
+
+void
+log_heap_reserved(const char *name, const char *when, size_t before)
+{
+	size_t after = heap_allocated();
+
+	RTE_LOG(NOTICE, GATEKEEPER, "launch: %s reserved %zu KiB %s\n",
+		name, after > before ? (after - before) / 1024 : 0, when);
+}
+
+/*
+ * Stage 1 is where the blocks reserve most of their memory,
+ * so what each entry reserves is logged as it runs. The total
+ * also covers what was reserved at configuration.
+ */
 static int
 launch_stage1(void)
 {
 	struct stage1_entry *entry, *next;
 
 	list_for_each_entry_safe(entry, next, &launch_heads.stage1, list) {
+		size_t before = heap_allocated();
 		int ret = entry->f(entry->arg);
 		if (ret != 0)
 			return ret;
+
+		log_heap_reserved(entry->name, "at stage 1", before);
+
 		list_del(&entry->list);
 		rte_free(entry);
 	}
 
+	RTE_LOG(NOTICE, GATEKEEPER,
+		"launch: %zu MiB are reserved once stage 1 finishes\n",
+		heap_allocated() / (1024 * 1024));
 	return 0;
 }
 
@@ -290,3 +330,25 @@ launch_gatekeeper(void)
 
 	return run_master_if_applicable();
 }
+
+/*
+ * Return the NUMA node of all @lcores, or SOCKET_ID_ANY if
+ * they are not on the same node. Structures shared by the lcores
+ * of a block are allocated on that node.
+ */
+int
+get_lcores_socket_id(const unsigned int *lcores, int num_lcores)
+{
+	int i;
+	int socket_id;
+
+	if (num_lcores <= 0)
+		return SOCKET_ID_ANY;
+
+	socket_id = rte_lcore_to_socket_id(lcores[0]);
+	for (i = 1; i < num_lcores; i++) {
+		if ((int)rte_lcore_to_socket_id(lcores[i]) != socket_id)
+			return SOCKET_ID_ANY;
+	}
+	return socket_id;
+}
@@ -0,0 +1,380 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+
+#include <rte_log.h>
+#include <rte_lcore.h>
+#include <rte_ether.h>
+#include <rte_cycles.h>
+#include <rte_malloc.h>
+#include <rte_atomic.h>
+
+#include "gatekeeper_capture.h"
+#include "gatekeeper_log.h"
+#include "gatekeeper_main.h"
+
+/* XXX Sample parameters, need to be tested for better performance. */
+#define LOG_RING_SIZE        (256)
+#define LOG_WRITER_PERIOD_US (1000)
+
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+
+/* Words of arguments of a record. */
+#define LOG_NUM_ARGS  (7)
+
+struct log_record {
+	uint16_t msg_id;
+	/* Records of the same message dropped before this one. */
+	uint32_t num_suppressed;
+	uint64_t args[LOG_NUM_ARGS];
+};
+
+/* The rate limit of a message at an lcore. */
+struct log_limit {
+	uint64_t window_start;
+	uint32_t num_logged;
+	uint32_t num_suppressed;
+};
+
+/*
+ * Single-producer, single-consumer ring of the records of an lcore.
+ * Only the lcore of the ring writes @head and @limits, and only
+ * the log writer writes @tail.
+ */
+struct log_ring {
+	volatile uint32_t head __rte_cache_aligned;
+	volatile uint32_t tail __rte_cache_aligned;
+	struct log_limit  limits[LOG_MSG_MAX] __rte_cache_aligned;
+	struct log_record records[LOG_RING_SIZE];
+};
+
+/* How to log a message. */
+struct log_msg {
+	uint32_t level;
+	/* Records logged per second and per lcore at most. */
+	uint32_t max_per_sec;
+};
+
+static const struct log_msg log_msgs[LOG_MSG_MAX] = {
+	[LOG_NET_IP4_TOO_SHORT] =   { RTE_LOG_NOTICE, 10 },
+	[LOG_NET_IP6_TOO_SHORT] =   { RTE_LOG_NOTICE, 10 },
+	[LOG_NET_UNKNOWN_PROTO] =   { RTE_LOG_NOTICE, 10 },
+	[LOG_GK_ADD_FLOW_FAILED] =  { RTE_LOG_ERR, 10 },
+	[LOG_GK_UNKNOWN_STATE] =    { RTE_LOG_ERR, 10 },
+	[LOG_GT_INVALID_PKT] =      { RTE_LOG_ALERT, 10 },
+	[LOG_GT_NOT_DESTINED] =     { RTE_LOG_ALERT, 10 },
+	[LOG_GGU_UNKNOWN_PROTO] =   { RTE_LOG_NOTICE, 10 },
+	[LOG_GGU_TOO_SHORT] =       { RTE_LOG_NOTICE, 10 },
+	[LOG_GGU_NON_UDP_IP4] =     { RTE_LOG_ERR, 10 },
+	[LOG_GGU_NON_UDP_IP6] =     { RTE_LOG_ERR, 10 },
+	[LOG_GGU_NOT_DESTINED] =    { RTE_LOG_ERR, 10 },
+	[LOG_GGU_UNKNOWN_PORTS] =   { RTE_LOG_ERR, 10 },
+	[LOG_GGU_UNKNOWN_FORMAT] =  { RTE_LOG_NOTICE, 10 },
+	[LOG_GGU_BAD_PAYLOAD_LEN] = { RTE_LOG_NOTICE, 10 },
+	[LOG_GGU_BAD_V2_FIELD] =    { RTE_LOG_NOTICE, 10 },
+};
+
+static struct log_ring *log_rings[RTE_MAX_LCORE];
+
+int
+init_log(void)
+{
+	unsigned int lcore_id;
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		log_rings[lcore_id] = rte_zmalloc_socket("log_ring",
+			sizeof(*log_rings[lcore_id]), 0,
+			rte_lcore_to_socket_id(lcore_id));
+		if (log_rings[lcore_id] == NULL) {
+			RTE_LOG(ERR, MALLOC,
+				"log: cannot allocate the log ring of lcore %u\n",
+				lcore_id);
+			goto rings;
+		}
+	}
+
+	return 0;
+
+rings:
+	RTE_LCORE_FOREACH(lcore_id) {
+		rte_free(log_rings[lcore_id]);
+		log_rings[lcore_id] = NULL;
+	}
+	return -1;
+}
+
+static void
+format_ip(char *buf, size_t len, uint16_t proto, const uint64_t *addr)
+{
+	int af = proto == ETHER_TYPE_IPv4 ? AF_INET : AF_INET6;
+
+	if (inet_ntop(af, addr, buf, len) == NULL)
+		snprintf(buf, len, "(invalid address)");
+}
+
+static void
+format_record(char *buf, size_t len, const struct log_record *rec)
+{
+	const uint64_t *a = rec->args;
+	char src[INET6_ADDRSTRLEN];
+	char dst[INET6_ADDRSTRLEN];
+
+	switch (rec->msg_id) {
+	case LOG_NET_IP4_TOO_SHORT:
+		snprintf(buf, len,
+			"net: packet is too short to be IPv4 (%" PRIu64 ")!",
+			a[0]);
+		break;
+	case LOG_NET_IP6_TOO_SHORT:
+		snprintf(buf, len,
+			"net: packet is too short to be IPv6 (%" PRIu64 ")!",
+			a[0]);
+		break;
+	case LOG_NET_UNKNOWN_PROTO:
+		snprintf(buf, len,
+			"net: unknown network layer protocol %" PRIu64 "!",
+			a[0]);
+		break;
+	case LOG_GK_ADD_FLOW_FAILED:
+		snprintf(buf, len,
+			"gk: failed to add a new key to the flow table (error %" PRIu64 ")!",
+			a[0]);
+		break;
+	case LOG_GK_UNKNOWN_STATE:
+		snprintf(buf, len, "gk: unknown flow state %" PRIu64 "!",
+			a[0]);
+		break;
+	case LOG_GT_INVALID_PKT:
+		snprintf(buf, len, "gt: parsing an invalid packet!");
+		break;
+	case LOG_GT_NOT_DESTINED:
+		format_ip(src, sizeof(src), a[4], &a[0]);
+		format_ip(dst, sizeof(dst), a[4], &a[2]);
+		snprintf(buf, len,
+			"gt: receiving a packet with IP source address %s, and destination address %s, whose destination IP address is not the Grantor server itself!",
+			src, dst);
+		break;
+	case LOG_GGU_UNKNOWN_PROTO:
+		snprintf(buf, len,
+			"ggu: unknown network layer protocol %" PRIu64,
+			a[0]);
+		break;
+	case LOG_GGU_TOO_SHORT:
+		snprintf(buf, len,
+			"ggu: the packet's actual size is %" PRIu64 ", which doesn't have the minimum expected size %" PRIu64,
+			a[0], a[1]);
+		break;
+	case LOG_GGU_NON_UDP_IP4:
+		snprintf(buf, len,
+			"ggu: received non-UDP packets, IPv4 ntuple filter bug!");
+		break;
+	case LOG_GGU_NON_UDP_IP6:
+		snprintf(buf, len,
+			"ggu: received non-UDP packets, IPv6 ntuple filter bug!");
+		break;
+	case LOG_GGU_NOT_DESTINED:
+		snprintf(buf, len,
+			"ggu: received packets not destined to the Gatekeeper server, IPv4 ntuple filter bug!");
+		break;
+	case LOG_GGU_UNKNOWN_PORTS:
+		snprintf(buf, len,
+			"ggu: unknown udp src port %" PRIu64 ", dst port %" PRIu64 ", ntuple filter bug!",
+			a[0], a[1]);
+		break;
+	case LOG_GGU_UNKNOWN_FORMAT:
+		snprintf(buf, len,
+			"ggu: unknown policy decision format %" PRIu64,
+			a[0]);
+		break;
+	case LOG_GGU_BAD_PAYLOAD_LEN:
+		snprintf(buf, len,
+			"ggu: the size (%" PRIu64 ") of the payload available in the UDP header doesn't match the expected size (%" PRIu64 ")!",
+			a[0], a[1]);
+		break;
+	case LOG_GGU_BAD_V2_FIELD:
+		snprintf(buf, len,
+			"ggu: invalid value %" PRIu64 " at offset %" PRIu64 " of a version 2 policy decision payload",
+			a[0], a[1]);
+		break;
+	default:
+		snprintf(buf, len, "log: unknown message %hu", rec->msg_id);
+		break;
+	}
+}
+
+static void
+write_record(const struct log_record *rec, unsigned int lcore_id)
+{
+	char msg[512];
+
+	format_record(msg, sizeof(msg), rec);
+	if (rec->num_suppressed > 0)
+		rte_log(log_msgs[rec->msg_id].level, RTE_LOGTYPE_GATEKEEPER,
+			"GATEKEEPER: %s (at lcore %u; %u similar messages suppressed)\n",
+			msg, lcore_id, rec->num_suppressed);
+	else
+		rte_log(log_msgs[rec->msg_id].level, RTE_LOGTYPE_GATEKEEPER,
+			"GATEKEEPER: %s (at lcore %u)\n", msg, lcore_id);
+}
+
+/*
+ * Reserve a record of @msg_id at the ring of the running lcore,
+ * or return NULL if the message is over its rate limit.
+ *
+ * When the running lcore has no ring, e.g. it is not an lcore of DPDK,
+ * @local is returned, and must be written with write_record().
+ */
+static struct log_record *
+reserve_record(enum log_msg_id msg_id, struct log_record *local)
+{
+	unsigned int lcore_id = rte_lcore_id();
+	struct log_ring *ring;
+	struct log_limit *limit;
+	struct log_record *rec;
+	uint64_t now;
+
+	RTE_VERIFY(msg_id < LOG_MSG_MAX);
+
+	if (unlikely(lcore_id >= RTE_MAX_LCORE ||
+			log_rings[lcore_id] == NULL)) {
+		memset(local, 0, sizeof(*local));
+		local->msg_id = msg_id;
+		return local;
+	}
+
+	ring = log_rings[lcore_id];
+	limit = &ring->limits[msg_id];
+	now = rte_rdtsc();
+	if (now - limit->window_start >= cycles_per_sec) {
+		limit->window_start = now;
+		limit->num_logged = 0;
+	}
+
+	if (limit->num_logged >= log_msgs[msg_id].max_per_sec ||
+			ring->head - ring->tail >= LOG_RING_SIZE) {
+		limit->num_suppressed++;
+		return NULL;
+	}
+
+	rec = &ring->records[ring->head & LOG_RING_MASK];
+	rec->msg_id = msg_id;
+	rec->num_suppressed = limit->num_suppressed;
+	limit->num_suppressed = 0;
+	limit->num_logged++;
+	return rec;
+}
+
+static void
+commit_record(struct log_record *rec, struct log_record *local)
+{
+	struct log_ring *ring;
+
+	if (unlikely(rec == local)) {
+		write_record(rec, rte_lcore_id());
+		return;
+	}
+
+	ring = log_rings[rte_lcore_id()];
+	/* The writer must see the record before the new head. */
+	rte_smp_wmb();
+	ring->head++;
+}
+
+void
+fast_log(enum log_msg_id msg_id, uint64_t arg0, uint64_t arg1,
+	uint64_t arg2, uint64_t arg3)
+{
+	struct log_record local;
+	struct log_record *rec = reserve_record(msg_id, &local);
+
+	if (rec == NULL)
+		return;
+
+	rec->args[0] = arg0;
+	rec->args[1] = arg1;
+	rec->args[2] = arg2;
+	rec->args[3] = arg3;
+	commit_record(rec, &local);
+}
+
+void
+fast_log_ips(enum log_msg_id msg_id, uint16_t proto,
+	const void *src, const void *dst)
+{
+	struct log_record local;
+	struct log_record *rec = reserve_record(msg_id, &local);
+	size_t len = proto == ETHER_TYPE_IPv4
+		? sizeof(struct in_addr) : sizeof(struct in6_addr);
+
+	if (rec == NULL)
+		return;
+
+	memcpy(&rec->args[0], src, len);
+	memcpy(&rec->args[2], dst, len);
+	rec->args[4] = proto;
+	commit_record(rec, &local);
+}
+
+static void
+drain_log_rings(void)
+{
+	unsigned int lcore_id;
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		struct log_ring *ring = log_rings[lcore_id];
+		uint32_t tail, head;
+
+		if (ring == NULL)
+			continue;
+
+		tail = ring->tail;
+		head = ring->head;
+		/* Pairs with the barrier in commit_record(). */
+		rte_smp_rmb();
+		for (; tail != head; tail++)
+			write_record(&ring->records[tail & LOG_RING_MASK],
+				lcore_id);
+
+		/* Do not let the lcore reuse the records before now. */
+		rte_smp_mb();
+		ring->tail = tail;
+	}
+}
+
+/*
+ * Write the records of all lcores, and the captured packets,
+ * until Gatekeeper exits. This function runs on the master lcore
+ * while the functional blocks run, so the functional blocks should
+ * not run on the master lcore.
+ */
+void
+run_log_writer(void)
+{
+	while (likely(!exiting)) {
+		drain_log_rings();
+		capture_write();
+		usleep(LOG_WRITER_PERIOD_US);
+	}
+
+	drain_log_rings();
+}
@@ -16,6 +16,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
 #include <rte_log.h>
 #include <rte_lcore.h>
 #include <rte_debug.h>
@@ -24,12 +29,9 @@
 #include "gatekeeper_main.h"
 #include "gatekeeper_mailbox.h"
 
-/* XXX Sample parameters, need to be tested for better performance. */
-#define GK_MEM_CACHE_SIZE (64)
-
 int
-init_mailbox(const char *tag,
-	int ele_count, int ele_size, unsigned int lcore_id, struct mailbox *mb)
+init_mailbox(const char *tag, const struct mailbox_params *params,
+	int ele_size, unsigned int lcore_id, struct mailbox *mb)
 {
 	int ret;
 	char ring_name[128];
@@ -41,33 +43,64 @@ init_mailbox(const char *tag,
 	RTE_VERIFY(ret > 0 && ret < (int)sizeof(ring_name));
 
 	mb->ring = (struct rte_ring *)rte_ring_create(
-		ring_name, ele_count, socket_id, RING_F_SC_DEQ);
+		ring_name, params->max_entries, socket_id, RING_F_SC_DEQ);
     	if (mb->ring == NULL) {
 		RTE_LOG(ERR, RING,
-			"mailbox: can't create ring %s (len = %d) at lcore %u!\n",
-			ring_name, ret, lcore_id);
+			"mailbox: can't create ring %s (len = %u) at lcore %u!\n",
+			ring_name, params->max_entries, lcore_id);
 		ret = -1;
 		goto out;
 	}
 
+	if (params->watermark > 0) {
+		ret = rte_ring_set_water_mark(mb->ring, params->watermark);
+		if (ret < 0) {
+			RTE_LOG(ERR, RING,
+				"mailbox: invalid watermark %u for ring %s (len = %u) at lcore %u!\n",
+				params->watermark, ring_name,
+				params->max_entries, lcore_id);
+			ret = -1;
+			goto free_ring;
+		}
+		mb->watermark = params->watermark;
+	} else
+		mb->watermark = params->max_entries;
+
 	ret = snprintf(pool_name,
 		sizeof(pool_name), "%s_mailbox_pool_%d", tag, lcore_id);
 	RTE_VERIFY(ret > 0 && ret < (int)sizeof(pool_name));
 
     	mb->pool = (struct rte_mempool *)rte_mempool_create(
-		pool_name, ele_count, ele_size, GK_MEM_CACHE_SIZE,
-		0, NULL, NULL, NULL, NULL, socket_id, 0);
+		pool_name, params->max_entries, ele_size,
+		params->mem_cache_size, 0, NULL, NULL, NULL, NULL,
+		socket_id, 0);
     	if (mb->pool == NULL) {
 		RTE_LOG(ERR, MEMPOOL,
-			"mailbox: can't create mempool %s (len = %d) at lcore %u!\n",
-			pool_name, ret, lcore_id);
+			"mailbox: can't create mempool %s (len = %u, cache = %u) at lcore %u!\n",
+			pool_name, params->max_entries,
+			params->mem_cache_size, lcore_id);
 		ret = -1;
         	goto free_ring;
     	}
 
+	mb->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mb->efd < 0) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"mailbox: can't create the eventfd of mailbox %s at lcore %u (errno=%d): %s\n",
+			tag, lcore_id, errno, strerror(errno));
+		ret = -1;
+		goto free_pool;
+	}
+
+	rte_atomic64_init(&mb->alloc_failures);
+	rte_atomic64_init(&mb->send_drops);
+	rte_atomic32_init(&mb->sleeping);
+
 	ret  = 0;
 	goto out;
 
+free_pool:
+	rte_mempool_free(mb->pool);
 free_ring:
 	rte_ring_free(mb->ring);
 out:
@@ -82,6 +115,7 @@ mb_alloc_entry(struct mailbox *mb)
 	if (ret == -ENOENT) {
 		RTE_LOG(ERR, MEMPOOL,
 			"mailbox: not enough entries in the mempool.\n");
+		rte_atomic64_inc(&mb->alloc_failures);
 		return NULL;
 	}
 
@@ -95,26 +129,156 @@ mb_send_entry(struct mailbox *mb, void *obj)
 {
 	int ret = rte_ring_mp_enqueue(mb->ring, obj);
 	if (ret == -EDQUOT) {
-		RTE_LOG(WARNING, RING,
+		/* Producers learn about it through mb_congested(). */
+		RTE_LOG(DEBUG, RING,
 			"mailbox: high water mark exceeded. The object has been enqueued.\n");
 		ret = 0;
 	} else if (ret == -ENOBUFS) {
 		RTE_LOG(ERR, RING,
 			"mailbox: quota exceeded. Not enough room in the ring to enqueue.\n");
 		mb_free_entry(mb, obj);
+		rte_atomic64_inc(&mb->send_drops);
+		return ret;
 	} else
 		RTE_VERIFY(ret == 0);
 
+	mb_wake(mb);
 	return ret;
 }
 
+/*
+ * Allocate @n entries at once; either all entries are allocated,
+ * or none is.
+ */
+int
+mb_alloc_entries(struct mailbox *mb, void **obj_table, unsigned int n)
+{
+	int ret = rte_mempool_get_bulk(mb->pool, obj_table, n);
+	if (ret == -ENOENT) {
+		RTE_LOG(ERR, MEMPOOL,
+			"mailbox: not enough entries in the mempool for %u entries.\n",
+			n);
+		rte_atomic64_add(&mb->alloc_failures, n);
+		return -1;
+	}
+
+	RTE_VERIFY(ret == 0);
+
+	return 0;
+}
+
+/*
+ * Send @n entries at once; the entries that don't fit
+ * in the ring are freed.
+ *
+ * Returns the number of entries sent.
+ */
+unsigned int
+mb_send_entries(struct mailbox *mb, void **obj_table, unsigned int n)
+{
+	unsigned int ret = rte_ring_mp_enqueue_burst(mb->ring, obj_table, n);
+	unsigned int num_sent = ret & RTE_RING_SZ_MASK;
+
+	if (ret & RTE_RING_QUOT_EXCEED)
+		RTE_LOG(DEBUG, RING,
+			"mailbox: high water mark exceeded. The objects have been enqueued.\n");
+
+	if (unlikely(num_sent < n)) {
+		RTE_LOG(ERR, RING,
+			"mailbox: quota exceeded. Not enough room in the ring to enqueue %u objects.\n",
+			n - num_sent);
+		rte_mempool_put_bulk(mb->pool, &obj_table[num_sent],
+			n - num_sent);
+		rte_atomic64_add(&mb->send_drops, n - num_sent);
+	}
+
+	if (num_sent > 0)
+		mb_wake(mb);
+	return num_sent;
+}
+
+void
+mb_stage_init(struct mb_stage *st, struct mailbox *mb)
+{
+	st->mb = mb;
+	st->num_free = 0;
+	st->num_staged = 0;
+}
+
+/* Called when @st has no free entries left. */
+int
+mb_stage_refill(struct mb_stage *st)
+{
+	RTE_VERIFY(st->num_free == 0);
+
+	if (rte_mempool_get_bulk(st->mb->pool, st->free_entries,
+			MAILBOX_STAGE_SIZE) == 0) {
+		st->num_free = MAILBOX_STAGE_SIZE;
+		return 0;
+	}
+
+	/* The mempool is running out of entries; try a single one. */
+	st->free_entries[0] = mb_alloc_entry(st->mb);
+	if (st->free_entries[0] == NULL)
+		return -1;
+	st->num_free = 1;
+	return 0;
+}
+
+void
+mb_stage_flush(struct mb_stage *st)
+{
+	if (st->num_staged == 0)
+		return;
+
+	mb_send_entries(st->mb, st->staged_entries, st->num_staged);
+	st->num_staged = 0;
+}
+
+/* Send the staged entries, and give the free entries back to the mailbox. */
+void
+mb_stage_release(struct mb_stage *st)
+{
+	mb_stage_flush(st);
+
+	if (st->num_free > 0) {
+		rte_mempool_put_bulk(st->mb->pool, st->free_entries,
+			st->num_free);
+		st->num_free = 0;
+	}
+}
+
+/*
+ * Wake up the consumer of @mb if it is sleeping; producers call it
+ * after they have enqueued entries. The full barrier pairs with
+ * the one of poll_sleep() so that either the producer sees that
+ * the consumer is sleeping, or the consumer sees the new entries.
+ */
+void
+mb_wake(struct mailbox *mb)
+{
+	uint64_t one = 1;
+
+	rte_mb();
+	if (likely(rte_atomic32_read(&mb->sleeping) == 0))
+		return;
+
+	/* Failing with EAGAIN means that a wakeup is already pending. */
+	if (write(mb->efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		RTE_LOG(ERR, GATEKEEPER,
+			"mailbox: can't wake up the consumer (errno=%d): %s\n",
+			errno, strerror(errno));
+}
+
 void
 destroy_mailbox(struct mailbox *mb)
 {
 	if (mb) {
 		if (mb->ring)
     			rte_ring_free(mb->ring);
-		if (mb->pool)
+		if (mb->pool) {
 			rte_mempool_free(mb->pool);
+			close(mb->efd);
+		}
 	}
 }
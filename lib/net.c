@@ -22,6 +22,7 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 
+#include <rte_ip.h>
 #include <rte_mbuf.h>
 #include <rte_thash.h>
 #include <rte_errno.h>
@@ -33,14 +34,25 @@
 #include "gatekeeper_net.h"
 #include "gatekeeper_config.h"
 #include "gatekeeper_launch.h"
+#include "gatekeeper_log.h"
+#include "gatekeeper_poll.h"
 
 /* Number of attempts to wait for a link to come up. */
 #define NUM_ATTEMPTS_LINK_GET	(5)
 
 #define GATEKEEPER_PKT_DROP_QUEUE (127)
 
+/* The minimum MTU of IPv4 hosts, from RFC 791. */
+#define GATEKEEPER_MIN_MTU (68)
+
 static struct net_config config;
 
+/*
+ * The number of mbufs that the rings of the queues on each NUMA node
+ * can hold; they must fit in the mbuf pool of the node.
+ */
+static rte_atomic32_t mbufs_in_rings[RTE_MAX_NUMA_NODES];
+
 /*
  * XXX The secret key of the RSS hash must be random
  * in order to avoid hackers to know it.
@@ -100,9 +112,7 @@ extract_packet_info(struct rte_mbuf *pkt, struct ipacket *packet)
 	case ETHER_TYPE_IPv4:
 		if (packet->len < sizeof(*eth_hdr) + sizeof(*ip4_hdr)) {
 			packet->flow.proto = 0;
-			RTE_LOG(NOTICE, GATEKEEPER,
-				"net: packet is too short to be IPv4 (%" PRIu16 ")!\n",
-				packet->len);
+			fast_log(LOG_NET_IP4_TOO_SHORT, packet->len, 0, 0, 0);
 			ret = -1;
 			goto out;
 		}
@@ -119,9 +129,7 @@ extract_packet_info(struct rte_mbuf *pkt, struct ipacket *packet)
 	case ETHER_TYPE_IPv6:
 		if (packet->len < sizeof(*eth_hdr) + sizeof(*ip6_hdr)) {
 			packet->flow.proto = 0;
-			RTE_LOG(NOTICE, GATEKEEPER,
-				"net: packet is too short to be IPv6 (%" PRIu16 ")!\n",
-				packet->len);
+			fast_log(LOG_NET_IP6_TOO_SHORT, packet->len, 0, 0, 0);
 			ret = -1;
 			goto out;
 		}
@@ -139,9 +147,7 @@ extract_packet_info(struct rte_mbuf *pkt, struct ipacket *packet)
 
 	default:
 		packet->flow.proto = 0;
-		RTE_LOG(NOTICE, GATEKEEPER,
-			"net: unknown network layer protocol %" PRIu16 "!\n",
-			ether_type);
+		fast_log(LOG_NET_UNKNOWN_PROTO, ether_type, 0, 0, 0);
 		ret = -1;
 		break;
 	}
@@ -207,6 +213,47 @@ out:
 	return ret;
 }
 
+/*
+ * Add, or delete according to @filter_op, the ntuple filter @filter,
+ * described by @desc, at @port_id.
+ */
+static int
+ntuple_filter_ctrl(uint8_t port_id, enum rte_filter_op filter_op,
+	struct rte_eth_ntuple_filter *filter, const char *desc)
+{
+	const char *op = filter_op == RTE_ETH_FILTER_ADD
+		? "adding" : "deleting";
+	int ret = rte_eth_dev_filter_ctrl(port_id,
+		RTE_ETH_FILTER_NTUPLE,
+		filter_op,
+		filter);
+	if (ret == -ENOTSUP) {
+		RTE_LOG(ERR, PORT,
+			"Hardware doesn't support %s an %s ntuple filter on port %hhu!\n",
+			op, desc, port_id);
+		return -1;
+	} else if (ret == -ENODEV) {
+		RTE_LOG(ERR, PORT,
+			"Port %hhu is invalid for %s an %s ntuple filter!\n",
+			port_id, op, desc);
+		return -1;
+	} else if (ret != 0) {
+		RTE_LOG(ERR, PORT,
+			"Other errors that depend on the specific operations implementation on port %hhu for %s an %s ntuple filter!\n",
+			port_id, op, desc);
+		return -1;
+	}
+
+	return 0;
+}
+
+static inline int
+add_ntuple_filter(uint8_t port_id, struct rte_eth_ntuple_filter *filter,
+	const char *desc)
+{
+	return ntuple_filter_ctrl(port_id, RTE_ETH_FILTER_ADD, filter, desc);
+}
+
 /*
  * @dst_ip, @src_port and @dst_port must be in big endian.
  * By specifying the tuple (proto, src_port, dst_port),
@@ -234,6 +281,10 @@ ntuple_filter_add(uint8_t portid, uint32_t dst_ip,
 		.queue = queue_id,
 	};
 
+	/*
+	 * Ntuple filters only match IPv4 addresses, so the block
+	 * that receives these packets must check IPv6 destinations.
+	 */
 	struct rte_eth_ntuple_filter filter_v6 = {
 		.flags = RTE_5TUPLE_FLAGS,
 		.dst_ip = 0,
@@ -256,64 +307,122 @@ ntuple_filter_add(uint8_t portid, uint32_t dst_ip,
 		RTE_LOG(ERR, PORT,
 			"Ntuple filter is not supported on port %hhu.\n",
 			portid);
-		ret = -1;
-		goto out;
+		return -1;
 	}
 
-	if (dst_ip != 0) {
-		ret = rte_eth_dev_filter_ctrl(portid,
-			RTE_ETH_FILTER_NTUPLE,
-			RTE_ETH_FILTER_ADD,
-			&filter_v4);
-		if (ret == -ENOTSUP) {
-			RTE_LOG(ERR, PORT,
-				"Hardware doesn't support adding an IPv4 ntuple filter on port %hhu!\n",
-				portid);
-			ret = -1;
-			goto out;
-		} else if (ret == -ENODEV) {
-			RTE_LOG(ERR, PORT,
-				"Port %hhu is invalid for adding an IPv4 ntuple filter!\n",
-				portid);
-			ret = -1;
-			goto out;
-		} else if (ret != 0) {
-			RTE_LOG(ERR, PORT,
-				"Other errors that depend on the specific operations implementation on port %hhu for adding an IPv4 ntuple filter!\n",
-				portid);
-			ret = -1;
-			goto out;
-		}
-	}
+	if (dst_ip != 0 && add_ntuple_filter(portid, &filter_v4, "IPv4") < 0)
+		return -1;
 
-	ret = rte_eth_dev_filter_ctrl(portid,
-		RTE_ETH_FILTER_NTUPLE,
-		RTE_ETH_FILTER_ADD,
-		&filter_v6);
-	if (ret == -ENOTSUP) {
-		RTE_LOG(ERR, PORT,
-			"Hardware doesn't support adding an IPv6 ntuple filter on port %hhu!\n",
-			portid);
-		ret = -1;
-		goto out;
-	} else if (ret == -ENODEV) {
-		RTE_LOG(ERR, PORT,
-			"Port %hhu is invalid for adding an IPv6 ntuple filter!\n",
-			portid);
-		ret = -1;
-		goto out;
-	} else if (ret != 0) {
+	return add_ntuple_filter(portid, &filter_v6, "IPv6");
+}
+
+/* Steer all ICMPv6 packets that arrive at @port_id to @queue_id. */
+int
+icmpv6_filter_add(uint8_t port_id, uint16_t queue_id)
+{
+	struct rte_eth_ntuple_filter filter = {
+		.flags = RTE_5TUPLE_FLAGS,
+		.dst_ip = 0,
+		.dst_ip_mask = 0,
+		.src_ip = 0,
+		.src_ip_mask = 0,
+		.dst_port = 0,
+		.dst_port_mask = 0,
+		.src_port = 0,
+		.src_port_mask = 0,
+		.proto = IPPROTO_ICMPV6,
+		.proto_mask = UINT8_MAX,
+		.tcp_flags = 0,
+		.priority = 1,
+		.queue = queue_id,
+	};
+
+	if (rte_eth_dev_filter_supported(port_id, RTE_ETH_FILTER_NTUPLE) < 0) {
 		RTE_LOG(ERR, PORT,
-			"Other errors that depend on the specific operations implementation on port %hhu for adding an IPv6 ntuple filter!\n",
-			portid);
-		ret = -1;
-		goto out;
+			"Ntuple filter is not supported on port %hhu.\n",
+			port_id);
+		return -1;
 	}
 
-	ret = 0;
+	return add_ntuple_filter(port_id, &filter, "ICMPv6");
+}
 
-out:
-	return ret;
+static inline void
+fill_ip4_flow_filter(struct rte_eth_ntuple_filter *filter,
+	uint32_t src_ip, uint32_t dst_ip, uint16_t queue_id)
+{
+	memset(filter, 0, sizeof(*filter));
+	filter->flags = RTE_5TUPLE_FLAGS;
+	filter->src_ip = src_ip;
+	filter->src_ip_mask = UINT32_MAX;
+	filter->dst_ip = dst_ip;
+	filter->dst_ip_mask = UINT32_MAX;
+	filter->priority = 1;
+	filter->queue = queue_id;
+}
+
+/*
+ * Steer the IPv4 packets from @src_ip to @dst_ip, both in big endian,
+ * that arrive at @port_id to @queue_id, whatever their protocols.
+ */
+int
+ip4_flow_filter_add(uint8_t port_id, uint32_t src_ip, uint32_t dst_ip,
+	uint16_t queue_id)
+{
+	struct rte_eth_ntuple_filter filter;
+
+	fill_ip4_flow_filter(&filter, src_ip, dst_ip, queue_id);
+	return add_ntuple_filter(port_id, &filter, "IPv4 flow");
+}
+
+/* Delete a filter added with ip4_flow_filter_add(). */
+int
+ip4_flow_filter_del(uint8_t port_id, uint32_t src_ip, uint32_t dst_ip,
+	uint16_t queue_id)
+{
+	struct rte_eth_ntuple_filter filter;
+
+	fill_ip4_flow_filter(&filter, src_ip, dst_ip, queue_id);
+	return ntuple_filter_ctrl(port_id, RTE_ETH_FILTER_DELETE, &filter,
+		"IPv4 flow");
+}
+
+/*
+ * Classification of the control-plane traffic.
+ *
+ * The NIC steers ARP, ND, and GK-GT Unit packets to the queues of
+ * the blocks that process them, so the blocks of the fast path do not
+ * inspect them. When ND packets are not steered by the NIC, the blocks
+ * that receive packets on @iface look for them in software
+ * (see struct gatekeeper_if), and pass them to the LLS block.
+ */
+
+int
+steer_arp(struct gatekeeper_if *iface, uint16_t queue_id)
+{
+	return ethertype_filter_add(iface->id, ETHER_TYPE_ARP, queue_id);
+}
+
+int
+steer_nd(struct gatekeeper_if *iface, uint16_t queue_id)
+{
+	if (!iface->hw_nd_filter)
+		return 0;
+
+	iface->hw_nd_filter = icmpv6_filter_add(iface->id, queue_id) == 0;
+	if (!iface->hw_nd_filter)
+		RTE_LOG(NOTICE, PORT,
+			"The ND packets of the %s interface are classified in software\n",
+			iface->name);
+	return 0;
+}
+
+int
+steer_ggu(struct gatekeeper_if *iface, uint16_t src_port_be,
+	uint16_t dst_port_be, uint16_t queue_id)
+{
+	return ntuple_filter_add(iface->id, iface->ip4_addr.s_addr,
+		src_port_be, dst_port_be, queue_id);
 }
 
 static uint32_t
@@ -333,29 +442,45 @@ find_num_numa_nodes(void)
 
 static int
 configure_queue(uint8_t port_id, uint16_t queue_id, enum queue_type ty,
-	unsigned int numa_node, struct rte_mempool *mp)
+	uint16_t num_desc, unsigned int numa_node, struct rte_mempool *mp)
 {
 	int ret;
 
 	switch (ty) {
 	case QUEUE_TYPE_RX:
 		ret = rte_eth_rx_queue_setup(port_id, queue_id,
-			GATEKEEPER_NUM_RX_DESC, numa_node, NULL, mp);
+			num_desc, numa_node, NULL, mp);
 		if (ret < 0) {
 			RTE_LOG(ERR, PORT, "Failed to configure port %hhu rx_queue %hu (err=%d)!\n",
 				port_id, queue_id, ret);
 			return ret;
 		}
 		break;
-	case QUEUE_TYPE_TX:
+	case QUEUE_TYPE_TX: {
+		struct rte_eth_dev_info dev_info;
+		struct rte_eth_txconf tx_conf;
+
+		/*
+		 * The default TX path of some NICs only sends single-segment
+		 * packets without offloads, but jumbo frames and packets
+		 * whose outer headers did not fit in their headroom have
+		 * several segments, and the encapsulated packets and
+		 * the notifications of the GT blocks offload their checksums.
+		 */
+		rte_eth_dev_info_get(port_id, &dev_info);
+		tx_conf = dev_info.default_txconf;
+		tx_conf.txq_flags &= ~(ETH_TXQ_FLAGS_NOMULTSEGS |
+			ETH_TXQ_FLAGS_NOOFFLOADS | ETH_TXQ_FLAGS_NOXSUMS);
+
 		ret = rte_eth_tx_queue_setup(port_id, queue_id,
-			GATEKEEPER_NUM_TX_DESC, numa_node, NULL);
+			num_desc, numa_node, &tx_conf);
 		if (ret < 0) {
 			RTE_LOG(ERR, PORT, "Failed to configure port %hhu tx_queue %hu (err=%d)!\n",
 				port_id, queue_id, ret);
 			return ret;
 		}
 		break;
+	}
 	default:
 		RTE_LOG(ERR, GATEKEEPER,
 			"Unsupported queue type (%d) passed to %s!\n",
@@ -369,10 +494,13 @@ configure_queue(uint8_t port_id, uint16_t queue_id, enum queue_type ty,
 /*
  * Get a queue identifier for a given functional block instance (lcore),
  * using a certain interface for either RX or TX.
+ *
+ * The queue is set up with @num_desc descriptors when it is allocated,
+ * or with the default of its type if @num_desc is zero.
  */
 int
 get_queue_id(struct gatekeeper_if *iface, enum queue_type ty,
-	unsigned int lcore)
+	unsigned int lcore, uint16_t num_desc)
 {
 	int16_t *queues;
 	int ret;
@@ -389,6 +517,30 @@ get_queue_id(struct gatekeeper_if *iface, enum queue_type ty,
 	if (queues[lcore] != GATEKEEPER_QUEUE_UNALLOCATED)
 		goto queue;
 
+	/*
+	 * The descriptors of the queue and the packets that it
+	 * receives are on the NUMA node of @lcore, and so must be
+	 * the mbuf pool. The NIC should be on the same node too,
+	 * otherwise packets cross the interconnect between nodes.
+	 */
+	numa_node = rte_lcore_to_socket_id(lcore);
+	mp = config.gatekeeper_pktmbuf_pool[numa_node];
+	if (mp == NULL || mp->socket_id != (int)numa_node) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"net: there is no mbuf pool on NUMA node %u for the queues of lcore %u\n",
+			numa_node, lcore);
+		return -1;
+	}
+	for (port = 0; port < iface->num_ports; port++) {
+		int port_node = rte_eth_dev_socket_id(iface->ports[port]);
+		if (port_node >= 0 && port_node != (int)numa_node)
+			RTE_LOG(WARNING, GATEKEEPER,
+				"net: lcore %u on NUMA node %u uses an %s queue of port %hhu of the %s interface, which is on NUMA node %d\n",
+				lcore, numa_node,
+				(ty == QUEUE_TYPE_RX) ? "RX" : "TX",
+				iface->ports[port], iface->name, port_node);
+	}
+
 	/* Get next queue identifier. */
 	new_queue_id = rte_atomic16_add_return(ty == QUEUE_TYPE_RX ?
 		&iface->rx_queue_id : &iface->tx_queue_id, 1);
@@ -399,6 +551,23 @@ get_queue_id(struct gatekeeper_if *iface, enum queue_type ty,
 	}
 	queues[lcore] = new_queue_id;
 
+	if (num_desc == 0)
+		num_desc = ty == QUEUE_TYPE_RX
+			? GATEKEEPER_NUM_RX_DESC : GATEKEEPER_NUM_TX_DESC;
+
+	/*
+	 * The rings of the queue on every port may be full of mbufs,
+	 * which would starve the other queues of the pool.
+	 */
+	ret = rte_atomic32_add_return(&mbufs_in_rings[numa_node],
+		num_desc * iface->num_ports);
+	if ((unsigned int)ret > mp->size) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"net: the rings of the queues on NUMA node %u can hold %d mbufs, but its mbuf pool only has %u mbufs; reduce the number of descriptors of the queues\n",
+			numa_node, ret, mp->size);
+		return -1;
+	}
+
 	/*
 	 * Configure this queue on all ports of this interface.
 	 *
@@ -407,11 +576,9 @@ get_queue_id(struct gatekeeper_if *iface, enum queue_type ty,
 	 * port. All slave ports must be configured and started
 	 * before the bonded port can be started.
 	 */
-	numa_node = rte_lcore_to_socket_id(lcore);
-	mp = config.gatekeeper_pktmbuf_pool[numa_node];
 	for (port = 0; port < iface->num_ports; port++) {
 		ret = configure_queue(iface->ports[port],
-			(uint16_t)new_queue_id, ty, numa_node, mp);
+			(uint16_t)new_queue_id, ty, num_desc, numa_node, mp);
 		if (ret < 0)
 			return ret;
 	}
@@ -419,7 +586,7 @@ get_queue_id(struct gatekeeper_if *iface, enum queue_type ty,
 	/* If there's a bonded port, configure it too. */
 	if (iface->num_ports > 1) {
 		ret = configure_queue(iface->id, (uint16_t)new_queue_id,
-			ty, numa_node, mp);
+			ty, num_desc, numa_node, mp);
 		if (ret < 0)
 			return ret;
 	}
@@ -428,6 +595,87 @@ queue:
 	return queues[lcore];
 }
 
+/* Set up the drop queue @queue_id at @port_id; see get_drop_queue_id(). */
+static int
+configure_drop_queue(uint8_t port_id, uint16_t queue_id,
+	unsigned int numa_node, struct rte_mempool *mp)
+{
+	int ret;
+	struct rte_eth_dev_info dev_info;
+	struct rte_eth_rxconf rx_conf;
+
+	rte_eth_dev_info_get(port_id, &dev_info);
+	rx_conf = dev_info.default_rxconf;
+	/* A full queue must not hold back the other queues of the port. */
+	rx_conf.rx_drop_en = 1;
+
+	ret = rte_eth_rx_queue_setup(port_id, queue_id,
+		GATEKEEPER_NUM_DROP_DESC, numa_node, &rx_conf, mp);
+	if (ret < 0) {
+		RTE_LOG(ERR, PORT,
+			"Failed to configure port %hhu drop queue %hu (err=%d)!\n",
+			port_id, queue_id, ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Get the RX queue of @iface that no block polls, allocating it
+ * on the NUMA node of @lcore the first time. Once its few descriptors
+ * are full, the NIC drops the packets that filters steer to it,
+ * so they cost no CPU. The queue must be counted in the RX queues of
+ * the interface at stage 1 (see net_launch_at_stage1()).
+ */
+int
+get_drop_queue_id(struct gatekeeper_if *iface, unsigned int lcore)
+{
+	int ret;
+	uint8_t port;
+	unsigned int numa_node;
+	struct rte_mempool *mp;
+	int16_t new_queue_id;
+
+	RTE_VERIFY(lcore < RTE_MAX_LCORE);
+
+	if (iface->drop_queue != GATEKEEPER_QUEUE_UNALLOCATED)
+		return iface->drop_queue;
+
+	numa_node = rte_lcore_to_socket_id(lcore);
+	mp = config.gatekeeper_pktmbuf_pool[numa_node];
+	if (mp == NULL || mp->socket_id != (int)numa_node) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"net: there is no mbuf pool on NUMA node %u for the drop queue of lcore %u\n",
+			numa_node, lcore);
+		return -1;
+	}
+
+	new_queue_id = rte_atomic16_add_return(&iface->rx_queue_id, 1);
+	if (new_queue_id == GATEKEEPER_QUEUE_UNALLOCATED) {
+		RTE_LOG(ERR, GATEKEEPER, "net: exhausted all RX queues for the %s interface; this is likely a bug\n",
+			iface->name);
+		return -1;
+	}
+
+	for (port = 0; port < iface->num_ports; port++) {
+		ret = configure_drop_queue(iface->ports[port],
+			(uint16_t)new_queue_id, numa_node, mp);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (iface->num_ports > 1) {
+		ret = configure_drop_queue(iface->id, (uint16_t)new_queue_id,
+			numa_node, mp);
+		if (ret < 0)
+			return ret;
+	}
+
+	iface->drop_queue = new_queue_id;
+	return iface->drop_queue;
+}
+
 static void
 stop_iface_ports(struct gatekeeper_if *iface, uint8_t nb_ports)
 {
@@ -564,6 +812,23 @@ lua_init_iface(struct gatekeeper_if *iface, const char *iface_name,
 		return -1;
 	}
 
+	switch (iface->bonding_mode) {
+	case BONDING_MODE_ROUND_ROBIN:
+		if (num_pci_addrs > 1)
+			RTE_LOG(WARNING, GATEKEEPER,
+				"net: the round-robin bonding mode of the %s interface reorders the packets of flows\n",
+				iface_name);
+		break;
+	case BONDING_MODE_BALANCE:
+	case BONDING_MODE_8023AD:
+		break;
+	default:
+		RTE_LOG(ERR, GATEKEEPER,
+			"net: the %s interface has an unsupported bonding mode %hhu\n",
+			iface_name, iface->bonding_mode);
+		return -1;
+	}
+
 	iface->num_ports = num_pci_addrs;
 
 	iface->name = rte_malloc("iface_name", strlen(iface_name) + 1, 0);
@@ -714,8 +979,49 @@ get_if_back(struct net_config *net_conf)
 	return net_conf->back_iface_enabled ? &net_conf->back : NULL;
 }
 
-int
-gatekeeper_setup_rss(uint8_t portid, uint16_t *queues, uint16_t num_queues)
+/*
+ * Find the port of @iface with the smallest RETA, and its RETA size.
+ *
+ * The RETA sizes are powers of 2, so the entry of a hash in a RETA
+ * modulo the smallest size is the entry of the hash in the smallest
+ * RETA. Filling entry i of every RETA as entry (i % @pbase_size) of
+ * the smallest one sends each flow to the same queue whatever
+ * the port of the interface where its packets arrive.
+ */
+static int
+get_iface_base_reta(struct gatekeeper_if *iface, uint8_t *pbase_port,
+	uint16_t *pbase_size)
+{
+	uint8_t i;
+
+	*pbase_size = 0;
+	for (i = 0; i < iface->num_ports; i++) {
+		struct rte_eth_dev_info dev_info;
+
+		memset(&dev_info, 0, sizeof(dev_info));
+		rte_eth_dev_info_get(iface->ports[i], &dev_info);
+		if (dev_info.reta_size == 0 ||
+				dev_info.reta_size > ETH_RSS_RETA_SIZE_512 ||
+				!rte_is_power_of_2(dev_info.reta_size)) {
+			RTE_LOG(ERR, PORT,
+				"Failed to setup RSS at port %hhu (invalid RETA size = %u)!\n",
+				iface->ports[i], dev_info.reta_size);
+			return -1;
+		}
+
+		if (*pbase_size == 0 || dev_info.reta_size < *pbase_size) {
+			*pbase_port = iface->ports[i];
+			*pbase_size = dev_info.reta_size;
+		}
+	}
+
+	return 0;
+}
+
+/* Fill the RETA of @portid; see get_iface_base_reta(). */
+static int
+setup_port_rss(uint8_t portid, uint16_t base_size, uint16_t *queues,
+	uint16_t num_queues)
 {
 	int ret = 0;
 	uint32_t i;
@@ -747,7 +1053,7 @@ gatekeeper_setup_rss(uint8_t portid, uint16_t *queues, uint16_t num_queues)
 	for (i = 0; i < dev_info.reta_size; i++) {
 		uint32_t idx = i / RTE_RETA_GROUP_SIZE;
 		uint32_t shift = i % RTE_RETA_GROUP_SIZE;
-		uint32_t queue_idx = i % num_queues; 
+		uint32_t queue_idx = (i % base_size) % num_queues;
 
 		/* Select all fields to set. */
 		reta_conf[idx].mask = ~0LL;
@@ -789,28 +1095,61 @@ out:
 	return ret;
 }
 
+/*
+ * Spread the flows that arrive at @iface over @queues.
+ *
+ * The RETAs of all ports of @iface, i.e. of the bonded port and of
+ * each of its slaves, map the RSS hashes the same way, so a flow goes
+ * to the same queue whatever the port where it arrives. The bonded port
+ * is set first, since it may copy its RETA to the slaves.
+ */
+int
+gatekeeper_setup_rss(struct gatekeeper_if *iface, uint16_t *queues,
+	uint16_t num_queues)
+{
+	int ret;
+	uint8_t i;
+	uint8_t base_port;
+	uint16_t base_size;
+
+	ret = get_iface_base_reta(iface, &base_port, &base_size);
+	if (ret < 0)
+		return ret;
+
+	if (iface->num_ports > 1) {
+		ret = setup_port_rss(iface->id, base_size, queues,
+			num_queues);
+		if (ret < 0)
+			return ret;
+	}
+
+	for (i = 0; i < iface->num_ports; i++) {
+		ret = setup_port_rss(iface->ports[i], base_size, queues,
+			num_queues);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Get the RETA that maps the RSS hashes of the flows of @iface
+ * to their queues, i.e. the smallest RETA of its ports.
+ */
 int
-gatekeeper_get_rss_config(uint8_t portid,
+gatekeeper_get_rss_config(struct gatekeeper_if *iface,
 	struct gatekeeper_rss_config *rss_conf)
 {
 	int ret = 0;
 	uint16_t i;
-	struct rte_eth_dev_info dev_info;
+	uint8_t portid;
 
-	/* Get RSS redirection table (RETA) information. */
-	memset(&dev_info, 0, sizeof(dev_info));
-	rte_eth_dev_info_get(portid, &dev_info);
-	rss_conf->reta_size = dev_info.reta_size;
-	if (rss_conf->reta_size == 0 ||
-			rss_conf->reta_size > ETH_RSS_RETA_SIZE_512) {
-		RTE_LOG(ERR, PORT,
-			"Failed to setup RSS at port %hhu (invalid RETA size = %hu)!\n",
-			portid, rss_conf->reta_size);
-		ret = -1;
+	ret = get_iface_base_reta(iface, &portid, &rss_conf->reta_size);
+	if (ret < 0)
 		goto out;
-	}
 
-	for (i = 0; i < dev_info.reta_size; i++) {
+	for (i = 0; i < rss_conf->reta_size; i++) {
 		uint32_t idx = i / RTE_RETA_GROUP_SIZE;
 		/* Select all fields to query. */
 		rss_conf->reta_conf[idx].mask = ~0LL;
@@ -839,14 +1178,40 @@ static int
 init_port(struct gatekeeper_if *iface, uint8_t port_id,
 	uint8_t *pnum_succ_ports)
 {
-	int ret = rte_eth_dev_configure(port_id, iface->num_rx_queues,
-		iface->num_tx_queues, &gatekeeper_port_conf);
+	int ret;
+	struct rte_eth_conf port_conf = gatekeeper_port_conf;
+
+	port_conf.intr_conf.rxq = iface->rx_intr;
+
+	if (iface->mtu > ETHER_MTU) {
+		/*
+		 * Jumbo frames span several mbufs of the packet pools.
+		 * rte_eth_dev_configure() fails if the port cannot
+		 * receive frames this long.
+		 */
+		port_conf.rxmode.jumbo_frame = 1;
+		port_conf.rxmode.enable_scatter = 1;
+		port_conf.rxmode.max_rx_pkt_len =
+			iface->mtu + ETHER_HDR_LEN + ETHER_CRC_LEN;
+	}
+
+	ret = rte_eth_dev_configure(port_id, iface->num_rx_queues,
+		iface->num_tx_queues, &port_conf);
 	if (ret < 0) {
 		RTE_LOG(ERR, PORT,
 			"Failed to configure port %hhu (err=%d)!\n",
 			port_id, ret);
 		return ret;
 	}
+
+	/* Bonded ports pass their configuration on to their slaves. */
+	ret = rte_eth_dev_set_mtu(port_id, iface->mtu);
+	if (ret < 0 && ret != -ENOTSUP) {
+		RTE_LOG(ERR, PORT,
+			"Failed to set the MTU of port %hhu to %hu (err=%d)!\n",
+			port_id, iface->mtu, ret);
+		return ret;
+	}
 	if (pnum_succ_ports != NULL)
 		(*pnum_succ_ports)++;
 
@@ -866,6 +1231,7 @@ init_iface(struct gatekeeper_if *iface)
 		iface->rx_queues[i] = GATEKEEPER_QUEUE_UNALLOCATED;
 		iface->tx_queues[i] = GATEKEEPER_QUEUE_UNALLOCATED;
 	}
+	iface->drop_queue = GATEKEEPER_QUEUE_UNALLOCATED;
 	rte_atomic16_set(&iface->rx_queue_id, -1);
 	rte_atomic16_set(&iface->tx_queue_id, -1);
 
@@ -909,9 +1275,8 @@ init_iface(struct gatekeeper_if *iface)
 	if (iface->num_ports == 1)
 		iface->id = iface->ports[0];
 	else {
-		/* TODO Also allow LACP to be used. */
 		ret = rte_eth_bond_create(iface->name,
-			BONDING_MODE_ROUND_ROBIN, 0);
+			iface->bonding_mode, 0);
 		if (ret < 0) {
 			RTE_LOG(ERR, PORT,
 				"Failed to create bonded port (err=%d)!\n",
@@ -921,6 +1286,19 @@ init_iface(struct gatekeeper_if *iface)
 
 		iface->id = (uint8_t)ret;
 
+		/* Keep the packets of each flow on one slave when sending. */
+		if (iface->bonding_mode != BONDING_MODE_ROUND_ROBIN) {
+			ret = rte_eth_bond_xmit_policy_set(iface->id,
+				BALANCE_XMIT_POLICY_LAYER23);
+			if (ret < 0) {
+				RTE_LOG(ERR, PORT,
+					"Failed to set the transmit policy of bonded port %hhu (err=%d)!\n",
+					iface->id, ret);
+				rte_eth_bond_free(iface->name);
+				goto close_partial;
+			}
+		}
+
 		for (i = 0; i < iface->num_ports; i++) {
 			ret = rte_eth_bond_slave_add(iface->id,
 				iface->ports[i]);
@@ -1148,10 +1526,33 @@ gatekeeper_init_network(struct net_config *net_conf)
 {
 	int i, num_ports;
 	int ret = -1;
+	size_t before;
+
+	/*
+	 * The packets of the pools keep room for the outer IP header
+	 * of the tunnels in front of their Ethernet header, so encapsulate()
+	 * does not need to chain a segment for the outer headers.
+	 */
+	RTE_BUILD_BUG_ON(RTE_PKTMBUF_HEADROOM < sizeof(struct ipv6_hdr));
 
 	if (net_conf == NULL)
 		return -1;
 
+	if (net_conf->front.mtu < GATEKEEPER_MIN_MTU ||
+			(net_conf->back_iface_enabled &&
+			net_conf->back.mtu < GATEKEEPER_MIN_MTU)) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"net: the MTU of the interfaces must be at least %d\n",
+			GATEKEEPER_MIN_MTU);
+		return -1;
+	}
+
+	if (net_conf->back_iface_enabled && net_conf->back.mtu <
+			net_conf->front.mtu + sizeof(struct ipv6_hdr))
+		RTE_LOG(WARNING, GATEKEEPER,
+			"net: the MTU of the back interface (%hu) has no room for the outer headers of the largest packets of the front interface (%hu)\n",
+			net_conf->back.mtu, net_conf->front.mtu);
+
 	if (config.gatekeeper_pktmbuf_pool == NULL) {
 		config.numa_nodes = find_num_numa_nodes();
 		config.gatekeeper_pktmbuf_pool =
@@ -1166,8 +1567,10 @@ gatekeeper_init_network(struct net_config *net_conf)
 	/* Convert RSS key. */
 	rte_convert_rss_key((uint32_t *)&default_rss_key,
 		(uint32_t *)rss_key_be, RTE_DIM(default_rss_key));
+	init_ip_flow_hash();
 
 	/* Initialize pktmbuf pool on each numa node. */
+	before = heap_allocated();
 	for (i = 0; (uint32_t)i < net_conf->numa_nodes; i++) {
 		char pool_name[64];
 
@@ -1202,6 +1605,7 @@ gatekeeper_init_network(struct net_config *net_conf)
 			goto out;
 		}
 	}
+	log_heap_reserved("mbuf pools", "at configuration", before);
 
 	/* Check port limits. */
 	num_ports = net_conf->front.num_ports +
@@ -1221,7 +1625,8 @@ gatekeeper_init_network(struct net_config *net_conf)
 
 	/* Initialize interfaces. */
 
-	ret = launch_at_stage1(init_iface_stage1, &net_conf->front);
+	ret = launch_at_stage1("front interface", init_iface_stage1,
+		&net_conf->front);
 	if (ret < 0)
 		goto out;
 
@@ -1230,7 +1635,8 @@ gatekeeper_init_network(struct net_config *net_conf)
 		goto destroy_front;
 
 	if (net_conf->back_iface_enabled) {
-		ret = launch_at_stage1(init_iface_stage1, &net_conf->back);
+		ret = launch_at_stage1("back interface",
+			init_iface_stage1, &net_conf->back);
 		if (ret < 0)
 			goto do_not_start_net;
 	}
@@ -1257,9 +1663,9 @@ int
 net_launch_at_stage1(struct net_config *net,
 	int front_rx_queues, int front_tx_queues,
 	int back_rx_queues, int back_tx_queues,
-	lcore_function_t *f, void *arg)
+	const char *name, lcore_function_t *f, void *arg)
 {
-	int ret = launch_at_stage1(f, arg);
+	int ret = launch_at_stage1(name, f, arg);
 
 	if (ret < 0)
 		return ret;
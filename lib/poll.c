@@ -0,0 +1,209 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <rte_log.h>
+#include <rte_eth_bond.h>
+#include <rte_interrupts.h>
+
+#include "gatekeeper_config.h"
+#include "gatekeeper_poll.h"
+
+/*
+ * Check @conf, the configuration of a block that polls @iface,
+ * and fill in its defaults. @iface may be NULL if the block
+ * never sleeps.
+ */
+int
+check_poll_config(struct poll_config *conf,
+	const struct gatekeeper_if *iface, const char *block)
+{
+	if (conf->num_rx_desc == 0)
+		conf->num_rx_desc = GATEKEEPER_NUM_RX_DESC;
+	if (conf->num_tx_desc == 0)
+		conf->num_tx_desc = GATEKEEPER_NUM_TX_DESC;
+	if (conf->max_pkt_burst == 0)
+		conf->max_pkt_burst = GATEKEEPER_DEF_PKT_BURST;
+	if (conf->min_pkt_burst == 0)
+		conf->min_pkt_burst = conf->max_pkt_burst;
+
+	if (conf->max_pkt_burst > GATEKEEPER_MAX_PKT_BURST ||
+			conf->min_pkt_burst > conf->max_pkt_burst) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"%s: the bursts of %hu to %hu packets must be at most %d packets\n",
+			block, conf->min_pkt_burst, conf->max_pkt_burst,
+			GATEKEEPER_MAX_PKT_BURST);
+		return -1;
+	}
+
+	/*
+	 * An instance can pin this many mbufs in its RX and TX rings
+	 * and in its burst; the rings of all queues that share
+	 * the mbuf pool of a NUMA node are checked in get_queue_id().
+	 */
+	if ((uint32_t)conf->num_rx_desc + conf->num_tx_desc +
+			conf->max_pkt_burst > GATEKEEPER_MBUF_SIZE) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"%s: the %hu RX and %hu TX descriptors, and the bursts of %hu packets, do not fit in the mbuf pool of %d mbufs\n",
+			block, conf->num_rx_desc, conf->num_tx_desc,
+			conf->max_pkt_burst, GATEKEEPER_MBUF_SIZE);
+		return -1;
+	}
+
+	/* An LACP bond that is not polled for 100ms loses its partner. */
+	if (iface != NULL && iface->num_ports > 1 &&
+			iface->bonding_mode == BONDING_MODE_8023AD &&
+			iface->rx_intr && conf->rx_intr_timeout_ms >= 100) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"%s: the %s interface uses LACP, so rx_intr_timeout_ms must be below 100, not %u\n",
+			block, iface->name, conf->rx_intr_timeout_ms);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+poll_init(struct poll_state *st, const struct poll_config *conf,
+	uint8_t port_id, uint16_t queue_id)
+{
+	st->port_id = port_id;
+	st->queue_id = queue_id;
+	st->burst = conf->max_pkt_burst;
+	st->idle_pauses = 0;
+	st->rx_intr = false;
+	st->mb = NULL;
+	memset(&st->mb_event, 0, sizeof(st->mb_event));
+}
+
+/* Clear the eventfd of a mailbox once it has woken up the block. */
+static void
+poll_clear_mailbox(int fd, __attribute__((unused)) void *arg)
+{
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		RTE_LOG(ERR, GATEKEEPER,
+			"poll: can't clear the eventfd of a mailbox (errno=%d): %s\n",
+			errno, strerror(errno));
+}
+
+/*
+ * Register the RX interrupt of the queue of @st, and the eventfd of
+ * the mailbox @mb if it is not NULL, with the epoll instance of
+ * the calling lcore, so the block can sleep on them.
+ *
+ * A block that has a mailbox must not sleep only on its RX interrupt,
+ * since the entries of its mailbox would wait for the timeout.
+ */
+int
+poll_enable_rx_intr(struct poll_state *st, const struct poll_config *conf,
+	struct mailbox *mb, const char *block)
+{
+	int ret;
+
+	if (conf->rx_intr_timeout_ms == 0 || conf->max_idle_pauses == 0)
+		return 0;
+
+	ret = rte_eth_dev_rx_intr_ctl_q(st->port_id, st->queue_id,
+		RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_ADD, NULL);
+	if (ret < 0) {
+		RTE_LOG(NOTICE, GATEKEEPER,
+			"%s: cannot sleep on the RX interrupts of queue %hu of port %hhu (err = %d), so the block only pauses when idle\n",
+			block, st->queue_id, st->port_id, ret);
+		return ret;
+	}
+
+	if (mb != NULL) {
+		st->mb_event.epdata.event = EPOLLIN;
+		st->mb_event.epdata.cb_fun = poll_clear_mailbox;
+		ret = rte_epoll_ctl(RTE_EPOLL_PER_THREAD, EPOLL_CTL_ADD,
+			mb->efd, &st->mb_event);
+		if (ret < 0) {
+			RTE_LOG(NOTICE, GATEKEEPER,
+				"%s: cannot sleep on the mailbox (err = %d), so the block only pauses when idle\n",
+				block, ret);
+			rte_eth_dev_rx_intr_ctl_q(st->port_id, st->queue_id,
+				RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_DEL,
+				NULL);
+			return ret;
+		}
+		st->mb = mb;
+	}
+
+	st->rx_intr = true;
+	return 0;
+}
+
+void
+poll_release(struct poll_state *st)
+{
+	if (!st->rx_intr)
+		return;
+
+	rte_eth_dev_rx_intr_ctl_q(st->port_id, st->queue_id,
+		RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_DEL, NULL);
+	st->rx_intr = false;
+
+	if (st->mb != NULL) {
+		rte_epoll_ctl(RTE_EPOLL_PER_THREAD, EPOLL_CTL_DEL,
+			st->mb->efd, &st->mb_event);
+		st->mb = NULL;
+	}
+}
+
+/*
+ * Sleep until a packet arrives at the queue of @st, an entry
+ * arrives at the mailbox of @st, or @conf->rx_intr_timeout_ms
+ * has passed.
+ *
+ * A packet that arrives between the last poll and the arming of
+ * the interrupt may only be noticed at the timeout, which is
+ * what bounds the latency of an idle block. Entries of the mailbox
+ * are not delayed: the block checks the mailbox after announcing
+ * that it is sleeping, and producers signal the eventfd of the
+ * mailbox once they see the announcement; see mb_wake().
+ */
+void
+poll_sleep(struct poll_state *st, const struct poll_config *conf)
+{
+	struct rte_epoll_event events[2];
+	struct mailbox *mb = st->mb;
+
+	if (mb != NULL) {
+		rte_atomic32_set(&mb->sleeping, 1);
+		rte_mb();
+		if (!rte_ring_empty(mb->ring))
+			goto awake;
+	}
+
+	if (rte_eth_dev_rx_intr_enable(st->port_id, st->queue_id) < 0)
+		goto awake;
+
+	rte_epoll_wait(RTE_EPOLL_PER_THREAD, events, RTE_DIM(events),
+		conf->rx_intr_timeout_ms);
+	rte_eth_dev_rx_intr_disable(st->port_id, st->queue_id);
+
+awake:
+	if (mb != NULL)
+		rte_atomic32_set(&mb->sleeping, 0);
+}
@@ -0,0 +1,85 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+#include <rte_log.h>
+#include <rte_lcore.h>
+#include <rte_memzone.h>
+
+#include "gatekeeper_stats.h"
+#include "gatekeeper_main.h"
+
+static void
+stats_zone_name(char *name, size_t len, const char *block_name,
+	unsigned int lcore_id)
+{
+	int ret = snprintf(name, len, "%s_stats_%u", block_name, lcore_id);
+	RTE_VERIFY(ret > 0 && ret < (int)len);
+}
+
+/*
+ * Allocate the statistics of @block_name at @lcore_id; @size
+ * must be a multiple of 8 bytes. The statistics start zeroed.
+ */
+void *
+stats_alloc(const char *block_name, unsigned int lcore_id, size_t size)
+{
+	char name[RTE_MEMZONE_NAMESIZE];
+	const struct rte_memzone *mz;
+
+	RTE_VERIFY(size % sizeof(uint64_t) == 0);
+
+	stats_zone_name(name, sizeof(name), block_name, lcore_id);
+	mz = rte_memzone_reserve(name, size,
+		rte_lcore_to_socket_id(lcore_id), 0);
+	if (mz == NULL) {
+		RTE_LOG(ERR, MALLOC,
+			"%s: cannot allocate the statistics at lcore %u\n",
+			block_name, lcore_id);
+		return NULL;
+	}
+
+	memset(mz->addr, 0, size);
+	return mz->addr;
+}
+
+void
+stats_free(const char *block_name, unsigned int lcore_id)
+{
+	char name[RTE_MEMZONE_NAMESIZE];
+	const struct rte_memzone *mz;
+
+	stats_zone_name(name, sizeof(name), block_name, lcore_id);
+	mz = rte_memzone_lookup(name);
+	if (mz != NULL)
+		rte_memzone_free(mz);
+}
+
+/* Copy the statistics at @src, written by another lcore, to @dst. */
+void
+stats_read(void *dst, const void *src, size_t size)
+{
+	const volatile uint64_t *from = src;
+	uint64_t *to = dst;
+	size_t i;
+
+	for (i = 0; i < size / sizeof(uint64_t); i++)
+		to[i] = from[i];
+}
@@ -0,0 +1,91 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <inttypes.h>
+
+#include <rte_log.h>
+#include <rte_ethdev.h>
+
+#include "gatekeeper_tx.h"
+
+void
+tx_buf_init(struct gatekeeper_tx_buf *buf, uint8_t port_id,
+	uint16_t queue_id)
+{
+	memset(buf, 0, sizeof(*buf));
+	buf->port_id = port_id;
+	buf->queue_id = queue_id;
+	buf->flush_cycles = cycles_per_sec * GATEKEEPER_TX_BUF_FLUSH_US /
+		1000000;
+}
+
+/*
+ * Send all buffered packets, pausing between the retries to give
+ * the NIC time to free descriptors. Returns the number of packets
+ * that were dropped because the TX ring stayed full.
+ */
+uint16_t
+tx_buf_flush(struct gatekeeper_tx_buf *buf)
+{
+	unsigned int retries = 0;
+	uint16_t num_sent = 0;
+	uint16_t num_dropped;
+	uint16_t i;
+
+	while (num_sent < buf->num_pkts) {
+		num_sent += rte_eth_tx_burst(buf->port_id, buf->queue_id,
+			&buf->pkts[num_sent], buf->num_pkts - num_sent);
+		if (likely(num_sent == buf->num_pkts) ||
+				retries == GATEKEEPER_TX_BUF_MAX_RETRIES)
+			break;
+		retries++;
+		rte_pause();
+	}
+
+	num_dropped = buf->num_pkts - num_sent;
+	for (i = num_sent; i < buf->num_pkts; i++)
+		rte_pktmbuf_free(buf->pkts[i]);
+
+	buf->num_sent += num_sent;
+	buf->num_retries += retries;
+	buf->num_dropped += num_dropped;
+	buf->num_pkts = 0;
+	return num_dropped;
+}
+
+/*
+ * Drop the buffered packets. The statistics of @buf are
+ * only logged when packets have been dropped.
+ */
+void
+tx_buf_free(struct gatekeeper_tx_buf *buf)
+{
+	uint16_t i;
+
+	for (i = 0; i < buf->num_pkts; i++)
+		rte_pktmbuf_free(buf->pkts[i]);
+	buf->num_dropped += buf->num_pkts;
+	buf->num_pkts = 0;
+
+	if (buf->num_dropped > 0)
+		RTE_LOG(NOTICE, GATEKEEPER,
+			"tx: port %hhu queue %hu sent %" PRIu64 " packets, retried %" PRIu64 " times, and dropped %" PRIu64 " packets\n",
+			buf->port_id, buf->queue_id, buf->num_sent,
+			buf->num_retries, buf->num_dropped);
+}
@@ -19,6 +19,7 @@
 #include <arpa/inet.h>
 
 #include <rte_arp.h>
+#include <rte_cycles.h>
 
 #include "arp.h"
 #include "cache.h"
@@ -66,14 +67,13 @@ ipv4_in_subnet(struct gatekeeper_if *iface, const void *ip_be)
 
 void
 xmit_arp_req(struct gatekeeper_if *iface, const uint8_t *ip_be,
-	const struct ether_addr *ha, uint16_t tx_queue)
+	const struct ether_addr *ha, struct gatekeeper_tx_buf *tx_buf)
 {
 	struct rte_mbuf *created_pkt;
 	struct ether_hdr *eth_hdr;
 	struct arp_hdr *arp_hdr;
 	size_t pkt_size;
 	struct lls_config *lls_conf = get_lls_conf();
-	int ret;
 
 	struct rte_mempool *mp = lls_conf->net->gatekeeper_pktmbuf_pool[
 		rte_lcore_to_socket_id(lls_conf->lcore_id)];
@@ -109,12 +109,7 @@ xmit_arp_req(struct gatekeeper_if *iface, const uint8_t *ip_be,
 	memset(&arp_hdr->arp_data.arp_tha, 0, ETHER_ADDR_LEN);
 	arp_hdr->arp_data.arp_tip = *(const uint32_t *)ip_be;
 
-	ret = rte_eth_tx_burst(iface->id, tx_queue, &created_pkt, 1);
-	if (ret <= 0) {
-		rte_pktmbuf_free(created_pkt);
-		RTE_LOG(ERR, GATEKEEPER,
-			"lls: could not transmit an ARP request\n");
-	}
+	tx_buf_add(tx_buf, created_pkt, rte_rdtsc());
 }
 
 /*
@@ -134,7 +129,8 @@ is_garp_pkt(const struct arp_hdr *arp_hdr)
 
 int
 process_arp(struct lls_config *lls_conf, struct gatekeeper_if *iface,
-	uint16_t tx_queue, struct rte_mbuf *buf, struct ether_hdr *eth_hdr)
+	struct gatekeeper_tx_buf *tx_buf, struct rte_mbuf *buf,
+	struct ether_hdr *eth_hdr)
 {
 	struct lls_mod_req mod_req;
 	struct arp_hdr *arp_hdr;
@@ -180,8 +176,6 @@ process_arp(struct lls_config *lls_conf, struct gatekeeper_if *iface,
 
 	switch (rte_be_to_cpu_16(arp_hdr->arp_op)) {
 	case ARP_OP_REQUEST: {
-		uint16_t num_tx;
-
 		/* Set-up Ethernet header. */
 		ether_addr_copy(&eth_hdr->s_addr, &eth_hdr->d_addr);
 		ether_addr_copy(&iface->eth_addr, &eth_hdr->s_addr);
@@ -195,11 +189,7 @@ process_arp(struct lls_config *lls_conf, struct gatekeeper_if *iface,
 		arp_hdr->arp_data.arp_sip = iface->ip4_addr.s_addr;
 
 		/* Need to transmit reply. */
-		num_tx = rte_eth_tx_burst(iface->id, tx_queue, &buf, 1);
-		if (unlikely(num_tx != 1)) {
-			RTE_LOG(NOTICE, GATEKEEPER, "lls: ARP reply failed\n");
-			return -1;
-		}
+		tx_buf_add(tx_buf, buf, rte_rdtsc());
 		return 0;
 	}
 	case ARP_OP_REPLY:
@@ -34,7 +34,7 @@ int ipv4_in_subnet(struct gatekeeper_if *iface, const void *ip_be);
 
 /* Transmit an ARP request packet. */
 void xmit_arp_req(struct gatekeeper_if *iface, const uint8_t *ip_be,
-	const struct ether_addr *ha, uint16_t tx_queue);
+	const struct ether_addr *ha, struct gatekeeper_tx_buf *tx_buf);
 
 /*
  * Process an ARP packet that arrived on @iface.
@@ -43,7 +43,8 @@ void xmit_arp_req(struct gatekeeper_if *iface, const uint8_t *ip_be,
  * -1 if it does not need to be transmitted (and needs to be freed).
  */
 int process_arp(struct lls_config *lls_conf, struct gatekeeper_if *iface,
-	uint16_t tx_queue, struct rte_mbuf *buf, struct ether_hdr *eth_hdr);
+	struct gatekeeper_tx_buf *tx_buf, struct rte_mbuf *buf,
+	struct ether_hdr *eth_hdr);
 
 /* Print an ARP record. */
 void print_arp_record(struct lls_cache *cache, struct lls_record *record);
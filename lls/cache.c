@@ -17,8 +17,10 @@
  */
 
 #include <stdbool.h>
+#include <string.h>
 
 #include <rte_hash.h>
+#include <rte_malloc.h>
 
 #include <gatekeeper_lls.h>
 #include "cache.h"
@@ -34,6 +36,8 @@
 
 /* XXX Sample parameters, need to be tested for better performance. */
 #define LLS_CACHE_BURST_SIZE (32)
+/* The maximum number of bursts of requests processed at once. */
+#define LLS_REQ_MAX_BURSTS (8)
 
 static void
 lls_send_request(struct lls_config *lls_conf, struct lls_cache *cache,
@@ -44,11 +48,11 @@ lls_send_request(struct lls_config *lls_conf, struct lls_cache *cache,
 	if (cache->iface_enabled(lls_conf->net, front) &&
 			cache->ip_in_subnet(front, ip_be))
 		cache->xmit_req(&lls_conf->net->front, ip_be, ha,
-			lls_conf->tx_queue_front);
+			&lls_conf->tx_buf_front);
 	if (cache->iface_enabled(lls_conf->net, back) &&
 			cache->ip_in_subnet(back, ip_be))
 		cache->xmit_req(&lls_conf->net->back, ip_be, ha,
-			lls_conf->tx_queue_back);
+			&lls_conf->tx_buf_back);
 }
 
 static void
@@ -68,31 +72,62 @@ lls_cache_dump(struct lls_cache *cache)
 	}
 }
 
+static int
+lls_add_hold(struct lls_cache *cache, struct lls_record *record,
+	const struct lls_hold *hold)
+{
+	uint32_t idx = cache->free_holds;
+
+	if (unlikely(idx == LLS_NO_HOLD)) {
+		char ip_buf[cache->key_str_len];
+		char *ip_str = cache->ip_str(cache, record->map.ip_be,
+			ip_buf, cache->key_str_len);
+		RTE_LOG(ERR, GATEKEEPER,
+			"lls: no space, could not add hold of lcore %u for %s\n",
+			hold->lcore_id, ip_str == NULL ? cache->name : ip_str);
+		return -1;
+	}
+
+	cache->free_holds = cache->holds[idx].next;
+	cache->holds[idx] = *hold;
+	cache->holds[idx].next = record->holds;
+	record->holds = idx;
+	record->num_holds++;
+	return 0;
+}
+
+/*
+ * Remove the hold at *@pidx, where @pidx points
+ * to the link to the hold in the list of @record.
+ */
 static void
-lls_update_subscribers(struct lls_record *record)
+lls_del_hold(struct lls_cache *cache, struct lls_record *record,
+	uint32_t *pidx)
 {
-	unsigned int i;
-	for (i = 0; i < record->num_holds; i++) {
+	uint32_t idx = *pidx;
+
+	*pidx = cache->holds[idx].next;
+	cache->holds[idx].next = cache->free_holds;
+	cache->free_holds = idx;
+	record->num_holds--;
+}
+
+static void
+lls_update_subscribers(struct lls_cache *cache, struct lls_record *record)
+{
+	uint32_t *pidx = &record->holds;
+
+	while (*pidx != LLS_NO_HOLD) {
+		struct lls_hold *hold = &cache->holds[*pidx];
 		int call_again = false;
 
-		record->holds[i].cb(&record->map, record->holds[i].arg,
+		hold->cb(&record->map, hold->arg,
 			LLS_REPLY_RESOLUTION, &call_again);
 
 		if (call_again)
-			continue;
-
-		/* Delete hold; keep all holds in beginning of array. */
-		record->num_holds--;
-		if (i < record->num_holds) {
-			rte_memcpy(&record->holds[i],
-				&record->holds[record->num_holds],
-				sizeof(record->holds[i]));
-			/*
-			 * This cancels out the update of the for loop so we
-			 * can redo update of hold at position @i, if needed.
-			 */
-			i--;
-		}
+			pidx = &hold->next;
+		else
+			lls_del_hold(cache, record, pidx);
 	}
 }
 
@@ -107,14 +142,17 @@ lls_add_record(struct lls_cache *cache, const uint8_t *ip_be)
 		RTE_LOG(ERR, HASH, "%s, could not add record for %s\n",
 			ret == -EINVAL ? "Invalid params" : "No space",
 			ip_str == NULL ? cache->name : ip_str);
-	} else
+	} else {
 		RTE_VERIFY(ret >= 0);
+		cache->records[ret].in_use = true;
+	}
 	return ret;
 }
 
 static void
 lls_del_record(struct lls_cache *cache, const uint8_t *ip_be)
 {
+	struct lls_record *record;
 	int32_t ret = rte_hash_del_key(cache->hash, ip_be);
 	if (unlikely(ret == -ENOENT || ret == -EINVAL)) {
 		char ip_buf[cache->key_str_len];
@@ -123,7 +161,34 @@ lls_del_record(struct lls_cache *cache, const uint8_t *ip_be)
 		RTE_LOG(ERR, HASH, "%s, record for %s not deleted\n",
 			ret == -ENOENT ? "No map found" : "Invalid params",
 			ip_str == NULL ? cache->name : ip_str);
+		return;
 	}
+
+	/* Release the holds that are left. */
+	record = &cache->records[ret];
+	while (record->holds != LLS_NO_HOLD) {
+		struct lls_hold *hold = &cache->holds[record->holds];
+		hold->cb(&record->map, hold->arg, LLS_REPLY_FREE, NULL);
+		lls_del_hold(cache, record, &record->holds);
+	}
+	record->in_use = false;
+}
+
+/*
+ * Tell the requester of @hold_req that its hold could not be placed,
+ * so it can release what it attached to the hold.
+ */
+static void
+lls_fail_hold(struct lls_config *lls_conf, struct lls_hold_req *hold_req)
+{
+	struct lls_cache *cache = hold_req->cache;
+	struct lls_map map;
+
+	memset(&map, 0, sizeof(map));
+	map.stale = true;
+	rte_memcpy(map.ip_be, hold_req->ip_be, cache->key_len);
+	hold_req->hold.cb(&map, hold_req->hold.arg, LLS_REPLY_FREE, NULL);
+	lls_conf->stats->holds_failed++;
 }
 
 static void
@@ -134,17 +199,28 @@ lls_process_hold(struct lls_config *lls_conf, struct lls_hold_req *hold_req)
 	int ret = rte_hash_lookup(cache->hash, hold_req->ip_be);
 
 	if (ret == -ENOENT) {
+		if (unlikely(cache->free_holds == LLS_NO_HOLD)) {
+			RTE_LOG(ERR, GATEKEEPER,
+				"lls: no space, could not hold a new %s map\n",
+				cache->name);
+			lls_fail_hold(lls_conf, hold_req);
+			return;
+		}
+
 		ret = lls_add_record(cache, hold_req->ip_be);
-		if (ret < 0)
+		if (ret < 0) {
+			lls_fail_hold(lls_conf, hold_req);
 			return;
+		}
 
 		record = &cache->records[ret];
 		record->map.stale = true;
 		rte_memcpy(record->map.ip_be, hold_req->ip_be, cache->key_len);
 		record->ts = time(NULL);
 		RTE_VERIFY(record->ts >= 0);
-		record->holds[0] = hold_req->hold;
-		record->num_holds = 1;
+		record->num_holds = 0;
+		record->holds = LLS_NO_HOLD;
+		RTE_VERIFY(lls_add_hold(cache, record, &hold_req->hold) == 0);
 
 		/* Try to resolve record using broadcast. */
 		lls_send_request(lls_conf, cache, hold_req->ip_be, NULL);
@@ -160,6 +236,7 @@ lls_process_hold(struct lls_config *lls_conf, struct lls_hold_req *hold_req)
 		RTE_LOG(ERR, HASH,
 			"Invalid params, could not get %s map; hold failed\n",
 			ip_str == NULL ? cache->name : ip_str);
+		lls_fail_hold(lls_conf, hold_req);
 		return;
 	}
 
@@ -174,7 +251,10 @@ lls_process_hold(struct lls_config *lls_conf, struct lls_hold_req *hold_req)
 		if (!call_again)
 			return;
 	}
-	record->holds[record->num_holds++] = hold_req->hold;
+	if (lls_add_hold(cache, record, &hold_req->hold) < 0) {
+		lls_fail_hold(lls_conf, hold_req);
+		return;
+	}
 
 	if (lls_conf->debug)
 		lls_cache_dump(cache);
@@ -185,7 +265,7 @@ lls_process_put(struct lls_config *lls_conf, struct lls_put_req *put_req)
 {
 	struct lls_cache *cache = put_req->cache;
 	struct lls_record *record;
-	unsigned int i;
+	uint32_t *pidx;
 	int ret = rte_hash_lookup(cache->hash, put_req->ip_be);
 
 	if (ret == -ENOENT) {
@@ -208,13 +288,14 @@ lls_process_put(struct lls_config *lls_conf, struct lls_put_req *put_req)
 	RTE_VERIFY(ret >= 0);
 	record = &cache->records[ret];
 
-	for (i = 0; i < record->num_holds; i++) {
-		if (put_req->lcore_id == record->holds[i].lcore_id)
+	for (pidx = &record->holds; *pidx != LLS_NO_HOLD;
+			pidx = &cache->holds[*pidx].next) {
+		if (put_req->lcore_id == cache->holds[*pidx].lcore_id)
 			break;
 	}
 
 	/* Requesting lcore not found in holds. */
-	if (i == record->num_holds)
+	if (*pidx == LLS_NO_HOLD)
 		return;
 
 	/*
@@ -228,14 +309,9 @@ lls_process_put(struct lls_config *lls_conf, struct lls_put_req *put_req)
 	 * requester using the temporary variable. This is OK since
 	 * there's only one writer.
 	 */
-	record->holds[i].cb(&record->map, record->holds[i].arg,
+	cache->holds[*pidx].cb(&record->map, cache->holds[*pidx].arg,
 		LLS_REPLY_FREE, NULL);
-
-	/* Keep all holds in beginning of array. */
-	record->num_holds--;
-	if (i < record->num_holds)
-		rte_memcpy(&record->holds[i], &record->holds[record->num_holds],
-			sizeof(record->holds[i]));
+	lls_del_hold(cache, record, pidx);
 
 	if (lls_conf->debug)
 		lls_cache_dump(cache);
@@ -264,6 +340,7 @@ lls_process_mod(struct lls_config *lls_conf, struct lls_mod_req *mod_req)
 		rte_memcpy(record->map.ip_be, mod_req->ip_be, cache->key_len);
 		record->ts = mod_req->ts;
 		record->num_holds = 0;
+		record->holds = LLS_NO_HOLD;
 
 		if (lls_conf->debug)
 			lls_cache_dump(cache);
@@ -297,44 +374,52 @@ lls_process_mod(struct lls_config *lls_conf, struct lls_mod_req *mod_req)
 	record->ts = mod_req->ts;
 
 	if (changed_ha || changed_port || changed_stale) {
-		lls_update_subscribers(record);
+		lls_update_subscribers(cache, record);
 		if (lls_conf->debug)
 			lls_cache_dump(cache);
 	}
 }
 
+/*
+ * Process the requests in bursts until the mailbox is empty,
+ * or LLS_REQ_MAX_BURSTS bursts have been processed, so requests
+ * do not starve the other duties of the LLS block.
+ */
 unsigned int
 lls_process_reqs(struct lls_config *lls_conf)
 {
 	struct lls_request *reqs[LLS_CACHE_BURST_SIZE];
-	unsigned int count = mb_dequeue_burst(&lls_conf->requests,
-		(void **)reqs, LLS_CACHE_BURST_SIZE);
-	unsigned int i;
-
-	for (i = 0; i < count; i++) {
-		switch (reqs[i]->ty) {
-		case LLS_REQ_HOLD:
-			lls_process_hold(lls_conf, &reqs[i]->u.hold);
-			break;
-		case LLS_REQ_PUT:
-			lls_process_put(lls_conf, &reqs[i]->u.put);
-			break;
-		case LLS_REQ_ND: {
-			struct lls_nd_req *nd = &reqs[i]->u.nd;
-			if (process_nd(lls_conf, nd->iface, nd->pkt) == -1)
-				rte_pktmbuf_free(nd->pkt);
-			break;
+	unsigned int total = 0;
+	unsigned int b;
+
+	for (b = 0; b < LLS_REQ_MAX_BURSTS; b++) {
+		unsigned int count = mb_dequeue_burst(&lls_conf->requests,
+			(void **)reqs, LLS_CACHE_BURST_SIZE);
+		unsigned int i;
+
+		for (i = 0; i < count; i++) {
+			switch (reqs[i]->ty) {
+			case LLS_REQ_HOLD:
+				lls_process_hold(lls_conf, &reqs[i]->u.hold);
+				break;
+			case LLS_REQ_PUT:
+				lls_process_put(lls_conf, &reqs[i]->u.put);
+				break;
+			default:
+				RTE_LOG(ERR, GATEKEEPER,
+					"lls: unrecognized request type (%d)\n",
+					reqs[i]->ty);
+				break;
+			}
 		}
-		default:
-			RTE_LOG(ERR, GATEKEEPER,
-				"lls: unrecognized request type (%d)\n",
-				reqs[i]->ty);
+		mb_free_entries(&lls_conf->requests, (void **)reqs, count);
+
+		total += count;
+		if (count < LLS_CACHE_BURST_SIZE)
 			break;
-		}
-		mb_free_entry(&lls_conf->requests, reqs[i]);
 	}
 
-	return count;
+	return total;
 }
 
 int
@@ -359,9 +444,6 @@ lls_req(enum lls_req_ty ty, void *req_arg)
 	case LLS_REQ_PUT:
 		req->u.put = *(struct lls_put_req *)req_arg;
 		break;
-	case LLS_REQ_ND:
-		req->u.nd = *(struct lls_nd_req *)req_arg;
-		break;
 	default:
 		mb_free_entry(&lls_conf->requests, req);
 		RTE_LOG(ERR, GATEKEEPER,
@@ -385,23 +467,32 @@ lls_cache_get(struct lls_cache *cache, const uint8_t *ip_be)
 	return &cache->records[ret].map;
 }
 
+/*
+ * Scan the slice of the records of @cache that starts at
+ * @cache->scan_next; every record is visited once
+ * every LLS_CACHE_SCAN_SLICES calls.
+ */
 void
 lls_cache_scan(struct lls_config *lls_conf, struct lls_cache *cache)
 {
-	uint32_t iter = 0;
-	int32_t index;
-	const uint8_t *ip_be;
-	void *data;
+	uint32_t slice_len = (cache->max_records +
+		LLS_CACHE_SCAN_SLICES - 1) / LLS_CACHE_SCAN_SLICES;
+	uint32_t end = RTE_MIN(cache->scan_next + slice_len,
+		cache->max_records);
+	uint32_t index;
 	struct gatekeeper_if *front = &lls_conf->net->front;
 	struct gatekeeper_if *back = &lls_conf->net->back;
 	time_t now = time(NULL);
 
 	RTE_VERIFY(now >= 0);
-	index = rte_hash_iterate(cache->hash, (void *)&ip_be, &data, &iter);
-	while (index >= 0) {
+	for (index = cache->scan_next; index < end; index++) {
 		struct lls_record *record = &cache->records[index];
+		const uint8_t *ip_be = record->map.ip_be;
 		uint32_t timeout;
 
+		if (!record->in_use)
+			continue;
+
 		/*
 		 * If a map is already stale, continue to
 		 * try to resolve it while there's interest.
@@ -411,7 +502,7 @@ lls_cache_scan(struct lls_config *lls_conf, struct lls_cache *cache)
 				lls_send_request(lls_conf, cache, ip_be, NULL);
 			else
 				lls_del_record(cache, ip_be);
-			goto next;
+			continue;
 		}
 
 		if (record->map.port_id == front->id)
@@ -428,12 +519,12 @@ lls_cache_scan(struct lls_config *lls_conf, struct lls_cache *cache)
 				ip_str == NULL ? cache->name : ip_str,
 				record->map.port_id);
 			lls_del_record(cache, ip_be);
-			goto next;
+			continue;
 		}
 
 		if (now - record->ts >= timeout) {
 			record->map.stale = true;
-			lls_update_subscribers(record);
+			lls_update_subscribers(cache, record);
 			if (record->num_holds > 0)
 				lls_send_request(lls_conf, cache, ip_be,
 					&record->map.ha);
@@ -448,11 +539,15 @@ lls_cache_scan(struct lls_config *lls_conf, struct lls_cache *cache)
 				lls_send_request(lls_conf, cache, ip_be,
 					&record->map.ha);
 		}
-next:
-		index = rte_hash_iterate(cache->hash, (void *)&ip_be,
-			&data, &iter);
 	}
 
+	if (end < cache->max_records) {
+		cache->scan_next = end;
+		return;
+	}
+
+	/* The whole cache has been scanned. */
+	cache->scan_next = 0;
 	if (get_lls_conf()->debug)
 		lls_cache_dump(cache);
 }
@@ -461,28 +556,71 @@ void
 lls_cache_destroy(struct lls_cache *cache)
 {
 	rte_hash_free(cache->hash);
+	rte_free(cache->holds);
+	rte_free(cache->records);
 }
 
 int
 lls_cache_init(struct lls_config *lls_conf, struct lls_cache *cache)
 {
+	uint32_t i;
+	int socket_id = rte_lcore_to_socket_id(lls_conf->lcore_id);
 	struct rte_hash_parameters lls_cache_params = {
 		.name = cache->name,
-		.entries = LLS_CACHE_RECORDS,
+		.entries = cache->max_records,
 		.reserved = 0,
 		.key_len = cache->key_len,
 		.hash_func = DEFAULT_HASH_FUNC,
 		.hash_func_init_val = 0,
-		.socket_id = rte_lcore_to_socket_id(lls_conf->lcore_id),
+		.socket_id = socket_id,
 		.extra_flag = 0,
 	};
 
 	RTE_VERIFY(cache->key_len <= LLS_MAX_KEY_LEN);
+
+	if (cache->max_records == 0 || lls_conf->max_holds == 0) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"lls: the %s cache must have room for records and holds\n",
+			cache->name);
+		return -1;
+	}
+
+	cache->records = rte_zmalloc_socket("lls_records",
+		cache->max_records * sizeof(*cache->records), 0, socket_id);
+	if (cache->records == NULL) {
+		RTE_LOG(ERR, MALLOC, "Could not allocate %s cache records\n",
+			cache->name);
+		goto out;
+	}
+
+	cache->holds = rte_malloc_socket("lls_holds",
+		lls_conf->max_holds * sizeof(*cache->holds), 0, socket_id);
+	if (cache->holds == NULL) {
+		RTE_LOG(ERR, MALLOC, "Could not allocate %s cache holds\n",
+			cache->name);
+		goto records;
+	}
+	for (i = 0; i < lls_conf->max_holds - 1; i++)
+		cache->holds[i].next = i + 1;
+	cache->holds[i].next = LLS_NO_HOLD;
+	cache->free_holds = 0;
+	cache->max_holds = lls_conf->max_holds;
+	cache->scan_next = 0;
+
 	cache->hash = rte_hash_create(&lls_cache_params);
 	if (cache->hash == NULL) {
 		RTE_LOG(ERR, HASH, "Could not create %s cache hash\n",
 			cache->name);
-		return -1;
+		goto holds;
 	}
 	return 0;
+
+holds:
+	rte_free(cache->holds);
+	cache->holds = NULL;
+records:
+	rte_free(cache->records);
+	cache->records = NULL;
+out:
+	return -1;
 }
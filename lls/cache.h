@@ -24,6 +24,14 @@
 /* Length of time (in seconds) to wait between scans of the cache. */
 #define LLS_CACHE_SCAN_INTERVAL 10
 
+/*
+ * XXX Sample parameter, need to be tested for better performance.
+ * Number of slices of the records of a cache visited by the scans;
+ * one slice is visited every LLS_CACHE_SCAN_INTERVAL /
+ * LLS_CACHE_SCAN_SLICES seconds.
+ */
+#define LLS_CACHE_SCAN_SLICES 10
+
 /* Information needed to add a hold to a record. */
 struct lls_hold_req {
 	/* Cache that holds (or will hold) this map. */
@@ -48,15 +56,6 @@ struct lls_put_req {
 	unsigned int     lcore_id;
 };
 
-/* Information needed to submit an ND packet to the LLS block. */
-struct lls_nd_req {
-	/* ND neighbor packet. */
-	struct rte_mbuf      *pkt;
-
-	/* Interface that received @pkt. */
-	struct gatekeeper_if *iface;
-};
-
 /* A modification to an LLS map. */
 struct lls_mod_req {
 	/* Cache that holds (or will hold) this map. */
@@ -91,8 +90,6 @@ struct lls_request {
 		struct lls_hold_req hold;
 		/* If @ty is LLS_REQ_PUT, use @put. */
 		struct lls_put_req  put;
-		/* If @ty is LLS_REQ_ND, use @nd. */
-		struct lls_nd_req   nd;
 	} u;
 };
 
@@ -126,7 +123,10 @@ void lls_process_mod(struct lls_config *lls_conf, struct lls_mod_req *mod);
  */
 struct lls_map *lls_cache_get(struct lls_cache *cache, const uint8_t *ip_be);
 
-/* Scan the cache and send requests or remove entries as needed. */
+/*
+ * Scan the next slice of the cache and send requests or
+ * remove entries as needed.
+ */
 void lls_cache_scan(struct lls_config *lls_conf, struct lls_cache *cache);
 
 #endif /* _GATEKEEPER_LLS_CACHE_H_ */
@@ -27,8 +27,11 @@
 #include "gatekeeper_launch.h"
 #include "nd.h"
 
-/* Length of time (in seconds) to wait between scans of the cache. */
-#define LLS_CACHE_SCAN_INTERVAL 10
+/* XXX Sample parameters, need to be tested for better performance. */
+/* The number of entries of the ring of ND packets; a power of two. */
+#define LLS_ND_RING_SIZE (512)
+/* Length of time (in microseconds) between runs of the timers. */
+#define LLS_TIMER_MANAGE_US (1000)
 
 static struct lls_config lls_conf = {
 	.arp_cache = {
@@ -77,6 +80,16 @@ get_lls_conf(void)
 	return &lls_conf;
 }
 
+static void
+free_nd_ring(struct rte_ring *nd_ring)
+{
+	struct rte_mbuf *pkt;
+
+	while (rte_ring_sc_dequeue(nd_ring, (void **)&pkt) == 0)
+		rte_pktmbuf_free(pkt);
+	rte_ring_free(nd_ring);
+}
+
 static int
 cleanup_lls(void)
 {
@@ -84,8 +97,11 @@ cleanup_lls(void)
 		lls_cache_destroy(&lls_conf.nd_cache);
 	if (arp_enabled(&lls_conf))
 		lls_cache_destroy(&lls_conf.arp_cache);
+	free_nd_ring(lls_conf.nd_ring);
 	destroy_mailbox(&lls_conf.requests);
 	rte_timer_stop(&lls_conf.timer);
+	stats_free("lls", lls_conf.lcore_id);
+	lls_conf.stats = NULL;
 	return 0;
 }
 
@@ -169,20 +185,20 @@ put_nd(struct in6_addr *ip_be, unsigned int lcore_id)
 	return -1;
 }
 
-int
-submit_nd(struct rte_mbuf *pkt, struct gatekeeper_if *iface)
+unsigned int
+submit_nd(struct rte_mbuf **pkts, unsigned int num_pkts,
+	struct gatekeeper_if *iface)
 {
 	if (nd_enabled(&lls_conf)) {
-		struct lls_nd_req nd_req = {
-			.pkt = pkt,
-			.iface = iface,
-		};
-		return lls_req(LLS_REQ_ND, &nd_req);
+		/* The ring of ND packets only holds packets of the front. */
+		RTE_VERIFY(iface == &lls_conf.net->front);
+		return rte_ring_mp_enqueue_burst(lls_conf.nd_ring,
+			(void **)pkts, num_pkts);
 	}
 
 	RTE_LOG(WARNING, GATEKEEPER,
 		"lls: %s invoked but ND service is not enabled\n", __func__);
-	return -1;
+	return 0;
 }
 
 int
@@ -224,15 +240,16 @@ lls_scan(__attribute__((unused)) struct rte_timer *timer, void *arg)
 		lls_cache_scan(lls_conf, &lls_conf->nd_cache);
 }
 
-static void
+static uint16_t
 process_pkts(struct lls_config *lls_conf, struct gatekeeper_if *iface,
-	uint16_t rx_queue, uint16_t tx_queue)
+	struct poll_state *poll, struct gatekeeper_tx_buf *tx_buf)
 {
 	struct rte_mbuf *bufs[GATEKEEPER_MAX_PKT_BURST];
-	uint16_t num_rx = rte_eth_rx_burst(iface->id, rx_queue, bufs,
-		GATEKEEPER_MAX_PKT_BURST);
+	uint16_t num_rx = poll_rx(poll, &lls_conf->poll, bufs);
 	uint16_t i;
 
+	lls_conf->stats->pkts_rx += num_rx;
+
 	for (i = 0; i < num_rx; i++) {
 		struct ether_hdr *eth_hdr = rte_pktmbuf_mtod(bufs[i],
 			struct ether_hdr *);
@@ -261,40 +278,44 @@ process_pkts(struct lls_config *lls_conf, struct gatekeeper_if *iface,
 
 		switch (rte_be_to_cpu_16(eth_hdr->ether_type)) {
 		case ETHER_TYPE_ARP:
-			if (process_arp(lls_conf, iface, tx_queue,
+			if (process_arp(lls_conf, iface, tx_buf,
 					bufs[i], eth_hdr) == -1)
 				goto free_buf;
 
 			/* ARP reply was sent, so no free is needed. */
 			continue;
-		case ETHER_TYPE_IPv6:
-			if (iface == &lls_conf->net->back) {
-				/*
-				 * Back interface can also see ND packets
-				 * received here.
-				 *
-				 * TODO Move RSS on the back interface
-				 * to a different block and pass ND
-				 * packets to the LLS using DPDK
-				 * packet classification and distribution.
-				 * Then, handle any non-ARP and non-ND
-				 * packets on the back interface. For now,
-				 * just drop them.
-				 */
-				struct ipacket packet;
-				int ret = extract_packet_info(bufs[i], &packet);
-				if (ret < 0)
-					goto free_buf;
+		case ETHER_TYPE_IPv6: {
+			/*
+			 * The back interface sees all packets received
+			 * here, and the front interface sees ICMPv6
+			 * packets when the NIC steers ND packets.
+			 *
+			 * TODO Move RSS on the back interface
+			 * to a different block. Then, handle any
+			 * non-ARP and non-ND packets on the back
+			 * interface. For now, just drop them.
+			 */
+			struct ipacket packet;
+			int ret = extract_packet_info(bufs[i], &packet);
+			if (ret < 0)
+				goto free_buf;
 
-				if (pkt_is_nd(&packet, iface)) {
-					if (process_nd(lls_conf, iface,
-							bufs[i]) == -1)
-						goto free_buf;
+			if (pkt_is_nd(&packet, iface)) {
+				if (process_nd(lls_conf, iface, bufs[i]) == -1)
+					goto free_buf;
 
-					/* ND reply sent, so no free needed. */
-					continue;
-				}
+				/* ND reply sent, so no free needed. */
+				continue;
 			}
+
+			/*
+			 * The other ICMPv6 packets that the NIC steers
+			 * here along with the ND packets are expected.
+			 */
+			if (iface == &lls_conf->net->front &&
+					packet.next_hdr == IPPROTO_ICMPV6)
+				goto free_buf;
+		}
 			/* FALLTHROUGH */
 		default:
 			RTE_LOG(ERR, GATEKEEPER, "lls: %s interface should not be seeing a packet with EtherType 0x%04hx\n",
@@ -303,8 +324,33 @@ process_pkts(struct lls_config *lls_conf, struct gatekeeper_if *iface,
 			goto free_buf;
 		}
 free_buf:
+		lls_conf->stats->pkts_dropped++;
 		rte_pktmbuf_free(bufs[i]);
 	}
+
+	return num_rx;
+}
+
+/* Process the ND packets submitted by the other blocks. */
+static unsigned int
+process_nd_ring(struct lls_config *lls_conf)
+{
+	struct rte_mbuf *bufs[GATEKEEPER_MAX_PKT_BURST];
+	unsigned int num_pkts = rte_ring_sc_dequeue_burst(lls_conf->nd_ring,
+		(void **)bufs, GATEKEEPER_MAX_PKT_BURST);
+	unsigned int i;
+
+	lls_conf->stats->nd_submitted += num_pkts;
+
+	for (i = 0; i < num_pkts; i++) {
+		if (process_nd(lls_conf, &lls_conf->net->front,
+				bufs[i]) == -1) {
+			lls_conf->stats->pkts_dropped++;
+			rte_pktmbuf_free(bufs[i]);
+		}
+	}
+
+	return num_pkts;
 }
 
 static int
@@ -312,34 +358,72 @@ lls_proc(void *arg)
 {
 	struct lls_config *lls_conf = (struct lls_config *)arg;
 	struct net_config *net_conf = lls_conf->net;
+	uint64_t timer_cycles = LLS_TIMER_MANAGE_US * cycles_per_sec / 1000000;
+	uint64_t manage_timers_at = 0;
 
 	RTE_LOG(NOTICE, GATEKEEPER,
 		"lls: the LLS block is running at lcore = %u\n",
 		lls_conf->lcore_id);
 
+	tx_buf_init(&lls_conf->tx_buf_front, net_conf->front.id,
+		lls_conf->tx_queue_front);
+	if (net_conf->back_iface_enabled)
+		tx_buf_init(&lls_conf->tx_buf_back, net_conf->back.id,
+			lls_conf->tx_queue_back);
+	poll_init(&lls_conf->poll_front, &lls_conf->poll, net_conf->front.id,
+		lls_conf->rx_queue_front);
+	if (net_conf->back_iface_enabled)
+		poll_init(&lls_conf->poll_back, &lls_conf->poll,
+			net_conf->back.id, lls_conf->rx_queue_back);
+
 	while (likely(!exiting)) {
+		uint64_t now;
+		unsigned int num_work;
+		unsigned int num_reqs;
+
 		/* Read in packets on front and back interfaces. */
-		process_pkts(lls_conf, &net_conf->front,
-			lls_conf->rx_queue_front, lls_conf->tx_queue_front);
+		num_work = process_pkts(lls_conf, &net_conf->front,
+			&lls_conf->poll_front, &lls_conf->tx_buf_front);
 		if (net_conf->back_iface_enabled)
-			process_pkts(lls_conf, &net_conf->back,
-				lls_conf->rx_queue_back,
-				lls_conf->tx_queue_back);
+			num_work += process_pkts(lls_conf, &net_conf->back,
+				&lls_conf->poll_back, &lls_conf->tx_buf_back);
 
-		/* Process any requests. */
-		if (likely(lls_process_reqs(lls_conf) == 0)) {
-			/*
-			 * If there are no requests to go through, then do a
-			 * scan of the cache (if enough time has passed).
-			 *
-			 * XXX In theory, many new LLS changes could starve
-			 * the ability to scan, but this will not likely
-			 * happen. In fact, we may want to reduce the amount
-			 * of times this is called, since reading the HPET
-			 * timer is inefficient. See the timer application.
-			 */
+		/* Process the ND packets and requests of other blocks. */
+		num_work += process_nd_ring(lls_conf);
+		num_reqs = lls_process_reqs(lls_conf);
+		lls_conf->stats->requests += num_reqs;
+		num_work += num_reqs;
+
+		/*
+		 * Only look for expired timers (i.e. the scan of
+		 * the caches) every LLS_TIMER_MANAGE_US, since
+		 * rte_timer_manage() is not free even when
+		 * no timer has expired.
+		 */
+		now = rte_rdtsc();
+		if (now >= manage_timers_at) {
 			rte_timer_manage();
+			manage_timers_at = now + timer_cycles;
 		}
+
+		/* Send the replies and requests that have waited enough. */
+		tx_buf_drain(&lls_conf->tx_buf_front, now);
+		if (net_conf->back_iface_enabled)
+			tx_buf_drain(&lls_conf->tx_buf_back, now);
+		lls_conf->stats->tx_dropped =
+			lls_conf->tx_buf_front.num_dropped +
+			lls_conf->tx_buf_back.num_dropped;
+
+		poll_idle(&lls_conf->poll_front, &lls_conf->poll,
+			num_work > 0 || lls_conf->tx_buf_front.num_pkts > 0 ||
+			lls_conf->tx_buf_back.num_pkts > 0);
+	}
+
+	tx_buf_flush(&lls_conf->tx_buf_front);
+	tx_buf_free(&lls_conf->tx_buf_front);
+	if (net_conf->back_iface_enabled) {
+		tx_buf_flush(&lls_conf->tx_buf_back);
+		tx_buf_free(&lls_conf->tx_buf_back);
 	}
 
 	RTE_LOG(NOTICE, GATEKEEPER,
@@ -353,26 +437,26 @@ static int
 assign_lls_queue_ids(struct lls_config *lls_conf)
 {
 	int ret = get_queue_id(&lls_conf->net->front, QUEUE_TYPE_RX,
-		lls_conf->lcore_id);
+		lls_conf->lcore_id, lls_conf->poll.num_rx_desc);
 	if (ret < 0)
 		goto fail;
 	lls_conf->rx_queue_front = ret;
 
 	ret = get_queue_id(&lls_conf->net->front, QUEUE_TYPE_TX,
-		lls_conf->lcore_id);
+		lls_conf->lcore_id, lls_conf->poll.num_tx_desc);
 	if (ret < 0)
 		goto fail;
 	lls_conf->tx_queue_front = ret;
 
 	if (lls_conf->net->back_iface_enabled) {
 		ret = get_queue_id(&lls_conf->net->back, QUEUE_TYPE_RX,
-			lls_conf->lcore_id);
+			lls_conf->lcore_id, lls_conf->poll.num_rx_desc);
 		if (ret < 0)
 			goto fail;
 		lls_conf->rx_queue_back = ret;
 
 		ret = get_queue_id(&lls_conf->net->back, QUEUE_TYPE_TX,
-			lls_conf->lcore_id);
+			lls_conf->lcore_id, lls_conf->poll.num_tx_desc);
 		if (ret < 0)
 			goto fail;
 		lls_conf->tx_queue_back = ret;
@@ -400,24 +484,28 @@ lls_stage2(void *arg)
 	int ret;
 
 	if (lls_conf->arp_cache.iface_enabled(net_conf, &net_conf->front)) {
-		ret = ethertype_filter_add(net_conf->front.id,
-			ETHER_TYPE_ARP, lls_conf->rx_queue_front);
+		ret = steer_arp(&net_conf->front, lls_conf->rx_queue_front);
 		if (ret < 0)
 			return ret;
 	}
 
 	if (lls_conf->arp_cache.iface_enabled(net_conf, &net_conf->back)) {
-		ret = ethertype_filter_add(net_conf->back.id,
-			ETHER_TYPE_ARP, lls_conf->rx_queue_back);
+		ret = steer_arp(&net_conf->back, lls_conf->rx_queue_back);
 		if (ret < 0)
 			return ret;
 	}
 
 	/*
-	 * Receive ND packets on the front interface from the
-	 * GK and GT blocks, depending on whether we're running
-	 * Gatekeeper or Grantor.
+	 * Receive ND packets on the front interface directly when
+	 * the NIC can steer them. Otherwise, the GK or GT blocks,
+	 * depending on whether we're running Gatekeeper or Grantor,
+	 * submit them to the LLS block.
 	 */
+	if (lls_conf->nd_cache.iface_enabled(net_conf, &net_conf->front)) {
+		ret = steer_nd(&net_conf->front, lls_conf->rx_queue_front);
+		if (ret < 0)
+			return ret;
+	}
 
 	/*
 	 * TODO Have a different block set up RSS on the back interface,
@@ -425,14 +513,14 @@ lls_stage2(void *arg)
 	 * the DPDK libraries.
 	 */
 	if (lls_conf->nd_cache.iface_enabled(net_conf, &net_conf->back)) {
-		uint8_t port_in = net_conf->back.id;
 		uint16_t lls_queue = lls_conf->rx_queue_back;
 
-		ret = gatekeeper_setup_rss(port_in, &lls_queue, 1);
+		ret = gatekeeper_setup_rss(&net_conf->back, &lls_queue, 1);
 		if (ret < 0)
 			return ret;
 
-		ret = gatekeeper_get_rss_config(port_in, &lls_conf->rss_conf);
+		ret = gatekeeper_get_rss_config(&net_conf->back,
+			&lls_conf->rss_conf);
 		if (ret < 0)
 			return ret;
 	}
@@ -440,20 +528,50 @@ lls_stage2(void *arg)
 	return 0;
 }
 
+/* A cache has room for the neighbors of all interfaces that use it. */
+static uint32_t
+cache_max_records(struct net_config *net_conf, struct lls_cache *cache,
+	uint32_t front_max_entries, uint32_t back_max_entries)
+{
+	uint32_t max_records = 0;
+
+	if (cache->iface_enabled(net_conf, &net_conf->front))
+		max_records += front_max_entries;
+	if (cache->iface_enabled(net_conf, &net_conf->back))
+		max_records += back_max_entries;
+	return max_records;
+}
+
 int
 run_lls(struct net_config *net_conf, struct lls_config *lls_conf)
 {
 	int ret;
+	size_t before = heap_allocated();
+	struct mailbox_params mb_params;
 
 	if (net_conf == NULL || lls_conf == NULL) {
 		ret = -1;
 		goto out;
 	}
 
-	ret = net_launch_at_stage1(net_conf, 1, 1, 1, 1, lls_stage1, lls_conf);
+	/* The LLS block never sleeps; see struct lls_config. */
+	lls_conf->poll.rx_intr_timeout_ms = 0;
+	ret = check_poll_config(&lls_conf->poll, NULL, "lls");
 	if (ret < 0)
 		goto out;
 
+	lls_conf->stats = stats_alloc("lls", lls_conf->lcore_id,
+		sizeof(*lls_conf->stats));
+	if (lls_conf->stats == NULL) {
+		ret = -1;
+		goto out;
+	}
+
+	ret = net_launch_at_stage1(net_conf, 1, 1, 1, 1, "lls", lls_stage1,
+		lls_conf);
+	if (ret < 0)
+		goto stats;
+
 	ret = launch_at_stage2(lls_stage2, lls_conf);
 	if (ret < 0)
 		goto stage1;
@@ -462,29 +580,49 @@ run_lls(struct net_config *net_conf, struct lls_config *lls_conf)
 	if (ret < 0)
 		goto stage2;
 
-	/* Do LLS cache scan every LLS_CACHE_SCAN_INTERVAL seconds. */
+	/*
+	 * Scan a slice of the LLS caches at a time, so each record
+	 * is visited every LLS_CACHE_SCAN_INTERVAL seconds.
+	 */
 	rte_timer_init(&lls_conf->timer);
 	ret = rte_timer_reset(&lls_conf->timer,
-		LLS_CACHE_SCAN_INTERVAL * rte_get_timer_hz(), PERIODICAL,
+		LLS_CACHE_SCAN_INTERVAL * rte_get_timer_hz() /
+		LLS_CACHE_SCAN_SLICES, PERIODICAL,
 		lls_conf->lcore_id, lls_scan, lls_conf);
 	if (ret < 0) {
 		RTE_LOG(ERR, TIMER, "Cannot set LLS scan timer\n");
 		goto stage3;
 	}
 
-	ret = init_mailbox("lls_req", MAILBOX_MAX_ENTRIES,
+	mb_params.max_entries = lls_conf->mailbox_max_entries;
+	mb_params.mem_cache_size = lls_conf->mailbox_mem_cache_size;
+	mb_params.watermark = lls_conf->mailbox_watermark;
+	ret = init_mailbox("lls_req", &mb_params,
 		sizeof(struct lls_request), lls_conf->lcore_id,
 		&lls_conf->requests);
 	if (ret < 0)
 		goto timer;
 
+	lls_conf->nd_ring = rte_ring_create("lls_nd", LLS_ND_RING_SIZE,
+		rte_lcore_to_socket_id(lls_conf->lcore_id), RING_F_SC_DEQ);
+	if (lls_conf->nd_ring == NULL) {
+		RTE_LOG(ERR, RING,
+			"lls: cannot create the ring of ND packets\n");
+		ret = -1;
+		goto requests;
+	}
+
 	lls_conf->net = net_conf;
 	if (arp_enabled(lls_conf)) {
+		lls_conf->arp_cache.max_records = cache_max_records(net_conf,
+			&lls_conf->arp_cache,
+			net_conf->front.arp_cache_max_entries,
+			net_conf->back.arp_cache_max_entries);
 		ret = lls_cache_init(lls_conf, &lls_conf->arp_cache);
 		if (ret < 0) {
 			RTE_LOG(ERR, GATEKEEPER,
 				"lls: ARP cache cannot be started\n");
-			goto requests;
+			goto nd_ring;
 		}
 
 		/* Set timeouts for front and back (if needed). */
@@ -499,6 +637,10 @@ run_lls(struct net_config *net_conf, struct lls_config *lls_conf)
 	}
 
 	if (nd_enabled(lls_conf)) {
+		lls_conf->nd_cache.max_records = cache_max_records(net_conf,
+			&lls_conf->nd_cache,
+			net_conf->front.nd_cache_max_entries,
+			net_conf->back.nd_cache_max_entries);
 		ret = lls_cache_init(lls_conf, &lls_conf->nd_cache);
 		if (ret < 0) {
 			RTE_LOG(ERR, GATEKEEPER,
@@ -516,11 +658,14 @@ run_lls(struct net_config *net_conf, struct lls_config *lls_conf)
 				lls_conf->net->back.nd_cache_timeout_sec;
 	}
 
+	log_heap_reserved("lls", "at configuration", before);
 	return 0;
 
 arp:
 	if (arp_enabled(lls_conf))
 		lls_cache_destroy(&lls_conf->arp_cache);
+nd_ring:
+	free_nd_ring(lls_conf->nd_ring);
 requests:
 	destroy_mailbox(&lls_conf->requests);
 timer:
@@ -531,6 +676,9 @@ stage2:
 	pop_n_at_stage2(1);
 stage1:
 	pop_n_at_stage1(1);
+stats:
+	stats_free("lls", lls_conf->lcore_id);
+	lls_conf->stats = NULL;
 out:
 	return ret;
 }
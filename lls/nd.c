@@ -20,6 +20,7 @@
 #include <stdbool.h>
 
 #include <rte_ip.h>
+#include <rte_cycles.h>
 
 #include "cache.h"
 #include "nd.h"
@@ -198,7 +199,7 @@ int ipv6_in_subnet(struct gatekeeper_if *iface, const void *ip_be)
  */
 void
 xmit_nd_req(struct gatekeeper_if *iface, const uint8_t *ip_be,
-	const struct ether_addr *ha, uint16_t tx_queue)
+	const struct ether_addr *ha, struct gatekeeper_tx_buf *tx_buf)
 {
 	struct lls_config *lls_conf = get_lls_conf();
 
@@ -278,11 +279,7 @@ xmit_nd_req(struct gatekeeper_if *iface, const uint8_t *ip_be,
 
 	icmpv6_hdr->cksum = rte_ipv6_icmpv6_cksum(ipv6_hdr, icmpv6_hdr);
 
-	if (rte_eth_tx_burst(iface->id, tx_queue, &created_pkt, 1) <= 0) {
-		rte_pktmbuf_free(created_pkt);
-		RTE_LOG(ERR, GATEKEEPER,
-			"lls: could not send an ND Neighbor Solicitation\n");
-	}
+	tx_buf_add(tx_buf, created_pkt, rte_rdtsc());
 }
 
 /*
@@ -347,7 +344,7 @@ static int
 process_nd_neigh_solicitation(struct lls_config *lls_conf, struct rte_mbuf *buf,
 	struct ether_hdr *eth_hdr, struct ipv6_hdr *ipv6_hdr,
 	struct icmpv6_hdr *icmpv6_hdr, uint16_t pkt_len, uint16_t icmpv6_len,
-	struct gatekeeper_if *iface, uint16_t tx_queue)
+	struct gatekeeper_if *iface, struct gatekeeper_tx_buf *tx_buf)
 {
 	struct nd_neigh_msg *nd_msg = (struct nd_neigh_msg *)&icmpv6_hdr[1];
 	struct nd_opt_lladdr *nd_opt;
@@ -512,10 +509,7 @@ process_nd_neigh_solicitation(struct lls_config *lls_conf, struct rte_mbuf *buf,
 
 		icmpv6_hdr->cksum = rte_ipv6_icmpv6_cksum(ipv6_hdr, icmpv6_hdr);
 
-		if (rte_eth_tx_burst(iface->id, tx_queue, &buf, 1) <= 0) {
-			RTE_LOG(ERR, GATEKEEPER, "lls: could not send an ND Neighbor Advertisement in response to a Solicitation\n");
-			return -1;
-		}
+		tx_buf_add(tx_buf, buf, rte_rdtsc());
 	} else {
 		/*
 		 * Can't respond to the original solicitation
@@ -572,10 +566,7 @@ process_nd_neigh_solicitation(struct lls_config *lls_conf, struct rte_mbuf *buf,
 
 		icmpv6_hdr->cksum = rte_ipv6_icmpv6_cksum(ipv6_hdr, icmpv6_hdr);
 
-		if (rte_eth_tx_burst(iface->id, tx_queue, &buf, 1) <= 0) {
-			RTE_LOG(ERR, GATEKEEPER, "lls: could not send an ND Neighbor Solicitation in response to a Solicitation\n");
-			return -1;
-		}
+		tx_buf_add(tx_buf, buf, rte_rdtsc());
 	}
 
 	return 0;
@@ -682,9 +673,9 @@ process_nd(struct lls_config *lls_conf, struct gatekeeper_if *iface,
 	struct ipv6_hdr *ipv6_hdr = (struct ipv6_hdr *)&eth_hdr[1];
 	struct icmpv6_hdr *icmpv6_hdr = (struct icmpv6_hdr *)&ipv6_hdr[1];
 
-	uint16_t tx_queue = iface == &lls_conf->net->front
-		? lls_conf->tx_queue_front
-		: lls_conf->tx_queue_back;
+	struct gatekeeper_tx_buf *tx_buf = iface == &lls_conf->net->front
+		? &lls_conf->tx_buf_front
+		: &lls_conf->tx_buf_back;
 	uint16_t pkt_len = rte_pktmbuf_data_len(buf);
 	uint16_t icmpv6_len = pkt_len - (sizeof(struct ether_hdr) +
 		sizeof(*ipv6_hdr));
@@ -696,7 +687,7 @@ process_nd(struct lls_config *lls_conf, struct gatekeeper_if *iface,
 	case ND_NEIGHBOR_SOLICITATION:
 		return process_nd_neigh_solicitation(lls_conf, buf, eth_hdr,
 			ipv6_hdr, icmpv6_hdr, pkt_len, icmpv6_len,
-			iface, tx_queue);
+			iface, tx_buf);
 	case ND_NEIGHBOR_ADVERTISEMENT:
 		return process_nd_neigh_advertisement(lls_conf,
 			ipv6_hdr, icmpv6_hdr, icmpv6_len, iface);
@@ -34,7 +34,7 @@ int ipv6_in_subnet(struct gatekeeper_if *iface, const void *ip_be);
 
 /* Transmit an ND request packet. */
 void xmit_nd_req(struct gatekeeper_if *iface, const uint8_t *ip_be,
-	const struct ether_addr *ha, uint16_t tx_queue);
+	const struct ether_addr *ha, struct gatekeeper_tx_buf *tx_buf);
 
 /*
  * Process an ND neighbor packet that arrived on @iface.
@@ -0,0 +1,228 @@
+/*
+ * Gatekeeper - DoS protection system.
+ * Copyright (C) 2016 Digirati LTDA.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <rte_log.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_memcpy.h>
+
+#include "gatekeeper_lls.h"
+#include "gatekeeper_main.h"
+
+struct lls_nh_cache *
+lls_nh_cache_create(unsigned int max_entries, unsigned int lcore_id)
+{
+	unsigned int i;
+	int socket_id = rte_lcore_to_socket_id(lcore_id);
+	struct lls_nh_cache *cache = rte_zmalloc_socket("lls_nh_cache",
+		sizeof(*cache), 0, socket_id);
+
+	if (cache == NULL)
+		goto out;
+
+	cache->entries = rte_zmalloc_socket("lls_nh_entries",
+		max_entries * sizeof(*cache->entries), 0, socket_id);
+	if (cache->entries == NULL)
+		goto cache;
+
+	for (i = 0; i < max_entries; i++)
+		cache->entries[i].cache = cache;
+	cache->lcore_id = lcore_id;
+	cache->max_entries = max_entries;
+	rte_atomic32_set(&cache->ref_cnt, 1);
+	return cache;
+
+cache:
+	rte_free(cache);
+out:
+	RTE_LOG(ERR, MALLOC,
+		"lls: failed to allocate the next-hop cache of lcore %u\n",
+		lcore_id);
+	return NULL;
+}
+
+static void
+nh_cache_put(struct lls_nh_cache *cache)
+{
+	if (rte_atomic32_dec_and_test(&cache->ref_cnt)) {
+		rte_free(cache->entries);
+		rte_free(cache);
+	}
+}
+
+/*
+ * Whether @entry is still held for the address of @map. The owner of
+ * an entry may release it and hold it for another address before the
+ * LLS block has removed the old hold.
+ */
+static inline bool
+nh_entry_is_map(const struct lls_nh_entry *entry, const struct lls_map *map)
+{
+	uint16_t proto = entry->proto;
+
+	if (proto == ETHER_TYPE_IPv4)
+		return memcmp(entry->ip_be, map->ip_be,
+			sizeof(struct in_addr)) == 0;
+	if (proto == ETHER_TYPE_IPv6)
+		return memcmp(entry->ip_be, map->ip_be,
+			sizeof(struct in6_addr)) == 0;
+	return false;
+}
+
+/* Callback of the holds of the next-hop caches; run by the LLS block. */
+static void
+nh_cache_cb(const struct lls_map *map, void *arg,
+	enum lls_reply_ty ty, int *pcall_again)
+{
+	unsigned int i;
+	uint64_t state = 0;
+	struct lls_nh_entry *entry = arg;
+	struct lls_nh_cache *cache = entry->cache;
+
+	if (ty == LLS_REPLY_FREE) {
+		nh_cache_put(cache);
+		return;
+	}
+
+	*pcall_again = true;
+
+	if (!nh_entry_is_map(entry, map))
+		return;
+
+	/* A map that has never been resolved has no address to keep. */
+	if (map->stale && !(entry->state & LLS_NH_RESOLVED))
+		return;
+
+	for (i = 0; i < ETHER_ADDR_LEN; i++)
+		state |= (uint64_t)map->ha.addr_bytes[i] << (8 * i);
+	state |= LLS_NH_RESOLVED;
+	if (map->stale)
+		state |= LLS_NH_STALE;
+
+	entry->state = state;
+	/*
+	 * If the owner took the entry for another address meanwhile,
+	 * the address of the old map must not stay in the entry; pairs
+	 * with the barrier of lls_nh_cache_hold().
+	 */
+	rte_mb();
+	if (!nh_entry_is_map(entry, map))
+		entry->state = 0;
+	/* The owner must see the new entry once it sees the new version. */
+	rte_wmb();
+	cache->version++;
+}
+
+/*
+ * Place a hold on the map of the IP address @ip_be of protocol @proto
+ * for the entry @idx of @cache, which must be free.
+ */
+int
+lls_nh_cache_hold(struct lls_nh_cache *cache, unsigned int idx,
+	uint16_t proto, const void *ip_be)
+{
+	int ret;
+	struct lls_nh_entry *entry;
+
+	if (idx >= cache->max_entries || cache->entries[idx].proto != 0) {
+		RTE_LOG(ERR, GATEKEEPER,
+			"lls: entry %u of the next-hop cache of lcore %u is not available\n",
+			idx, cache->lcore_id);
+		return -1;
+	}
+
+	entry = &cache->entries[idx];
+	memcpy(entry->ip_be, ip_be, proto == ETHER_TYPE_IPv4
+		? sizeof(struct in_addr) : sizeof(struct in6_addr));
+	entry->proto = proto;
+	/*
+	 * The callbacks of a previous hold of the entry don't write it
+	 * once they see the new address; see nh_cache_cb().
+	 */
+	rte_mb();
+	entry->state = 0;
+
+	rte_atomic32_inc(&cache->ref_cnt);
+	if (proto == ETHER_TYPE_IPv4)
+		ret = hold_arp(nh_cache_cb, entry,
+			(struct in_addr *)entry->ip_be, cache->lcore_id);
+	else
+		ret = hold_nd(nh_cache_cb, entry,
+			(struct in6_addr *)entry->ip_be, cache->lcore_id);
+
+	if (ret < 0) {
+		entry->proto = 0;
+		nh_cache_put(cache);
+	}
+	return ret;
+}
+
+/*
+ * Release the hold of the entry @idx of @cache, if any,
+ * so the entry can be held again for another address.
+ */
+void
+lls_nh_cache_put(struct lls_nh_cache *cache, unsigned int idx)
+{
+	struct lls_nh_entry *entry = &cache->entries[idx];
+
+	if (entry->proto == ETHER_TYPE_IPv4)
+		put_arp((struct in_addr *)entry->ip_be, cache->lcore_id);
+	else if (entry->proto == ETHER_TYPE_IPv6)
+		put_nd((struct in6_addr *)entry->ip_be, cache->lcore_id);
+	else
+		return;
+
+	entry->proto = 0;
+	/* Pairs with the barrier of nh_cache_cb(). */
+	rte_mb();
+	entry->state = 0;
+}
+
+/*
+ * Release the holds of @cache. The cache is freed once
+ * the LLS block has removed all of them.
+ */
+void
+lls_nh_cache_release(struct lls_nh_cache *cache)
+{
+	unsigned int i;
+
+	/*
+	 * While Gatekeeper exits, the LLS block and its mailbox
+	 * may already be gone, so the cache is left as it is.
+	 */
+	if (cache == NULL || exiting)
+		return;
+
+	for (i = 0; i < cache->max_entries; i++) {
+		struct lls_nh_entry *entry = &cache->entries[i];
+
+		if (entry->proto == ETHER_TYPE_IPv4)
+			put_arp((struct in_addr *)entry->ip_be,
+				cache->lcore_id);
+		else if (entry->proto == ETHER_TYPE_IPv6)
+			put_nd((struct in6_addr *)entry->ip_be,
+				cache->lcore_id);
+	}
+
+	nh_cache_put(cache);
+}
@@ -0,0 +1,26 @@
+-- Only one of gk_conf and gt_conf is set: the Dynamic Config block
+-- updates the FIBs of a Gatekeeper server, or reloads the policy
+-- of a Grantor server.
+return function (gk_conf, gt_conf, numa_table)
+
+	-- Init the Dynamic Config configuration structure.
+	local dy_conf = gatekeeper.c.alloc_dy_conf()
+	if dy_conf == nil then
+		error("Failed to allocate dy_conf")
+	end
+
+	-- Change these parameters to configure the Dynamic Config block.
+	dy_conf.lcore_id = gatekeeper.alloc_an_lcore(numa_table)
+	dy_conf.mailbox_max_entries = 128
+	dy_conf.mailbox_mem_cache_size = 0
+	dy_conf.mailbox_watermark = 96
+
+	-- Setup the Dynamic Config functional block.
+	local ret = gatekeeper.c.run_dynamic_config(gk_conf, gt_conf,
+		dy_conf)
+	if ret < 0 then
+		error("Failed to run dynamic config block")
+	end
+
+	return dy_conf
+end
@@ -99,6 +99,19 @@ local ffi = require("ffi")
 -- Structs
 ffi.cdef[[
 
+enum gk_fib_action {
+	GK_FWD_GRANTOR,
+	GK_FWD_BACK,
+	GK_DROP,
+};
+
+/* The bonding modes of rte_eth_bond.h that interfaces support. */
+enum bonding_mode {
+	BONDING_MODE_ROUND_ROBIN = 0,
+	BONDING_MODE_BALANCE = 2,
+	BONDING_MODE_8023AD = 4,
+};
+
 struct gatekeeper_if {
 	char     **pci_addrs;
 	uint8_t  num_ports;
@@ -107,6 +120,12 @@ struct gatekeeper_if {
 	uint16_t num_tx_queues;
 	uint32_t arp_cache_timeout_sec;
 	uint32_t nd_cache_timeout_sec;
+	uint32_t arp_cache_max_entries;
+	uint32_t nd_cache_max_entries;
+	bool     hw_nd_filter;
+	bool     rx_intr;
+	uint8_t  bonding_mode;
+	uint16_t mtu;
 	/* This struct has hidden fields. */
 };
 
@@ -115,27 +134,83 @@ struct net_config {
 	/* This struct has hidden fields. */
 };
 
+struct poll_config {
+	uint16_t num_rx_desc;
+	uint16_t num_tx_desc;
+	uint16_t min_pkt_burst;
+	uint16_t max_pkt_burst;
+	uint32_t max_idle_pauses;
+	uint32_t rx_intr_timeout_ms;
+};
+
+struct capture_config {
+	unsigned int sample_rate;
+	unsigned int classes;
+};
+
 struct gk_config {
 	unsigned int flow_ht_size;
+	unsigned int request_timeout_sec;
+	unsigned int flow_table_scan_iter;
+	unsigned int mailbox_max_entries;
+	unsigned int mailbox_mem_cache_size;
+	unsigned int mailbox_watermark;
+	unsigned int cmd_budget_us;
+	unsigned int cmd_drain_budget_us;
+	unsigned int request_queue_len;
+	unsigned int request_rate_kb_sec;
+	unsigned int request_burst_kb;
+	unsigned int max_num_ipv4_rules;
+	unsigned int num_ipv4_tbl8s;
+	unsigned int max_num_ipv6_rules;
+	unsigned int num_ipv6_tbl8s;
+	unsigned int offload_max_rules;
+	unsigned int offload_min_drops;
+	bool track_talkers;
+	struct poll_config poll;
+	struct capture_config capture;
 	/* This struct has hidden fields. */
 };
 
 struct ggu_config {
-	unsigned int      lcore_id;
 	uint16_t          ggu_src_port;
 	uint16_t          ggu_dst_port;
+	uint16_t          num_ggu_src_ports;
+	int               coalesce_decisions;
+	struct poll_config poll;
 	/* This struct has hidden fields. */
 };
 
 struct lls_config {
 	unsigned int lcore_id;
 	int          debug;
+	unsigned int mailbox_max_entries;
+	unsigned int mailbox_mem_cache_size;
+	unsigned int mailbox_watermark;
+	unsigned int max_holds;
+	struct poll_config poll;
+	/* This struct has hidden fields. */
+};
+
+struct dynamic_config {
+	unsigned int lcore_id;
+	unsigned int mailbox_max_entries;
+	unsigned int mailbox_mem_cache_size;
+	unsigned int mailbox_watermark;
 	/* This struct has hidden fields. */
 };
 
 struct gt_config {
 	uint16_t     ggu_src_port;
 	uint16_t     ggu_dst_port;
+	uint16_t     num_ggu_src_ports;
+	unsigned int max_ggu_notify_delay_ms;
+	unsigned int decision_cache_size;
+	unsigned int recent_decisions_size;
+	unsigned int recent_decision_window_ms;
+	unsigned int ggu_pd_version;
+	struct poll_config poll;
+	struct capture_config capture;
 	/* This struct has hidden fields. */
 };
 
@@ -154,18 +229,35 @@ struct gatekeeper_if *get_if_front(struct net_config *net_conf);
 struct gatekeeper_if *get_if_back(struct net_config *net_conf);
 int gatekeeper_init_network(struct net_config *net_conf);
 
+int capture_open(const char *path);
+
 struct gk_config *alloc_gk_conf(void);
 int run_gk(struct net_config *net_conf, struct gk_config *gk_conf);
+int gk_set_flow_persist_dir(struct gk_config *gk_conf, const char *dir);
+int add_fib_entry(const char *prefix, const char *gateway,
+	int action, struct gk_config *gk_conf);
+int del_fib_entry(const char *prefix, struct gk_config *gk_conf);
 
 struct ggu_config *alloc_ggu_conf(void);
 int run_ggu(struct net_config *net_conf,
 	struct gk_config *gk_conf, struct ggu_config *ggu_conf);
-int cleanup_ggu(struct ggu_config *ggu_conf);
 
 struct lls_config *get_lls_conf(void);
 int run_lls(struct net_config *net_conf, struct lls_config *lls_conf);
 
+struct dynamic_config *alloc_dy_conf(void);
+int run_dynamic_config(struct gk_config *gk_conf, struct gt_config *gt_conf,
+	struct dynamic_config *dy_conf);
+int dy_add_fib_entry(const char *prefix, const char *gateway,
+	int action, struct dynamic_config *dy_conf);
+int dy_del_fib_entry(const char *prefix, struct dynamic_config *dy_conf);
+int dy_export_flows(const char *path, struct dynamic_config *dy_conf);
+int dy_import_flows(const char *path, struct dynamic_config *dy_conf);
+int dy_reload_gt_policy(struct dynamic_config *dy_conf);
+int dy_report_talkers(const char *path, struct dynamic_config *dy_conf);
+
 struct gt_config *alloc_gt_conf(void);
+int gt_set_front_gateway(const char *ip_addr, struct gt_config *gt_conf);
 int run_gt(struct net_config *net_conf, struct gt_config *gt_conf);
 
 ]]
@@ -12,6 +12,14 @@ function gatekeeper_init()
 	-- Otherwise, it will run as a grantor server.
 	local gatekeeper_server = false
 
+	-- Set to a path to capture the packets sampled by
+	-- the GK and GT blocks there, in the pcap format.
+	local capture_file = nil
+	if capture_file ~= nil and
+			gatekeeper.c.capture_open(capture_file) < 0 then
+		error("Failed to open the capture file")
+	end
+
 	local numa_table = gatekeeper.get_numa_table()
 
 	local netf = require("net")
@@ -22,13 +30,19 @@ function gatekeeper_init()
 
 	if gatekeeper_server == true then
 		local gkf = require("gk")
-		local gk_conf, ggu_lcore = gkf(net_conf, numa_table)
+		local gk_conf, ggu_lcores = gkf(net_conf, numa_table)
 
 		local gguf = require("ggu")
-		local ggu_conf = gguf(net_conf, gk_conf, ggu_lcore)
+		local ggu_conf = gguf(net_conf, gk_conf, ggu_lcores)
+
+		local dyf = require("dynamic")
+		local dy_conf = dyf(gk_conf, nil, numa_table)
 	else
 		local gtf = require("gt")
 		local gt_conf = gtf(net_conf, numa_table)
+
+		local dyf = require("dynamic")
+		local dy_conf = dyf(nil, gt_conf, numa_table)
 	end
 
 	return 0
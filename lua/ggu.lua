@@ -1,4 +1,4 @@
-return function (net_conf, gk_conf, lcore)
+return function (net_conf, gk_conf, lcores)
 
 	-- Init the GGU configuration structure.
 	local ggu_conf = gatekeeper.c.alloc_ggu_conf()
@@ -6,9 +6,16 @@ return function (net_conf, gk_conf, lcore)
 		error("Failed to allocate ggu_conf")
 	end
 
-	ggu_conf.lcore_id = lcore
+	gatekeeper.ggu_assign_lcores(ggu_conf, lcores)
+	-- The Grantor servers must use the same range of source ports.
 	ggu_conf.ggu_src_port = 0xA0A0
 	ggu_conf.ggu_dst_port = 0xB0B0
+	ggu_conf.num_ggu_src_ports = 8
+	ggu_conf.coalesce_decisions = true
+	ggu_conf.poll.num_rx_desc = 128
+	ggu_conf.poll.max_pkt_burst = 32
+	ggu_conf.poll.max_idle_pauses = 1024
+	ggu_conf.poll.rx_intr_timeout_ms = 10
 
 	-- Setup the GGU functional block.
 	local ret = gatekeeper.c.run_ggu(net_conf, gk_conf, ggu_conf)
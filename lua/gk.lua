@@ -8,18 +8,84 @@ return function (net_conf, numa_table)
 	
 	-- Change these parameters to configure the Gatekeeper.
 	gk_conf.flow_ht_size = 1024
+	gk_conf.request_timeout_sec = 60
+	gk_conf.flow_table_scan_iter = 16
+	gk_conf.mailbox_max_entries = 512
+	gk_conf.mailbox_mem_cache_size = 64
+	gk_conf.mailbox_watermark = 384
+	gk_conf.cmd_budget_us = 20
+	gk_conf.cmd_drain_budget_us = 200
+	-- Requests get about 5% of a 10Gbps back link.
+	gk_conf.request_queue_len = 2048
+	gk_conf.request_rate_kb_sec = 62500
+	gk_conf.request_burst_kb = 64
+	gk_conf.max_num_ipv4_rules = 1024
+	gk_conf.num_ipv4_tbl8s = 256
+	gk_conf.max_num_ipv6_rules = 1024
+	gk_conf.num_ipv6_tbl8s = 65536
+	-- The 82599 has 128 ntuple filters for the NIC to drop the
+	-- declined IPv4 flows of the GK blocks; set it to 0 to drop
+	-- them all in software.
+	gk_conf.offload_max_rules = 128
+	gk_conf.offload_min_drops = 1024
+	-- Track the top talkers for dy_report_talkers().
+	gk_conf.track_talkers = true
+	-- RX bursts adapt between 16 and 64 packets. Idle blocks
+	-- back off up to 1024 pauses, then sleep for at most 10ms if
+	-- the front interface has RX interrupts enabled.
+	gk_conf.poll.num_rx_desc = 128
+	gk_conf.poll.num_tx_desc = 512
+	gk_conf.poll.min_pkt_burst = 16
+	gk_conf.poll.max_pkt_burst = 64
+	gk_conf.poll.max_idle_pauses = 1024
+	gk_conf.poll.rx_intr_timeout_ms = 10
+	-- Set the sample rate to capture one out of that many packets
+	-- into the capture file of gatekeeper_config.lua. The classes
+	-- select flow states as bits, e.g. 1 for requests only.
+	gk_conf.capture.sample_rate = 0
+	gk_conf.capture.classes = 0
+	-- Set to a directory, preferably on a hugetlbfs mount, to keep
+	-- the granted and declined flows across restarts.
+	local flow_persist_dir = nil
 	local n_lcores = 2
+	-- The GGU instances run on the NUMA node of the GK blocks.
+	local n_ggu_lcores = 2
 
 	local gk_lcores = gatekeeper.alloc_lcores_from_same_numa(numa_table,
-		n_lcores + 1)
-	local ggu_lcore = table.remove(gk_lcores)
+		n_lcores + n_ggu_lcores)
+	local ggu_lcores = {}
+	for i = 1, n_ggu_lcores do
+		table.insert(ggu_lcores, 1, table.remove(gk_lcores))
+	end
 	gatekeeper.gk_assign_lcores(gk_conf, gk_lcores)
 
+	if flow_persist_dir ~= nil then
+		local ret = gatekeeper.c.gk_set_flow_persist_dir(gk_conf,
+			flow_persist_dir)
+		if ret < 0 then
+			error("Failed to set the flow persistence directory")
+		end
+	end
+
 	-- Setup the GK functional block.
 	local ret = gatekeeper.c.run_gk(net_conf, gk_conf)
 	if ret < 0 then
 		error("Failed to run gk block(s)")
 	end
 
-	return gk_conf, ggu_lcore
+	-- Setup the FIB: which destinations are protected by which
+	-- Grantor servers, and which are simply forwarded.
+	local fib_entries = {
+		{ "192.0.2.0/24", "10.0.0.254", gatekeeper.c.GK_FWD_GRANTOR },
+		{ "2001:db8:1::/48", "2001:db8::254",
+			gatekeeper.c.GK_FWD_GRANTOR },
+	}
+	for i, v in ipairs(fib_entries) do
+		ret = gatekeeper.c.add_fib_entry(v[1], v[2], v[3], gk_conf)
+		if ret < 0 then
+			error("Failed to add FIB entry " .. v[1])
+		end
+	end
+
+	return gk_conf, ggu_lcores
 end
@@ -9,6 +9,32 @@ return function (net_conf, numa_table)
 	-- Change these parameters to configure the Grantor.
 	gt_conf.ggu_src_port = 0xA0A0
 	gt_conf.ggu_dst_port = 0xB0B0
+	gt_conf.num_ggu_src_ports = 8
+	gt_conf.max_ggu_notify_delay_ms = 1
+	gt_conf.decision_cache_size = 65536
+	gt_conf.recent_decisions_size = 4096
+	gt_conf.recent_decision_window_ms = 10
+	-- Set to 1 while there are Gatekeeper servers that
+	-- only understand version 1 of the notification packets.
+	gt_conf.ggu_pd_version = 2
+	gt_conf.poll.num_rx_desc = 128
+	gt_conf.poll.num_tx_desc = 512
+	gt_conf.poll.min_pkt_burst = 16
+	gt_conf.poll.max_pkt_burst = 64
+	gt_conf.poll.max_idle_pauses = 1024
+	gt_conf.poll.rx_intr_timeout_ms = 10
+	-- Set the sample rate to capture one out of that many requests
+	-- into the capture file of gatekeeper_config.lua.
+	gt_conf.capture.sample_rate = 0
+
+	-- The gateways of the front interface that receive
+	-- the packets of the granted flows.
+	local front_gateways = { "10.0.0.254", "2001:db8::254" }
+	for i, v in ipairs(front_gateways) do
+		if gatekeeper.c.gt_set_front_gateway(v, gt_conf) < 0 then
+			error("Failed to set front gateway " .. v)
+		end
+	end
 
 	local n_lcores = 2
 
@@ -8,6 +8,14 @@ return function (net_conf, numa_table)
 
 	-- Change these parameters to configure the LLS block.
 	lls_conf.debug = false
+	lls_conf.mailbox_max_entries = 128
+	lls_conf.mailbox_mem_cache_size = 64
+	lls_conf.mailbox_watermark = 0
+	lls_conf.max_holds = 4096
+	lls_conf.poll.num_rx_desc = 128
+	lls_conf.poll.num_tx_desc = 512
+	lls_conf.poll.max_pkt_burst = 32
+	lls_conf.poll.max_idle_pauses = 1024
 
 	-- Setup the LLS functional block.
 	lls_conf.lcore_id = gatekeeper.alloc_an_lcore(numa_table)
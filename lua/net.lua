@@ -10,12 +10,34 @@ return function (gatekeeper_server)
 	local front_ips  = {"10.0.0.1/24", "2001:db8::1/32"}
 	local front_arp_cache_timeout_sec = 7200
 	local front_nd_cache_timeout_sec = 7200
+	local front_arp_cache_max_entries = 1024
+	local front_nd_cache_max_entries = 1024
+	-- Steering ND packets in hardware also steers all
+	-- other ICMPv6 packets away from the GK/GT blocks.
+	local front_hw_nd_filter = false
+	-- Let idle blocks sleep on RX interrupts; see
+	-- rx_intr_timeout_ms in the configuration of the blocks.
+	local front_rx_intr = false
+	-- How the front ports are bonded when there are several of them:
+	-- BONDING_MODE_ROUND_ROBIN, which reorders the packets of flows,
+	-- BONDING_MODE_BALANCE (static XOR), or BONDING_MODE_8023AD (LACP).
+	-- LACP needs rx_intr_timeout_ms below 100 in the blocks.
+	local front_bonding_mode = gatekeeper.c.BONDING_MODE_ROUND_ROBIN
+	-- Use e.g. 9000 for jumbo frames.
+	local front_mtu = 1500
 
 	local back_iface_enabled = gatekeeper_server
 	local back_ports = {"enp133s0f1"}
 	local back_ips  = {"10.0.0.2/24", "2001:db8::2/32"}
 	local back_arp_cache_timeout_sec = 7200
 	local back_nd_cache_timeout_sec = 7200
+	local back_arp_cache_max_entries = 1024
+	local back_nd_cache_max_entries = 1024
+	local back_rx_intr = false
+	local back_bonding_mode = gatekeeper.c.BONDING_MODE_ROUND_ROBIN
+	-- Room for the outer IPv6 header of the packets of
+	-- the front interface that go to Grantor servers.
+	local back_mtu = front_mtu + 40
 
 	--
 	-- Code below this point should not need to be changed.
@@ -25,6 +47,12 @@ return function (gatekeeper_server)
 	local front_iface = gatekeeper.c.get_if_front(net_conf)
 	front_iface.arp_cache_timeout_sec = front_arp_cache_timeout_sec
 	front_iface.nd_cache_timeout_sec = front_nd_cache_timeout_sec
+	front_iface.arp_cache_max_entries = front_arp_cache_max_entries
+	front_iface.nd_cache_max_entries = front_nd_cache_max_entries
+	front_iface.hw_nd_filter = front_hw_nd_filter
+	front_iface.rx_intr = front_rx_intr
+	front_iface.bonding_mode = front_bonding_mode
+	front_iface.mtu = front_mtu
 	local ret = gatekeeper.init_iface(front_iface, "front",
 		front_ports, front_ips)
 
@@ -33,6 +61,11 @@ return function (gatekeeper_server)
 		local back_iface = gatekeeper.c.get_if_back(net_conf)
 		back_iface.arp_cache_timeout_sec = back_arp_cache_timeout_sec
 		back_iface.nd_cache_timeout_sec = back_nd_cache_timeout_sec
+		back_iface.arp_cache_max_entries = back_arp_cache_max_entries
+		back_iface.nd_cache_max_entries = back_nd_cache_max_entries
+		back_iface.rx_intr = back_rx_intr
+		back_iface.bonding_mode = back_bonding_mode
+		back_iface.mtu = back_mtu
 		ret = gatekeeper.init_iface(back_iface, "back",
 			back_ports, back_ips)
 	end
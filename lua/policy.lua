@@ -54,6 +54,10 @@ local simple_policies = {
 
 GLOBAL_POLICIES["simple_policy"] = simple_policies
 
+local function ntohs(port)
+	return bit.bor(bit.rshift(port, 8), bit.lshift(bit.band(port, 0xFF), 8))
+end
+
 -- Function that looks up the simple policy for the packet.
 local function lookup_simple_policy(policies, pkt_info)
 
@@ -63,11 +67,11 @@ local function lookup_simple_policy(policies, pkt_info)
 	-- TODO The Lua policy should be responsible for
 	-- checking the necessary space for each l4 header type.
 	if ph.l4_proto == policylib.c.TCP then
-		local tcphdr = ffi.cast("struct tcp_hdr *", fields.l4_hdr)
-		dest_port = tcphdr.dst_port
+		local tcphdr = ffi.cast("struct tcp_hdr *", ph.l4_hdr)
+		dest_port = ntohs(tcphdr.dst_port)
 	elseif ph.l4_proto == policylib.c.UDP then
-		local udphdr = ffi.cast("struct udp_hdr *", fields.l4_hdr)
-		dest_port = udphdr.dst_port
+		local udphdr = ffi.cast("struct udp_hdr *", ph.l4_hdr)
+		dest_port = ntohs(udphdr.dst_port)
 	else
 		-- TODO Add support for other transport protocols.
 		return nil
@@ -84,14 +88,7 @@ local function lookup_simple_policy(policies, pkt_info)
 	return nil
 end
 
-function lookup_policy(pkt_info, policy)
-	local ph = ffi.cast("struct gt_packet_headers *",pkt_info)
-	local pl = ffi.cast("struct ggu_policy *", policy)
-
-	-- Lookup the simple policy.
-	local group = lookup_simple_policy(GLOBAL_POLICIES["simple_policy"], ph)
-	if group == nil then group = default end
-
+local function fill_policy(pl, group)
 	pl.state = group["params"]["action"]
 
 	if pl.state == policylib.c.GK_DECLINED then
@@ -108,3 +105,87 @@ function lookup_policy(pkt_info, policy)
 			group["params"]["renewal_step_ms"]
 	end
 end
+
+function lookup_policy(pkt_info, policy)
+	local ph = ffi.cast("struct gt_packet_headers *",pkt_info)
+	local pl = ffi.cast("struct ggu_policy *", policy)
+
+	-- Lookup the simple policy.
+	local group = lookup_simple_policy(GLOBAL_POLICIES["simple_policy"], ph)
+	if group == nil then group = default end
+
+	fill_policy(pl, group)
+end
+
+--[[
+Function that looks up the policies of a burst of @num_pkts requests.
+@pkt_infos and @policies are C arrays indexed from 0.
+
+Gatekeeper prefers this function over lookup_policy(), so a whole
+burst goes through a single call into Lua.
+--]]
+function lookup_policy_burst(pkt_infos, policies, num_pkts)
+	local simple_policy = GLOBAL_POLICIES["simple_policy"]
+
+	for i = 0, num_pkts - 1 do
+		local group = lookup_simple_policy(simple_policy,
+			pkt_infos + i)
+		if group == nil then group = default end
+
+		fill_policy(policies + i, group)
+	end
+end
+
+--[[
+Gatekeeper calls this function once after loading this file to compile
+the simple policies into C lookup structures, so lookup_policy() only
+runs for packets that no simple policy covers.
+
+A simple policy matches either a destination port, optionally
+restricted to a transport protocol with "l4_proto", or a destination
+prefix given by "dest_ip" and "prefix_len". The default group is left
+to lookup_policy(), whose decisions Gatekeeper caches.
+--]]
+function compile_policy(handle)
+	local sp = ffi.cast("struct gt_simple_policy *", handle)
+	local pl = ffi.new("struct ggu_policy")
+	local group_ids = {}
+
+	for id, group in pairs(groups) do
+		fill_policy(pl, group)
+		if policylib.c.gt_simple_policy_add_group(sp, id, pl) < 0 then
+			error("Failed to compile group " .. id)
+		end
+		group_ids[group] = id
+	end
+
+	for ip_ver, tables in pairs(GLOBAL_POLICIES["simple_policy"]) do
+		for i, v in ipairs(tables) do
+			for j, g in ipairs(v) do
+				local id = group_ids[g["policy_id"]]
+				local ret = 0
+
+				if g["dest_port"] ~= nil then
+					local protos = { g["l4_proto"] }
+					if g["l4_proto"] == nil then
+						protos = { policylib.c.TCP,
+							policylib.c.UDP }
+					end
+					for k, proto in ipairs(protos) do
+						ret = policylib.c.gt_simple_policy_add_port(
+							sp, ip_ver, proto,
+							g["dest_port"], id)
+						if ret < 0 then break end
+					end
+				elseif g["dest_ip"] ~= nil then
+					ret = policylib.c.gt_simple_policy_add_prefix(
+						sp, g["dest_ip"], g["prefix_len"], id)
+				end
+
+				if ret < 0 then
+					error("Failed to compile the simple policies")
+				end
+			end
+		end
+	end
+end
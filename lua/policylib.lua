@@ -67,6 +67,7 @@ struct gt_packet_headers {
 	uint16_t outer_ip_ver;
 	uint16_t inner_ip_ver;
 	uint8_t l4_proto;
+	uint8_t priority;
 
 	void *l2_hdr;
 	void *outer_l3_hdr;
@@ -110,6 +111,23 @@ struct ggu_policy {
 	}__attribute__((packed)) params;
 };
 
+struct gt_simple_policy;
+
+]]
+
+-- Functions and wrappers
+ffi.cdef[[
+
+int gt_simple_policy_add_group(struct gt_simple_policy *policy,
+	uint8_t group_id, const struct ggu_policy *params);
+int gt_simple_policy_add_port(struct gt_simple_policy *policy,
+	uint16_t ip_ver, uint8_t l4_proto, uint16_t dst_port,
+	uint8_t group_id);
+int gt_simple_policy_add_prefix(struct gt_simple_policy *policy,
+	const char *ip_addr, uint8_t prefix_len, uint8_t group_id);
+int gt_simple_policy_set_default(struct gt_simple_policy *policy,
+	uint8_t group_id);
+
 ]]
 
 c = ffi.C
@@ -29,10 +29,12 @@
 #include <rte_cycles.h>
 #include <rte_timer.h>
 
+#include "gatekeeper_capture.h"
 #include "gatekeeper_main.h"
 #include "gatekeeper_config.h"
 #include "gatekeeper_net.h"
 #include "gatekeeper_launch.h"
+#include "gatekeeper_log.h"
 
 /* Indicates whether the program needs to exit or not. */
 volatile int exiting = false;
@@ -45,9 +47,12 @@ uint64_t cycles_per_sec;
 uint64_t cycles_per_ms;
 uint64_t picosec_per_cycle;
 
-/* Obtain the system time resolution. */
+/*
+ * Measure the TSC frequency against the system clock,
+ * which takes a second.
+ */
 static int
-time_resolution_init(void)
+measure_tsc_hz(uint64_t *ptsc_hz)
 {
 	int ret;
 	uint64_t diff_ns;
@@ -78,9 +83,27 @@ time_resolution_init(void)
 		}
 	}
 
-	cycles_per_sec = cycles * 1000000000UL / diff_ns;
+	*ptsc_hz = cycles * 1000000000UL / diff_ns;
+	return 0;
+}
+
+/* Obtain the system time resolution. */
+static int
+time_resolution_init(void)
+{
+	int ret;
+	/* The EAL already calibrated the TSC in rte_eal_init(). */
+	uint64_t tsc_hz = rte_get_tsc_hz();
+
+	if (tsc_hz == 0) {
+		ret = measure_tsc_hz(&tsc_hz);
+		if (ret < 0)
+			return ret;
+	}
+
+	cycles_per_sec = tsc_hz;
 	cycles_per_ms = cycles_per_sec / 1000UL;
-	picosec_per_cycle = 1000UL * diff_ns / cycles;
+	picosec_per_cycle = 1000000000000UL / cycles_per_sec;
 
 	RTE_LOG(NOTICE, TIMER,
 		"cycles/second = %" PRIu64 ", cycles/millisecond = %" PRIu64 ", picosec/cycle = %" PRIu64 "!\n",
@@ -135,8 +158,11 @@ main(int argc, char **argv)
 	if (ret < 0)
 		rte_exit(EXIT_FAILURE, "Error with EAL initialization!\n");
 
-	/* XXX Set the global log level. Change it as needed. */
-	rte_set_log_level(RTE_LOG_DEBUG);
+	/*
+	 * XXX Set the global log level. Change it as needed.
+	 * The debug level is expensive on the lcores of the blocks.
+	 */
+	rte_set_log_level(RTE_LOG_INFO);
 
 	/* Used by the LLS block. */
 	rte_timer_subsystem_init();
@@ -154,6 +180,10 @@ main(int argc, char **argv)
 	if (ret < 0)
 		goto out;
 
+	ret = init_log();
+	if (ret < 0)
+		goto out;
+
 	ret = config_gatekeeper();
 	if (ret < 0) {
 		RTE_LOG(ERR, GATEKEEPER, "Failed to configure Gatekeeper!\n");
@@ -164,7 +194,11 @@ main(int argc, char **argv)
 	if (ret < 0)
 		exiting = true;
 
+	/* The master lcore writes the logs of the fast path. */
+	run_log_writer();
+
 	rte_eal_mp_wait_lcore();
+	capture_close();
 net:
 	gatekeeper_free_network();
 out: